@@ -7,6 +7,10 @@ echo  pix - Build Script
 echo ========================================
 echo.
 
+REM build.bat asan - debug build with AddressSanitizer (MSVC), for
+REM pix_asan.exe --stress-decode <folder> [threads] [rounds]
+if /i "%~1"=="asan" goto :asan_build
+
 REM Check for compiler
 where cl >nul 2>&1
 if %ERRORLEVEL% EQU 0 (
@@ -30,20 +34,40 @@ exit /b 1
 
 :msvc_build
 echo Compiling with MSVC...
-cl /nologo /O2 /W3 ^
+cl /nologo /O2 /W3 /openmp ^
     /Fe:pix.exe ^
     src\main.c src\image_loader.c src\renderer.c src\file_browser.c src\settings.c src\ui.c ^
+    src\thumb_cache.c src\image_format.c src\batch.c src\manifest.c src\image_ops.c src\png_writer.c src\jpeg_writer.c src\pixel_memory.c src\anim_clock.c src\gdi_cache.c src\stress_decode.c ^
     /I lib ^
     user32.lib gdi32.lib shell32.lib comdlg32.lib ^
     /link /SUBSYSTEM:WINDOWS
 if %ERRORLEVEL% NEQ 0 goto :error
 goto :success
 
+:asan_build
+where cl >nul 2>&1
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: the asan build needs MSVC ^(cl.exe^) in the path
+    goto :error
+)
+echo Compiling with MSVC and AddressSanitizer...
+REM console subsystem so sanitizer reports have somewhere to go
+cl /nologo /Od /Zi /W3 /openmp /fsanitize=address ^
+    /Fe:pix_asan.exe ^
+    src\main.c src\image_loader.c src\renderer.c src\file_browser.c src\settings.c src\ui.c ^
+    src\thumb_cache.c src\image_format.c src\batch.c src\manifest.c src\image_ops.c src\png_writer.c src\jpeg_writer.c src\pixel_memory.c src\anim_clock.c src\gdi_cache.c src\stress_decode.c ^
+    /I lib ^
+    user32.lib gdi32.lib shell32.lib comdlg32.lib ^
+    /link /SUBSYSTEM:CONSOLE /ENTRY:WinMainCRTStartup
+if %ERRORLEVEL% NEQ 0 goto :error
+goto :success
+
 :gcc_build
 echo Compiling with GCC...
 gcc -O2 -Wall -mwindows -fopenmp ^
     -o pix.exe ^
     src/main.c src/image_loader.c src/renderer.c src/file_browser.c src/settings.c src/ui.c ^
+    src/thumb_cache.c src/image_format.c src/batch.c src/manifest.c src/image_ops.c src/png_writer.c src/jpeg_writer.c src/pixel_memory.c src/anim_clock.c src/gdi_cache.c src/stress_decode.c ^
     resource.o ^
     -I lib ^
     -lgdi32 -lshell32 -lcomdlg32
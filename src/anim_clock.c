@@ -0,0 +1,87 @@
+/*
+ * Anim Clock - Implementation
+ * pix - anim clock
+ *
+ * the loop is laid out once as a table of frame start times. the due frame
+ * is the one whose slot the elapsed time (mod the loop length) falls in,
+ * found with a binary search, so however late a tick comes the next one
+ * still lands on schedule - nothing accumulates.
+ */
+
+#include "anim_clock.h"
+#include <stdlib.h>
+#include <string.h>
+
+static LONGLONG Now(void) {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return now.QuadPart;
+}
+
+int AnimClock_Start(AnimClock *clock, const int *delays, int frameCount) {
+  AnimClock_Stop(clock);
+  if (frameCount < 1)
+    return 0;
+
+  clock->frameStart = (int *)malloc(sizeof(int) * (frameCount + 1));
+  if (!clock->frameStart)
+    return 0;
+
+  int t = 0;
+  for (int i = 0; i < frameCount; i++) {
+    clock->frameStart[i] = t;
+    t += delays && delays[i] > 0 ? delays[i] : 100;
+  }
+  clock->frameStart[frameCount] = t;
+  clock->frameCount = frameCount;
+
+  LARGE_INTEGER freq;
+  QueryPerformanceFrequency(&freq);
+  clock->freq = freq.QuadPart;
+  clock->start = Now();
+  clock->windowStart = clock->start;
+  clock->targetFps = frameCount * 1000.0f / t;
+  return 1;
+}
+
+void AnimClock_Stop(AnimClock *clock) {
+  free(clock->frameStart);
+  memset(clock, 0, sizeof(AnimClock));
+}
+
+int AnimClock_Due(const AnimClock *clock, int *untilNextMs) {
+  if (!clock->frameStart) {
+    *untilNextMs = 100;
+    return 0;
+  }
+
+  int loop = clock->frameStart[clock->frameCount];
+  LONGLONG elapsed = (Now() - clock->start) * 1000 / clock->freq;
+  int pos = (int)(elapsed % loop);
+
+  // last frame starting at or before pos
+  int lo = 0, hi = clock->frameCount - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (clock->frameStart[mid] <= pos)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  *untilNextMs = clock->frameStart[lo + 1] - pos;
+  return lo;
+}
+
+void AnimClock_Shown(AnimClock *clock, int skipped) {
+  clock->windowShown++;
+  clock->skipped += skipped;
+
+  LONGLONG now = Now();
+  LONGLONG span = now - clock->windowStart;
+  if (span >= clock->freq) {
+    clock->achievedFps = (float)((double)clock->windowShown * clock->freq / span);
+    clock->windowShown = 0;
+    clock->windowStart = now;
+  }
+}
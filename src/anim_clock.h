@@ -0,0 +1,34 @@
+// anim clock header
+// playback clock for animated gifs. the frame on screen comes from how long
+// the animation has been running, not from counting timer ticks, so slow
+// frames get dropped instead of stretching the whole thing out
+
+#ifndef ANIM_CLOCK_H
+#define ANIM_CLOCK_H
+
+#include <windows.h>
+
+typedef struct {
+  LONGLONG freq;  // qpc ticks per second
+  LONGLONG start; // qpc when the first loop started
+  int frameCount;
+  int *frameStart; // ms into a loop each frame starts, last = loop length
+
+  // stats, over roughly the last second
+  LONGLONG windowStart;
+  int windowShown;
+  int skipped; // frames dropped to keep time, since start
+  float achievedFps;
+  float targetFps;
+} AnimClock;
+
+// delays in ms, one per frame. 0 if out of memory
+int AnimClock_Start(AnimClock *clock, const int *delays, int frameCount);
+void AnimClock_Stop(AnimClock *clock);
+
+// the frame that should be on screen now, and how long until the next one
+int AnimClock_Due(const AnimClock *clock, int *untilNextMs);
+// a frame went on screen, skipped = frames passed over to get there
+void AnimClock_Shown(AnimClock *clock, int skipped);
+
+#endif
@@ -4,6 +4,7 @@
 #ifndef APP_STATE_H
 #define APP_STATE_H
 
+#include "anim_clock.h"
 #include "file_browser.h"
 #include "image_loader.h"
 #include "renderer.h"
@@ -13,10 +14,12 @@
 extern ImageData g_image;
 extern Renderer g_renderer;
 extern FileBrowser g_browser;
+extern AnimClock g_animClock;
 extern BOOL g_fullscreen;
 extern BOOL g_showInfo;
 extern BOOL g_darkTheme;
 extern BOOL g_showThumbnails;
+extern BOOL g_showGrid;
 extern BOOL g_showStatusBar;
 extern BOOL g_showEditPanel;
 extern BOOL g_slideshowActive;
@@ -34,6 +37,11 @@ extern BOOL g_showZoom;
 extern BOOL g_showHelp;
 extern BOOL g_showSettings;
 
+// thumbnail grid state
+extern int g_gridScrollY;    // scroll offset in pixels
+extern int g_gridScrollDir;  // +1 scrolling down, -1 up (prefetch direction)
+extern int g_gridSelection;  // highlighted file index
+
 // theme colors
 extern COLORREF g_bgColor;
 extern COLORREF g_textColor;
@@ -48,5 +56,8 @@ extern COLORREF g_statusBarColor;
 #define STATUS_BAR_HEIGHT 28
 #define SHADOW_SIZE 8
 #define EDIT_PANEL_WIDTH 200
+#define GRID_THUMB_SIZE 128
+#define GRID_CELL_WIDTH (GRID_THUMB_SIZE + 24)
+#define GRID_CELL_HEIGHT (GRID_THUMB_SIZE + 40)
 
 #endif
@@ -0,0 +1,1435 @@
+/*
+ * Batch - Implementation
+ * pix - command line batch processing
+ *
+ * files flow through three stages connected by small bounded queues:
+ *
+ *   folder scan -> decoders -> processors -> encoders
+ *
+ * decode and encode are single threaded per file, so several files are
+ * decoded / encoded at once. processors run the whole op chain (image_ops)
+ * on one image in one go - the lanczos resize is already parallel inside
+ * (openmp rows), so only a couple of processors run, each with its share
+ * of the thread budget. the queues are short so only a handful of decoded
+ * or processed images are ever waiting in memory.
+ *
+ * before a file enters the pipeline the scanner reads just its header,
+ * estimates the job's peak memory and waits until that fits in the budget
+ * next to everything already in flight. small photos go through many at a
+ * time, a huge one waits for the pipeline to drain and then runs alone.
+ * a plain resize to png that wont fit (or --stream) is streamed instead:
+ * the processor resizes a band of rows at a time straight into the png
+ * writer, so the full size output never exists in memory.
+ *
+ * every finished file goes into a manifest next to the outputs. a rerun
+ * skips sources that havent changed since (same size and mtime, or same
+ * content hash if only the mtime moved) as long as the params match and
+ * the output is still there - so an interrupted run picks up where it
+ * stopped and a nightly run only pays for new files.
+ *
+ * --shard i/n splits the work between independent processes or machines:
+ * a file belongs to shard (hash of its lowercase name mod n) + 1, so every
+ * shard agrees on the split without talking to the others. each shard
+ * keeps its own manifest and summary next to the outputs, and
+ * --batch-merge folds them back into one.
+ *
+ * every job is timed per stage off the performance counter (queued, hash,
+ * decode, process, encode). a monitor thread logs queue depths, memory and
+ * throughput once a second to pix_progress.log, and the run ends with
+ * pix_summary.txt (key = value, what --batch-merge adds up) and
+ * pix_summary.json (every file plus the totals). comparing each stage's
+ * busy time to its threads x wall time shows which one holds the rest up.
+ */
+
+#include "batch.h"
+#include "image_format.h"
+#include "image_loader.h"
+#include "image_ops.h"
+#include "manifest.h"
+#include "settings.h"
+#include <omp.h>
+#define PSAPI_VERSION 2 // GetProcessMemoryInfo from kernel32, no psapi.lib
+#include <psapi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// command line options
+typedef struct {
+  const char *folder;
+  const char *outDir;     // --out, NULL = folder\<defaultOut>
+  const char *defaultOut; // "upscaled" or "processed"
+  ImageOpList ops;
+  int shardIndex; // 1-based, 0 = not sharded
+  int shardCount;
+  const char *fileList; // NULL = scan the folder, "-" = stdin
+  int stream;           // --stream: row bands for every job that can
+} BatchOptions;
+
+// how a job gets from source to output
+enum {
+  JOB_WHOLE,      // decode, run the chain, encode - all in memory
+  JOB_STREAM,     // decode, then resize + png in row bands
+  JOB_STREAM_ROWS // source read a window of rows at a time too
+};
+static const char *g_modeNames[] = {"whole", "stream", "stream rows"};
+
+// per job timings in ms. queued is time spent waiting in (or to get
+// into) the queues, the rest is work. streamed jobs encode while they
+// process, so all of it lands in process
+enum {
+  TIME_QUEUED,
+  TIME_HASH,
+  TIME_DECODE,
+  TIME_PROCESS,
+  TIME_ENCODE,
+  TIME_COUNT
+};
+static const char *g_timeNames[TIME_COUNT] = {"queued", "hash", "decode",
+                                              "process", "encode"};
+
+// pipeline stages, for how busy each one was (decode includes the hash)
+enum { STAGE_DECODE, STAGE_PROCESS, STAGE_ENCODE, STAGE_COUNT };
+static const char *g_stageNames[STAGE_COUNT] = {"decode", "process",
+                                                "encode"};
+
+#define BATCH_MAX_FAILURE_KINDS 16
+#define MONITOR_INTERVAL_MS 1000
+#define MONITOR_PRINT_EVERY 10 // samples between console lines
+
+typedef struct {
+  char reason[48];
+  int count;
+} FailureCount;
+
+// totals for one run, or for several shards added up by --batch-merge
+typedef struct {
+  char params[MANIFEST_MAX_PARAMS];
+  int shards;
+  int assigned;
+  int processed;
+  int unchanged;
+  int failed;
+  double seconds;
+  unsigned long long inBytes; // sources of the processed files
+  unsigned long long outBytes;
+  double timeMs[TIME_COUNT];    // summed over files
+  double workerMs[STAGE_COUNT]; // threads x wall time - what busy is out of
+  double peakAdmittedMB;        // most memory reserved at once
+  double peakWorkingSetMB;
+  FailureCount failures[BATCH_MAX_FAILURE_KINDS];
+  int failureKinds;
+} BatchSummary;
+
+typedef struct {
+  char name[MAX_PATH];
+  char inputPath[MAX_PATH];
+  char outputPath[MAX_PATH];
+  unsigned long long size; // source stats for the manifest
+  unsigned long long mtime;
+  unsigned long long hash;
+  int srcWidth; // from the header probe
+  int srcHeight;
+  int dstWidth; // planned output
+  int dstHeight;
+  int mode;
+  size_t reserved; // admitted memory, given back when the job finishes
+  double queuedAt; // when it went into its current queue
+  double ms[TIME_COUNT];
+  unsigned long long outBytes;
+  ImageData image;
+} BatchJob;
+
+// bounded blocking queue of jobs
+typedef struct {
+  BatchJob **items;
+  int capacity;
+  int head;
+  int count;
+  int closed;
+  CRITICAL_SECTION lock;
+  CONDITION_VARIABLE notEmpty;
+  CONDITION_VARIABLE notFull;
+} JobQueue;
+
+static struct {
+  const ImageOpList *ops;
+  int stream;
+  int ompThreads;    // openmp threads per processor
+  int encodeThreads; // openmp threads per png / jpeg encoder
+  char outFolder[MAX_PATH];
+  char params[MANIFEST_MAX_PARAMS]; // op description stored per file
+
+  Manifest manifest;
+  int haveManifest;
+
+  JobQueue decodeQueue;
+  JobQueue processQueue;
+  JobQueue encodeQueue;
+
+  LONG decodersLeft; // last one out closes the next queue
+  LONG processorsLeft;
+  LONG processed;
+  LONG failed;
+  int skipped;  // scan thread only
+  int assigned; // files that fell in this shard
+
+  // reporting - stats and json under printLock
+  double msPerTick; // performance counter
+  double startMs;
+  int workers[STAGE_COUNT];
+  BatchSummary stats;
+  FILE *json; // per file records go in as files finish
+  int jsonFiles;
+  HANDLE stopMonitor;
+
+  // memory admission - guarded by memLock
+  CRITICAL_SECTION memLock;
+  CONDITION_VARIABLE memFreed;
+  size_t memBudget;
+  size_t memInUse;
+  size_t peakAdmitted;
+
+  CRITICAL_SECTION printLock;
+} g_batch;
+
+static int QueueInit(JobQueue *q, int capacity) {
+  memset(q, 0, sizeof(JobQueue));
+  q->items = (BatchJob **)malloc(sizeof(BatchJob *) * capacity);
+  if (!q->items)
+    return 0;
+  q->capacity = capacity;
+  InitializeCriticalSection(&q->lock);
+  InitializeConditionVariable(&q->notEmpty);
+  InitializeConditionVariable(&q->notFull);
+  return 1;
+}
+
+static void QueueDestroy(JobQueue *q) {
+  if (!q->items)
+    return;
+  DeleteCriticalSection(&q->lock);
+  free(q->items);
+  q->items = NULL;
+}
+
+// blocks while full, returns 0 if the queue was closed (caller keeps job)
+static int QueuePush(JobQueue *q, BatchJob *job) {
+  EnterCriticalSection(&q->lock);
+  while (q->count == q->capacity && !q->closed)
+    SleepConditionVariableCS(&q->notFull, &q->lock, INFINITE);
+  if (q->closed) {
+    LeaveCriticalSection(&q->lock);
+    return 0;
+  }
+  q->items[(q->head + q->count) % q->capacity] = job;
+  q->count++;
+  WakeConditionVariable(&q->notEmpty);
+  LeaveCriticalSection(&q->lock);
+  return 1;
+}
+
+// blocks while empty, returns NULL once closed and drained
+static BatchJob *QueuePop(JobQueue *q) {
+  EnterCriticalSection(&q->lock);
+  while (q->count == 0 && !q->closed)
+    SleepConditionVariableCS(&q->notEmpty, &q->lock, INFINITE);
+  BatchJob *job = NULL;
+  if (q->count > 0) {
+    job = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    WakeConditionVariable(&q->notFull);
+  }
+  LeaveCriticalSection(&q->lock);
+  return job;
+}
+
+static int QueueDepth(JobQueue *q) {
+  if (!q->items)
+    return 0;
+  EnterCriticalSection(&q->lock);
+  int count = q->count;
+  LeaveCriticalSection(&q->lock);
+  return count;
+}
+
+static double NowMs(void) {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return (double)now.QuadPart * g_batch.msPerTick;
+}
+
+// queue waits (including waiting for room) count as the job's queued time
+static int Enqueue(JobQueue *q, BatchJob *job) {
+  job->queuedAt = NowMs();
+  return QueuePush(q, job);
+}
+
+static BatchJob *Dequeue(JobQueue *q) {
+  BatchJob *job = QueuePop(q);
+  if (job)
+    job->ms[TIME_QUEUED] += NowMs() - job->queuedAt;
+  return job;
+}
+
+static void QueueClose(JobQueue *q) {
+  if (!q->items)
+    return;
+  EnterCriticalSection(&q->lock);
+  q->closed = 1;
+  WakeAllConditionVariable(&q->notEmpty);
+  WakeAllConditionVariable(&q->notFull);
+  LeaveCriticalSection(&q->lock);
+}
+
+// only the scanner admits, so jobs get in strictly in folder order and a
+// big one cant be starved by small ones slipping past it
+static void AdmitJob(BatchJob *job) {
+  EnterCriticalSection(&g_batch.memLock);
+  // over-budget jobs wait for an empty pipeline, then run alone
+  while (g_batch.memInUse > 0 &&
+         g_batch.memInUse + job->reserved > g_batch.memBudget)
+    SleepConditionVariableCS(&g_batch.memFreed, &g_batch.memLock, INFINITE);
+  g_batch.memInUse += job->reserved;
+  if (g_batch.memInUse > g_batch.peakAdmitted)
+    g_batch.peakAdmitted = g_batch.memInUse;
+  LeaveCriticalSection(&g_batch.memLock);
+}
+
+static void ReleaseJob(BatchJob *job) {
+  EnterCriticalSection(&g_batch.memLock);
+  g_batch.memInUse -= job->reserved;
+  job->reserved = 0;
+  WakeAllConditionVariable(&g_batch.memFreed);
+  LeaveCriticalSection(&g_batch.memLock);
+
+  ImageLoader_Free(&job->image);
+  free(job);
+}
+
+static void CountFailure(BatchSummary *sum, const char *reason, int count) {
+  for (int i = 0; i < sum->failureKinds; i++) {
+    if (strcmp(sum->failures[i].reason, reason) == 0) {
+      sum->failures[i].count += count;
+      return;
+    }
+  }
+  if (sum->failureKinds < BATCH_MAX_FAILURE_KINDS) {
+    FailureCount *f = &sum->failures[sum->failureKinds++];
+    strncpy(f->reason, reason, sizeof(f->reason) - 1);
+    f->count = count;
+  }
+}
+
+static void JsonString(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(f, "\\u%04x", c);
+    else
+      fputc(c, f);
+  }
+  fputc('"', f);
+}
+
+// one entry of the json "files" list. failures before a job existed have
+// no job. caller holds printLock
+static void WriteJsonFile(const char *name, const BatchJob *job,
+                          const char *status) {
+  FILE *f = g_batch.json;
+  if (!f)
+    return;
+  fprintf(f, "%s\n    {\"name\": ", g_batch.jsonFiles++ ? "," : "");
+  JsonString(f, name);
+  fprintf(f, ", \"status\": ");
+  JsonString(f, status ? status : "done");
+  if (job) {
+    fprintf(f,
+            ", \"mode\": \"%s\", \"width\": %d, \"height\": %d, "
+            "\"inBytes\": %llu, \"outBytes\": %llu, \"ms\": {",
+            g_modeNames[job->mode], job->dstWidth, job->dstHeight, job->size,
+            job->outBytes);
+    for (int t = 0; t < TIME_COUNT; t++)
+      fprintf(f, "%s\"%s\": %.1f", t ? ", " : "", g_timeNames[t], job->ms[t]);
+    fprintf(f, "}");
+  }
+  fprintf(f, "}");
+}
+
+static void ReportFailure(const char *name, const char *status) {
+  EnterCriticalSection(&g_batch.printLock);
+  printf("%s: %s\n", name, status);
+  g_batch.failed++;
+  CountFailure(&g_batch.stats, status, 1);
+  WriteJsonFile(name, NULL, status);
+  fflush(stdout);
+  LeaveCriticalSection(&g_batch.printLock);
+}
+
+static unsigned long long FileSize(const char *path) {
+  WIN32_FILE_ATTRIBUTE_DATA attr;
+  if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attr))
+    return 0;
+  return ((unsigned long long)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+}
+
+static void FinishJob(BatchJob *job, const char *status) {
+  if (!status)
+    job->outBytes = FileSize(job->outputPath);
+
+  EnterCriticalSection(&g_batch.printLock);
+  if (status) {
+    printf("%s: %s\n", job->name, status);
+    g_batch.failed++;
+    CountFailure(&g_batch.stats, status, 1);
+  } else {
+    printf("%s: done (%dx%d%s) decode %.0f, process %.0f, encode %.0f ms\n",
+           job->name, job->dstWidth, job->dstHeight,
+           job->mode == JOB_WHOLE ? "" : ", streamed",
+           job->ms[TIME_HASH] + job->ms[TIME_DECODE], job->ms[TIME_PROCESS],
+           job->ms[TIME_ENCODE]);
+    g_batch.processed++;
+    g_batch.stats.inBytes += job->size;
+    g_batch.stats.outBytes += job->outBytes;
+  }
+  // failed jobs still took the time
+  for (int t = 0; t < TIME_COUNT; t++)
+    g_batch.stats.timeMs[t] += job->ms[t];
+  WriteJsonFile(job->name, job, status);
+  fflush(stdout);
+  LeaveCriticalSection(&g_batch.printLock);
+
+  ReleaseJob(job);
+}
+
+static void RecordJob(BatchJob *job) {
+  ManifestEntry e;
+  memset(&e, 0, sizeof(e));
+  strncpy(e.name, job->name, MAX_PATH - 1);
+  e.size = job->size;
+  e.mtime = job->mtime;
+  e.hash = job->hash;
+  strcpy(e.params, g_batch.params);
+  const char *slash = strrchr(job->outputPath, '\\');
+  strncpy(e.output, slash ? slash + 1 : job->outputPath, MAX_PATH - 1);
+  Manifest_Record(&g_batch.manifest, &e);
+}
+
+// same params as last time, output still there, and the source is the
+// same - by size + mtime, or by content when only the mtime moved
+static int IsUpToDate(const char *name, const char *inputPath,
+                      unsigned long long size, unsigned long long mtime) {
+  ManifestEntry e;
+  if (!g_batch.haveManifest || !Manifest_Find(&g_batch.manifest, name, &e))
+    return 0;
+  if (strcmp(e.params, g_batch.params) != 0 || e.size != size)
+    return 0;
+
+  char outputPath[MAX_PATH];
+  snprintf(outputPath, sizeof(outputPath), "%s\\%s", g_batch.outFolder,
+           e.output);
+  if (GetFileAttributesA(outputPath) == INVALID_FILE_ATTRIBUTES)
+    return 0;
+
+  if (e.mtime == mtime)
+    return 1;
+
+  unsigned long long hash;
+  if (!Manifest_HashFile(inputPath, &hash) || hash != e.hash)
+    return 0;
+
+  // touched but not changed - remember the new mtime for the fast path
+  e.mtime = mtime;
+  Manifest_Record(&g_batch.manifest, &e);
+  return 1;
+}
+
+static DWORD WINAPI DecodeWorker(LPVOID param) {
+  (void)param;
+  // one per thread, so every decoder keeps its own error text. only the
+  // first gif frame gets resized anyway, and nothing reads exif here
+  ImageLoadContext load = {0};
+  load.flags = IMAGE_LOAD_FIRST_FRAME | IMAGE_LOAD_NO_EXIF;
+
+  BatchJob *job;
+  while ((job = Dequeue(&g_batch.decodeQueue)) != NULL) {
+    // hashed now so the manifest can later tell a touched file from an
+    // edited one (the decode below reads it again, from the os cache)
+    double start = NowMs();
+    if (g_batch.haveManifest)
+      Manifest_HashFile(job->inputPath, &job->hash);
+    double hashed = NowMs();
+    job->ms[TIME_HASH] = hashed - start;
+
+    // row streamed jobs read the file themselves, in the processor
+    int loaded = job->mode == JOB_STREAM_ROWS ||
+                 ImageLoader_Load(job->inputPath, &job->image, &load);
+    job->ms[TIME_DECODE] = NowMs() - hashed;
+    if (!loaded)
+      FinishJob(job, load.error);
+    else if (!Enqueue(&g_batch.processQueue, job))
+      FinishJob(job, "cancelled");
+  }
+  if (InterlockedDecrement(&g_batch.decodersLeft) == 0)
+    QueueClose(&g_batch.processQueue);
+  return 0;
+}
+
+// resize + png encode in row bands, straight into the output file
+static const char *StreamJob(BatchJob *job) {
+  ImageRowReader rows;
+  int fromRows = (job->mode == JOB_STREAM_ROWS);
+  if (fromRows && !ImageLoader_OpenRows(job->inputPath, &rows))
+    return "failed to load";
+
+  int w = fromRows ? rows.width : job->image.width;
+  int h = fromRows ? rows.height : job->image.height;
+  const char *status = NULL;
+  if (w != job->srcWidth || h != job->srcHeight)
+    status = "size changed since scan";
+  else if (!ImageOps_Stream(g_batch.ops, fromRows ? NULL : &job->image,
+                            fromRows ? &rows : NULL, job->outputPath))
+    status = "failed to stream";
+
+  if (fromRows)
+    ImageLoader_CloseRows(&rows);
+  ImageLoader_Free(&job->image); // nothing left for the encoder to do
+  return status;
+}
+
+static DWORD WINAPI ProcessWorker(LPVOID param) {
+  (void)param;
+  // nthreads is per calling thread, so each processor gets its own team size
+  omp_set_num_threads(g_batch.ompThreads);
+
+  BatchJob *job;
+  while ((job = Dequeue(&g_batch.processQueue)) != NULL) {
+    double start = NowMs();
+    if (job->mode != JOB_WHOLE) {
+      const char *status = StreamJob(job);
+      job->ms[TIME_PROCESS] = NowMs() - start;
+      if (status)
+        FinishJob(job, status);
+      else if (!Enqueue(&g_batch.encodeQueue, job))
+        FinishJob(job, "cancelled");
+      continue;
+    }
+
+    // the header lied (or the file changed) - the estimate is off
+    if (job->image.width != job->srcWidth ||
+        job->image.height != job->srcHeight) {
+      FinishJob(job, "size changed since scan");
+      continue;
+    }
+
+    int applied = ImageOps_Apply(g_batch.ops, &job->image);
+    job->ms[TIME_PROCESS] = NowMs() - start;
+    if (!applied)
+      FinishJob(job, "out of memory");
+    else if (!Enqueue(&g_batch.encodeQueue, job))
+      FinishJob(job, "cancelled");
+  }
+  if (InterlockedDecrement(&g_batch.processorsLeft) == 0)
+    QueueClose(&g_batch.encodeQueue);
+  return 0;
+}
+
+static DWORD WINAPI EncodeWorker(LPVOID param) {
+  (void)param;
+  omp_set_num_threads(g_batch.encodeThreads); // png chunks deflate in parallel
+
+  BatchJob *job;
+  while ((job = Dequeue(&g_batch.encodeQueue)) != NULL) {
+    // streamed jobs are already on disk, they just get recorded here
+    double start = NowMs();
+    int saved = job->mode != JOB_WHOLE ||
+                ImageOps_Save(g_batch.ops, &job->image, job->outputPath);
+    job->ms[TIME_ENCODE] = NowMs() - start;
+    if (saved) {
+      // only recorded once the output is fully written
+      if (g_batch.haveManifest)
+        RecordJob(job);
+      FinishJob(job, NULL);
+    } else
+      FinishJob(job, "failed to save");
+  }
+  return 0;
+}
+
+static int StartWorkers(HANDLE *handles, int count,
+                        LPTHREAD_START_ROUTINE proc) {
+  int started = 0;
+  for (int i = 0; i < count; i++) {
+    handles[started] = CreateThread(NULL, 0, proc, NULL, 0, NULL);
+    if (handles[started])
+      started++;
+  }
+  return started;
+}
+
+static void JoinWorkers(HANDLE *handles, int count) {
+  if (count > 0)
+    WaitForMultipleObjects(count, handles, TRUE, INFINITE);
+  for (int i = 0; i < count; i++)
+    CloseHandle(handles[i]);
+}
+
+// splits the cpuThreads budget (or all cores) between the stages
+static void PlanThreads(int parallelEncode, int *decoders, int *processors,
+                        int *ompThreads, int *encoders, int *encodeThreads) {
+  int budget = g_settings.cpuThreads;
+  if (budget <= 0) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    budget = (int)si.dwNumberOfProcessors;
+  }
+  if (budget < 1)
+    budget = 1;
+
+  // a quarter each for decode and encode, the rest goes to the op chain.
+  // the png and jpeg writers are parallel themselves, so those use half as
+  // many encoders with a couple of threads each - fewer images held waiting
+  *decoders = budget / 4;
+  *encoders = parallelEncode ? budget / 8 : budget / 4;
+  if (*decoders < 1)
+    *decoders = 1;
+  if (*encoders < 1)
+    *encoders = 1;
+  if (*decoders > BATCH_MAX_DECODERS)
+    *decoders = BATCH_MAX_DECODERS;
+  if (*encoders > BATCH_MAX_ENCODERS)
+    *encoders = BATCH_MAX_ENCODERS;
+
+  *encodeThreads = parallelEncode ? (budget / 4) / *encoders : 1;
+  if (*encodeThreads < 1)
+    *encodeThreads = 1;
+
+  int rest = budget - *decoders - *encoders * *encodeThreads;
+  if (rest < 1)
+    rest = 1;
+
+  // two processors so one image's tail rows overlap the next one's start
+  *processors = (rest >= 4) ? 2 : 1;
+  if (*processors > BATCH_MAX_PROCESSORS)
+    *processors = BATCH_MAX_PROCESSORS;
+  *ompThreads = rest / *processors;
+  if (*ompThreads < 1)
+    *ompThreads = 1;
+}
+
+// stable across runs and machines - fnv-1a 64 of the lowercase name
+static int ShardOf(const char *name, int shardCount) {
+  unsigned long long h = 14695981039346656037ull;
+  while (*name) {
+    unsigned char c = (unsigned char)*name++;
+    if (c >= 'A' && c <= 'Z')
+      c += 32;
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  return (int)(h % (unsigned long long)shardCount) + 1;
+}
+
+// whether this run's shard owns the file (always, when not sharding)
+static int InShard(const BatchOptions *opt, const char *name) {
+  return opt->shardCount <= 0 ||
+         ShardOf(name, opt->shardCount) == opt->shardIndex;
+}
+
+// shard files live next to the outputs as <base>.shard-i-of-n<ext>
+static void ShardFileName(char *buffer, size_t size, const char *base,
+                          const char *ext, const BatchOptions *opt) {
+  if (opt->shardCount > 0)
+    snprintf(buffer, size, "%s\\%s.shard-%d-of-%d%s", g_batch.outFolder,
+             base, opt->shardIndex, opt->shardCount, ext);
+  else
+    snprintf(buffer, size, "%s\\%s%s", g_batch.outFolder, base, ext);
+}
+
+// queues one source file, returns 0 if the pipeline is shutting down
+static int SubmitFile(const BatchOptions *opt, const char *inputPath,
+                      const char *name, unsigned long long size,
+                      unsigned long long mtime) {
+  // Check if image file (same registry as the browser)
+  const ImageFormatInfo *info =
+      ImageFormat_Get(ImageFormat_FromExtension(name));
+  if (!info || !info->batchInput)
+    return 1;
+
+  if (!InShard(opt, name))
+    return 1;
+  g_batch.assigned++;
+
+  if (IsUpToDate(name, inputPath, size, mtime)) {
+    g_batch.skipped++;
+    return 1;
+  }
+
+  BatchJob *job = (BatchJob *)calloc(1, sizeof(BatchJob));
+  if (!job)
+    return 0;
+  strncpy(job->name, name, MAX_PATH - 1);
+  strncpy(job->inputPath, inputPath, MAX_PATH - 1);
+  job->size = size;
+  job->mtime = mtime;
+
+  // the whole source name, plus the output extension if it isnt already
+  // that one - photo.jpg -> photo.jpg.png, photo.png stays photo.png. just
+  // swapping the extension would send photo.jpg and photo.png to the same
+  // file from two encoders at once
+  const char *ext = ImageOps_Extension(g_batch.ops);
+  const char *dot = strrchr(job->name, '.');
+  snprintf(job->outputPath, sizeof(job->outputPath), "%s\\%s%s",
+           g_batch.outFolder, job->name,
+           dot && _stricmp(dot, ext) == 0 ? "" : ext);
+
+  // header only - no pixels yet
+  if (!ImageLoader_ProbeSize(job->inputPath, &job->srcWidth,
+                             &job->srcHeight)) {
+    FinishJob(job, "failed to read header");
+    return 1;
+  }
+
+  // walks the chain on paper - sizes and the biggest buffer pair
+  int planned = ImageOps_Plan(g_batch.ops, job->srcWidth, job->srcHeight,
+                              &job->dstWidth, &job->dstHeight,
+                              &job->reserved);
+
+  // too big to hold whole (or --stream) - a plain resize to png can run
+  // in row bands instead, so only the source (or a window of it) and one
+  // band of output are in memory
+  if (ImageOps_Streamable(g_batch.ops) &&
+      (g_batch.stream || !planned || job->reserved > g_batch.memBudget)) {
+    ImageRowReader rows;
+    int fromRows = ImageLoader_OpenRows(job->inputPath, &rows);
+    if (fromRows)
+      ImageLoader_CloseRows(&rows);
+    planned = ImageOps_PlanStream(g_batch.ops, job->srcWidth, job->srcHeight,
+                                  fromRows, &job->dstWidth, &job->dstHeight,
+                                  &job->reserved);
+    job->mode = fromRows ? JOB_STREAM_ROWS : JOB_STREAM;
+  }
+
+  if (!planned) {
+    FinishJob(job, "too large (or crop outside the image)");
+    return 1;
+  }
+
+  // blocks while memory is short, then while the decoders are busy
+  double start = NowMs();
+  AdmitJob(job);
+  job->ms[TIME_QUEUED] = NowMs() - start; // waiting for memory
+  if (!Enqueue(&g_batch.decodeQueue, job)) {
+    ReleaseJob(job);
+    return 0;
+  }
+  return 1;
+}
+
+static void ScanFolder(const BatchOptions *opt) {
+  // Find all images
+  char searchPath[MAX_PATH];
+  snprintf(searchPath, sizeof(searchPath), "%s\\*.*", opt->folder);
+
+  WIN32_FIND_DATAA findData;
+  HANDLE hFind = FindFirstFileA(searchPath, &findData);
+  if (hFind == INVALID_HANDLE_VALUE)
+    return;
+
+  do {
+    if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+      continue;
+
+    char inputPath[MAX_PATH];
+    snprintf(inputPath, sizeof(inputPath), "%s\\%s", opt->folder,
+             findData.cFileName);
+    unsigned long long size =
+        ((unsigned long long)findData.nFileSizeHigh << 32) |
+        findData.nFileSizeLow;
+    unsigned long long mtime =
+        ((unsigned long long)findData.ftLastWriteTime.dwHighDateTime << 32) |
+        findData.ftLastWriteTime.dwLowDateTime;
+    if (!SubmitFile(opt, inputPath, findData.cFileName, size, mtime))
+      break;
+  } while (FindNextFileA(hFind, &findData));
+  FindClose(hFind);
+}
+
+// one file per line, bare names are taken from the folder. blank lines
+// and lines starting with # are ignored
+static void ReadFileList(const BatchOptions *opt) {
+  int useStdin = (strcmp(opt->fileList, "-") == 0);
+  FILE *f = useStdin ? stdin : fopen(opt->fileList, "r");
+  if (!f) {
+    printf("cant open file list: %s\n", opt->fileList);
+    return;
+  }
+
+  char line[MAX_PATH];
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0' || line[0] == '#')
+      continue;
+
+    char inputPath[MAX_PATH];
+    const char *slash = strrchr(line, '\\');
+    const char *fwd = strrchr(line, '/');
+    if (fwd > slash)
+      slash = fwd;
+    if (slash || strchr(line, ':'))
+      strcpy(inputPath, line);
+    else
+      snprintf(inputPath, sizeof(inputPath), "%s\\%s", opt->folder, line);
+    const char *name = slash ? slash + 1 : line;
+
+    // every shard reads the whole list, so a missing file is only the
+    // failure of the shard it would have gone to - or merge counts it n times
+    if (!InShard(opt, name))
+      continue;
+
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExA(inputPath, GetFileExInfoStandard, &attr) ||
+        (attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      g_batch.assigned++;
+      ReportFailure(name, "not found");
+      continue;
+    }
+    unsigned long long size =
+        ((unsigned long long)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    unsigned long long mtime =
+        ((unsigned long long)attr.ftLastWriteTime.dwHighDateTime << 32) |
+        attr.ftLastWriteTime.dwLowDateTime;
+    if (!SubmitFile(opt, inputPath, name, size, mtime))
+      break;
+  }
+
+  if (!useStdin)
+    fclose(f);
+}
+
+static double StageMs(const BatchSummary *sum, int stage) {
+  if (stage == STAGE_DECODE)
+    return sum->timeMs[TIME_HASH] + sum->timeMs[TIME_DECODE];
+  return sum->timeMs[stage == STAGE_PROCESS ? TIME_PROCESS : TIME_ENCODE];
+}
+
+static double StageBusy(const BatchSummary *sum, int stage) {
+  return sum->workerMs[stage] > 0 ? StageMs(sum, stage) / sum->workerMs[stage]
+                                  : 0;
+}
+
+static double PerSecond(double amount, double seconds) {
+  return seconds > 0 ? amount / seconds : 0;
+}
+
+// key = value lines, same look as pix.ini. --batch-merge reads these back
+static int WriteSummaryText(const char *path, const BatchSummary *sum,
+                            const char *title, const char *shard) {
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return 0;
+  fprintf(f, "; %s\n", title);
+  fprintf(f, "params = %s\n", sum->params);
+  if (shard)
+    fprintf(f, "shard = %s\n", shard);
+  fprintf(f, "shards = %d\n", sum->shards);
+  fprintf(f, "assigned = %d\n", sum->assigned);
+  fprintf(f, "processed = %d\n", sum->processed);
+  fprintf(f, "unchanged = %d\n", sum->unchanged);
+  fprintf(f, "failed = %d\n", sum->failed);
+  fprintf(f, "seconds = %.1f\n", sum->seconds);
+  fprintf(f, "in_bytes = %llu\n", sum->inBytes);
+  fprintf(f, "out_bytes = %llu\n", sum->outBytes);
+  for (int t = 0; t < TIME_COUNT; t++)
+    fprintf(f, "%s_ms = %.0f\n", g_timeNames[t], sum->timeMs[t]);
+  for (int s = 0; s < STAGE_COUNT; s++)
+    fprintf(f, "%s_worker_ms = %.0f\n", g_stageNames[s], sum->workerMs[s]);
+  fprintf(f, "peak_admitted_mb = %.0f\n", sum->peakAdmittedMB);
+  fprintf(f, "peak_working_set_mb = %.0f\n", sum->peakWorkingSetMB);
+  for (int i = 0; i < sum->failureKinds; i++)
+    fprintf(f, "failure = %d %s\n", sum->failures[i].count,
+            sum->failures[i].reason);
+  return fclose(f) == 0;
+}
+
+// everything after the header / files list of the json summary
+static void WriteJsonTotals(FILE *f, const BatchSummary *sum) {
+  fprintf(f, "  \"shards\": %d,\n", sum->shards);
+  fprintf(f,
+          "  \"totals\": {\"assigned\": %d, \"processed\": %d, "
+          "\"unchanged\": %d, \"failed\": %d, \"seconds\": %.1f, "
+          "\"inBytes\": %llu, \"outBytes\": %llu},\n",
+          sum->assigned, sum->processed, sum->unchanged, sum->failed,
+          sum->seconds, sum->inBytes, sum->outBytes);
+  fprintf(f,
+          "  \"throughput\": {\"imagesPerSecond\": %.2f, "
+          "\"inMBPerSecond\": %.2f, \"outMBPerSecond\": %.2f},\n",
+          PerSecond(sum->processed, sum->seconds),
+          PerSecond(sum->inBytes / (1024.0 * 1024.0), sum->seconds),
+          PerSecond(sum->outBytes / (1024.0 * 1024.0), sum->seconds));
+
+  fprintf(f, "  \"ms\": {");
+  for (int t = 0; t < TIME_COUNT; t++)
+    fprintf(f, "%s\"%s\": %.0f", t ? ", " : "", g_timeNames[t],
+            sum->timeMs[t]);
+  fprintf(f, "},\n  \"stages\": {");
+  for (int s = 0; s < STAGE_COUNT; s++)
+    fprintf(f, "%s\"%s\": {\"ms\": %.0f, \"workerMs\": %.0f, \"busy\": %.3f}",
+            s ? ", " : "", g_stageNames[s], StageMs(sum, s), sum->workerMs[s],
+            StageBusy(sum, s));
+  fprintf(f, "},\n");
+
+  fprintf(f,
+          "  \"peakMemoryMB\": {\"admitted\": %.0f, \"workingSet\": %.0f},\n",
+          sum->peakAdmittedMB, sum->peakWorkingSetMB);
+  fprintf(f, "  \"failures\": {");
+  for (int i = 0; i < sum->failureKinds; i++) {
+    fprintf(f, "%s", i ? ", " : "");
+    JsonString(f, sum->failures[i].reason);
+    fprintf(f, ": %d", sum->failures[i].count);
+  }
+  fprintf(f, "}\n}\n");
+}
+
+// throughput, how busy each stage was and peak memory
+static void PrintStats(const BatchSummary *sum) {
+  printf("%.1f images/s, %.1f MB/s in, %.1f MB/s out\n",
+         PerSecond(sum->processed, sum->seconds),
+         PerSecond(sum->inBytes / (1024.0 * 1024.0), sum->seconds),
+         PerSecond(sum->outBytes / (1024.0 * 1024.0), sum->seconds));
+
+  int busiest = 0;
+  printf("stages busy:");
+  for (int s = 0; s < STAGE_COUNT; s++) {
+    printf(" %s %.0f%%", g_stageNames[s], StageBusy(sum, s) * 100);
+    if (StageBusy(sum, s) > StageBusy(sum, busiest))
+      busiest = s;
+  }
+  if (sum->processed > 0)
+    printf(" (bottleneck: %s)", g_stageNames[busiest]);
+  printf("\n");
+  printf("peak memory: %.0f MB admitted, %.0f MB working set\n",
+         sum->peakAdmittedMB, sum->peakWorkingSetMB);
+}
+
+static double WorkingSetMB(int peak) {
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+    return 0;
+  return (peak ? pmc.PeakWorkingSetSize : pmc.WorkingSetSize) /
+         (1024.0 * 1024.0);
+}
+
+// once a second: progress, queue depths and memory into the progress log,
+// and every MONITOR_PRINT_EVERY samples a line on the console too
+static DWORD WINAPI MonitorWorker(LPVOID param) {
+  FILE *log = (FILE *)param;
+  int samples = 0;
+  int lastDone = 0;
+  unsigned long long lastBytes = 0;
+  double lastMs = g_batch.startMs;
+
+  while (WaitForSingleObject(g_batch.stopMonitor, MONITOR_INTERVAL_MS) ==
+         WAIT_TIMEOUT) {
+    EnterCriticalSection(&g_batch.printLock);
+    int done = (int)g_batch.processed;
+    int failed = (int)g_batch.failed;
+    unsigned long long inBytes = g_batch.stats.inBytes;
+    LeaveCriticalSection(&g_batch.printLock);
+    EnterCriticalSection(&g_batch.memLock);
+    double admitted = g_batch.memInUse / (1024.0 * 1024.0);
+    LeaveCriticalSection(&g_batch.memLock);
+
+    int decodeDepth = QueueDepth(&g_batch.decodeQueue);
+    int processDepth = QueueDepth(&g_batch.processQueue);
+    int encodeDepth = QueueDepth(&g_batch.encodeQueue);
+    double now = NowMs();
+    double seconds = (now - lastMs) / 1000.0;
+    double images = PerSecond(done - lastDone, seconds);
+    double mb = PerSecond((inBytes - lastBytes) / (1024.0 * 1024.0), seconds);
+    lastDone = done;
+    lastBytes = inBytes;
+    lastMs = now;
+
+    double elapsed = (now - g_batch.startMs) / 1000.0;
+    if (log) {
+      fprintf(log,
+              "t=%.1f done=%d failed=%d img/s=%.1f in_mb/s=%.1f "
+              "queues=%d/%d/%d admitted_mb=%.0f working_set_mb=%.0f\n",
+              elapsed, done, failed, images, mb, decodeDepth, processDepth,
+              encodeDepth, admitted, WorkingSetMB(0));
+      fflush(log);
+    }
+    if (++samples % MONITOR_PRINT_EVERY == 0) {
+      EnterCriticalSection(&g_batch.printLock);
+      printf("-- %.0fs: %d done, %d failed, %.1f img/s, %.1f MB/s in, "
+             "queues %d/%d/%d, %.0f MB admitted\n",
+             elapsed, done, failed, PerSecond(done, elapsed),
+             PerSecond(inBytes / (1024.0 * 1024.0), elapsed), decodeDepth,
+             processDepth, encodeDepth, admitted);
+      fflush(stdout);
+      LeaveCriticalSection(&g_batch.printLock);
+    }
+  }
+  return 0;
+}
+
+// the header of the json summary - files get appended as they finish
+static FILE *OpenJsonSummary(const BatchOptions *opt, const int *threads) {
+  char path[MAX_PATH];
+  ShardFileName(path, sizeof(path), BATCH_SUMMARY_BASE, ".json", opt);
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return NULL;
+  fprintf(f, "{\n  \"params\": ");
+  JsonString(f, g_batch.params);
+  if (opt->shardCount > 0)
+    fprintf(f, ",\n  \"shard\": \"%d/%d\"", opt->shardIndex,
+            opt->shardCount);
+  fprintf(f,
+          ",\n  \"threads\": {\"decode\": %d, \"process\": %d, "
+          "\"processThreads\": %d, \"encode\": %d, \"encodeThreads\": %d}",
+          threads[0], threads[1], threads[2], threads[3], threads[4]);
+  fprintf(f, ",\n  \"files\": [");
+  return f;
+}
+
+// --out is taken as is if absolute, otherwise inside the source folder
+static void ResolveOutFolder(const BatchOptions *opt, char *buffer,
+                             size_t size) {
+  const char *out = opt->outDir ? opt->outDir : opt->defaultOut;
+  if (out[0] == '\\' || out[0] == '/' || strchr(out, ':'))
+    snprintf(buffer, size, "%s", out);
+  else
+    snprintf(buffer, size, "%s\\%s", opt->folder, out);
+}
+
+static int RunBatch(const BatchOptions *opt) {
+  memset(&g_batch, 0, sizeof(g_batch));
+  g_batch.ops = &opt->ops;
+  g_batch.stream = opt->stream;
+  ImageOps_Format(&opt->ops, g_batch.params, sizeof(g_batch.params));
+  LARGE_INTEGER freq;
+  QueryPerformanceFrequency(&freq);
+  g_batch.msPerTick = 1000.0 / (double)freq.QuadPart;
+
+  printf("\npix batch\n");
+  printf("folder: %s\n", opt->folder);
+  printf("ops: %s\n", g_batch.params);
+  if (opt->shardCount > 0)
+    printf("shard: %d of %d\n", opt->shardIndex, opt->shardCount);
+  if (opt->fileList)
+    printf("file list: %s\n",
+           strcmp(opt->fileList, "-") == 0 ? "stdin" : opt->fileList);
+
+  int decoders, processors, ompThreads, encoders, encoderThreads;
+  PlanThreads(opt->ops.outputFormat != IMAGE_FORMAT_BMP, &decoders,
+              &processors, &ompThreads, &encoders, &encoderThreads);
+  printf("threads: %d decode, %d x %d process, %d x %d encode\n", decoders,
+         processors, ompThreads, encoders, encoderThreads);
+
+  g_batch.ompThreads = ompThreads;
+  g_batch.encodeThreads = encoderThreads;
+  g_batch.workers[STAGE_DECODE] = decoders;
+  g_batch.workers[STAGE_PROCESS] = processors;
+  g_batch.workers[STAGE_ENCODE] = encoders;
+  g_batch.memBudget = Settings_MemoryBudget();
+  InitializeCriticalSection(&g_batch.printLock);
+  InitializeCriticalSection(&g_batch.memLock);
+  InitializeConditionVariable(&g_batch.memFreed);
+
+  // Create output folder
+  ResolveOutFolder(opt, g_batch.outFolder, sizeof(g_batch.outFolder));
+  CreateDirectoryA(g_batch.outFolder, NULL);
+
+  // a shard writes its own manifest (other shards run at the same time)
+  // but still skips whatever an earlier merged run already did
+  char manifestPath[MAX_PATH];
+  char mainPath[MAX_PATH];
+  ShardFileName(manifestPath, sizeof(manifestPath), MANIFEST_BASE, ".txt",
+                opt);
+  snprintf(mainPath, sizeof(mainPath), "%s\\%s.txt", g_batch.outFolder,
+           MANIFEST_BASE);
+  g_batch.haveManifest =
+      Manifest_Open(&g_batch.manifest, manifestPath,
+                    opt->shardCount > 0 ? mainPath : NULL);
+  if (!g_batch.haveManifest) {
+    printf("warning: cant write %s, everything will be redone\n",
+           manifestPath);
+  }
+
+  int threads[5] = {decoders, processors, ompThreads, encoders,
+                    encoderThreads};
+  g_batch.json = OpenJsonSummary(opt, threads);
+  char logPath[MAX_PATH];
+  ShardFileName(logPath, sizeof(logPath), BATCH_PROGRESS_BASE, ".log", opt);
+  FILE *progressLog = fopen(logPath, "w");
+
+  printf("memory budget: %d MB\n", (int)(g_batch.memBudget / (1024 * 1024)));
+  printf("progress log: %s\n", logPath);
+  printf("--------------------------------\n");
+
+  // one waiting item per consumer keeps every stage fed without piling up
+  // decoded images in memory
+  int ok = QueueInit(&g_batch.decodeQueue, decoders * 2) &&
+           QueueInit(&g_batch.processQueue, processors + 1) &&
+           QueueInit(&g_batch.encodeQueue, encoders + 1);
+
+  HANDLE decodeThreads[BATCH_MAX_DECODERS];
+  HANDLE processThreads[BATCH_MAX_PROCESSORS];
+  HANDLE encodeThreads[BATCH_MAX_ENCODERS];
+  int decodeCount = 0, processCount = 0, encodeCount = 0;
+
+  // the counters must be set before any worker can finish
+  g_batch.decodersLeft = decoders;
+  g_batch.processorsLeft = processors;
+  if (ok) {
+    encodeCount = StartWorkers(encodeThreads, encoders, EncodeWorker);
+    processCount = StartWorkers(processThreads, processors, ProcessWorker);
+    decodeCount = StartWorkers(decodeThreads, decoders, DecodeWorker);
+    ok = (decodeCount == decoders && processCount == processors &&
+          encodeCount > 0);
+  }
+
+  g_batch.startMs = NowMs();
+  g_batch.stopMonitor = CreateEventA(NULL, TRUE, FALSE, NULL);
+  HANDLE monitor = (ok && g_batch.stopMonitor)
+                       ? CreateThread(NULL, 0, MonitorWorker, progressLog, 0,
+                                      NULL)
+                       : NULL;
+
+  if (!ok)
+    printf("failed to start worker threads\n");
+  else if (opt->fileList)
+    ReadFileList(opt);
+  else
+    ScanFolder(opt);
+
+  // no more input - the close ripples down the pipeline as stages drain.
+  // after a failed start nothing counts down, so close everything
+  QueueClose(&g_batch.decodeQueue);
+  if (!ok) {
+    QueueClose(&g_batch.processQueue);
+    QueueClose(&g_batch.encodeQueue);
+  }
+  JoinWorkers(decodeThreads, decodeCount);
+  JoinWorkers(processThreads, processCount);
+  JoinWorkers(encodeThreads, encodeCount);
+
+  double seconds = (NowMs() - g_batch.startMs) / 1000.0;
+  if (monitor) {
+    SetEvent(g_batch.stopMonitor);
+    WaitForSingleObject(monitor, INFINITE);
+    CloseHandle(monitor);
+  }
+  if (g_batch.stopMonitor)
+    CloseHandle(g_batch.stopMonitor);
+  if (progressLog)
+    fclose(progressLog);
+
+  QueueDestroy(&g_batch.decodeQueue);
+  QueueDestroy(&g_batch.processQueue);
+  QueueDestroy(&g_batch.encodeQueue);
+  DeleteCriticalSection(&g_batch.printLock);
+  DeleteCriticalSection(&g_batch.memLock);
+  if (g_batch.haveManifest)
+    Manifest_Close(&g_batch.manifest);
+
+  // the workers are gone, the stats are all ours now
+  BatchSummary *sum = &g_batch.stats;
+  strcpy(sum->params, g_batch.params);
+  sum->shards = 1;
+  sum->assigned = g_batch.assigned;
+  sum->processed = (int)g_batch.processed;
+  sum->unchanged = g_batch.skipped;
+  sum->failed = (int)g_batch.failed;
+  sum->seconds = seconds;
+  for (int s = 0; s < STAGE_COUNT; s++)
+    sum->workerMs[s] = g_batch.workers[s] * seconds * 1000.0;
+  sum->peakAdmittedMB = g_batch.peakAdmitted / (1024.0 * 1024.0);
+  sum->peakWorkingSetMB = WorkingSetMB(1);
+
+  char path[MAX_PATH];
+  char shard[32];
+  snprintf(shard, sizeof(shard), "%d/%d", opt->shardIndex, opt->shardCount);
+  ShardFileName(path, sizeof(path), BATCH_SUMMARY_BASE, ".txt", opt);
+  WriteSummaryText(path, sum, "pix batch summary",
+                   opt->shardCount > 0 ? shard : NULL);
+  if (g_batch.json) {
+    fprintf(g_batch.json, "\n  ],\n");
+    WriteJsonTotals(g_batch.json, sum);
+    fclose(g_batch.json);
+  }
+
+  printf("--------------------------------\n");
+  printf("processed %d images", (int)g_batch.processed);
+  if (g_batch.skipped > 0)
+    printf(", %d unchanged", g_batch.skipped);
+  if (g_batch.failed > 0)
+    printf(", %d failed", (int)g_batch.failed);
+  printf(" in %.1fs\n", seconds);
+  PrintStats(sum);
+  printf("output: %s\n\n", g_batch.outFolder);
+  return 1;
+}
+
+// calls fn for every file in outFolder matching base.shard-*.txt
+static int ForEachShardFile(const char *outFolder, const char *base,
+                            void (*fn)(const char *path, void *ctx),
+                            void *ctx) {
+  char searchPath[MAX_PATH];
+  snprintf(searchPath, sizeof(searchPath), "%s\\%s.shard-*.txt", outFolder,
+           base);
+
+  WIN32_FIND_DATAA findData;
+  HANDLE hFind = FindFirstFileA(searchPath, &findData);
+  if (hFind == INVALID_HANDLE_VALUE)
+    return 0;
+
+  int count = 0;
+  do {
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s\\%s", outFolder, findData.cFileName);
+    fn(path, ctx);
+    count++;
+  } while (FindNextFileA(hFind, &findData));
+  FindClose(hFind);
+  return count;
+}
+
+static void ImportShardManifest(const char *path, void *ctx) {
+  int entries = Manifest_Import((Manifest *)ctx, path);
+  const char *name = strrchr(path, '\\');
+  printf("%s: %d files\n", name ? name + 1 : path, entries);
+}
+
+static void DeleteShardFile(const char *path, void *ctx) {
+  (void)ctx;
+  DeleteFileA(path);
+}
+
+static void AddShardSummary(const char *path, void *ctx) {
+  BatchSummary *sum = (BatchSummary *)ctx;
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return;
+
+  char line[MANIFEST_MAX_PARAMS + 32];
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    char *eq = strstr(line, " = ");
+    if (line[0] == ';' || !eq)
+      continue;
+    *eq = '\0';
+    const char *value = eq + 3;
+
+    if (strcmp(line, "params") == 0)
+      strncpy(sum->params, value, sizeof(sum->params) - 1);
+    else if (strcmp(line, "shards") == 0)
+      sum->shards += atoi(value);
+    else if (strcmp(line, "assigned") == 0)
+      sum->assigned += atoi(value);
+    else if (strcmp(line, "processed") == 0)
+      sum->processed += atoi(value);
+    else if (strcmp(line, "unchanged") == 0)
+      sum->unchanged += atoi(value);
+    else if (strcmp(line, "failed") == 0)
+      sum->failed += atoi(value);
+    else if (strcmp(line, "seconds") == 0 && atof(value) > sum->seconds)
+      sum->seconds = atof(value); // shards run side by side - slowest wins
+    else if (strcmp(line, "in_bytes") == 0)
+      sum->inBytes += _strtoui64(value, NULL, 10);
+    else if (strcmp(line, "out_bytes") == 0)
+      sum->outBytes += _strtoui64(value, NULL, 10);
+    else if (strcmp(line, "peak_admitted_mb") == 0 &&
+             atof(value) > sum->peakAdmittedMB)
+      sum->peakAdmittedMB = atof(value); // per machine, so the biggest
+    else if (strcmp(line, "peak_working_set_mb") == 0 &&
+             atof(value) > sum->peakWorkingSetMB)
+      sum->peakWorkingSetMB = atof(value);
+    else if (strcmp(line, "failure") == 0) {
+      int count;
+      char reason[64];
+      if (sscanf(value, "%d %63[^\n]", &count, reason) == 2)
+        CountFailure(sum, reason, count);
+    } else {
+      // <time>_ms and <stage>_worker_ms add up
+      char key[64];
+      for (int t = 0; t < TIME_COUNT; t++) {
+        snprintf(key, sizeof(key), "%s_ms", g_timeNames[t]);
+        if (strcmp(line, key) == 0)
+          sum->timeMs[t] += atof(value);
+      }
+      for (int s = 0; s < STAGE_COUNT; s++) {
+        snprintf(key, sizeof(key), "%s_worker_ms", g_stageNames[s]);
+        if (strcmp(line, key) == 0)
+          sum->workerMs[s] += atof(value);
+      }
+    }
+  }
+  fclose(f);
+}
+
+// folds every shard manifest into the main one and adds up the shard
+// summaries. shard files are only removed once the merged copy is written
+static int RunMerge(const BatchOptions *opt) {
+  char outFolder[MAX_PATH];
+  ResolveOutFolder(opt, outFolder, sizeof(outFolder));
+  printf("\npix batch merge\n");
+  printf("folder: %s\n", outFolder);
+  printf("--------------------------------\n");
+
+  char path[MAX_PATH];
+  snprintf(path, sizeof(path), "%s\\%s.txt", outFolder, MANIFEST_BASE);
+  Manifest manifest;
+  if (!Manifest_Open(&manifest, path, NULL)) {
+    printf("cant write %s\n\n", path);
+    return 1;
+  }
+  int manifests =
+      ForEachShardFile(outFolder, MANIFEST_BASE, ImportShardManifest, &manifest);
+  if (Manifest_Close(&manifest))
+    ForEachShardFile(outFolder, MANIFEST_BASE, DeleteShardFile, NULL);
+  else
+    printf("cant write %s, shard manifests kept\n", path);
+
+  BatchSummary sum;
+  memset(&sum, 0, sizeof(sum));
+  ForEachShardFile(outFolder, BATCH_SUMMARY_BASE, AddShardSummary, &sum);
+
+  if (sum.shards > 0) {
+    // the shard .json files keep their per file lists, the merged one
+    // only has the totals
+    snprintf(path, sizeof(path), "%s\\%s.json", outFolder,
+             BATCH_SUMMARY_BASE);
+    FILE *f = fopen(path, "w");
+    if (f) {
+      fprintf(f, "{\n  \"params\": ");
+      JsonString(f, sum.params);
+      fprintf(f, ",\n");
+      WriteJsonTotals(f, &sum);
+      fclose(f);
+    }
+
+    snprintf(path, sizeof(path), "%s\\%s.txt", outFolder, BATCH_SUMMARY_BASE);
+    if (WriteSummaryText(path, &sum, "pix batch summary (merged)", NULL))
+      ForEachShardFile(outFolder, BATCH_SUMMARY_BASE, DeleteShardFile, NULL);
+  }
+
+  printf("--------------------------------\n");
+  printf("merged %d manifests, %d summaries\n", manifests, sum.shards);
+  if (sum.shards > 0) {
+    printf("%d files: %d processed, %d unchanged, %d failed\n", sum.assigned,
+           sum.processed, sum.unchanged, sum.failed);
+    PrintStats(&sum);
+  }
+  printf("\n");
+  return 1;
+}
+
+static void PrintUsage(const char *error) {
+  if (error)
+    printf("\n%s\n", error);
+  printf("\nusage:\n");
+  printf("  pix --batch <folder> \"<ops>\" [options]\n");
+  printf("  pix --batch <folder> --ops-file <edits.txt> [options]\n");
+  printf("  pix --batch-upscale <folder> [scale] [options]\n");
+  printf("  pix --batch-merge <folder> [--out <dir>]\n");
+  printf("\noptions:\n");
+  printf("  --out <dir>               output folder (default upscaled or "
+         "processed)\n");
+  printf("  --shard i/n               only this process's share of files\n");
+  printf("  --file-list <path|->      files to process instead of a scan\n");
+  printf("  --stream                  resize + png in row bands (low memory)\n");
+  printf("\nops, separated by ; (output is png unless a format op says "
+         "otherwise):\n");
+  printf("  fit WxH, resize WxH, scale F, crop X Y W H, rotate 90|180|270,\n");
+  printf("  flip h|v, levels, sharpen, blur, grayscale, sepia, invert,\n");
+  printf("  brightness N, contrast F, saturation F, format png|jpg [Q]|bmp\n");
+  printf("\n  e.g. pix --batch C:\\photos \"fit 1920x1080; levels; sharpen; "
+         "format jpg 90\"\n\n");
+}
+
+int Batch_Run(int argc, char *argv[]) {
+  if (argc < 3)
+    return 0;
+
+  int merge = (strcmp(argv[1], "--batch-merge") == 0);
+  int upscale = (strcmp(argv[1], "--batch-upscale") == 0);
+  int generic = (strcmp(argv[1], "--batch") == 0);
+  if (!merge && !upscale && !generic)
+    return 0; // not batch mode
+
+  // Attach console for output
+  AttachConsole(ATTACH_PARENT_PROCESS);
+  FILE *con = freopen("CONOUT$", "w", stdout);
+
+  BatchOptions opt;
+  memset(&opt, 0, sizeof(opt));
+  opt.folder = argv[2];
+  opt.defaultOut = generic ? "processed" : "upscaled";
+
+  // --batch-upscale folder N is shorthand for --batch folder "scale N"
+  const char *spec = "scale 2"; // default 2x
+  char scaleSpec[32];
+  const char *opsFile = NULL; // --ops-file, e.g. saved from the gui
+  char error[128] = {0};
+  int valid = 1;
+  int first = 3;
+  if (generic) {
+    spec = NULL;
+    if (argc > 3 && argv[3][0] != '-') {
+      spec = argv[3];
+      first = 4;
+    }
+  }
+
+  for (int i = first; i < argc && valid; i++) {
+    if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+      // 1-based: --shard 1/4 ... --shard 4/4
+      if (sscanf(argv[++i], "%d/%d", &opt.shardIndex, &opt.shardCount) != 2 ||
+          opt.shardCount < 1 || opt.shardIndex < 1 ||
+          opt.shardIndex > opt.shardCount)
+        valid = 0;
+    } else if (strcmp(argv[i], "--file-list") == 0 && i + 1 < argc) {
+      opt.fileList = argv[++i];
+    } else if (strcmp(argv[i], "--stream") == 0) {
+      opt.stream = 1;
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      opt.outDir = argv[++i];
+    } else if (generic && strcmp(argv[i], "--ops-file") == 0 && i + 1 < argc) {
+      opsFile = argv[++i];
+    } else if (upscale && i == 3 && argv[i][0] != '-') {
+      int scale = atoi(argv[i]);
+      snprintf(scaleSpec, sizeof(scaleSpec), "scale %d", scale < 1 ? 1 : scale);
+      spec = scaleSpec;
+    } else {
+      valid = 0;
+    }
+  }
+
+  if (valid && generic && !spec == !opsFile) {
+    valid = 0;
+    strcpy(error, "--batch needs an ops list or --ops-file (not both)");
+  }
+
+  if (valid && opsFile)
+    valid = ImageOps_ReadFile(opsFile, &opt.ops, error, sizeof(error));
+  else if (valid && !merge)
+    valid = ImageOps_Parse(spec, &opt.ops, error, sizeof(error));
+
+  if (!valid)
+    PrintUsage(error[0] ? error : NULL);
+  else if (merge)
+    RunMerge(&opt);
+  else
+    RunBatch(&opt);
+
+  if (con)
+    fclose(con);
+  return 1; // batch mode was used
+}
@@ -0,0 +1,22 @@
+// batch header
+// command line batch processing
+//   pix --batch <folder> "<ops>" [--out dir] [--shard i/n] [--file-list f|-]
+//   pix --batch <folder> --ops-file <path> [same options]
+//   pix --batch-upscale <folder> [scale] [same options]
+//   pix --batch-merge <folder> [--out dir]
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <windows.h>
+
+#define BATCH_MAX_DECODERS 16
+#define BATCH_MAX_PROCESSORS 4
+#define BATCH_MAX_ENCODERS 16
+#define BATCH_SUMMARY_BASE "pix_summary" // upscaled\pix_summary[.shard-i-of-n].txt (+ .json)
+#define BATCH_PROGRESS_BASE "pix_progress" // upscaled\pix_progress[.shard-i-of-n].log
+
+// returns 1 if argv was a batch command (and it ran), 0 for normal gui
+int Batch_Run(int argc, char *argv[]);
+
+#endif
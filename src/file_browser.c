@@ -4,50 +4,73 @@
  */
 
 #include "file_browser.h"
+#include "image_format.h"
 #include <commdlg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-
-// Supported image extensions
-static const char *g_imageExtensions[] = {".jpg", ".jpeg", ".png", ".bmp",
-                                          ".gif", ".tga",  ".psd", ".hdr",
-                                          ".pic", ".pnm",  NULL};
-
 void FileBrowser_Init(FileBrowser *browser) {
+  browser->files = NULL;
   browser->fileCount = 0;
+  browser->fileCapacity = 0;
   browser->currentIndex = -1;
   browser->currentDir[0] = '\0';
 }
 
-int FileBrowser_IsImageFile(const char *filename) {
-  const char *ext = strrchr(filename, '.');
-  if (!ext)
-    return 0;
+// drops all paths but keeps the array around for the next scan
+static void ClearFiles(FileBrowser *browser) {
+  for (int i = 0; i < browser->fileCount; i++)
+    free(browser->files[i]);
+  browser->fileCount = 0;
+  browser->currentIndex = -1;
+}
 
-  // Convert to lowercase for comparison
-  char lowerExt[16] = {0};
-  for (int i = 0; ext[i] && i < 15; i++) {
-    lowerExt[i] = (ext[i] >= 'A' && ext[i] <= 'Z') ? ext[i] + 32 : ext[i];
-  }
+void FileBrowser_Free(FileBrowser *browser) {
+  ClearFiles(browser);
+  free(browser->files);
+  browser->files = NULL;
+  browser->fileCapacity = 0;
+}
 
-  for (int i = 0; g_imageExtensions[i]; i++) {
-    if (strcmp(lowerExt, g_imageExtensions[i]) == 0) {
-      return 1;
-    }
+// appends a path, doubling the array when full
+static int AddFile(FileBrowser *browser, const char *dir, const char *name) {
+  if (browser->fileCount == browser->fileCapacity) {
+    int newCap = browser->fileCapacity ? browser->fileCapacity * 2 : 256;
+    char **grown = (char **)realloc(browser->files, newCap * sizeof(char *));
+    if (!grown)
+      return 0;
+    browser->files = grown;
+    browser->fileCapacity = newCap;
   }
-  return 0;
+
+  char path[MAX_PATH];
+  int len = snprintf(path, MAX_PATH, "%s\\%s", dir, name);
+  if (len < 0 || len >= MAX_PATH)
+    return 0;
+
+  char *copy = (char *)malloc(len + 1);
+  if (!copy)
+    return 0;
+  memcpy(copy, path, len + 1);
+  browser->files[browser->fileCount++] = copy;
+  return 1;
+}
+
+// listing goes by extension (cheap), the loader sniffs the real format
+int FileBrowser_IsImageFile(const char *filename) {
+  return ImageFormat_FromExtension(filename) != IMAGE_FORMAT_UNKNOWN;
 }
 
 int FileBrowser_OpenDialog(FileBrowser *browser, HWND hwnd) {
   char filename[MAX_PATH] = {0};
+  char filter[512];
+  ImageFormat_BuildFilter(filter, sizeof(filter));
 
   OPENFILENAMEA ofn = {0};
   ofn.lStructSize = sizeof(ofn);
   ofn.hwndOwner = hwnd;
-  ofn.lpstrFilter =
-      "Image Files\0*.jpg;*.jpeg;*.png;*.bmp;*.gif;*.tga;*.psd;*.hdr\0"
-      "All Files\0*.*\0";
+  ofn.lpstrFilter = filter;
   ofn.lpstrFile = filename;
   ofn.nMaxFile = MAX_PATH;
   ofn.Flags = OFN_FILEMUSTEXIST | OFN_PATHMUSTEXIST;
@@ -62,9 +85,16 @@ int FileBrowser_LoadDirectory(FileBrowser *browser, const char *filepath) {
   if (!filepath)
     return 0;
 
+  // filepath may point into our own list, which gets freed below
+  char target[MAX_PATH];
+  strncpy(target, filepath, MAX_PATH - 1);
+  target[MAX_PATH - 1] = '\0';
+  filepath = target;
+
   // Extract directory from filepath
   char dir[MAX_PATH];
   strncpy(dir, filepath, MAX_PATH - 1);
+  dir[MAX_PATH - 1] = '\0';
 
   char *lastSlash = strrchr(dir, '\\');
   if (!lastSlash)
@@ -79,8 +109,7 @@ int FileBrowser_LoadDirectory(FileBrowser *browser, const char *filepath) {
   strncpy(browser->currentDir, dir, MAX_PATH - 1);
 
   // Clear file list
-  browser->fileCount = 0;
-  browser->currentIndex = -1;
+  ClearFiles(browser);
 
   // Build search pattern
   char searchPattern[MAX_PATH];
@@ -94,14 +123,10 @@ int FileBrowser_LoadDirectory(FileBrowser *browser, const char *filepath) {
     do {
       if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
         if (FileBrowser_IsImageFile(findData.cFileName)) {
-          if (browser->fileCount < MAX_FILES) {
-            snprintf(browser->files[browser->fileCount], MAX_PATH, "%s\\%s",
-                     dir, findData.cFileName);
-            browser->fileCount++;
-          }
+          AddFile(browser, dir, findData.cFileName);
         }
       }
-    } while (FindNextFileA(hFind, &findData) && browser->fileCount < MAX_FILES);
+    } while (FindNextFileA(hFind, &findData));
 
     FindClose(hFind);
   }
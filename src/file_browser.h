@@ -7,18 +7,19 @@
 #include <stdio.h>
 #include <windows.h>
 
-#define MAX_FILES 10000
-
 // browser state
+// file list grows on demand so big folders (100k+) aren't truncated
 typedef struct {
-  char files[MAX_FILES][MAX_PATH];
+  char **files; // heap-allocated paths
   int fileCount;
+  int fileCapacity;
   int currentIndex;
   char currentDir[MAX_PATH];
 } FileBrowser;
 
 // functions
 void FileBrowser_Init(FileBrowser *browser);
+void FileBrowser_Free(FileBrowser *browser);
 int FileBrowser_OpenDialog(FileBrowser *browser, HWND hwnd);
 int FileBrowser_LoadDirectory(FileBrowser *browser, const char *filepath);
 const char *FileBrowser_GetCurrent(FileBrowser *browser);
@@ -0,0 +1,249 @@
+/*
+ * GDI Cache - Implementation
+ * pix - gdi cache
+ *
+ * everything is made up front: the fonts once, the brushes and pens for
+ * the current theme whenever the theme changes. the theme the objects were
+ * made for is kept with them, so a paint that finds the theme changed
+ * under it rebuilds rather than drawing in the old colors - and that shows
+ * up in the mid-paint counter, as does anything else made while painting.
+ *
+ * the back buffer only ever has to be right inside the region being
+ * painted: each paint is clipped to the window's update region, redraws
+ * everything in it and copies just that out. whats outside stays on screen
+ * from earlier paints (or was moved there by ScrollWindowEx).
+ */
+
+#include "gdi_cache.h"
+#include "app_state.h"
+
+#define BACK_BUFFER_SLACK 128 // the back buffer grows in steps of this
+
+static struct {
+  HFONT fonts[UI_FONT_COUNT];
+  HBRUSH brushes[UI_BRUSH_COUNT];
+  HPEN pens[UI_PEN_COUNT];
+  BOOL built;
+  BOOL dark; // theme the brushes and pens were made for
+
+  HDC backDC;
+  HBITMAP backBitmap;
+  HGDIOBJ oldBitmap;
+  int backW, backH;
+  HRGN dirty; // the update region of the paint in progress
+
+  BOOL painting;
+  long created;
+  long createdInPaint;
+} g_gdi;
+
+static void Made(void) {
+  g_gdi.created++;
+  if (g_gdi.painting)
+    g_gdi.createdInPaint++;
+}
+
+static HFONT MakeFont(int height, int weight, DWORD pitch, const char *face) {
+  Made();
+  return CreateFontA(height, 0, 0, 0, weight, FALSE, FALSE, FALSE,
+                     DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
+                     CLEARTYPE_QUALITY, pitch, face);
+}
+
+static HBRUSH MakeBrush(COLORREF color) {
+  Made();
+  return CreateSolidBrush(color);
+}
+
+static HPEN MakePen(int style, int width, COLORREF color) {
+  Made();
+  return CreatePen(style, width, color);
+}
+
+// the back dc may have one of ours selected, and gdi wont delete that
+static void Deselect(void) {
+  if (!g_gdi.backDC)
+    return;
+  SelectObject(g_gdi.backDC, GetStockObject(SYSTEM_FONT));
+  SelectObject(g_gdi.backDC, GetStockObject(WHITE_BRUSH));
+  SelectObject(g_gdi.backDC, GetStockObject(BLACK_PEN));
+}
+
+static void FreeThemed(void) {
+  Deselect();
+  for (int i = 0; i < UI_BRUSH_COUNT; i++) {
+    if (g_gdi.brushes[i])
+      DeleteObject(g_gdi.brushes[i]);
+    g_gdi.brushes[i] = NULL;
+  }
+  for (int i = 0; i < UI_PEN_COUNT; i++) {
+    if (g_gdi.pens[i])
+      DeleteObject(g_gdi.pens[i]);
+    g_gdi.pens[i] = NULL;
+  }
+}
+
+void GdiCache_SetTheme(void) {
+  FreeThemed();
+  g_gdi.dark = g_darkTheme;
+
+  HBRUSH *b = g_gdi.brushes;
+  b[UI_BRUSH_BG] = MakeBrush(g_bgColor);
+  b[UI_BRUSH_PANEL] = MakeBrush(g_panelBgColor);
+  b[UI_BRUSH_STATUS] = MakeBrush(g_statusBarColor);
+  b[UI_BRUSH_ACCENT] = MakeBrush(g_accentColor);
+  b[UI_BRUSH_STRIP] = MakeBrush(RGB(20, 20, 20));
+  b[UI_BRUSH_THUMB] = MakeBrush(RGB(50, 50, 50));
+  b[UI_BRUSH_THUMB_CURRENT] = MakeBrush(RGB(70, 130, 180));
+  b[UI_BRUSH_TRACK] = MakeBrush(RGB(50, 50, 55));
+  b[UI_BRUSH_HIGHLIGHT] = MakeBrush(RGB(120, 170, 210));
+  b[UI_BRUSH_OVERLAY] = MakeBrush(RGB(30, 30, 35));
+  b[UI_BRUSH_DIALOG] = MakeBrush(RGB(25, 25, 30));
+  b[UI_BRUSH_EDIT] = MakeBrush(RGB(35, 35, 38));
+  b[UI_BRUSH_SLIDER] = MakeBrush(RGB(60, 60, 65));
+  b[UI_BRUSH_SCROLLBAR] = MakeBrush(RGB(90, 90, 95));
+  b[UI_BRUSH_DIM] = MakeBrush(RGB(0, 0, 0));
+
+  HPEN *p = g_gdi.pens;
+  p[UI_PEN_PANEL] = MakePen(PS_SOLID, 1,
+                            g_darkTheme ? RGB(80, 80, 80) : RGB(180, 180, 180));
+  p[UI_PEN_STRIP] = MakePen(PS_SOLID, 1, RGB(60, 60, 60));
+  p[UI_PEN_THUMB] = MakePen(PS_SOLID, 1, RGB(80, 80, 80));
+  p[UI_PEN_THUMB_CURRENT] = MakePen(PS_SOLID, 1, RGB(100, 180, 255));
+  p[UI_PEN_STATUS] = MakePen(PS_SOLID, 1, RGB(45, 45, 48));
+  p[UI_PEN_SHADOW] = MakePen(PS_SOLID, 1, RGB(0, 0, 0));
+  p[UI_PEN_OVERLAY] = MakePen(PS_SOLID, 1, RGB(60, 60, 65));
+  p[UI_PEN_DIALOG] = MakePen(PS_SOLID, 1, RGB(70, 70, 80));
+  p[UI_PEN_SELECTION] = MakePen(PS_DASH, 2, RGB(255, 255, 255));
+}
+
+void GdiCache_Init(void) {
+  if (g_gdi.built)
+    return;
+
+  DWORD swiss = DEFAULT_PITCH | FF_SWISS;
+  HFONT *f = g_gdi.fonts;
+  f[UI_FONT_INFO] = MakeFont(15, FW_MEDIUM, swiss, "Segoe UI");
+  f[UI_FONT_INFO_BOLD] = MakeFont(15, FW_BOLD, swiss, "Segoe UI");
+  f[UI_FONT_SMALL] = MakeFont(13, FW_NORMAL, swiss, "Segoe UI");
+  f[UI_FONT_ZOOM] = MakeFont(16, FW_MEDIUM, swiss, "Segoe UI");
+  f[UI_FONT_EDIT] = MakeFont(14, FW_NORMAL, swiss, "Segoe UI");
+  f[UI_FONT_LABEL] = MakeFont(14, FW_SEMIBOLD, swiss, "Segoe UI");
+  f[UI_FONT_MONO] =
+      MakeFont(14, FW_NORMAL, FIXED_PITCH | FF_MODERN, "Consolas");
+  f[UI_FONT_TITLE] = MakeFont(16, FW_BOLD, swiss, "Segoe UI");
+
+  Made();
+  g_gdi.dirty = CreateRectRgn(0, 0, 0, 0);
+
+  GdiCache_SetTheme();
+  g_gdi.built = TRUE;
+}
+
+static void FreeBackBuffer(void) {
+  if (g_gdi.backDC) {
+    Deselect();
+    SelectObject(g_gdi.backDC, g_gdi.oldBitmap);
+    DeleteDC(g_gdi.backDC);
+  }
+  if (g_gdi.backBitmap)
+    DeleteObject(g_gdi.backBitmap);
+  g_gdi.backDC = NULL;
+  g_gdi.backBitmap = NULL;
+  g_gdi.backW = g_gdi.backH = 0;
+}
+
+void GdiCache_Free(void) {
+  FreeBackBuffer();
+  FreeThemed();
+  for (int i = 0; i < UI_FONT_COUNT; i++) {
+    if (g_gdi.fonts[i])
+      DeleteObject(g_gdi.fonts[i]);
+    g_gdi.fonts[i] = NULL;
+  }
+  if (g_gdi.dirty)
+    DeleteObject(g_gdi.dirty);
+  g_gdi.dirty = NULL;
+  g_gdi.built = FALSE;
+}
+
+HFONT GdiCache_Font(UiFont font) { return g_gdi.fonts[font]; }
+
+HBRUSH GdiCache_Brush(UiBrush brush) {
+  if (g_gdi.dark != g_darkTheme)
+    GdiCache_SetTheme();
+  return g_gdi.brushes[brush];
+}
+
+HPEN GdiCache_Pen(UiPen pen) {
+  if (g_gdi.dark != g_darkTheme)
+    GdiCache_SetTheme();
+  return g_gdi.pens[pen];
+}
+
+// makes the back buffer at least w x h (rounded up to the slack)
+static void GrowBackBuffer(HDC hdc, int w, int h) {
+  int newW = (w + BACK_BUFFER_SLACK - 1) / BACK_BUFFER_SLACK * BACK_BUFFER_SLACK;
+  int newH = (h + BACK_BUFFER_SLACK - 1) / BACK_BUFFER_SLACK * BACK_BUFFER_SLACK;
+  // keep it while it fits, unless the window shrank to a fraction of it
+  if (g_gdi.backDC && w <= g_gdi.backW && h <= g_gdi.backH &&
+      (long long)newW * newH * 4 >= (long long)g_gdi.backW * g_gdi.backH)
+    return;
+
+  FreeBackBuffer();
+  Made();
+  g_gdi.backDC = CreateCompatibleDC(hdc);
+  Made();
+  g_gdi.backBitmap = CreateCompatibleBitmap(hdc, newW, newH);
+  if (!g_gdi.backDC || !g_gdi.backBitmap) {
+    FreeBackBuffer();
+    return;
+  }
+  g_gdi.oldBitmap = SelectObject(g_gdi.backDC, g_gdi.backBitmap);
+  g_gdi.backW = newW;
+  g_gdi.backH = newH;
+}
+
+void GdiCache_Resize(HWND hwnd) {
+  RECT client;
+  GetClientRect(hwnd, &client);
+  if (client.right < 1 || client.bottom < 1)
+    return; // minimized
+  HDC hdc = GetDC(hwnd);
+  GrowBackBuffer(hdc, client.right, client.bottom);
+  ReleaseDC(hwnd, hdc);
+}
+
+HDC GdiCache_BeginPaint(HWND hwnd, PAINTSTRUCT *ps, int w, int h) {
+  if (!g_gdi.built)
+    GdiCache_Init();
+
+  // BeginPaint validates the window, so the region has to be read first
+  BOOL clip = g_gdi.dirty && GetUpdateRgn(hwnd, g_gdi.dirty, FALSE) > NULLREGION;
+  HDC hdc = BeginPaint(hwnd, ps);
+  g_gdi.painting = TRUE;
+  GrowBackBuffer(hdc, w, h);
+  if (!g_gdi.backDC)
+    return hdc;
+
+  SelectClipRgn(g_gdi.backDC, clip ? g_gdi.dirty : NULL);
+  return g_gdi.backDC;
+}
+
+void GdiCache_EndPaint(HWND hwnd, PAINTSTRUCT *ps) {
+  if (g_gdi.backDC) {
+    // ps->hdc is clipped to the update region already
+    RECT *r = &ps->rcPaint;
+    BitBlt(ps->hdc, r->left, r->top, r->right - r->left, r->bottom - r->top,
+           g_gdi.backDC, r->left, r->top, SRCCOPY);
+    SelectClipRgn(g_gdi.backDC, NULL);
+  }
+  g_gdi.painting = FALSE;
+  EndPaint(hwnd, ps);
+}
+
+void GdiCache_NoteCreated(void) { Made(); }
+
+long GdiCache_Created(void) { return g_gdi.created; }
+
+long GdiCache_CreatedInPaint(void) { return g_gdi.createdInPaint; }
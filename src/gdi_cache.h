@@ -0,0 +1,82 @@
+// gdi cache header
+// the fonts, brushes and pens the ui draws with, and the back buffer it
+// draws into - made once instead of on every paint
+
+#ifndef GDI_CACHE_H
+#define GDI_CACHE_H
+
+#include <windows.h>
+
+typedef enum {
+  UI_FONT_INFO,      // info panel text
+  UI_FONT_INFO_BOLD, // info panel and edit panel headings
+  UI_FONT_SMALL,     // status bar, grid captions
+  UI_FONT_ZOOM,      // zoom % overlay
+  UI_FONT_EDIT,      // edit panel text
+  UI_FONT_LABEL,     // "SLIDESHOW"
+  UI_FONT_MONO,      // help and settings lines
+  UI_FONT_TITLE,     // help and settings titles
+  UI_FONT_COUNT
+} UiFont;
+
+typedef enum {
+  // follow the theme
+  UI_BRUSH_BG,
+  UI_BRUSH_PANEL,
+  UI_BRUSH_STATUS,
+  UI_BRUSH_ACCENT,
+  // the same in both themes
+  UI_BRUSH_STRIP,
+  UI_BRUSH_THUMB,
+  UI_BRUSH_THUMB_CURRENT,
+  UI_BRUSH_TRACK,     // slideshow progress track
+  UI_BRUSH_HIGHLIGHT, // slideshow progress top line
+  UI_BRUSH_OVERLAY,   // zoom % box
+  UI_BRUSH_DIALOG,    // help and settings
+  UI_BRUSH_EDIT,      // edit panel
+  UI_BRUSH_SLIDER,    // edit panel slider tracks
+  UI_BRUSH_SCROLLBAR, // grid scroll indicator
+  UI_BRUSH_DIM,       // outside the crop selection
+  UI_BRUSH_COUNT
+} UiBrush;
+
+typedef enum {
+  UI_PEN_PANEL, // info panel border, follows the theme
+  UI_PEN_STRIP,
+  UI_PEN_THUMB,
+  UI_PEN_THUMB_CURRENT,
+  UI_PEN_STATUS,
+  UI_PEN_SHADOW,
+  UI_PEN_OVERLAY, // zoom % box and edit panel borders
+  UI_PEN_DIALOG,  // help and settings borders
+  UI_PEN_SELECTION,
+  UI_PEN_COUNT
+} UiPen;
+
+// builds everything for the current theme colors
+void GdiCache_Init(void);
+// rebuilds the theme colored objects, call after the colors change
+void GdiCache_SetTheme(void);
+void GdiCache_Free(void);
+
+HFONT GdiCache_Font(UiFont font);
+HBRUSH GdiCache_Brush(UiBrush brush);
+HPEN GdiCache_Pen(UiPen pen);
+
+// the back buffer. Resize (from WM_SIZE) grows it ahead of time, with some
+// slack so dragging the window edge doesnt remake it every message.
+// BeginPaint wraps the win32 one and hands back its dc, at least w x h and
+// clipped to the window's update region (or ps->hdc itself if there is no
+// memory for one). EndPaint copies just that region to the window
+void GdiCache_Resize(HWND hwnd);
+HDC GdiCache_BeginPaint(HWND hwnd, PAINTSTRUCT *ps, int w, int h);
+void GdiCache_EndPaint(HWND hwnd, PAINTSTRUCT *ps);
+
+// gdi objects made so far, and how many of those were made mid-paint
+// (shown in the settings panel). objects made outside this file count
+// too, whoever makes them calls NoteCreated
+void GdiCache_NoteCreated(void);
+long GdiCache_Created(void);
+long GdiCache_CreatedInPaint(void);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * Image Format - Implementation
+ * pix - format registry and content sniffing
+ */
+
+#include "image_format.h"
+#include <stdio.h>
+#include <string.h>
+
+// every format stb_image decodes for us
+static const ImageFormatInfo g_formats[] = {
+    {IMAGE_FORMAT_PNG, "PNG", {".png", NULL}, 1},
+    {IMAGE_FORMAT_JPEG, "JPEG", {".jpg", ".jpeg", ".jpe", NULL}, 1},
+    {IMAGE_FORMAT_BMP, "BMP", {".bmp", NULL}, 1},
+    {IMAGE_FORMAT_GIF, "GIF", {".gif", NULL}, 0}, // animated, not batched
+    {IMAGE_FORMAT_TGA, "TGA", {".tga", NULL}, 1},
+    {IMAGE_FORMAT_PSD, "PSD", {".psd", NULL}, 1},
+    {IMAGE_FORMAT_HDR, "HDR", {".hdr", NULL}, 1},
+    {IMAGE_FORMAT_PIC, "PIC", {".pic", NULL}, 1},
+    {IMAGE_FORMAT_PNM, "PNM", {".pnm", ".ppm", ".pgm", NULL}, 1},
+};
+
+#define FORMAT_COUNT (int)(sizeof(g_formats) / sizeof(g_formats[0]))
+
+const ImageFormatInfo *ImageFormat_Get(ImageFormat format) {
+  for (int i = 0; i < FORMAT_COUNT; i++) {
+    if (g_formats[i].format == format)
+      return &g_formats[i];
+  }
+  return NULL;
+}
+
+ImageFormat ImageFormat_FromExtension(const char *filename) {
+  const char *ext = filename ? strrchr(filename, '.') : NULL;
+  if (!ext)
+    return IMAGE_FORMAT_UNKNOWN;
+
+  // Convert to lowercase for comparison
+  char lowerExt[16] = {0};
+  for (int i = 0; ext[i] && i < 15; i++) {
+    lowerExt[i] = (ext[i] >= 'A' && ext[i] <= 'Z') ? ext[i] + 32 : ext[i];
+  }
+
+  for (int i = 0; i < FORMAT_COUNT; i++) {
+    for (int e = 0; g_formats[i].extensions[e]; e++) {
+      if (strcmp(lowerExt, g_formats[i].extensions[e]) == 0)
+        return g_formats[i].format;
+    }
+  }
+  return IMAGE_FORMAT_UNKNOWN;
+}
+
+// tga has no magic, so check the header fields the same way stb does
+static int LooksLikeTga(const unsigned char *h, size_t len) {
+  if (len < 18)
+    return 0;
+
+  int colorType = h[1];
+  int imageType = h[2];
+  if (colorType > 1)
+    return 0;
+  if (colorType == 1) {
+    if (imageType != 1 && imageType != 9)
+      return 0;
+    int entryBits = h[7];
+    if (entryBits != 8 && entryBits != 15 && entryBits != 16 &&
+        entryBits != 24 && entryBits != 32)
+      return 0;
+  } else if (imageType != 2 && imageType != 3 && imageType != 10 &&
+             imageType != 11) {
+    return 0;
+  }
+
+  int width = h[12] | (h[13] << 8);
+  int height = h[14] | (h[15] << 8);
+  int bpp = h[16];
+  if (width < 1 || height < 1)
+    return 0;
+  if (colorType == 1 && bpp != 8 && bpp != 16)
+    return 0;
+  return bpp == 8 || bpp == 15 || bpp == 16 || bpp == 24 || bpp == 32;
+}
+
+ImageFormat ImageFormat_Sniff(const unsigned char *head, size_t len,
+                              const char *filename) {
+  if (!head)
+    return IMAGE_FORMAT_UNKNOWN;
+
+  static const unsigned char pngSig[8] = {0x89, 'P', 'N', 'G',
+                                          0x0D, 0x0A, 0x1A, 0x0A};
+  if (len >= 8 && memcmp(head, pngSig, 8) == 0)
+    return IMAGE_FORMAT_PNG;
+  if (len >= 3 && head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF)
+    return IMAGE_FORMAT_JPEG;
+  if (len >= 6 && (memcmp(head, "GIF87a", 6) == 0 ||
+                   memcmp(head, "GIF89a", 6) == 0))
+    return IMAGE_FORMAT_GIF;
+  if (len >= 2 && head[0] == 'B' && head[1] == 'M')
+    return IMAGE_FORMAT_BMP;
+  if (len >= 4 && memcmp(head, "8BPS", 4) == 0)
+    return IMAGE_FORMAT_PSD;
+  if ((len >= 11 && memcmp(head, "#?RADIANCE\n", 11) == 0) ||
+      (len >= 7 && memcmp(head, "#?RGBE\n", 7) == 0))
+    return IMAGE_FORMAT_HDR;
+  if (len >= 4 && head[0] == 0x53 && head[1] == 0x80 && head[2] == 0xF6 &&
+      head[3] == 0x34)
+    return IMAGE_FORMAT_PIC;
+  if (len >= 2 && head[0] == 'P' && (head[1] == '5' || head[1] == '6'))
+    return IMAGE_FORMAT_PNM;
+
+  // no magic matched - only trust the weak tga check if the name agrees
+  if (ImageFormat_FromExtension(filename) == IMAGE_FORMAT_TGA &&
+      LooksLikeTga(head, len))
+    return IMAGE_FORMAT_TGA;
+
+  return IMAGE_FORMAT_UNKNOWN;
+}
+
+void ImageFormat_BuildFilter(char *buffer, size_t size) {
+  if (!buffer || size < 2)
+    return;
+
+  // "Image Files\0*.png;*.jpg;...\0All Files\0*.*\0\0"
+  size_t pos = 0;
+  pos += snprintf(buffer + pos, size - pos, "Image Files") + 1;
+
+  for (int i = 0; i < FORMAT_COUNT && pos < size; i++) {
+    for (int e = 0; g_formats[i].extensions[e] && pos < size; e++) {
+      int n = snprintf(buffer + pos, size - pos, "%s*%s",
+                       (i == 0 && e == 0) ? "" : ";",
+                       g_formats[i].extensions[e]);
+      if (n < 0)
+        break;
+      pos += n;
+    }
+  }
+  if (pos < size)
+    pos++; // keep the terminator
+
+  const char tail[] = "All Files\0*.*\0";
+  if (pos + sizeof(tail) <= size) {
+    memcpy(buffer + pos, tail, sizeof(tail)); // includes final \0
+  } else {
+    buffer[size - 2] = '\0';
+    buffer[size - 1] = '\0';
+  }
+}
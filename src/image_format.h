@@ -0,0 +1,47 @@
+// image format header
+// one registry of supported formats, shared by the loader, browser and batch
+
+#ifndef IMAGE_FORMAT_H
+#define IMAGE_FORMAT_H
+
+#include <stddef.h>
+
+// bytes the sniffer wants to see (enough for every magic we check)
+#define IMAGE_SNIFF_BYTES 32
+
+typedef enum {
+  IMAGE_FORMAT_UNKNOWN = 0,
+  IMAGE_FORMAT_PNG,
+  IMAGE_FORMAT_JPEG,
+  IMAGE_FORMAT_BMP,
+  IMAGE_FORMAT_GIF,
+  IMAGE_FORMAT_TGA,
+  IMAGE_FORMAT_PSD,
+  IMAGE_FORMAT_HDR,
+  IMAGE_FORMAT_PIC,
+  IMAGE_FORMAT_PNM,
+  IMAGE_FORMAT_COUNT
+} ImageFormat;
+
+// registry entry
+typedef struct {
+  ImageFormat format;
+  const char *name;
+  const char *extensions[4]; // lowercase with dot, NULL terminated
+  int batchInput;            // batch mode picks these up
+} ImageFormatInfo;
+
+const ImageFormatInfo *ImageFormat_Get(ImageFormat format);
+
+// by file name - cheap, used for folder listings
+ImageFormat ImageFormat_FromExtension(const char *filename);
+
+// by content - magic bytes first, extension only as a tie-breaker for
+// formats without a magic number (tga)
+ImageFormat ImageFormat_Sniff(const unsigned char *head, size_t len,
+                              const char *filename);
+
+// builds a double-null terminated open dialog filter from the registry
+void ImageFormat_BuildFilter(char *buffer, size_t size);
+
+#endif
@@ -6,41 +6,326 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "image_loader.h"
+
+// stb allocates through the allocator of the load running on this thread
+static void *StbMalloc(size_t size);
+static void *StbRealloc(void *ptr, size_t oldSize, size_t newSize);
+static void StbFree(void *ptr);
+#define STBI_MALLOC(sz) StbMalloc(sz)
+#define STBI_REALLOC_SIZED(p, oldsz, newsz) StbRealloc(p, oldsz, newsz)
+#define STBI_FREE(p) StbFree(p)
+
 #include "../lib/stb_image.h"
 #include "../lib/stb_image_write.h"
+#include <emmintrin.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static char g_lastError[256] = {0};
+// stb only keeps its failure reason per thread when it has thread locals,
+// without them two decodes at once would trample each other's errors
+#ifndef STBI_THREAD_LOCAL
+#error "stb_image needs thread locals for concurrent decodes"
+#endif
 
-// Helper to check if file is GIF
-static int IsGifFile(const char *filepath) {
-  const char *ext = strrchr(filepath, '.');
-  if (ext && (_stricmp(ext, ".gif") == 0)) {
-    return 1;
+static void *TrackedAlloc(void *user, size_t size, PixelTag tag) {
+  (void)user;
+  return PixelMemory_Alloc(size, tag);
+}
+
+static void *TrackedResize(void *user, void *ptr, size_t oldSize,
+                           size_t newSize) {
+  (void)user;
+  (void)oldSize;
+  return PixelMemory_Realloc(ptr, newSize);
+}
+
+static void TrackedRelease(void *user, void *ptr) {
+  (void)user;
+  PixelMemory_Free(ptr);
+}
+
+static void TrackedRetag(void *user, void *ptr, PixelTag tag) {
+  (void)user;
+  PixelMemory_Retag(ptr, tag);
+}
+
+static const ImageAllocator g_trackedAllocator = {
+    TrackedAlloc, TrackedResize, TrackedRelease, TrackedRetag, NULL};
+
+// zeroed allocator (calloc'd ImageData, no context) means the tracked one
+static const ImageAllocator *Allocator(const ImageAllocator *a) {
+  return a && a->alloc ? a : &g_trackedAllocator;
+}
+
+// set for the length of a decode, so stb's buffers come from the caller's
+// allocator under the right tag. per thread, so concurrent loads each get
+// their own
+static STBI_THREAD_LOCAL const ImageAllocator *t_allocator;
+static STBI_THREAD_LOCAL PixelTag t_tag;
+
+static void BeginDecode(const ImageAllocator *allocator, PixelTag tag) {
+  t_allocator = allocator;
+  t_tag = tag;
+}
+
+static void EndDecode(void) {
+  t_allocator = NULL;
+  t_tag = PIXMEM_CURRENT;
+}
+
+static void *StbMalloc(size_t size) {
+  const ImageAllocator *a = Allocator(t_allocator);
+  return a->alloc(a->user, size, t_tag);
+}
+
+static void *StbRealloc(void *ptr, size_t oldSize, size_t newSize) {
+  const ImageAllocator *a = Allocator(t_allocator);
+  if (!ptr)
+    return a->alloc(a->user, newSize, t_tag);
+  return a->resize(a->user, ptr, oldSize, newSize);
+}
+
+static void StbFree(void *ptr) {
+  if (ptr) {
+    const ImageAllocator *a = Allocator(t_allocator);
+    a->release(a->user, ptr);
+  }
+}
+
+unsigned char *ImageLoader_AllocPixels(const ImageData *image, size_t size,
+                                       PixelTag tag) {
+  const ImageAllocator *a = Allocator(image ? &image->allocator : NULL);
+  return (unsigned char *)a->alloc(a->user, size, tag);
+}
+
+static void RetagPixels(const ImageData *image, void *pixels, PixelTag tag) {
+  const ImageAllocator *a = Allocator(&image->allocator);
+  if (pixels && a->retag)
+    a->retag(a->user, pixels, tag);
+}
+
+void ImageLoader_FreePixels(const ImageData *image, void *pixels) {
+  if (pixels) {
+    const ImageAllocator *a = Allocator(image ? &image->allocator : NULL);
+    a->release(a->user, pixels);
+  }
+}
+
+// error text goes to the caller's context, never anywhere shared
+static int LoadFailed(ImageLoadContext *ctx, const char *what,
+                      const char *why) {
+  if (ctx) {
+    if (why)
+      snprintf(ctx->error, sizeof(ctx->error), "%s: %s", what, why);
+    else
+      snprintf(ctx->error, sizeof(ctx->error), "%s", what);
   }
   return 0;
 }
 
-// Helper to load entire file into memory
-static unsigned char *LoadFileToMemory(const char *filepath, int *outSize) {
-  FILE *f = fopen(filepath, "rb");
-  if (!f)
-    return NULL;
+void ImageLoader_SwizzleRB(unsigned char *dst, const unsigned char *src,
+                           size_t pixels) {
+  // as 32-bit words a pixel is a<<24 | b<<16 | g<<8 | r (or r and b the
+  // other way) - keep g and a, rotate the other two bytes past each other
+  const __m128i ga = _mm_set1_epi32((int)0xFF00FF00);
+  const __m128i rb = _mm_set1_epi32(0x00FF00FF);
+  size_t i = 0;
+  for (; i + 4 <= pixels; i += 4) {
+    __m128i p = _mm_loadu_si128((const __m128i *)(src + i * 4));
+    __m128i x = _mm_and_si128(p, rb);
+    x = _mm_or_si128(_mm_slli_epi32(x, 16), _mm_srli_epi32(x, 16));
+    _mm_storeu_si128((__m128i *)(dst + i * 4),
+                     _mm_or_si128(_mm_and_si128(p, ga), x));
+  }
+  for (; i < pixels; i++) {
+    unsigned char r = src[i * 4 + 0], b = src[i * 4 + 2];
+    dst[i * 4 + 0] = b;
+    dst[i * 4 + 1] = src[i * 4 + 1];
+    dst[i * 4 + 2] = r;
+    dst[i * 4 + 3] = src[i * 4 + 3];
+  }
+}
 
-  fseek(f, 0, SEEK_END);
-  int size = ftell(f);
-  fseek(f, 0, SEEK_SET);
+void ImageLoader_SetPixelFormat(ImageData *image, PixelFormat format) {
+  if (!image || image->pixelFormat == format)
+    return;
+  if (image->pixels)
+    ImageLoader_SwizzleRB(image->pixels, image->pixels,
+                          (size_t)image->width * image->height);
+  image->pixelFormat = format;
+}
 
-  unsigned char *buffer = (unsigned char *)malloc(size);
-  if (buffer) {
-    fread(buffer, 1, size, f);
-    *outSize = size;
+// read-only mapping of a whole file - the sniffer and the decoder both
+// read straight from the view, so the file is only touched once
+typedef struct {
+  HANDLE file;
+  HANDLE mapping;
+  const unsigned char *data;
+  int size;
+} MappedFile;
+
+static int MapFile(const char *filepath, MappedFile *mf) {
+  memset(mf, 0, sizeof(MappedFile));
+
+  mf->file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (mf->file == INVALID_HANDLE_VALUE)
+    return 0;
+
+  // stb takes an int length, and empty files cant be mapped
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(mf->file, &size) || size.QuadPart <= 0 ||
+      size.QuadPart > 0x7FFFFFFF) {
+    CloseHandle(mf->file);
+    return 0;
   }
-  fclose(f);
-  return buffer;
+  mf->size = (int)size.QuadPart;
+
+  mf->mapping = CreateFileMappingA(mf->file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mf->mapping)
+    mf->data =
+        (const unsigned char *)MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!mf->data) {
+    if (mf->mapping)
+      CloseHandle(mf->mapping);
+    CloseHandle(mf->file);
+    return 0;
+  }
+  return 1;
+}
+
+static void UnmapFile(MappedFile *mf) {
+  if (mf->data)
+    UnmapViewOfFile(mf->data);
+  if (mf->mapping)
+    CloseHandle(mf->mapping);
+  if (mf->file && mf->file != INVALID_HANDLE_VALUE)
+    CloseHandle(mf->file);
+  memset(mf, 0, sizeof(MappedFile));
+}
+
+// stb's jpeg colour conversion, then r and b swapped on the row it just
+// wrote - still in cache, so bgra costs no extra pass over the image
+static STBI_THREAD_LOCAL void (*t_ycbcrKernel)(stbi_uc *out, const stbi_uc *y,
+                                               const stbi_uc *pcb,
+                                               const stbi_uc *pcr, int count,
+                                               int step);
+static STBI_THREAD_LOCAL int t_ycbcrRows;
+
+static void YCbCrToBgraRow(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb,
+                           const stbi_uc *pcr, int count, int step) {
+  t_ycbcrKernel(out, y, pcb, pcr, count, step);
+  ImageLoader_SwizzleRB(out, out, count);
+  t_ycbcrRows++;
+}
+
+// stbi__jpeg_load with the bgra kernel swapped in. the odd jpegs that dont
+// go through the kernel (cmyk, adobe rgb) come back rgba, *swizzled says
+static unsigned char *LoadJpegBgra(stbi__context *s, int *w, int *h,
+                                   int *comp, int *swizzled) {
+  stbi__jpeg *j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+  if (!j)
+    return stbi__errpuc("outofmem", "Out of memory");
+  memset(j, 0, sizeof(stbi__jpeg));
+  j->s = s;
+  stbi__setup_jpeg(j);
+  t_ycbcrKernel = j->YCbCr_to_RGB_kernel;
+  t_ycbcrRows = 0;
+  j->YCbCr_to_RGB_kernel = YCbCrToBgraRow;
+
+  unsigned char *result = load_jpeg_image(j, w, h, comp, 4);
+  STBI_FREE(j);
+  *swizzled = t_ycbcrRows > 0;
+  return result;
+}
+
+// runs only the stb decoder the sniffer picked, instead of stb's
+// try-every-format chain (its jpeg test alone parses the whole header).
+// mirrors stbi__load_and_postprocess_8bit, always returns 8-bit rgba
+static unsigned char *DecodeSniffed(ImageFormat format,
+                                    const unsigned char *data, int size,
+                                    int *w, int *h, int *comp,
+                                    PixelFormat pixelFormat) {
+  stbi__context s;
+  stbi__result_info ri;
+  void *result = NULL;
+  int swizzled = 0; // already in pixelFormat
+
+  stbi__start_mem(&s, data, size);
+  memset(&ri, 0, sizeof(ri));
+  ri.bits_per_channel = 8;
+  ri.channel_order = STBI_ORDER_RGB;
+
+  switch (format) {
+  case IMAGE_FORMAT_PNG:
+    result = stbi__png_load(&s, w, h, comp, 4, &ri);
+    break;
+  case IMAGE_FORMAT_JPEG:
+    if (pixelFormat == PIXEL_BGRA)
+      result = LoadJpegBgra(&s, w, h, comp, &swizzled);
+    else
+      result = stbi__jpeg_load(&s, w, h, comp, 4, &ri);
+    break;
+  case IMAGE_FORMAT_BMP:
+    result = stbi__bmp_load(&s, w, h, comp, 4, &ri);
+    break;
+  case IMAGE_FORMAT_GIF: // first frame only
+    result = stbi__gif_load(&s, w, h, comp, 4, &ri);
+    break;
+  case IMAGE_FORMAT_TGA:
+    result = stbi__tga_load(&s, w, h, comp, 4, &ri);
+    break;
+  case IMAGE_FORMAT_PSD:
+    result = stbi__psd_load(&s, w, h, comp, 4, &ri, 8);
+    break;
+  case IMAGE_FORMAT_PIC:
+    result = stbi__pic_load(&s, w, h, comp, 4, &ri);
+    break;
+  case IMAGE_FORMAT_PNM:
+    result = stbi__pnm_load(&s, w, h, comp, 4, &ri);
+    break;
+  default:
+    // hdr needs stb's float to ldr step, let stb do the whole thing
+    result = stbi_load_from_memory(data, size, w, h, comp, 4);
+    break;
+  }
+
+  if (result && ri.bits_per_channel != 8)
+    result = stbi__convert_16_to_8((stbi__uint16 *)result, *w, *h, 4);
+  // grey is the same either way round. otherwise stb only does rgba, so
+  // anything but a jpeg takes one sse2 pass
+  if (result && pixelFormat == PIXEL_BGRA && !swizzled && *comp > 2)
+    ImageLoader_SwizzleRB((unsigned char *)result, (unsigned char *)result,
+                          (size_t)*w * *h);
+  return (unsigned char *)result;
+}
+
+// map + sniff + decode a single still (first frame for gifs), pixels from
+// allocator (NULL = tracked) under tag
+static unsigned char *LoadStill(const char *filepath, int *w, int *h,
+                                ImageFormat *outFormat,
+                                const ImageAllocator *allocator, PixelTag tag,
+                                PixelFormat pixelFormat) {
+  MappedFile mf;
+  if (!MapFile(filepath, &mf))
+    return NULL;
+
+  int comp;
+  unsigned char *pixels = NULL;
+  ImageFormat format = ImageFormat_Sniff(mf.data, mf.size, filepath);
+  if (format != IMAGE_FORMAT_UNKNOWN) {
+    BeginDecode(allocator, tag);
+    pixels = DecodeSniffed(format, mf.data, mf.size, w, h, &comp,
+                           pixelFormat);
+    EndDecode();
+  }
+
+  UnmapFile(&mf);
+  if (outFormat)
+    *outFormat = format;
+  return pixels;
 }
 
 // Parse EXIF data from JPEG file
@@ -234,84 +519,562 @@ static void ParseExifData(const char *filepath, ExifData *exif) {
   fclose(f);
 }
 
-int ImageLoader_Load(const char *filepath, ImageData *image) {
-  if (!filepath || !image) {
-    strcpy(g_lastError, "Invalid parameters");
+// ---- animated gifs ----
+// frames are decoded one at a time from the mapped file, straight onto one
+// canvas (stb's gif state: lzw tables, canvas, disposal background). a
+// worker keeps a small ring of finished frames ahead of the screen, so
+// memory is a few canvases whatever the frame count.
+//
+// on the first time through, each frame is also recorded as the rectangle
+// that changed since the one before, in 8-bit palette indices when it has
+// 256 colours or less (nearly always - it came from a gif). once the whole
+// loop is recorded the decoder, ring and file all go and frames are
+// composited from the record instead, which also gives random access. too
+// big to record (GIF_STORE_MAX_BYTES) and it just keeps streaming
+
+// one recorded change - rows of w*h indices after a palette of colours
+// entries, or plain rgba when colours is 0. w/h of 0 = same as before
+typedef struct {
+  int x, y, w, h;
+  int colors;
+  unsigned char *data;
+} GifDelta;
+
+struct GifStream {
+  MappedFile file; // stays mapped, frames are decoded straight from it
+  stbi__context ctx;
+  stbi__gif g;
+  ImageAllocator allocator; // the image's, for the ring and stb's buffers
+  PixelFormat pixelFormat;  // the image's. stb's canvas and the record are
+                            // always rgba, frames convert on the way out
+  int width;
+  int height;
+  int frameCount; // from the block scan
+  int nextIndex;  // frame number the decoder produces next
+  RECT drawn;     // area the last decoded frame drew over
+  RECT changed;   // what the last decode changed on the canvas
+
+  // frames decoded ahead, oldest at head - guarded by lock
+  CRITICAL_SECTION lock;
+  CONDITION_VARIABLE wake;
+  unsigned char *slots[GIF_RING_FRAMES];
+  int slotIndex[GIF_RING_FRAMES];
+  RECT slotDirty[GIF_RING_FRAMES]; // what changed since the slot before
+  int head;
+  int count;
+  int quit;
+  int failed;
+  int resident; // record complete, worker gone - guarded by lock
+  HANDLE thread;
+
+  // the record. written by the worker until resident, the ui thread after
+  GifDelta *deltas;
+  int deltaCount;
+  int deltaCap;
+  int *frameDelta;       // frame -> delta that finishes it (shared if equal)
+  int recorded;          // frames recorded so far, -1 = gave up
+  size_t storeBytes;
+  unsigned char *canvas; // last recorded frame, then the playback canvas
+  int applied;           // delta the canvas shows
+};
+
+// length of a run of gif sub-blocks (ends with a zero length byte)
+static int SkipSubBlocks(const unsigned char *data, int size, int pos) {
+  while (pos < size) {
+    int len = data[pos++];
+    if (len == 0)
+      return pos;
+    pos += len;
+  }
+  return size;
+}
+
+// walks the blocks without decoding anything, for the frame count and the
+// delays. the lzw data is just skipped a sub-block at a time
+static int ScanGifFrames(const unsigned char *data, int size, int **outDelays) {
+  *outDelays = NULL;
+  if (size < 13)
     return 0;
+  int pos = 13;
+  if (data[10] & 0x80)
+    pos += 3 * (2 << (data[10] & 7)); // global colour table
+
+  int count = 0, cap = 0, delay = 0;
+  int *delays = NULL;
+  while (pos < size) {
+    int tag = data[pos++];
+    if (tag == 0x21 && pos < size) {
+      int ext = data[pos++];
+      // graphic control: delay in 1/100 s, kept for later frames like stb
+      if (ext == 0xF9 && pos + 4 < size && data[pos] == 4)
+        delay = (data[pos + 2] | (data[pos + 3] << 8)) * 10;
+      pos = SkipSubBlocks(data, size, pos);
+    } else if (tag == 0x2C && pos + 9 <= size) {
+      int lflags = data[pos + 8];
+      pos += 9;
+      if (lflags & 0x80)
+        pos += 3 * (2 << (lflags & 7)); // local colour table
+      pos = SkipSubBlocks(data, size, pos + 1); // +1 lzw code size
+
+      if (count == cap) {
+        cap = cap ? cap * 2 : 64;
+        int *grown = (int *)realloc(delays, sizeof(int) * cap);
+        if (!grown)
+          break;
+        delays = grown;
+      }
+      // browsers treat tiny delays as 100 ms too
+      delays[count++] = delay < 20 ? 100 : delay;
+    } else {
+      break; // 0x3B trailer, or junk
+    }
   }
 
-  // Clear previous image data
-  memset(image, 0, sizeof(ImageData));
+  *outDelays = delays;
+  return count;
+}
+
+static void FreeGifState(GifStream *s) {
+  BeginDecode(&s->allocator, PIXMEM_GIF_FRAMES);
+  StbFree(s->g.out);
+  StbFree(s->g.background);
+  StbFree(s->g.history);
+  EndDecode();
+  memset(&s->g, 0, sizeof(s->g));
+}
 
-  // Check if GIF for animation
-  if (IsGifFile(filepath)) {
-    int fileSize;
-    unsigned char *fileData = LoadFileToMemory(filepath, &fileSize);
-    if (!fileData) {
-      snprintf(g_lastError, sizeof(g_lastError), "Failed to read file");
+// composites the next frame onto the canvas and returns it, going back to
+// the first frame after the last. NULL on a decode error
+static unsigned char *DecodeGifFrame(GifStream *s) {
+  int comp;
+  int fresh = !s->g.out;
+  BeginDecode(&s->allocator, PIXMEM_GIF_FRAMES);
+  // "restore to previous" goes back to the canvas as it was before the
+  // last frame, which stb keeps as the background
+  unsigned char *canvas =
+      stbi__gif_load_next(&s->ctx, &s->g, &comp, 4, s->g.background);
+  EndDecode();
+
+  if (canvas == (unsigned char *)&s->ctx) { // trailer - loop
+    FreeGifState(s);
+    stbi__start_mem(&s->ctx, s->file.data, s->file.size);
+    s->nextIndex = 0;
+    BeginDecode(&s->allocator, PIXMEM_GIF_FRAMES);
+    canvas = stbi__gif_load_next(&s->ctx, &s->g, &comp, 4, NULL);
+    EndDecode();
+    if (canvas == (unsigned char *)&s->ctx)
+      canvas = NULL;
+    fresh = 1;
+  }
+  if (!canvas)
+    return NULL;
+  s->nextIndex++;
+
+  // a frame changes its own rect, and disposing of the one before can
+  // change that one's. a fresh canvas is new everywhere
+  RECT drawn = {s->g.start_x / 4, s->g.start_y / s->g.line_size,
+                s->g.max_x / 4, s->g.max_y / s->g.line_size};
+  if (fresh || !s->g.line_size)
+    SetRect(&s->changed, 0, 0, s->g.w, s->g.h);
+  else
+    UnionRect(&s->changed, &drawn, &s->drawn);
+  s->drawn = drawn;
+  return canvas;
+}
+
+// every frame leaves the stream through here, so bgra costs nothing extra
+static void CopyFrame(const GifStream *s, unsigned char *dst,
+                      const unsigned char *canvas) {
+  size_t count = (size_t)s->width * s->height;
+  if (s->pixelFormat == PIXEL_BGRA)
+    ImageLoader_SwizzleRB(dst, canvas, count);
+  else
+    memcpy(dst, canvas, count * 4);
+}
+
+static void FreeGifRecord(GifStream *s) {
+  const ImageAllocator *a = Allocator(&s->allocator);
+  for (int i = 0; i < s->deltaCount; i++)
+    if (s->deltas[i].data)
+      a->release(a->user, s->deltas[i].data);
+  if (s->canvas)
+    a->release(a->user, s->canvas);
+  free(s->deltas);
+  free(s->frameDelta);
+  s->deltas = NULL;
+  s->deltaCount = s->deltaCap = 0;
+  s->frameDelta = NULL;
+  s->canvas = NULL;
+  s->storeBytes = 0;
+  s->recorded = -1;
+}
+
+// packs the w*h rect at x,y of frame as a palette and indices. 0 if it has
+// more than 256 colours
+static int PackIndexed(GifStream *s, const unsigned int *frame, GifDelta *d) {
+  unsigned int keys[512];
+  short slot[512]; // palette entry per key, -1 = empty
+  unsigned int palette[256];
+  memset(slot, -1, sizeof(slot));
+
+  const ImageAllocator *a = Allocator(&s->allocator);
+  size_t count = (size_t)d->w * d->h;
+  unsigned char *data = (unsigned char *)a->alloc(
+      a->user, sizeof(palette) + count, PIXMEM_GIF_FRAMES);
+  if (!data)
+    return 0;
+
+  unsigned char *indices = data + sizeof(palette);
+  int colors = 0;
+  for (int y = 0; y < d->h; y++) {
+    const unsigned int *row = frame + (size_t)(d->y + y) * s->width + d->x;
+    for (int x = 0; x < d->w; x++) {
+      unsigned int c = row[x];
+      unsigned int h = (c * 2654435761u) >> 23; // 9 bits
+      while (slot[h] >= 0 && keys[h] != c)
+        h = (h + 1) & 511;
+      if (slot[h] < 0) {
+        if (colors == 256) {
+          a->release(a->user, data);
+          return 0;
+        }
+        keys[h] = c;
+        slot[h] = (short)colors;
+        palette[colors++] = c;
+      }
+      *indices++ = (unsigned char)slot[h];
+    }
+  }
+
+  // palette right before the indices, then trim off what it didnt use
+  size_t paletteSize = (size_t)colors * 4;
+  memmove(data + paletteSize, data + sizeof(palette), count);
+  memcpy(data, palette, paletteSize);
+  unsigned char *trimmed = (unsigned char *)a->resize(
+      a->user, data, sizeof(palette) + count, paletteSize + count);
+  d->data = trimmed ? trimmed : data;
+  d->colors = colors;
+  return 1;
+}
+
+static int AddDelta(GifStream *s, const unsigned int *frame, int x, int y,
+                    int w, int h) {
+  if (s->deltaCount == s->deltaCap) {
+    int cap = s->deltaCap ? s->deltaCap * 2 : 64;
+    GifDelta *grown = (GifDelta *)realloc(s->deltas, sizeof(GifDelta) * cap);
+    if (!grown)
       return 0;
+    s->deltas = grown;
+    s->deltaCap = cap;
+  }
+
+  GifDelta *d = &s->deltas[s->deltaCount];
+  d->x = x;
+  d->y = y;
+  d->w = w;
+  d->h = h;
+  if (!PackIndexed(s, frame, d)) {
+    const ImageAllocator *a = Allocator(&s->allocator);
+    d->colors = 0;
+    d->data = (unsigned char *)a->alloc(a->user, (size_t)w * h * 4,
+                                        PIXMEM_GIF_FRAMES);
+    if (!d->data)
+      return 0;
+    for (int row = 0; row < h; row++)
+      memcpy(d->data + (size_t)row * w * 4,
+             frame + (size_t)(y + row) * s->width + x, (size_t)w * 4);
+  }
+
+  s->storeBytes += (size_t)w * h * (d->colors ? 1 : 4) + d->colors * 4;
+  s->deltaCount++;
+  return 1;
+}
+
+// adds frame (composited, rgba) to the record. 1 once the last one is in
+static int RecordGifFrame(GifStream *s, const unsigned char *frame,
+                          int index) {
+  if (s->recorded < 0)
+    return 0;
+  if (index != s->recorded) { // the scan and stb disagree
+    FreeGifRecord(s);
+    return 0;
+  }
+
+  const unsigned int *px = (const unsigned int *)frame;
+  unsigned int *prev = (unsigned int *)s->canvas;
+  int x0 = 0, y0 = 0, x1 = s->width - 1, y1 = s->height - 1;
+
+  if (index > 0) {
+    // bounding box of whatever changed
+    x0 = s->width;
+    y0 = s->height;
+    x1 = y1 = -1;
+    for (int y = 0; y < s->height; y++) {
+      const unsigned int *a = px + (size_t)y * s->width;
+      const unsigned int *b = prev + (size_t)y * s->width;
+      if (!memcmp(a, b, (size_t)s->width * 4))
+        continue;
+      int l = 0, r = s->width - 1;
+      while (a[l] == b[l])
+        l++;
+      while (a[r] == b[r])
+        r--;
+      if (y < y0)
+        y0 = y;
+      y1 = y;
+      if (l < x0)
+        x0 = l;
+      if (r > x1)
+        x1 = r;
     }
+  }
 
-    int *delays = NULL;
-    int width, height, frames, channels;
-
-    unsigned char *gifData = stbi_load_gif_from_memory(
-        fileData, fileSize, &delays, &width, &height, &frames, &channels, 4);
-
-    free(fileData);
-
-    if (gifData && frames > 1) {
-      // Animated GIF
-      image->width = width;
-      image->height = height;
-      image->channels = 4;
-      image->isAnimated = 1;
-      image->frameCount = frames;
-      image->currentFrame = 0;
-
-      // Allocate frame arrays
-      image->frames =
-          (unsigned char **)malloc(sizeof(unsigned char *) * frames);
-      image->frameDelays = (int *)malloc(sizeof(int) * frames);
-
-      int frameSize = width * height * 4;
-      for (int i = 0; i < frames; i++) {
-        image->frames[i] = (unsigned char *)malloc(frameSize);
-        memcpy(image->frames[i], gifData + i * frameSize, frameSize);
-        // GIF delays are in centiseconds, convert to milliseconds
-        image->frameDelays[i] = delays ? (delays[i] * 10) : 100;
-        if (image->frameDelays[i] < 20)
-          image->frameDelays[i] = 100; // Min delay
-      }
+  int ok = 1;
+  if (y1 < 0) {
+    // identical to the frame before - shares its delta
+  } else {
+    int w = x1 - x0 + 1, h = y1 - y0 + 1;
+    size_t budget = PixelMemory_Budget();
+    if (s->storeBytes + (size_t)w * h * 4 > GIF_STORE_MAX_BYTES ||
+        (budget && PixelMemory_Total() + (size_t)w * h * 4 > budget))
+      ok = 0;
+    else
+      ok = AddDelta(s, px, x0, y0, w, h);
+    for (int y = y0; ok && y <= y1; y++)
+      memcpy(prev + (size_t)y * s->width + x0, px + (size_t)y * s->width + x0,
+             (size_t)w * 4);
+  }
+  if (!ok) {
+    FreeGifRecord(s);
+    return 0;
+  }
 
-      // Set current pixels to first frame
-      image->pixels = (unsigned char *)malloc(frameSize);
-      memcpy(image->pixels, image->frames[0], frameSize);
+  s->frameDelta[index] = s->deltaCount - 1;
+  s->applied = s->deltaCount - 1;
+  return ++s->recorded == s->frameCount;
+}
 
-      stbi_image_free(gifData);
-      if (delays)
-        stbi_image_free(delays);
+static void ApplyDelta(GifStream *s, const GifDelta *d) {
+  unsigned int *canvas = (unsigned int *)s->canvas;
+  const unsigned int *palette = (const unsigned int *)d->data;
+  const unsigned char *src = d->data + (size_t)d->colors * 4;
 
-      strncpy(image->filepath, filepath, MAX_PATH - 1);
-      return 1;
+  for (int y = 0; y < d->h; y++) {
+    unsigned int *dst = canvas + (size_t)(d->y + y) * s->width + d->x;
+    if (d->colors) {
+      for (int x = 0; x < d->w; x++)
+        dst[x] = palette[*src++];
+    } else {
+      memcpy(dst, src, (size_t)d->w * 4);
+      src += (size_t)d->w * 4;
     }
+  }
+}
 
-    // Not animated or failed - free and fall through to regular load
-    if (gifData)
-      stbi_image_free(gifData);
-    if (delays)
-      stbi_image_free(delays);
+// brings the playback canvas to frame, adding what changed to dirty.
+// deltas only go forwards, so going back starts again from the first (a
+// full frame)
+static void SeekRecord(GifStream *s, int frame, RECT *dirty) {
+  int target = s->frameDelta[frame];
+  if (target < s->applied)
+    s->applied = -1;
+  while (s->applied < target) {
+    const GifDelta *d = &s->deltas[++s->applied];
+    RECT r = {d->x, d->y, d->x + d->w, d->y + d->h};
+    ApplyDelta(s, d);
+    UnionRect(dirty, dirty, &r);
   }
+}
 
-  // Standard image load
-  image->pixels =
-      stbi_load(filepath, &image->width, &image->height, &image->channels, 4);
+// ui thread, once the worker has finished the record and the ring has
+// drained: everything that was only there for decoding goes
+static void SettleGifStream(ImageData *image) {
+  GifStream *s = image->gif;
+  if (!s->thread)
+    return;
+  WaitForSingleObject(s->thread, INFINITE);
+  CloseHandle(s->thread);
+  s->thread = NULL;
+  for (int i = 0; i < GIF_RING_FRAMES; i++) {
+    ImageLoader_FreePixels(image, s->slots[i]);
+    s->slots[i] = NULL;
+  }
+  s->head = s->count = 0; // anything left in the ring is in the record too
+  FreeGifState(s);
+  UnmapFile(&s->file);
+}
 
-  if (!image->pixels) {
-    snprintf(g_lastError, sizeof(g_lastError), "Failed to load: %s",
-             stbi_failure_reason());
-    return 0;
+static DWORD WINAPI GifWorker(LPVOID param) {
+  GifStream *s = (GifStream *)param;
+
+  for (;;) {
+    EnterCriticalSection(&s->lock);
+    while (!s->quit && s->count == GIF_RING_FRAMES)
+      SleepConditionVariableCS(&s->wake, &s->lock, INFINITE);
+    // the screen only takes ready slots, so this one stays ours
+    int slot = (s->head + s->count) % GIF_RING_FRAMES;
+    int quit = s->quit;
+    LeaveCriticalSection(&s->lock);
+    if (quit)
+      break;
+
+    unsigned char *canvas = DecodeGifFrame(s);
+    int index = s->nextIndex - 1; // after any loop back to the start
+    if (canvas)
+      CopyFrame(s, s->slots[slot], canvas);
+
+    int done = canvas && RecordGifFrame(s, canvas, index);
+
+    EnterCriticalSection(&s->lock);
+    if (canvas) {
+      s->slotIndex[slot] = index < s->frameCount ? index : s->frameCount - 1;
+      s->slotDirty[slot] = s->changed;
+      s->count++;
+    } else {
+      s->failed = 1; // keeps showing what it has
+    }
+    s->resident = done;
+    LeaveCriticalSection(&s->lock);
+    if (!canvas || done)
+      break;
+  }
+  return 0;
+}
+
+static void CloseGifStream(ImageData *image) {
+  GifStream *s = image->gif;
+  if (!s)
+    return;
+
+  if (s->thread) {
+    EnterCriticalSection(&s->lock);
+    s->quit = 1;
+    WakeAllConditionVariable(&s->wake);
+    LeaveCriticalSection(&s->lock);
+    WaitForSingleObject(s->thread, INFINITE);
+    CloseHandle(s->thread);
+  }
+  for (int i = 0; i < GIF_RING_FRAMES; i++)
+    ImageLoader_FreePixels(image, s->slots[i]);
+  FreeGifRecord(s);
+  FreeGifState(s);
+  UnmapFile(&s->file);
+  DeleteCriticalSection(&s->lock);
+  free(s);
+  image->gif = NULL;
+}
+
+// takes over the mapping. decodes the first frame into image->pixels right
+// away, the worker carries on from the second
+static int OpenGifStream(MappedFile *mf, ImageData *image,
+                         ImageLoadContext *ctx) {
+  GifStream *s = (GifStream *)calloc(1, sizeof(GifStream));
+  if (!s) {
+    UnmapFile(mf);
+    return LoadFailed(ctx, "Failed to load", "out of memory");
   }
+  s->file = *mf;
+  s->allocator = image->allocator;
+  s->pixelFormat = image->pixelFormat;
+  s->frameCount = image->frameCount;
+  InitializeCriticalSection(&s->lock);
+  InitializeConditionVariable(&s->wake);
+  stbi__start_mem(&s->ctx, s->file.data, s->file.size);
+  image->gif = s;
+
+  unsigned char *canvas = DecodeGifFrame(s);
+  if (!canvas) {
+    const char *why = stbi_failure_reason();
+    CloseGifStream(image);
+    return LoadFailed(ctx, "Failed to load", why);
+  }
+  s->width = s->g.w;
+  s->height = s->g.h;
+
+  size_t frameSize = (size_t)s->width * s->height * 4;
+  int ok = (image->pixels = ImageLoader_AllocPixels(image, frameSize,
+                                                    PIXMEM_CURRENT)) != NULL;
+  for (int i = 0; ok && i < GIF_RING_FRAMES; i++)
+    ok = (s->slots[i] = ImageLoader_AllocPixels(image, frameSize,
+                                                PIXMEM_GIF_FRAMES)) != NULL;
+  if (ok) {
+    CopyFrame(s, image->pixels, canvas);
+
+    // recording is optional, the stream works without it
+    s->frameDelta = (int *)malloc(sizeof(int) * s->frameCount);
+    s->canvas = ImageLoader_AllocPixels(image, frameSize, PIXMEM_GIF_FRAMES);
+    if (s->frameDelta && s->canvas)
+      RecordGifFrame(s, canvas, 0);
+    else
+      FreeGifRecord(s);
+
+    s->thread = CreateThread(NULL, 0, GifWorker, s, 0, NULL);
+  }
+  if (!ok || !s->thread) {
+    CloseGifStream(image);
+    ImageLoader_FreePixels(image, image->pixels);
+    image->pixels = NULL;
+    return LoadFailed(ctx, "Failed to load", "out of memory");
+  }
+
+  image->width = s->width;
+  image->height = s->height;
+  image->channels = 4;
+  image->isAnimated = 1;
+  image->currentFrame = 0;
+  return 1;
+}
+
+int ImageLoader_Load(const char *filepath, ImageData *image,
+                     ImageLoadContext *ctx) {
+  if (!filepath || !image)
+    return LoadFailed(ctx, "Invalid parameters", NULL);
+
+  // Clear previous image data, keep the caller's allocator
+  memset(image, 0, sizeof(ImageData));
+  if (ctx)
+    image->allocator = ctx->allocator;
+  int flags = ctx ? ctx->flags : 0;
+
+  MappedFile mf;
+  if (!MapFile(filepath, &mf))
+    return LoadFailed(ctx, "Failed to read file", NULL);
+
+  // Decide by content, not by extension
+  ImageFormat format = ImageFormat_Sniff(mf.data, mf.size, filepath);
+  if (format == IMAGE_FORMAT_UNKNOWN) {
+    UnmapFile(&mf);
+    return LoadFailed(ctx, "Unrecognized image format", NULL);
+  }
+  image->format = format;
+  image->pixelFormat = (flags & IMAGE_LOAD_BGRA) ? PIXEL_BGRA : PIXEL_RGBA;
+
+  int frames = 1;
+  if (format == IMAGE_FORMAT_GIF && !(flags & IMAGE_LOAD_FIRST_FRAME))
+    frames = ScanGifFrames(mf.data, mf.size, &image->frameDelays);
+
+  if (frames > 1) {
+    // Animated GIF - streamed, the mapping now belongs to the stream
+    image->frameCount = frames;
+    if (!OpenGifStream(&mf, image, ctx)) {
+      ImageLoader_Free(image);
+      return 0;
+    }
+    strncpy(image->filepath, filepath, MAX_PATH - 1);
+    return 1;
+  } else {
+    free(image->frameDelays);
+    image->frameDelays = NULL;
+    BeginDecode(&image->allocator, PIXMEM_CURRENT);
+    image->pixels =
+        DecodeSniffed(format, mf.data, mf.size, &image->width, &image->height,
+                      &image->channels, image->pixelFormat);
+    EndDecode();
+    UnmapFile(&mf);
+  }
+
+  if (!image->pixels)
+    return LoadFailed(ctx, "Failed to load", stbi_failure_reason());
 
   // no longer keeping original in ram - reset reloads from disk
   image->original = NULL;
@@ -324,8 +1087,9 @@ int ImageLoader_Load(const char *filepath, ImageData *image) {
   image->frameCount = 1;
   image->currentFrame = 0;
 
-  // Parse EXIF data (for JPEGs)
-  ParseExifData(filepath, &image->exif);
+  // Parse EXIF data (only JPEGs carry it)
+  if (format == IMAGE_FORMAT_JPEG && !(flags & IMAGE_LOAD_NO_EXIF))
+    ParseExifData(filepath, &image->exif);
 
   return 1;
 }
@@ -334,38 +1098,23 @@ void ImageLoader_Free(ImageData *image) {
   if (!image)
     return;
 
-  if (image->isAnimated && image->frames) {
-    for (int i = 0; i < image->frameCount; i++) {
-      if (image->frames[i])
-        free(image->frames[i]);
-    }
-    free(image->frames);
-    image->frames = NULL;
-  }
+  // stops the decoder before anything it writes to goes away
+  CloseGifStream(image);
 
   if (image->frameDelays) {
     free(image->frameDelays);
     image->frameDelays = NULL;
   }
 
-  if (image->pixels) {
-    if (!image->isAnimated) {
-      stbi_image_free(image->pixels);
-    } else {
-      free(image->pixels);
-    }
-    image->pixels = NULL;
-  }
+  // every pixel buffer came from the image's allocator, whoever made it
+  ImageLoader_FreePixels(image, image->pixels);
+  image->pixels = NULL;
 
   // Free undo buffers
-  if (image->original) {
-    free(image->original);
-    image->original = NULL;
-  }
-  if (image->undo) {
-    free(image->undo);
-    image->undo = NULL;
-  }
+  ImageLoader_FreePixels(image, image->original);
+  image->original = NULL;
+  ImageLoader_FreePixels(image, image->undo);
+  image->undo = NULL;
 
   image->width = 0;
   image->height = 0;
@@ -376,16 +1125,245 @@ void ImageLoader_Free(ImageData *image) {
   image->currentFrame = 0;
 }
 
-const char *ImageLoader_GetError(void) { return g_lastError; }
+int ImageLoader_ProbeSize(const char *filepath, int *outWidth,
+                          int *outHeight) {
+  MappedFile mf;
+  if (!MapFile(filepath, &mf))
+    return 0;
+
+  // the view is lazy, so only the header pages actually get read
+  int comp, ok = 0;
+  if (ImageFormat_Sniff(mf.data, mf.size, filepath) != IMAGE_FORMAT_UNKNOWN)
+    ok = stbi_info_from_memory(mf.data, mf.size, outWidth, outHeight, &comp);
+
+  UnmapFile(&mf);
+  return ok;
+}
+
+// pnm header number, skipping whitespace and # comments
+static int ReadPnmNumber(FILE *f) {
+  int c = fgetc(f);
+  for (;;) {
+    if (c == '#') {
+      while (c != '\n' && c != EOF)
+        c = fgetc(f);
+    } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+      c = fgetc(f);
+    } else {
+      break;
+    }
+  }
+
+  int value = 0, digits = 0;
+  while (c >= '0' && c <= '9') {
+    // no real header field gets near this - rejecting beats reading the
+    // rest of the number as the next field
+    if (value >= 1000000)
+      return -1;
+    value = value * 10 + (c - '0');
+    digits++;
+    c = fgetc(f);
+  }
+  // exactly one whitespace char ends the last header field, and it has
+  // been read here - so the pixel data starts right after
+  return digits > 0 ? value : -1;
+}
+
+int ImageLoader_OpenRows(const char *filepath, ImageRowReader *reader) {
+  memset(reader, 0, sizeof(ImageRowReader));
+
+  // only binary 8-bit pnm is laid out as plain rows on disk. everything
+  // else is compressed and stb only decodes those in one go
+  FILE *f = fopen(filepath, "rb");
+  if (!f)
+    return 0;
+  int p = fgetc(f), kind = fgetc(f);
+  int channels = 0;
+  if (p == 'P' && kind == '6')
+    channels = 3; // ppm
+  else if (p == 'P' && kind == '5')
+    channels = 1; // pgm
+  int w = channels ? ReadPnmNumber(f) : -1;
+  int h = w > 0 ? ReadPnmNumber(f) : -1;
+  int maxVal = h > 0 ? ReadPnmNumber(f) : -1;
+  if (w <= 0 || h <= 0 || maxVal <= 0 || maxVal > 255 ||
+      (double)w * h * 4 > 0x7FFFFFFF) {
+    fclose(f);
+    return 0;
+  }
+
+  reader->file = f;
+  reader->width = w;
+  reader->height = h;
+  reader->channels = channels;
+  reader->scratch = (unsigned char *)malloc((size_t)w * channels);
+  if (!reader->scratch) {
+    ImageLoader_CloseRows(reader);
+    return 0;
+  }
+  setvbuf(f, NULL, _IOFBF, 256 * 1024);
+  return 1;
+}
+
+int ImageLoader_ReadRows(ImageRowReader *reader, unsigned char *rgba,
+                         int rows) {
+  int w = reader->width;
+  for (int r = 0; r < rows; r++) {
+    if (reader->nextRow >= reader->height ||
+        fread(reader->scratch, reader->channels, w, reader->file) !=
+            (size_t)w)
+      return 0; // truncated file
+
+    const unsigned char *in = reader->scratch;
+    unsigned char *out = rgba + (size_t)r * w * 4;
+    for (int x = 0; x < w; x++) {
+      out[0] = in[0];
+      out[1] = in[reader->channels == 3 ? 1 : 0];
+      out[2] = in[reader->channels == 3 ? 2 : 0];
+      out[3] = 255;
+      in += reader->channels;
+      out += 4;
+    }
+    reader->nextRow++;
+  }
+  return 1;
+}
+
+void ImageLoader_CloseRows(ImageRowReader *reader) {
+  if (reader->file)
+    fclose(reader->file);
+  free(reader->scratch);
+  memset(reader, 0, sizeof(ImageRowReader));
+}
+
+// thumbnail decode - safe to call from worker threads, touches nothing
+// shared. averages each source block into one pixel (box filter)
+unsigned char *ImageLoader_LoadThumbnail(const char *filepath, int maxSize,
+                                         int *outWidth, int *outHeight) {
+  int srcW, srcH;
+  unsigned char *src =
+      LoadStill(filepath, &srcW, &srcH, NULL, NULL, PIXMEM_CACHE, PIXEL_RGBA);
+  if (!src)
+    return NULL;
+
+  // fit inside maxSize x maxSize, never upscale
+  int dstW = srcW, dstH = srcH;
+  if (srcW > maxSize || srcH > maxSize) {
+    if (srcW >= srcH) {
+      dstW = maxSize;
+      dstH = (int)((long long)srcH * maxSize / srcW);
+    } else {
+      dstH = maxSize;
+      dstW = (int)((long long)srcW * maxSize / srcH);
+    }
+    if (dstW < 1)
+      dstW = 1;
+    if (dstH < 1)
+      dstH = 1;
+  }
+
+  unsigned char *dst =
+      (unsigned char *)PixelMemory_Alloc((size_t)dstW * dstH * 4, PIXMEM_CACHE);
+  if (!dst) {
+    PixelMemory_Free(src);
+    return NULL;
+  }
+
+  for (int y = 0; y < dstH; y++) {
+    int sy0 = (int)((long long)y * srcH / dstH);
+    int sy1 = (int)((long long)(y + 1) * srcH / dstH);
+    if (sy1 <= sy0)
+      sy1 = sy0 + 1;
+
+    for (int x = 0; x < dstW; x++) {
+      int sx0 = (int)((long long)x * srcW / dstW);
+      int sx1 = (int)((long long)(x + 1) * srcW / dstW);
+      if (sx1 <= sx0)
+        sx1 = sx0 + 1;
+
+      unsigned int r = 0, g = 0, b = 0, n = 0;
+      for (int sy = sy0; sy < sy1; sy++) {
+        const unsigned char *p = src + ((size_t)sy * srcW + sx0) * 4;
+        for (int sx = sx0; sx < sx1; sx++, p += 4) {
+          r += p[0];
+          g += p[1];
+          b += p[2];
+          n++;
+        }
+      }
+
+      unsigned char *d = dst + ((size_t)y * dstW + x) * 4;
+      d[0] = (unsigned char)(b / n); // B
+      d[1] = (unsigned char)(g / n); // G
+      d[2] = (unsigned char)(r / n); // R
+      d[3] = 255;
+    }
+  }
+
+  PixelMemory_Free(src);
+  *outWidth = dstW;
+  *outHeight = dstH;
+  return dst;
+}
 
 int ImageLoader_NextFrame(ImageData *image) {
-  if (!image || !image->isAnimated || image->frameCount <= 1)
+  if (!image || !image->isAnimated || !image->gif)
     return 0;
 
-  image->currentFrame = (image->currentFrame + 1) % image->frameCount;
-  int frameSize = image->width * image->height * 4;
-  memcpy(image->pixels, image->frames[image->currentFrame], frameSize);
+  // cropped or rotated since - the frames no longer fit
+  GifStream *s = image->gif;
+  if (image->width != s->width || image->height != s->height)
+    return 0;
 
+  // the next frame's buffer becomes the image and the one on screen goes
+  // back to the decoder, so nothing gets copied
+  EnterCriticalSection(&s->lock);
+  int ready = s->count > 0;
+  int resident = s->resident;
+  if (ready) {
+    unsigned char *shown = image->pixels;
+    image->pixels = s->slots[s->head];
+    image->currentFrame = s->slotIndex[s->head];
+    UnionRect(&image->frameDirty, &image->frameDirty, &s->slotDirty[s->head]);
+    s->slots[s->head] = shown;
+    RetagPixels(image, image->pixels, PIXMEM_CURRENT);
+    RetagPixels(image, shown, PIXMEM_GIF_FRAMES);
+    s->head = (s->head + 1) % GIF_RING_FRAMES;
+    s->count--;
+    WakeConditionVariable(&s->wake);
+  }
+  LeaveCriticalSection(&s->lock);
+
+  // ring drained after the worker finished the record - from the record
+  if (!ready && resident)
+    return ImageLoader_SeekFrame(image,
+                                 (image->currentFrame + 1) % image->frameCount);
+  return ready;
+}
+
+int ImageLoader_SeekFrame(ImageData *image, int frame) {
+  if (!image || !image->isAnimated || !image->gif || frame < 0 ||
+      frame >= image->frameCount)
+    return 0;
+
+  GifStream *s = image->gif;
+  if (image->width != s->width || image->height != s->height)
+    return 0;
+
+  EnterCriticalSection(&s->lock);
+  int resident = s->resident;
+  LeaveCriticalSection(&s->lock);
+  if (!resident)
+    return 0;
+
+  SettleGifStream(image);
+  // the deltas are relative to the canvas, which only matches the screen if
+  // the last frame shown came from it too (not the ring)
+  if (s->frameDelta[image->currentFrame] != s->applied)
+    SetRect(&image->frameDirty, 0, 0, s->width, s->height);
+  SeekRecord(s, frame, &image->frameDirty);
+  CopyFrame(s, image->pixels, s->canvas);
+  image->currentFrame = frame;
   return 1;
 }
 
@@ -401,13 +1379,13 @@ void ImageLoader_SaveUndo(ImageData *image) {
 
   int pixelSize = image->width * image->height * 4;
 
-  // Free old undo if exists
-  if (image->undo) {
-    free(image->undo);
-  }
+  // Free old undo if exists. cleared before the alloc below, which can
+  // run the undo evictor when memory is over budget
+  ImageLoader_FreePixels(image, image->undo);
+  image->undo = NULL;
 
   // Copy current state to undo
-  image->undo = (unsigned char *)malloc(pixelSize);
+  image->undo = ImageLoader_AllocPixels(image, pixelSize, PIXMEM_UNDO);
   if (image->undo) {
     memcpy(image->undo, image->pixels, pixelSize);
   }
@@ -421,6 +1399,8 @@ int ImageLoader_Undo(ImageData *image) {
   unsigned char *temp = image->pixels;
   image->pixels = image->undo;
   image->undo = temp;
+  RetagPixels(image, image->pixels, PIXMEM_CURRENT);
+  RetagPixels(image, image->undo, PIXMEM_UNDO);
 
   return 1;
 }
@@ -433,19 +1413,15 @@ int ImageLoader_Reset(ImageData *image) {
   ImageLoader_SaveUndo(image);
 
   // reload from disk (memory efficient - no need to keep original in ram)
-  int w, h, c;
-  unsigned char *fresh = stbi_load(image->filepath, &w, &h, &c, 4);
+  int w, h;
+  unsigned char *fresh =
+      LoadStill(image->filepath, &w, &h, NULL, &image->allocator,
+                PIXMEM_CURRENT, image->pixelFormat);
   if (!fresh)
     return 0;
 
   // free current pixels and replace
-  if (image->pixels) {
-    if (image->isAnimated) {
-      free(image->pixels);
-    } else {
-      stbi_image_free(image->pixels);
-    }
-  }
+  ImageLoader_FreePixels(image, image->pixels);
 
   image->pixels = fresh;
   image->width = w;
@@ -454,74 +1430,87 @@ int ImageLoader_Reset(ImageData *image) {
   return 1;
 }
 
-void ImageLoader_RotateRight(ImageData *image) {
-  if (!image || !image->pixels)
-    return;
-
-  ImageLoader_SaveUndo(image);
+// quarterTurns clockwise: 1 = right, 2 = 180, 3 = left.
+// dst is (h x w) for odd turns, (w x h) for 180
+void ImageLoader_RotateInto(const unsigned char *src, int w, int h,
+                            unsigned char *dst, int quarterTurns) {
+  const unsigned int *in = (const unsigned int *)src;
+  unsigned int *out = (unsigned int *)dst;
+  quarterTurns &= 3;
 
-  int oldW = image->width;
-  int oldH = image->height;
-  int newW = oldH;
-  int newH = oldW;
-
-  unsigned char *newPixels = (unsigned char *)malloc(newW * newH * 4);
-  if (!newPixels)
-    return;
-
-  for (int y = 0; y < oldH; y++) {
-    for (int x = 0; x < oldW; x++) {
-      int srcIdx = (y * oldW + x) * 4;
-      int dstX = oldH - 1 - y;
-      int dstY = x;
-      int dstIdx = (dstY * newW + dstX) * 4;
-
-      newPixels[dstIdx + 0] = image->pixels[srcIdx + 0];
-      newPixels[dstIdx + 1] = image->pixels[srcIdx + 1];
-      newPixels[dstIdx + 2] = image->pixels[srcIdx + 2];
-      newPixels[dstIdx + 3] = image->pixels[srcIdx + 3];
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      int dstIdx;
+      if (quarterTurns == 1)
+        dstIdx = x * h + (h - 1 - y);
+      else if (quarterTurns == 2)
+        dstIdx = (h - 1 - y) * w + (w - 1 - x);
+      else if (quarterTurns == 3)
+        dstIdx = (w - 1 - x) * h + y;
+      else
+        dstIdx = y * w + x;
+      out[dstIdx] = in[y * w + x];
     }
   }
-
-  free(image->pixels);
-  image->pixels = newPixels;
-  image->width = newW;
-  image->height = newH;
 }
 
-void ImageLoader_RotateLeft(ImageData *image) {
+static int RotateImage(ImageData *image, int quarterTurns) {
   if (!image || !image->pixels)
-    return;
+    return 0;
 
   ImageLoader_SaveUndo(image);
 
   int oldW = image->width;
   int oldH = image->height;
-  int newW = oldH;
-  int newH = oldW;
 
-  unsigned char *newPixels = (unsigned char *)malloc(newW * newH * 4);
+  unsigned char *newPixels =
+      ImageLoader_AllocPixels(image, (size_t)oldW * oldH * 4, PIXMEM_CURRENT);
   if (!newPixels)
-    return;
+    return 0;
+  ImageLoader_RotateInto(image->pixels, oldW, oldH, newPixels, quarterTurns);
 
-  for (int y = 0; y < oldH; y++) {
-    for (int x = 0; x < oldW; x++) {
-      int srcIdx = (y * oldW + x) * 4;
-      int dstX = y;
-      int dstY = oldW - 1 - x;
-      int dstIdx = (dstY * newW + dstX) * 4;
-
-      newPixels[dstIdx + 0] = image->pixels[srcIdx + 0];
-      newPixels[dstIdx + 1] = image->pixels[srcIdx + 1];
-      newPixels[dstIdx + 2] = image->pixels[srcIdx + 2];
-      newPixels[dstIdx + 3] = image->pixels[srcIdx + 3];
+  ImageLoader_FreePixels(image, image->pixels);
+  image->pixels = newPixels;
+  image->width = oldH;
+  image->height = oldW;
+  return 1;
+}
+
+int ImageLoader_RotateRight(ImageData *image) { return RotateImage(image, 1); }
+
+int ImageLoader_RotateLeft(ImageData *image) { return RotateImage(image, 3); }
+
+// in place, no undo
+void ImageLoader_FlipPixels(unsigned char *pixels, int w, int h,
+                            int vertical) {
+  if (!vertical) {
+    unsigned int *px = (unsigned int *)pixels;
+    for (int y = 0; y < h; y++) {
+      unsigned int *row = px + y * w;
+      for (int x = 0; x < w / 2; x++) {
+        unsigned int tmp = row[x];
+        row[x] = row[w - 1 - x];
+        row[w - 1 - x] = tmp;
+      }
     }
+    return;
   }
 
-  free(image->pixels);
-  image->pixels = newPixels;
-  image->width = newW;
-  image->height = newH;
+  // swap rows through a small stack buffer, a chunk at a time
+  unsigned char tempRow[4096];
+  int rowSize = w * 4;
+  for (int y = 0; y < h / 2; y++) {
+    unsigned char *topRow = pixels + y * rowSize;
+    unsigned char *bottomRow = pixels + (h - 1 - y) * rowSize;
+    for (int off = 0; off < rowSize; off += (int)sizeof(tempRow)) {
+      int n = rowSize - off;
+      if (n > (int)sizeof(tempRow))
+        n = (int)sizeof(tempRow);
+      memcpy(tempRow, topRow + off, n);
+      memcpy(topRow + off, bottomRow + off, n);
+      memcpy(bottomRow + off, tempRow, n);
+    }
+  }
 }
 
 void ImageLoader_FlipHorizontal(ImageData *image) {
@@ -529,22 +1518,7 @@ void ImageLoader_FlipHorizontal(ImageData *image) {
     return;
 
   ImageLoader_SaveUndo(image);
-
-  int w = image->width;
-  int h = image->height;
-
-  for (int y = 0; y < h; y++) {
-    for (int x = 0; x < w / 2; x++) {
-      int leftIdx = (y * w + x) * 4;
-      int rightIdx = (y * w + (w - 1 - x)) * 4;
-
-      for (int c = 0; c < 4; c++) {
-        unsigned char tmp = image->pixels[leftIdx + c];
-        image->pixels[leftIdx + c] = image->pixels[rightIdx + c];
-        image->pixels[rightIdx + c] = tmp;
-      }
-    }
-  }
+  ImageLoader_FlipPixels(image->pixels, image->width, image->height, 0);
 }
 
 void ImageLoader_FlipVertical(ImageData *image) {
@@ -552,25 +1526,7 @@ void ImageLoader_FlipVertical(ImageData *image) {
     return;
 
   ImageLoader_SaveUndo(image);
-
-  int w = image->width;
-  int h = image->height;
-  int rowSize = w * 4;
-
-  unsigned char *tempRow = (unsigned char *)malloc(rowSize);
-  if (!tempRow)
-    return;
-
-  for (int y = 0; y < h / 2; y++) {
-    unsigned char *topRow = image->pixels + y * rowSize;
-    unsigned char *bottomRow = image->pixels + (h - 1 - y) * rowSize;
-
-    memcpy(tempRow, topRow, rowSize);
-    memcpy(topRow, bottomRow, rowSize);
-    memcpy(bottomRow, tempRow, rowSize);
-  }
-
-  free(tempRow);
+  ImageLoader_FlipPixels(image->pixels, image->width, image->height, 1);
 }
 
 void ImageLoader_AdjustBrightness(ImageData *image, int delta) {
@@ -607,16 +1563,22 @@ void ImageLoader_AdjustContrast(ImageData *image, float factor) {
   }
 }
 
+// where red sits in a pixel, blue is at 2 - that
+static int RedIndex(const ImageData *image) {
+  return image->pixelFormat == PIXEL_BGRA ? 2 : 0;
+}
+
 void ImageLoader_AdjustSaturation(ImageData *image, float factor) {
   if (!image || !image->pixels)
     return;
 
+  int ri = RedIndex(image), bi = 2 - ri;
   int count = image->width * image->height * 4;
   for (int i = 0; i < count; i += 4) {
     // Get RGB
-    float r = image->pixels[i + 0];
+    float r = image->pixels[i + ri];
     float g = image->pixels[i + 1];
-    float b = image->pixels[i + 2];
+    float b = image->pixels[i + bi];
 
     // Calculate luminance
     float gray = 0.299f * r + 0.587f * g + 0.114f * b;
@@ -640,9 +1602,9 @@ void ImageLoader_AdjustSaturation(ImageData *image, float factor) {
     if (b > 255)
       b = 255;
 
-    image->pixels[i + 0] = (unsigned char)r;
+    image->pixels[i + ri] = (unsigned char)r;
     image->pixels[i + 1] = (unsigned char)g;
-    image->pixels[i + 2] = (unsigned char)b;
+    image->pixels[i + bi] = (unsigned char)b;
   }
 }
 
@@ -650,11 +1612,12 @@ void ImageLoader_Grayscale(ImageData *image) {
   if (!image || !image->pixels)
     return;
 
+  int ri = RedIndex(image), bi = 2 - ri;
   int count = image->width * image->height * 4;
   for (int i = 0; i < count; i += 4) {
-    float r = image->pixels[i + 0];
+    float r = image->pixels[i + ri];
     float g = image->pixels[i + 1];
-    float b = image->pixels[i + 2];
+    float b = image->pixels[i + bi];
 
     unsigned char gray = (unsigned char)(0.299f * r + 0.587f * g + 0.114f * b);
 
@@ -664,9 +1627,17 @@ void ImageLoader_Grayscale(ImageData *image) {
   }
 }
 
-void ImageLoader_Crop(ImageData *image, int x, int y, int w, int h) {
+// rect must already be inside the source
+void ImageLoader_CropInto(const unsigned char *src, int srcW, int x, int y,
+                          int w, int h, unsigned char *dst) {
+  for (int row = 0; row < h; row++)
+    memcpy(dst + (size_t)row * w * 4, src + ((size_t)(y + row) * srcW + x) * 4,
+           (size_t)w * 4);
+}
+
+int ImageLoader_Crop(ImageData *image, int x, int y, int w, int h) {
   if (!image || !image->pixels)
-    return;
+    return 0;
 
   // Validate bounds
   if (x < 0)
@@ -678,25 +1649,22 @@ void ImageLoader_Crop(ImageData *image, int x, int y, int w, int h) {
   if (y + h > image->height)
     h = image->height - y;
   if (w <= 0 || h <= 0)
-    return;
+    return 0;
 
   // Allocate new buffer
-  unsigned char *newPixels = (unsigned char *)malloc(w * h * 4);
+  unsigned char *newPixels =
+      ImageLoader_AllocPixels(image, (size_t)w * h * 4, PIXMEM_CURRENT);
   if (!newPixels)
-    return;
+    return 0;
 
-  // Copy cropped region
-  for (int row = 0; row < h; row++) {
-    unsigned char *src = image->pixels + ((y + row) * image->width + x) * 4;
-    unsigned char *dst = newPixels + row * w * 4;
-    memcpy(dst, src, w * 4);
-  }
+  ImageLoader_CropInto(image->pixels, image->width, x, y, w, h, newPixels);
 
   // Replace old pixels
-  free(image->pixels);
+  ImageLoader_FreePixels(image, image->pixels);
   image->pixels = newPixels;
   image->width = w;
   image->height = h;
+  return 1;
 }
 
 void ImageLoader_Invert(ImageData *image) {
@@ -715,7 +1683,9 @@ void ImageLoader_Resize(ImageData *image, int newWidth, int newHeight) {
   if (!image || !image->pixels || newWidth <= 0 || newHeight <= 0)
     return;
 
-  unsigned char *newPixels = (unsigned char *)malloc(newWidth * newHeight * 4);
+  unsigned char *newPixels =
+      ImageLoader_AllocPixels(image, (size_t)newWidth * newHeight * 4,
+                              PIXMEM_CURRENT);
   if (!newPixels)
     return;
 
@@ -747,7 +1717,7 @@ void ImageLoader_Resize(ImageData *image, int newWidth, int newHeight) {
     }
   }
 
-  free(image->pixels);
+  ImageLoader_FreePixels(image, image->pixels);
   image->pixels = newPixels;
   image->width = newWidth;
   image->height = newHeight;
@@ -774,27 +1744,37 @@ static int clamp_int(int v, int lo, int hi) {
   return v;
 }
 
-// lanczos-3 resize - photoshop quality
-void ImageLoader_ResizeLanczos(ImageData *image, int newWidth, int newHeight) {
-  if (!image || !image->pixels || newWidth <= 0 || newHeight <= 0)
-    return;
+// source row a lanczos-3 tap lands on (before clamping)
+static int LanczosCenterRow(int y, int srcH, int newHeight) {
+  double srcY = (y + 0.5) * ((double)srcH / newHeight) - 0.5;
+  return (int)floor(srcY);
+}
 
-  int a = 3; // lanczos-3 uses 3-tap kernel
-  int srcW = image->width;
-  int srcH = image->height;
+void ImageLoader_LanczosSourceRows(int srcH, int dstH, int firstRow,
+                                   int lastRow, int *srcFirst, int *srcLast) {
+  *srcFirst = clamp_int(LanczosCenterRow(firstRow, srcH, dstH) - 2, 0,
+                        srcH - 1);
+  *srcLast = clamp_int(LanczosCenterRow(lastRow, srcH, dstH) + 3, 0,
+                       srcH - 1);
+}
 
-  unsigned char *newPixels = (unsigned char *)malloc(newWidth * newHeight * 4);
-  if (!newPixels)
-    return;
+// lanczos-3 resize - photoshop quality
+void ImageLoader_ResizeLanczosRows(const unsigned char *src, int srcW,
+                                   int srcH, int srcFirst, unsigned char *dst,
+                                   int newWidth, int newHeight, int firstRow,
+                                   int rowCount) {
+  int a = 3; // lanczos-3 uses 3-tap kernel
 
   double xRatio = (double)srcW / newWidth;
   double yRatio = (double)srcH / newHeight;
 
 // parallelize across rows for multi-core speedup
 #pragma omp parallel for schedule(dynamic)
-  for (int y = 0; y < newHeight; y++) {
+  for (int row = 0; row < rowCount; row++) {
+    int y = firstRow + row;
     double srcY = (y + 0.5) * yRatio - 0.5;
     int y0 = (int)floor(srcY);
+    unsigned char *newPixels = dst + (size_t)row * newWidth * 4;
 
     for (int x = 0; x < newWidth; x++) {
       double srcX = (x + 0.5) * xRatio - 0.5;
@@ -805,7 +1785,7 @@ void ImageLoader_ResizeLanczos(ImageData *image, int newWidth, int newHeight) {
 
       // sample neighborhood
       for (int j = -a + 1; j <= a; j++) {
-        int py = clamp_int(y0 + j, 0, srcH - 1);
+        int py = clamp_int(y0 + j, 0, srcH - 1) - srcFirst;
         double wy = lanczos_kernel(srcY - (y0 + j), a);
 
         for (int i = -a + 1; i <= a; i++) {
@@ -813,17 +1793,17 @@ void ImageLoader_ResizeLanczos(ImageData *image, int newWidth, int newHeight) {
           double wx = lanczos_kernel(srcX - (x0 + i), a);
           double w = wx * wy;
 
-          int idx = (py * srcW + px) * 4;
-          r += image->pixels[idx + 0] * w;
-          g += image->pixels[idx + 1] * w;
-          b += image->pixels[idx + 2] * w;
-          alpha += image->pixels[idx + 3] * w;
+          size_t idx = ((size_t)py * srcW + px) * 4;
+          r += src[idx + 0] * w;
+          g += src[idx + 1] * w;
+          b += src[idx + 2] * w;
+          alpha += src[idx + 3] * w;
           weightSum += w;
         }
       }
 
       // normalize and clamp
-      int dstIdx = (y * newWidth + x) * 4;
+      int dstIdx = x * 4;
       if (weightSum > 0) {
         newPixels[dstIdx + 0] =
             (unsigned char)clamp_int((int)(r / weightSum + 0.5), 0, 255);
@@ -841,56 +1821,62 @@ void ImageLoader_ResizeLanczos(ImageData *image, int newWidth, int newHeight) {
       }
     }
   }
+}
+
+void ImageLoader_ResizeLanczosInto(const unsigned char *src, int srcW,
+                                   int srcH, unsigned char *dst, int newWidth,
+                                   int newHeight) {
+  ImageLoader_ResizeLanczosRows(src, srcW, srcH, 0, dst, newWidth, newHeight,
+                                0, newHeight);
+}
+
+int ImageLoader_ResizeLanczos(ImageData *image, int newWidth, int newHeight) {
+  if (!image || !image->pixels || newWidth <= 0 || newHeight <= 0)
+    return 0;
+
+  unsigned char *newPixels =
+      ImageLoader_AllocPixels(image, (size_t)newWidth * newHeight * 4,
+                              PIXMEM_CURRENT);
+  if (!newPixels)
+    return 0;
 
-  free(image->pixels);
+  ImageLoader_ResizeLanczosInto(image->pixels, image->width, image->height,
+                                newPixels, newWidth, newHeight);
+
+  ImageLoader_FreePixels(image, image->pixels);
   image->pixels = newPixels;
   image->width = newWidth;
   image->height = newHeight;
+  return 1;
 }
 
-void ImageLoader_Sharpen(ImageData *image) {
-  if (!image || !image->pixels)
-    return;
-
-  int w = image->width;
-  int h = image->height;
-  unsigned char *newPixels = (unsigned char *)malloc(w * h * 4);
-  if (!newPixels)
-    return;
-  memcpy(newPixels, image->pixels, w * h * 4);
+void ImageLoader_SharpenInto(const unsigned char *src, int w, int h,
+                             unsigned char *dst) {
+  // edges and alpha are kept as they are
+  memcpy(dst, src, (size_t)w * h * 4);
 
   // Sharpen kernel: 0 -1 0 / -1 5 -1 / 0 -1 0
   for (int y = 1; y < h - 1; y++) {
     for (int x = 1; x < w - 1; x++) {
       for (int c = 0; c < 3; c++) {
-        int val = image->pixels[((y)*w + x) * 4 + c] * 5 -
-                  image->pixels[((y - 1) * w + x) * 4 + c] -
-                  image->pixels[((y + 1) * w + x) * 4 + c] -
-                  image->pixels[((y)*w + x - 1) * 4 + c] -
-                  image->pixels[((y)*w + x + 1) * 4 + c];
+        int val = src[((y)*w + x) * 4 + c] * 5 -
+                  src[((y - 1) * w + x) * 4 + c] -
+                  src[((y + 1) * w + x) * 4 + c] -
+                  src[((y)*w + x - 1) * 4 + c] -
+                  src[((y)*w + x + 1) * 4 + c];
         if (val < 0)
           val = 0;
         if (val > 255)
           val = 255;
-        newPixels[(y * w + x) * 4 + c] = (unsigned char)val;
+        dst[(y * w + x) * 4 + c] = (unsigned char)val;
       }
     }
   }
-
-  free(image->pixels);
-  image->pixels = newPixels;
 }
 
-void ImageLoader_Blur(ImageData *image) {
-  if (!image || !image->pixels)
-    return;
-
-  int w = image->width;
-  int h = image->height;
-  unsigned char *newPixels = (unsigned char *)malloc(w * h * 4);
-  if (!newPixels)
-    return;
-  memcpy(newPixels, image->pixels, w * h * 4);
+void ImageLoader_BlurInto(const unsigned char *src, int w, int h,
+                          unsigned char *dst) {
+  memcpy(dst, src, (size_t)w * h * 4);
 
   // 3x3 box blur
   for (int y = 1; y < h - 1; y++) {
@@ -899,16 +1885,41 @@ void ImageLoader_Blur(ImageData *image) {
         int sum = 0;
         for (int dy = -1; dy <= 1; dy++) {
           for (int dx = -1; dx <= 1; dx++) {
-            sum += image->pixels[((y + dy) * w + (x + dx)) * 4 + c];
+            sum += src[((y + dy) * w + (x + dx)) * 4 + c];
           }
         }
-        newPixels[(y * w + x) * 4 + c] = (unsigned char)(sum / 9);
+        dst[(y * w + x) * 4 + c] = (unsigned char)(sum / 9);
       }
     }
   }
+}
+
+// runs a same-size buffer kernel on an image, swapping in the result
+static int FilterImage(ImageData *image,
+                       void (*kernel)(const unsigned char *, int, int,
+                                      unsigned char *)) {
+  if (!image || !image->pixels)
+    return 0;
 
-  free(image->pixels);
+  int w = image->width;
+  int h = image->height;
+  unsigned char *newPixels =
+      ImageLoader_AllocPixels(image, (size_t)w * h * 4, PIXMEM_CURRENT);
+  if (!newPixels)
+    return 0;
+  kernel(image->pixels, w, h, newPixels);
+
+  ImageLoader_FreePixels(image, image->pixels);
   image->pixels = newPixels;
+  return 1;
+}
+
+int ImageLoader_Sharpen(ImageData *image) {
+  return FilterImage(image, ImageLoader_SharpenInto);
+}
+
+int ImageLoader_Blur(ImageData *image) {
+  return FilterImage(image, ImageLoader_BlurInto);
 }
 
 void ImageLoader_AutoLevels(ImageData *image) {
@@ -955,18 +1966,19 @@ void ImageLoader_Sepia(ImageData *image) {
   if (!image || !image->pixels)
     return;
 
+  int ri = RedIndex(image), bi = 2 - ri;
   int count = image->width * image->height * 4;
   for (int i = 0; i < count; i += 4) {
-    int r = image->pixels[i + 0];
+    int r = image->pixels[i + ri];
     int g = image->pixels[i + 1];
-    int b = image->pixels[i + 2];
+    int b = image->pixels[i + bi];
 
     int newR = (int)(r * 0.393f + g * 0.769f + b * 0.189f);
     int newG = (int)(r * 0.349f + g * 0.686f + b * 0.168f);
     int newB = (int)(r * 0.272f + g * 0.534f + b * 0.131f);
 
-    image->pixels[i + 0] = (unsigned char)(newR > 255 ? 255 : newR);
+    image->pixels[i + ri] = (unsigned char)(newR > 255 ? 255 : newR);
     image->pixels[i + 1] = (unsigned char)(newG > 255 ? 255 : newG);
-    image->pixels[i + 2] = (unsigned char)(newB > 255 ? 255 : newB);
+    image->pixels[i + bi] = (unsigned char)(newB > 255 ? 255 : newB);
   }
 }
@@ -4,11 +4,16 @@
 #ifndef IMAGE_LOADER_H
 #define IMAGE_LOADER_H
 
+#include "image_format.h"
+#include "pixel_memory.h"
 #include <stdio.h>
 #include <windows.h>
 
 // gif stuff
-#define MAX_GIF_FRAMES 500
+#define GIF_RING_FRAMES 4 // frames decoded ahead of the one on screen
+#define GIF_STORE_MAX_BYTES (64 * 1024 * 1024) // recorded frames, see .c
+
+typedef struct GifStream GifStream; // image_loader.c
 
 // EXIF metadata from camera
 typedef struct {
@@ -21,14 +26,45 @@ typedef struct {
   int hasExif;          // 1 if exif data was found
 } ExifData;
 
+// where pixel buffers come from - set alloc, resize and release or none
+// (all zero means the tracked pixel_memory.c allocator). resize gets the
+// old size for allocators that track bytes, retag is optional
+typedef struct {
+  void *(*alloc)(void *user, size_t size, PixelTag tag);
+  void *(*resize)(void *user, void *ptr, size_t oldSize, size_t newSize);
+  void (*release)(void *user, void *ptr);
+  void (*retag)(void *user, void *ptr, PixelTag tag);
+  void *user;
+} ImageAllocator;
+
+#define IMAGE_LOAD_FIRST_FRAME 0x1 // animated gifs load as a still
+#define IMAGE_LOAD_NO_EXIF 0x2     // skip the exif parse
+#define IMAGE_LOAD_BGRA 0x4        // pixels in dib order, see PixelFormat
+
+// byte order of a pixel. bgra is what gdi wants, so the viewer loads that
+// and the display never has to convert - the writers and batch stick to
+// rgba. kernels that care (anything weighing r/g/b) go by image->pixelFormat
+typedef enum { PIXEL_RGBA, PIXEL_BGRA } PixelFormat;
+
+// everything one load call needs, so loads never share state - any number
+// of threads can decode at once, each with its own context.
+// zeroed = tracked allocator, no flags
+typedef struct {
+  ImageAllocator allocator; // the decoded image (and stb's scratch) use this
+  int flags;                // IMAGE_LOAD_*
+  char error[256];          // why the last load on this context failed
+} ImageLoadContext;
+
 // main image data struct
 typedef struct {
-  unsigned char *pixels;   // current frame rgba data
+  unsigned char *pixels;   // current frame, 4 bytes a pixel in pixelFormat
   unsigned char *original; // original from disk for reset
   unsigned char *undo;     // previous state for ctrl+z
   int width;
   int height;
   int channels;
+  ImageFormat format; // sniffed from the file contents
+  PixelFormat pixelFormat; // pixels, undo and original are all in this
   char filepath[MAX_PATH];
 
   // EXIF metadata
@@ -38,23 +74,51 @@ typedef struct {
   int isAnimated;
   int frameCount;
   int currentFrame;
-  int *frameDelays;       // delay per frame in ms
-  unsigned char **frames; // frame pixel data array
+  int *frameDelays; // delay per frame in ms
+  GifStream *gif;   // decodes the frames as they come up
+  RECT frameDirty;  // changed by frame steps since the display last caught up
+
+  // pixels, frames and undo all come from (and go back to) this
+  ImageAllocator allocator;
 } ImageData;
 
-// loading
-int ImageLoader_Load(const char *filepath, ImageData *image);
+// loading - ctx can be NULL for the defaults and no error text
+int ImageLoader_Load(const char *filepath, ImageData *image,
+                     ImageLoadContext *ctx);
 void ImageLoader_Free(ImageData *image);
-const char *ImageLoader_GetError(void);
 
-// transforms
-void ImageLoader_RotateRight(ImageData *image);
-void ImageLoader_RotateLeft(ImageData *image);
+// a pixel buffer from / back to the image's allocator - anything that ends
+// up in image->pixels has to come from here
+unsigned char *ImageLoader_AllocPixels(const ImageData *image, size_t size,
+                                       PixelTag tag);
+void ImageLoader_FreePixels(const ImageData *image, void *pixels);
+
+// swaps r and b (sse2), dst can be src. rgba <-> bgra either way
+void ImageLoader_SwizzleRB(unsigned char *dst, const unsigned char *src,
+                           size_t pixels);
+// converts just the pixels in place (not undo) - for handing an image to
+// the rgba writers, so set it back straight after
+void ImageLoader_SetPixelFormat(ImageData *image, PixelFormat format);
+
+// header-only probe, no pixels decoded - thread safe
+int ImageLoader_ProbeSize(const char *filepath, int *outWidth, int *outHeight);
+
+// thumbnails - decodes and box-filters down to fit maxSize
+// returns bgra (dib order) pixels, release with PixelMemory_Free()
+unsigned char *ImageLoader_LoadThumbnail(const char *filepath, int maxSize,
+                                         int *outWidth, int *outHeight);
+
+// transforms. the ones that need a new buffer return 0 if there wasnt
+// memory for it, and leave the image as it was
+int ImageLoader_RotateRight(ImageData *image);
+int ImageLoader_RotateLeft(ImageData *image);
 void ImageLoader_FlipHorizontal(ImageData *image);
 void ImageLoader_FlipVertical(ImageData *image);
 
 // gif animation
-int ImageLoader_NextFrame(ImageData *image);
+int ImageLoader_NextFrame(ImageData *image); // 0 = not ready yet, try later
+// any frame, once the first loop has been recorded (0 before that)
+int ImageLoader_SeekFrame(ImageData *image, int frame);
 int ImageLoader_GetFrameDelay(ImageData *image);
 
 // undo system
@@ -62,18 +126,62 @@ void ImageLoader_SaveUndo(ImageData *image);
 int ImageLoader_Undo(ImageData *image);
 int ImageLoader_Reset(ImageData *image);
 
-// editing
+// editing. crop, resize, sharpen and blur return 0 (image untouched) if
+// the result couldnt be allocated or the crop was empty
 void ImageLoader_AdjustBrightness(ImageData *image, int delta);
 void ImageLoader_AdjustContrast(ImageData *image, float factor);
 void ImageLoader_AdjustSaturation(ImageData *image, float factor);
 void ImageLoader_Grayscale(ImageData *image);
-void ImageLoader_Crop(ImageData *image, int x, int y, int w, int h);
+int ImageLoader_Crop(ImageData *image, int x, int y, int w, int h);
 void ImageLoader_Invert(ImageData *image);
 void ImageLoader_Resize(ImageData *image, int newWidth, int newHeight);
-void ImageLoader_ResizeLanczos(ImageData *image, int newWidth, int newHeight);
-void ImageLoader_Sharpen(ImageData *image);
-void ImageLoader_Blur(ImageData *image);
+int ImageLoader_ResizeLanczos(ImageData *image, int newWidth, int newHeight);
+int ImageLoader_Sharpen(ImageData *image);
+int ImageLoader_Blur(ImageData *image);
 void ImageLoader_AutoLevels(ImageData *image);
 void ImageLoader_Sepia(ImageData *image);
 
+// buffer kernels - write into dst (caller owned, never src), no undo,
+// no allocation. the ImageData versions above are wrappers around these.
+// none of them care which channel is which, rgba and bgra both work
+void ImageLoader_ResizeLanczosInto(const unsigned char *src, int srcW,
+                                   int srcH, unsigned char *dst, int dstW,
+                                   int dstH);
+void ImageLoader_RotateInto(const unsigned char *src, int w, int h,
+                            unsigned char *dst, int quarterTurns);
+void ImageLoader_CropInto(const unsigned char *src, int srcW, int x, int y,
+                          int w, int h, unsigned char *dst);
+void ImageLoader_SharpenInto(const unsigned char *src, int w, int h,
+                             unsigned char *dst);
+void ImageLoader_BlurInto(const unsigned char *src, int w, int h,
+                          unsigned char *dst);
+void ImageLoader_FlipPixels(unsigned char *pixels, int w, int h, int vertical);
+
+// row band lanczos: output rows [firstRow, firstRow + rowCount) into dst.
+// src only has to hold source rows srcFirst.. as given by
+// LanczosSourceRows for the same output rows
+void ImageLoader_ResizeLanczosRows(const unsigned char *src, int srcW,
+                                   int srcH, int srcFirst, unsigned char *dst,
+                                   int dstW, int dstH, int firstRow,
+                                   int rowCount);
+void ImageLoader_LanczosSourceRows(int srcH, int dstH, int firstRow,
+                                   int lastRow, int *srcFirst, int *srcLast);
+
+// reads rgba rows straight off disk without decoding the whole image.
+// only formats stored as plain rows can do this (8-bit binary pnm), for
+// the rest OpenRows returns 0 and they go through ImageLoader_Load
+typedef struct {
+  FILE *file;
+  int width;
+  int height;
+  int channels; // on disk, 1 or 3
+  int nextRow;
+  unsigned char *scratch; // one row as stored
+} ImageRowReader;
+
+int ImageLoader_OpenRows(const char *filepath, ImageRowReader *reader);
+int ImageLoader_ReadRows(ImageRowReader *reader, unsigned char *rgba,
+                         int rows);
+void ImageLoader_CloseRows(ImageRowReader *reader);
+
 #endif
@@ -0,0 +1,721 @@
+/*
+ * Image Ops - Implementation
+ * pix - operation chains for batch mode
+ */
+
+#include "image_ops.h"
+#include "../lib/stb_image_write.h"
+#include "jpeg_writer.h"
+#include "png_writer.h"
+#include "settings.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *g_opNames[IMAGE_OP_COUNT] = {
+    "fit",     "resize", "scale",     "crop",  "rotate",
+    "flip",    "levels", "sharpen",   "blur",  "grayscale",
+    "sepia",   "invert", "brightness", "contrast", "saturation",
+};
+
+static void SetError(char *error, size_t size, const char *fmt,
+                     const char *arg) {
+  if (error && size > 0)
+    snprintf(error, size, fmt, arg);
+}
+
+// "1920x1080" - either side may be 0 for resize
+static int ParseSize(const char *s, int *w, int *h) {
+  char x;
+  return s && sscanf(s, "%d%c%d", w, &x, h) == 3 && (x == 'x' || x == 'X') &&
+         *w >= 0 && *h >= 0 && (*w > 0 || *h > 0);
+}
+
+static int ParseOp(char **tok, int n, ImageOpList *list, char *error,
+                   size_t errorSize) {
+  // names and arguments alike are case insensitive ("Flip H", "format PNG")
+  for (int i = 0; i < n; i++) {
+    for (char *p = tok[i]; *p; p++)
+      *p = (char)tolower((unsigned char)*p);
+  }
+
+  // format isnt a pixel op, it just picks the encoder
+  if (strcmp(tok[0], "format") == 0) {
+    char ext[16];
+    snprintf(ext, sizeof(ext), ".%s", n > 1 ? tok[1] : "");
+    ImageFormat f = ImageFormat_FromExtension(ext);
+    if (f != IMAGE_FORMAT_PNG && f != IMAGE_FORMAT_JPEG &&
+        f != IMAGE_FORMAT_BMP) {
+      SetError(error, errorSize, "format must be png, jpg or bmp: %s",
+               n > 1 ? tok[1] : "");
+      return 0;
+    }
+    list->outputFormat = f;
+    if (n > 2 && f == IMAGE_FORMAT_PNG) {
+      int level = PngWriter_LevelFromName(tok[2]);
+      if (level < 0) {
+        SetError(error, errorSize,
+                 "png level must be fast, default or small: %s", tok[2]);
+        return 0;
+      }
+      list->pngLevel = (PngLevel)level;
+    } else if (n > 2) {
+      list->quality = atoi(tok[2]);
+      if (list->quality < 1 || list->quality > 100) {
+        SetError(error, errorSize, "jpeg quality must be 1-100: %s", tok[2]);
+        return 0;
+      }
+    }
+    if (n > 3 && f == IMAGE_FORMAT_JPEG) {
+      int subsample = JpegWriter_SubsampleFromName(tok[3]);
+      if (subsample < 0) {
+        SetError(error, errorSize, "jpeg chroma must be 420, 422 or 444: %s",
+                 tok[3]);
+        return 0;
+      }
+      list->jpegSubsample = (JpegSubsample)subsample;
+    }
+    return 1;
+  }
+
+  int type = -1;
+  for (int i = 0; i < IMAGE_OP_COUNT; i++) {
+    if (strcmp(tok[0], g_opNames[i]) == 0)
+      type = i;
+  }
+  if (type < 0) {
+    SetError(error, errorSize, "unknown op: %s", tok[0]);
+    return 0;
+  }
+  if (list->count >= IMAGE_OPS_MAX) {
+    SetError(error, errorSize, "too many ops (%s)", tok[0]);
+    return 0;
+  }
+
+  ImageOp op;
+  memset(&op, 0, sizeof(op));
+  op.type = (ImageOpType)type;
+  int ok = 1;
+
+  switch (op.type) {
+  case IMAGE_OP_FIT:
+    ok = n == 2 && ParseSize(tok[1], &op.args[0], &op.args[1]) &&
+         op.args[0] > 0 && op.args[1] > 0;
+    break;
+  case IMAGE_OP_RESIZE:
+    ok = n == 2 && ParseSize(tok[1], &op.args[0], &op.args[1]);
+    break;
+  case IMAGE_OP_SCALE:
+    op.value = n == 2 ? (float)atof(tok[1]) : 0;
+    ok = op.value > 0 && op.value <= 64;
+    break;
+  case IMAGE_OP_CROP:
+    ok = n == 5;
+    for (int i = 0; ok && i < 4; i++)
+      op.args[i] = atoi(tok[i + 1]);
+    ok = ok && op.args[0] >= 0 && op.args[1] >= 0 && op.args[2] > 0 &&
+         op.args[3] > 0;
+    break;
+  case IMAGE_OP_ROTATE: {
+    int deg = n == 2 ? atoi(tok[1]) : 0;
+    deg = ((deg % 360) + 360) % 360;
+    op.args[0] = deg / 90; // quarter turns clockwise
+    ok = n == 2 && deg % 90 == 0 && deg != 0;
+    break;
+  }
+  case IMAGE_OP_FLIP:
+    ok = n == 2 && (tok[1][0] == 'h' || tok[1][0] == 'v') && !tok[1][1];
+    op.args[0] = ok && tok[1][0] == 'v';
+    break;
+  case IMAGE_OP_BRIGHTNESS:
+    op.args[0] = n == 2 ? atoi(tok[1]) : 0;
+    ok = n == 2 && op.args[0] >= -255 && op.args[0] <= 255;
+    break;
+  case IMAGE_OP_CONTRAST:
+  case IMAGE_OP_SATURATION:
+    op.value = n == 2 ? (float)atof(tok[1]) : -1;
+    ok = op.value >= 0 && op.value <= 10;
+    break;
+  default:
+    ok = (n == 1); // no arguments
+    break;
+  }
+
+  if (!ok) {
+    SetError(error, errorSize, "bad arguments for %s", g_opNames[op.type]);
+    return 0;
+  }
+  list->ops[list->count++] = op;
+  return 1;
+}
+
+int ImageOps_Parse(const char *text, ImageOpList *list, char *error,
+                   size_t errorSize) {
+  ImageOps_Clear(list);
+  if (error && errorSize > 0)
+    error[0] = '\0';
+
+  const char *p = text ? text : "";
+  while (*p) {
+    // one op per ; or line
+    size_t len = strcspn(p, ";\r\n");
+    char segment[256];
+    if (len >= sizeof(segment)) {
+      SetError(error, errorSize, "op too long: %s", "");
+      return 0;
+    }
+    memcpy(segment, p, len);
+    segment[len] = '\0';
+    p += len;
+    if (*p)
+      p++;
+
+    // # starts a comment (ops files)
+    char *hash = strchr(segment, '#');
+    if (hash)
+      *hash = '\0';
+
+    char *tok[8];
+    int n = 0;
+    for (char *t = strtok(segment, " \t"); t && n < 8; t = strtok(NULL, " \t"))
+      tok[n++] = t;
+    if (n == 0)
+      continue;
+    if (!ParseOp(tok, n, list, error, errorSize))
+      return 0;
+  }
+
+  char canonical[IMAGE_OPS_TEXT_MAX];
+  if (!ImageOps_Format(list, canonical, sizeof(canonical))) {
+    SetError(error, errorSize, "ops list too long%s", "");
+    return 0;
+  }
+  return 1;
+}
+
+// one op as text, e.g. "crop 10 10 640 480"
+static void FormatOp(const ImageOp *op, char *buffer, size_t size) {
+  char args[64] = {0};
+  switch (op->type) {
+  case IMAGE_OP_FIT:
+  case IMAGE_OP_RESIZE:
+    snprintf(args, sizeof(args), " %dx%d", op->args[0], op->args[1]);
+    break;
+  case IMAGE_OP_SCALE:
+  case IMAGE_OP_CONTRAST:
+  case IMAGE_OP_SATURATION:
+    snprintf(args, sizeof(args), " %g", op->value);
+    break;
+  case IMAGE_OP_CROP:
+    snprintf(args, sizeof(args), " %d %d %d %d", op->args[0], op->args[1],
+             op->args[2], op->args[3]);
+    break;
+  case IMAGE_OP_ROTATE:
+    snprintf(args, sizeof(args), " %d", op->args[0] * 90);
+    break;
+  case IMAGE_OP_FLIP:
+    snprintf(args, sizeof(args), " %c", op->args[0] ? 'v' : 'h');
+    break;
+  case IMAGE_OP_BRIGHTNESS:
+    snprintf(args, sizeof(args), " %d", op->args[0]);
+    break;
+  default:
+    break;
+  }
+  snprintf(buffer, size, "%s%s", g_opNames[op->type], args);
+}
+
+static void FormatOutput(const ImageOpList *list, char *buffer, size_t size) {
+  const ImageFormatInfo *info = ImageFormat_Get(list->outputFormat);
+  if (list->outputFormat == IMAGE_FORMAT_JPEG &&
+      list->jpegSubsample != JPEG_SUBSAMPLE_420)
+    snprintf(buffer, size, "format jpg %d %s", list->quality,
+             JpegWriter_SubsampleName(list->jpegSubsample));
+  else if (list->outputFormat == IMAGE_FORMAT_JPEG)
+    snprintf(buffer, size, "format jpg %d", list->quality);
+  else if (list->outputFormat == IMAGE_FORMAT_PNG &&
+           list->pngLevel != PNG_LEVEL_DEFAULT)
+    snprintf(buffer, size, "format png %s",
+             PngWriter_LevelName(list->pngLevel));
+  else
+    snprintf(buffer, size, "format %s",
+             info ? info->extensions[0] + 1 : "png");
+}
+
+int ImageOps_Format(const ImageOpList *list, char *buffer, size_t size) {
+  if (!buffer || size == 0)
+    return 0;
+  buffer[0] = '\0';
+
+  char text[96];
+  size_t pos = 0;
+  for (int i = 0; i <= list->count; i++) {
+    if (i < list->count)
+      FormatOp(&list->ops[i], text, sizeof(text));
+    else
+      FormatOutput(list, text, sizeof(text));
+    int n = snprintf(buffer + pos, size - pos, "%s%s", text,
+                     i < list->count ? "; " : "");
+    if (n < 0 || (size_t)n >= size - pos)
+      return 0; // cut short
+    pos += n;
+  }
+  return 1;
+}
+
+// the canonical text is what the manifest compares, so it has to fit whole
+static int TextFits(const ImageOpList *list) {
+  char text[IMAGE_OPS_TEXT_MAX];
+  return ImageOps_Format(list, text, sizeof(text));
+}
+
+void ImageOps_Clear(ImageOpList *list) {
+  memset(list, 0, sizeof(ImageOpList));
+  list->outputFormat = IMAGE_FORMAT_PNG;
+  list->quality = 90;
+  list->pngLevel = PNG_LEVEL_DEFAULT;
+  list->jpegSubsample = JPEG_SUBSAMPLE_420;
+}
+
+int ImageOps_Append(ImageOpList *list, const ImageOp *op) {
+  ImageOp *last = list->count > 0 ? &list->ops[list->count - 1] : NULL;
+
+  // fold repeats into the last op. only where the result is identical -
+  // +10 then -10 brightness clips in between, so mixed signs stay separate
+  if (last && last->type == op->type) {
+    switch (op->type) {
+    case IMAGE_OP_ROTATE:
+      last->args[0] = (last->args[0] + op->args[0]) & 3;
+      if (last->args[0] == 0)
+        list->count--; // full turn
+      return 1;
+    case IMAGE_OP_FLIP:
+    case IMAGE_OP_INVERT:
+      if (op->type == IMAGE_OP_INVERT || last->args[0] == op->args[0]) {
+        list->count--; // undoes itself
+        return 1;
+      }
+      break;
+    case IMAGE_OP_BRIGHTNESS: {
+      int sum = last->args[0] + op->args[0];
+      if ((last->args[0] > 0) == (op->args[0] > 0) && sum >= -255 &&
+          sum <= 255) {
+        last->args[0] = sum;
+        return 1;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  if (list->count >= IMAGE_OPS_MAX)
+    return 0;
+  list->ops[list->count++] = *op;
+  if (!TextFits(list)) {
+    list->count--;
+    return 0;
+  }
+  return 1;
+}
+
+int ImageOps_ReadFile(const char *path, ImageOpList *list, char *error,
+                      size_t errorSize) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    SetError(error, errorSize, "cant open %s", path);
+    return 0;
+  }
+  // a full list with comments is well under this
+  char *text = (char *)malloc(IMAGE_OPS_FILE_MAX + 1);
+  size_t len = text ? fread(text, 1, IMAGE_OPS_FILE_MAX + 1, f) : 0;
+  fclose(f);
+  if (!text || len > IMAGE_OPS_FILE_MAX) {
+    free(text);
+    SetError(error, errorSize, "%s is too big for an ops file", path);
+    return 0;
+  }
+  text[len] = '\0';
+
+  int ok = ImageOps_Parse(text, list, error, errorSize);
+  free(text);
+  return ok;
+}
+
+int ImageOps_WriteFile(const ImageOpList *list, const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return 0;
+
+  // one op per line so it reads (and edits) like a recipe
+  char text[96];
+  fprintf(f, "# pix edit log\n");
+  fprintf(f, "# pix --batch <folder> --ops-file <this file>\n");
+  for (int i = 0; i < list->count; i++) {
+    FormatOp(&list->ops[i], text, sizeof(text));
+    fprintf(f, "%s\n", text);
+  }
+  FormatOutput(list, text, sizeof(text));
+  fprintf(f, "%s\n", text);
+  return fclose(f) == 0;
+}
+
+static int RoundDim(double v) {
+  if (v > (double)(1 << 30))
+    return 1 << 30; // way past any limit below, just dont overflow
+  int d = (int)floor(v + 0.5);
+  return d < 1 ? 1 : d;
+}
+
+// size after one op. 0 if it cant apply to a w x h image
+static int OpSize(const ImageOp *op, int w, int h, int *nw, int *nh) {
+  *nw = w;
+  *nh = h;
+  switch (op->type) {
+  case IMAGE_OP_FIT: {
+    double sx = (double)op->args[0] / w;
+    double sy = (double)op->args[1] / h;
+    double s = sx < sy ? sx : sy;
+    *nw = RoundDim(w * s);
+    *nh = RoundDim(h * s);
+    break;
+  }
+  case IMAGE_OP_RESIZE:
+    *nw = op->args[0] ? op->args[0] : RoundDim((double)w * op->args[1] / h);
+    *nh = op->args[1] ? op->args[1] : RoundDim((double)h * op->args[0] / w);
+    break;
+  case IMAGE_OP_SCALE:
+    *nw = RoundDim(w * (double)op->value);
+    *nh = RoundDim(h * (double)op->value);
+    break;
+  case IMAGE_OP_CROP:
+    // clamped to the image like the interactive crop
+    if (op->args[0] >= w || op->args[1] >= h)
+      return 0;
+    *nw = op->args[2] < w - op->args[0] ? op->args[2] : w - op->args[0];
+    *nh = op->args[3] < h - op->args[1] ? op->args[3] : h - op->args[1];
+    break;
+  case IMAGE_OP_ROTATE:
+    if (op->args[0] & 1) {
+      *nw = h;
+      *nh = w;
+    }
+    break;
+  default:
+    break;
+  }
+  return 1;
+}
+
+static int OpOutputSize(const ImageOp *op, int w, int h, int *nw, int *nh) {
+  // everything downstream works in int byte counts
+  return OpSize(op, w, h, nw, nh) && (double)*nw * *nh * 4 <= 0x7FFFFFFF;
+}
+
+// ops that need a second buffer (the rest run in place)
+static int NeedsBuffer(const ImageOp *op, int w, int h, int nw, int nh) {
+  switch (op->type) {
+  case IMAGE_OP_FIT:
+  case IMAGE_OP_RESIZE:
+  case IMAGE_OP_SCALE:
+  case IMAGE_OP_CROP:
+    return nw != w || nh != h; // same size is a no-op
+  case IMAGE_OP_ROTATE:
+  case IMAGE_OP_SHARPEN:
+  case IMAGE_OP_BLUR:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+int ImageOps_Plan(const ImageOpList *list, int srcW, int srcH, int *outW,
+                  int *outH, size_t *peakBytes) {
+  int w = srcW, h = srcH;
+  if (w <= 0 || h <= 0 || (double)w * h * 4 > 0x7FFFFFFF)
+    return 0;
+
+  // same ping-pong as ImageOps_Apply, just counting bytes
+  size_t imageCap = (size_t)w * h * 4;
+  size_t spareCap = 0;
+  size_t chainPeak = 0;
+
+  for (int i = 0; i < list->count; i++) {
+    int nw, nh;
+    if (!OpOutputSize(&list->ops[i], w, h, &nw, &nh))
+      return 0;
+    if (NeedsBuffer(&list->ops[i], w, h, nw, nh)) {
+      size_t need = (size_t)nw * nh * 4;
+      if (spareCap < need)
+        spareCap = need;
+      if (imageCap + spareCap > chainPeak)
+        chainPeak = imageCap + spareCap;
+      size_t tmp = imageCap;
+      imageCap = spareCap;
+      spareCap = tmp;
+    }
+    w = nw;
+    h = nh;
+  }
+
+  // decode + encode side, then the chain itself. the spare buffer is gone
+  // by the time the encoder runs, but the image buffer may be oversized
+  size_t peak = Settings_EstimateJobMemory(srcW, srcH, w, h);
+  if (chainPeak > peak)
+    peak = chainPeak;
+  if (imageCap + (size_t)w * h * 4 * 2 > peak)
+    peak = imageCap + (size_t)w * h * 4 * 2;
+
+  *outW = w;
+  *outH = h;
+  if (peakBytes)
+    *peakBytes = peak;
+  return 1;
+}
+
+int ImageOps_Apply(const ImageOpList *list, ImageData *image) {
+  if (!image || !image->pixels)
+    return 0;
+
+  unsigned char *spare = NULL;
+  size_t spareCap = 0;
+  size_t imageCap = (size_t)image->width * image->height * 4;
+  int ok = 1;
+
+  for (int i = 0; i < list->count && ok; i++) {
+    const ImageOp *op = &list->ops[i];
+    int w = image->width, h = image->height;
+    int nw, nh;
+    if (!OpOutputSize(op, w, h, &nw, &nh)) {
+      ok = 0;
+      break;
+    }
+
+    if (!NeedsBuffer(op, w, h, nw, nh)) {
+      switch (op->type) {
+      case IMAGE_OP_FLIP:
+        ImageLoader_FlipPixels(image->pixels, w, h, op->args[0]);
+        break;
+      case IMAGE_OP_LEVELS:
+        ImageLoader_AutoLevels(image);
+        break;
+      case IMAGE_OP_GRAYSCALE:
+        ImageLoader_Grayscale(image);
+        break;
+      case IMAGE_OP_SEPIA:
+        ImageLoader_Sepia(image);
+        break;
+      case IMAGE_OP_INVERT:
+        ImageLoader_Invert(image);
+        break;
+      case IMAGE_OP_BRIGHTNESS:
+        ImageLoader_AdjustBrightness(image, op->args[0]);
+        break;
+      case IMAGE_OP_CONTRAST:
+        ImageLoader_AdjustContrast(image, op->value);
+        break;
+      case IMAGE_OP_SATURATION:
+        ImageLoader_AdjustSaturation(image, op->value);
+        break;
+      default:
+        break; // same-size resize
+      }
+      continue;
+    }
+
+    // garbage in the spare buffer, so grow it without copying
+    size_t need = (size_t)nw * nh * 4;
+    if (spareCap < need) {
+      ImageLoader_FreePixels(image, spare);
+      spare = ImageLoader_AllocPixels(image, need, PIXMEM_CURRENT);
+      spareCap = spare ? need : 0;
+      if (!spare) {
+        ok = 0;
+        break;
+      }
+    }
+
+    switch (op->type) {
+    case IMAGE_OP_CROP:
+      ImageLoader_CropInto(image->pixels, w, op->args[0], op->args[1], nw, nh,
+                           spare);
+      break;
+    case IMAGE_OP_ROTATE:
+      ImageLoader_RotateInto(image->pixels, w, h, spare, op->args[0]);
+      break;
+    case IMAGE_OP_SHARPEN:
+      ImageLoader_SharpenInto(image->pixels, w, h, spare);
+      break;
+    case IMAGE_OP_BLUR:
+      ImageLoader_BlurInto(image->pixels, w, h, spare);
+      break;
+    default: // fit / resize / scale
+      ImageLoader_ResizeLanczosInto(image->pixels, w, h, spare, nw, nh);
+      break;
+    }
+
+    // result becomes the image, the old image buffer becomes the spare
+    unsigned char *tmp = image->pixels;
+    size_t tmpCap = imageCap;
+    image->pixels = spare;
+    imageCap = spareCap;
+    spare = tmp;
+    spareCap = tmpCap;
+    image->width = nw;
+    image->height = nh;
+  }
+
+  ImageLoader_FreePixels(image, spare);
+  return ok;
+}
+
+// ---- streaming ----
+
+// output rows per band - a few mb, but enough rows to keep the openmp
+// threads of one band busy
+static int StreamBandRows(int dstW, int dstH) {
+  int rows = STREAM_BAND_BYTES / (dstW * 4);
+  if (rows < 16)
+    rows = 16;
+  return rows < dstH ? rows : dstH;
+}
+
+// most source rows any band needs at once
+static int StreamWindowRows(int srcH, int dstH, int band) {
+  int most = 0;
+  for (int y = 0; y < dstH; y += band) {
+    int last = y + band < dstH ? y + band - 1 : dstH - 1;
+    int first, srcLast;
+    ImageLoader_LanczosSourceRows(srcH, dstH, y, last, &first, &srcLast);
+    if (srcLast - first + 1 > most)
+      most = srcLast - first + 1;
+  }
+  return most;
+}
+
+int ImageOps_Streamable(const ImageOpList *list) {
+  if (list->count != 1 || list->outputFormat != IMAGE_FORMAT_PNG)
+    return 0;
+  ImageOpType t = list->ops[0].type;
+  return t == IMAGE_OP_FIT || t == IMAGE_OP_RESIZE || t == IMAGE_OP_SCALE;
+}
+
+int ImageOps_PlanStream(const ImageOpList *list, int srcW, int srcH,
+                        int fromRows, int *outW, int *outH,
+                        size_t *peakBytes) {
+  int w, h;
+  if (!ImageOps_Streamable(list) || srcW <= 0 || srcH <= 0 ||
+      (double)srcW * srcH * 4 > 0x7FFFFFFF ||
+      !OpSize(&list->ops[0], srcW, srcH, &w, &h) || w > STREAM_MAX_DIM ||
+      h > STREAM_MAX_DIM)
+    return 0;
+
+  // output side: one band of pixels plus what the png writer holds for it
+  int band = StreamBandRows(w, h);
+  size_t peak = (size_t)band * w * 4 + PngWriter_WorkingSet(w, band);
+
+  // source side: a window of rows, or the whole decode (which briefly
+  // needs two copies while stb converts it)
+  size_t src = (size_t)srcW * srcH * 4;
+  if (fromRows)
+    peak += (size_t)StreamWindowRows(srcH, h, band) * srcW * 4 + srcW * 4;
+  else
+    peak = (peak + src > src * 2) ? peak + src : src * 2;
+
+  *outW = w;
+  *outH = h;
+  if (peakBytes)
+    *peakBytes = peak;
+  return 1;
+}
+
+int ImageOps_Stream(const ImageOpList *list, const ImageData *image,
+                    ImageRowReader *rows, const char *path) {
+  int srcW = image ? image->width : rows->width;
+  int srcH = image ? image->height : rows->height;
+  int dstW, dstH;
+  if (!ImageOps_PlanStream(list, srcW, srcH, rows != NULL, &dstW, &dstH,
+                           NULL))
+    return 0;
+
+  int band = StreamBandRows(dstW, dstH);
+  int windowCap = rows ? StreamWindowRows(srcH, dstH, band) : 0;
+  size_t srcRow = (size_t)srcW * 4;
+  unsigned char *out = (unsigned char *)malloc((size_t)band * dstW * 4);
+  unsigned char *window =
+      rows ? (unsigned char *)malloc(windowCap * srcRow) : NULL;
+
+  PngWriter png;
+  int ok = out && (!rows || window) && PngWriter_Open(&png, path, dstW, dstH,
+                                                    list->pngLevel, 0);
+  int opened = ok;
+
+  // the window holds source rows [winFirst, winFirst + winCount) and
+  // only ever slides down, the reader is always at winFirst + winCount
+  int winFirst = 0, winCount = 0;
+  for (int y = 0; ok && y < dstH; y += band) {
+    int n = band < dstH - y ? band : dstH - y;
+    const unsigned char *src = image ? image->pixels : window;
+    int srcFirst = 0;
+
+    if (rows) {
+      int first, last;
+      ImageLoader_LanczosSourceRows(srcH, dstH, y, y + n - 1, &first, &last);
+
+      int drop = first - winFirst;
+      if (drop > winCount)
+        drop = winCount;
+      if (drop > 0) {
+        memmove(window, window + drop * srcRow, (winCount - drop) * srcRow);
+        winFirst += drop;
+        winCount -= drop;
+      }
+      // big downscales skip whole rows
+      while (ok && winCount == 0 && winFirst < first) {
+        ok = ImageLoader_ReadRows(rows, window, 1);
+        winFirst++;
+      }
+      int need = last - winFirst + 1 - winCount;
+      if (ok && need > 0) {
+        ok = ImageLoader_ReadRows(rows, window + winCount * srcRow, need);
+        winCount += need;
+      }
+      srcFirst = winFirst;
+    }
+
+    if (ok) {
+      ImageLoader_ResizeLanczosRows(src, srcW, srcH, srcFirst, out, dstW,
+                                    dstH, y, n);
+      ok = PngWriter_WriteRows(&png, out, n);
+    }
+  }
+
+  // close also removes the file if it didnt get every row
+  if (opened)
+    ok = PngWriter_Close(&png) && ok;
+  free(out);
+  free(window);
+  return ok;
+}
+
+const char *ImageOps_Extension(const ImageOpList *list) {
+  const ImageFormatInfo *info = ImageFormat_Get(list->outputFormat);
+  return info ? info->extensions[0] : ".png";
+}
+
+int ImageOps_Save(const ImageOpList *list, const ImageData *image,
+                  const char *path) {
+  int w = image->width, h = image->height;
+  switch (list->outputFormat) {
+  case IMAGE_FORMAT_JPEG:
+    return JpegWriter_WriteImage(path, image->pixels, w, h, list->quality,
+                                 list->jpegSubsample, 0);
+  case IMAGE_FORMAT_BMP:
+    return stbi_write_bmp(path, w, h, 4, image->pixels);
+  default:
+    return PngWriter_WriteImage(path, image->pixels, w, h, list->pngLevel, 0);
+  }
+}
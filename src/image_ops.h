@@ -0,0 +1,99 @@
+// image ops header
+// chains of editing operations, parsed from text like
+//   "fit 1920x1080; levels; sharpen; format jpg 90"
+// and applied in one pass per image
+
+#ifndef IMAGE_OPS_H
+#define IMAGE_OPS_H
+
+#include "image_format.h"
+#include "image_loader.h"
+#include "jpeg_writer.h"
+#include "png_writer.h"
+#include <stddef.h>
+
+#define IMAGE_OPS_MAX 32
+#define IMAGE_OPS_TEXT_MAX 1024 // canonical text always fits in this
+#define IMAGE_OPS_FILE_MAX 16384
+#define STREAM_BAND_BYTES (4 * 1024 * 1024) // output pixels per band
+#define STREAM_MAX_DIM 262144                // streamed output, per side
+
+typedef enum {
+  IMAGE_OP_FIT,        // fit WxH - lanczos to fit inside the box, keeps aspect
+  IMAGE_OP_RESIZE,     // resize WxH - lanczos to exact size (0 = keep aspect)
+  IMAGE_OP_SCALE,      // scale F - lanczos by a factor
+  IMAGE_OP_CROP,       // crop X Y W H
+  IMAGE_OP_ROTATE,     // rotate 90|180|270 (clockwise)
+  IMAGE_OP_FLIP,       // flip h|v
+  IMAGE_OP_LEVELS,     // auto levels
+  IMAGE_OP_SHARPEN,
+  IMAGE_OP_BLUR,
+  IMAGE_OP_GRAYSCALE,
+  IMAGE_OP_SEPIA,
+  IMAGE_OP_INVERT,
+  IMAGE_OP_BRIGHTNESS, // brightness N (-255..255)
+  IMAGE_OP_CONTRAST,   // contrast F (1 = unchanged)
+  IMAGE_OP_SATURATION, // saturation F (1 = unchanged, 0 = gray)
+  IMAGE_OP_COUNT
+} ImageOpType;
+
+typedef struct {
+  ImageOpType type;
+  int args[4];
+  float value;
+} ImageOp;
+
+typedef struct {
+  ImageOp ops[IMAGE_OPS_MAX];
+  int count;
+  ImageFormat outputFormat;    // "format png|jpg|bmp", png by default
+  int quality;                 // "format jpg 90"
+  JpegSubsample jpegSubsample; // "format jpg 90 444", 420 by default
+  PngLevel pngLevel;           // "format png fast|small"
+} ImageOpList;
+
+// ops are separated by ; or new lines. returns 0 and fills error on a bad op
+int ImageOps_Parse(const char *text, ImageOpList *list, char *error,
+                   size_t errorSize);
+// canonical text, parses back to the same list. 0 if it didnt fit
+int ImageOps_Format(const ImageOpList *list, char *buffer, size_t size);
+
+// empty list, png output
+void ImageOps_Clear(ImageOpList *list);
+// adds an op to the end, folding it into the last one when that gives the
+// same pixels (two rotates, a flip twice, brightness steps). 0 if full
+int ImageOps_Append(ImageOpList *list, const ImageOp *op);
+
+// ops files - same syntax, one op per line, # comments
+int ImageOps_ReadFile(const char *path, ImageOpList *list, char *error,
+                      size_t errorSize);
+int ImageOps_WriteFile(const ImageOpList *list, const char *path);
+
+// size after every op, plus the most memory any point of the job needs
+// (decode, the op chain and the encode). 0 if some step is too big
+int ImageOps_Plan(const ImageOpList *list, int srcW, int srcH, int *outW,
+                  int *outH, size_t *peakBytes);
+
+// runs the chain. size-changing ops ping-pong between the image buffer
+// and one spare buffer, so a chain allocates at most once or twice
+int ImageOps_Apply(const ImageOpList *list, ImageData *image);
+
+// streaming - a single fit / resize / scale written as png can run in row
+// bands, so the full size output never exists in memory. the source is
+// either the decoded image or (for formats stored as rows) read off disk
+// a window of rows at a time
+int ImageOps_Streamable(const ImageOpList *list);
+int ImageOps_PlanStream(const ImageOpList *list, int srcW, int srcH,
+                        int fromRows, int *outW, int *outH,
+                        size_t *peakBytes);
+// image or rows, not both. the png at path is removed again on failure
+int ImageOps_Stream(const ImageOpList *list, const ImageData *image,
+                    ImageRowReader *rows, const char *path);
+
+// writes with the list's output format. the writers take rgba, which is
+// how batch loads (no IMAGE_LOAD_BGRA)
+const char *ImageOps_Extension(const ImageOpList *list);
+int ImageOps_Save(const ImageOpList *list, const ImageData *image,
+                  const char *path);
+
+#endif
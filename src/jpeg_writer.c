@@ -0,0 +1,578 @@
+/*
+ * JPEG Writer - Implementation
+ * pix - multithreaded baseline jpeg encoder
+ *
+ * same output as any baseline encoder (standard huffman tables, libjpeg
+ * quality scaling) but with a restart marker after every mcu row. a
+ * restart resets the dc predictors and byte-aligns the stream, so each
+ * mcu row is an independent piece: rows are encoded in parallel (openmp)
+ * a band at a time and written out in order with RST0..RST7 between them.
+ * color conversion, the aan float dct and quantization are sse2.
+ */
+
+#include "jpeg_writer.h"
+#include <emmintrin.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#define JPEG_MAX_DIM 65535
+#define BLOCK_BOUND 512 // worst case bytes for one coded 8x8 block
+
+typedef struct {
+  unsigned short code[256];
+  unsigned char size[256];
+} HuffTable;
+
+// per image: quant tables, and the dct scale + quant folded together
+typedef struct {
+  unsigned char quant[2][64];    // natural order, 0 = luma, 1 = chroma
+  __m128 divisor[2][16];         // transposed, see ForwardDct
+  int mcuW, mcuH;                // 8 or 16
+  int lumaBlocks;                // y blocks per mcu
+} JpegTables;
+
+// one mcu row's coded bytes
+typedef struct {
+  unsigned char *data;
+  size_t len;
+  size_t cap;
+  int failed;
+} RowOut;
+
+static const unsigned char g_dcLumCounts[16] = {0, 1, 5, 1, 1, 1, 1, 1,
+                                                1, 0, 0, 0, 0, 0, 0, 0};
+static const unsigned char g_dcChromaCounts[16] = {0, 3, 1, 1, 1, 1, 1, 1,
+                                                   1, 1, 1, 0, 0, 0, 0, 0};
+static const unsigned char g_dcValues[12] = {0, 1, 2, 3, 4,  5,
+                                             6, 7, 8, 9, 10, 11};
+static const unsigned char g_acLumCounts[16] = {0, 2, 1, 3, 3, 2, 4, 3,
+                                                5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const unsigned char g_acLumValues[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06,
+    0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72,
+    0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+    0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+    0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3,
+    0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9,
+    0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4,
+    0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+static const unsigned char g_acChromaCounts[16] = {0, 2, 1, 2, 4, 4, 3, 4,
+                                                   7, 5, 4, 4, 0, 1, 2, 0x77};
+static const unsigned char g_acChromaValues[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
+    0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+    0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1,
+    0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44,
+    0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74,
+    0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a,
+    0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+    0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4,
+    0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+
+// annex k tables, natural order
+static const unsigned char g_lumQuant[64] = {
+    16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,
+    14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+    18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99};
+static const unsigned char g_chromaQuant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99};
+
+// natural index -> zigzag position
+static const unsigned char g_zigzag[64] = {
+    0,  1,  5,  6,  14, 15, 27, 28, 2,  4,  7,  13, 16, 26, 29, 42,
+    3,  8,  12, 17, 25, 30, 41, 43, 9,  11, 18, 24, 31, 40, 44, 53,
+    10, 19, 23, 32, 39, 45, 52, 54, 20, 22, 33, 38, 46, 51, 55, 60,
+    21, 34, 37, 47, 50, 56, 59, 61, 35, 36, 48, 49, 57, 58, 62, 63};
+
+// aan dct output scale per row / column
+static const float g_aanScale[8] = {
+    1.0f * 2.828427125f,         1.387039845f * 2.828427125f,
+    1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f,
+    1.0f * 2.828427125f,         0.785694958f * 2.828427125f,
+    0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f};
+
+static const char *g_subsampleNames[JPEG_SUBSAMPLE_COUNT] = {"420", "422",
+                                                             "444"};
+
+// built once
+static HuffTable g_dcHuff[2], g_acHuff[2];
+static unsigned char g_zigzagToDct[64]; // zigzag position -> ForwardDct slot
+static INIT_ONCE g_tablesOnce = INIT_ONCE_STATIC_INIT;
+
+static void BuildHuff(const unsigned char *counts, const unsigned char *values,
+                      HuffTable *t) {
+  int code = 0, k = 0;
+  for (int len = 1; len <= 16; len++) {
+    for (int i = 0; i < counts[len - 1]; i++) {
+      t->code[values[k]] = (unsigned short)code++;
+      t->size[values[k]] = (unsigned char)len;
+      k++;
+    }
+    code <<= 1;
+  }
+}
+
+static BOOL CALLBACK BuildTables(PINIT_ONCE once, PVOID param,
+                                 PVOID *context) {
+  (void)once;
+  (void)param;
+  (void)context;
+  BuildHuff(g_dcLumCounts, g_dcValues, &g_dcHuff[0]);
+  BuildHuff(g_dcChromaCounts, g_dcValues, &g_dcHuff[1]);
+  BuildHuff(g_acLumCounts, g_acLumValues, &g_acHuff[0]);
+  BuildHuff(g_acChromaCounts, g_acChromaValues, &g_acHuff[1]);
+
+  // ForwardDct leaves coefficient (row r, col c) at c * 8 + r
+  for (int n = 0; n < 64; n++)
+    g_zigzagToDct[g_zigzag[n]] = (unsigned char)((n % 8) * 8 + n / 8);
+  return TRUE;
+}
+
+// libjpeg's quality scaling
+static void BuildQuant(const unsigned char *base, int quality,
+                       unsigned char *quant, __m128 *divisor) {
+  int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+  float div[64];
+  for (int n = 0; n < 64; n++) {
+    int q = (base[n] * scale + 50) / 100;
+    quant[n] = (unsigned char)(q < 1 ? 1 : q > 255 ? 255 : q);
+    int r = n / 8, c = n % 8;
+    div[c * 8 + r] = 1.0f / (quant[n] * g_aanScale[r] * g_aanScale[c]);
+  }
+  for (int i = 0; i < 16; i++)
+    divisor[i] = _mm_loadu_ps(div + i * 4);
+}
+
+// ---- sse2 kernels ----
+
+// 4 rgba pixels -> level shifted y, cb, cr
+static void ConvertPixels(const unsigned char *px, float *y, float *cb,
+                          float *cr) {
+  __m128i p = _mm_loadu_si128((const __m128i *)px);
+  __m128i mask = _mm_set1_epi32(0xFF);
+  __m128 r = _mm_cvtepi32_ps(_mm_and_si128(p, mask));
+  __m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 8), mask));
+  __m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 16), mask));
+
+  __m128 vy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(0.299f)),
+                                    _mm_mul_ps(g, _mm_set1_ps(0.587f))),
+                         _mm_mul_ps(b, _mm_set1_ps(0.114f)));
+  __m128 vcb = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(-0.16874f)),
+                                     _mm_mul_ps(g, _mm_set1_ps(-0.33126f))),
+                          _mm_mul_ps(b, _mm_set1_ps(0.5f)));
+  __m128 vcr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(0.5f)),
+                                     _mm_mul_ps(g, _mm_set1_ps(-0.41869f))),
+                          _mm_mul_ps(b, _mm_set1_ps(-0.08131f)));
+  _mm_storeu_ps(y, _mm_sub_ps(vy, _mm_set1_ps(128.0f)));
+  _mm_storeu_ps(cb, vcb);
+  _mm_storeu_ps(cr, vcr);
+}
+
+// one aan pass down the 8 rows, 4 columns per register
+static void DctPass(__m128 *d) {
+  __m128 tmp0 = _mm_add_ps(d[0], d[7]), tmp7 = _mm_sub_ps(d[0], d[7]);
+  __m128 tmp1 = _mm_add_ps(d[1], d[6]), tmp6 = _mm_sub_ps(d[1], d[6]);
+  __m128 tmp2 = _mm_add_ps(d[2], d[5]), tmp5 = _mm_sub_ps(d[2], d[5]);
+  __m128 tmp3 = _mm_add_ps(d[3], d[4]), tmp4 = _mm_sub_ps(d[3], d[4]);
+
+  // even part
+  __m128 tmp10 = _mm_add_ps(tmp0, tmp3), tmp13 = _mm_sub_ps(tmp0, tmp3);
+  __m128 tmp11 = _mm_add_ps(tmp1, tmp2), tmp12 = _mm_sub_ps(tmp1, tmp2);
+  d[0] = _mm_add_ps(tmp10, tmp11);
+  d[4] = _mm_sub_ps(tmp10, tmp11);
+  __m128 z1 =
+      _mm_mul_ps(_mm_add_ps(tmp12, tmp13), _mm_set1_ps(0.707106781f));
+  d[2] = _mm_add_ps(tmp13, z1);
+  d[6] = _mm_sub_ps(tmp13, z1);
+
+  // odd part
+  tmp10 = _mm_add_ps(tmp4, tmp5);
+  tmp11 = _mm_add_ps(tmp5, tmp6);
+  tmp12 = _mm_add_ps(tmp6, tmp7);
+  __m128 z5 = _mm_mul_ps(_mm_sub_ps(tmp10, tmp12), _mm_set1_ps(0.382683433f));
+  __m128 z2 = _mm_add_ps(_mm_mul_ps(tmp10, _mm_set1_ps(0.541196100f)), z5);
+  __m128 z4 = _mm_add_ps(_mm_mul_ps(tmp12, _mm_set1_ps(1.306562965f)), z5);
+  __m128 z3 = _mm_mul_ps(tmp11, _mm_set1_ps(0.707106781f));
+  __m128 z11 = _mm_add_ps(tmp7, z3), z13 = _mm_sub_ps(tmp7, z3);
+  d[5] = _mm_add_ps(z13, z2);
+  d[3] = _mm_sub_ps(z13, z2);
+  d[1] = _mm_add_ps(z11, z4);
+  d[7] = _mm_sub_ps(z11, z4);
+}
+
+// 8x8 block (row stride in floats) -> quantized coefficients. the rows
+// come back transposed, g_zigzagToDct knows where everything ends up
+static void ForwardDct(const float *src, int stride, const __m128 *divisor,
+                       int *out) {
+  __m128 lo[8], hi[8];
+  for (int r = 0; r < 8; r++) {
+    lo[r] = _mm_loadu_ps(src + r * stride);
+    hi[r] = _mm_loadu_ps(src + r * stride + 4);
+  }
+  DctPass(lo); // columns 0-3
+  DctPass(hi); // columns 4-7
+
+  // transpose the four 4x4 quarters, swapping the off-diagonal ones
+  _MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+  _MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+  _MM_TRANSPOSE4_PS(lo[4], lo[5], lo[6], lo[7]);
+  _MM_TRANSPOSE4_PS(hi[4], hi[5], hi[6], hi[7]);
+  __m128 t[8], u[8];
+  for (int r = 0; r < 4; r++) {
+    t[r] = lo[r];
+    u[r] = lo[r + 4];
+    t[r + 4] = hi[r];
+    u[r + 4] = hi[r + 4];
+  }
+  DctPass(t);
+  DctPass(u);
+
+  for (int r = 0; r < 8; r++) {
+    _mm_storeu_si128((__m128i *)(out + r * 8),
+                     _mm_cvtps_epi32(_mm_mul_ps(t[r], divisor[r * 2])));
+    _mm_storeu_si128((__m128i *)(out + r * 8 + 4),
+                     _mm_cvtps_epi32(_mm_mul_ps(u[r], divisor[r * 2 + 1])));
+  }
+}
+
+// ---- entropy coding ----
+
+typedef struct {
+  RowOut *out;
+  unsigned int bits;
+  int count;
+} BitOut;
+
+static void PutBits(BitOut *b, unsigned int value, int n) {
+  b->bits = (b->bits << n) | (value & ((1u << n) - 1));
+  b->count += n;
+  while (b->count >= 8) {
+    unsigned char byte = (unsigned char)(b->bits >> (b->count - 8));
+    b->out->data[b->out->len++] = byte;
+    if (byte == 0xFF)
+      b->out->data[b->out->len++] = 0; // byte stuffing
+    b->count -= 8;
+  }
+}
+
+// jpeg stores a value as its bit count and then the low bits
+// (negatives as value - 1)
+static int BitCount(int v) {
+  unsigned int mag = v < 0 ? -v : v;
+  int n = 0;
+  while (mag) {
+    n++;
+    mag >>= 1;
+  }
+  return n;
+}
+
+static void EncodeBlock(BitOut *b, const int *coef, int *dcPrev,
+                        const HuffTable *dc, const HuffTable *ac) {
+  int value = coef[g_zigzagToDct[0]];
+  int diff = value - *dcPrev;
+  *dcPrev = value;
+  int n = BitCount(diff);
+  PutBits(b, dc->code[n], dc->size[n]);
+  if (n)
+    PutBits(b, diff < 0 ? diff - 1 : diff, n);
+
+  int last = 63;
+  while (last > 0 && coef[g_zigzagToDct[last]] == 0)
+    last--;
+
+  int run = 0;
+  for (int i = 1; i <= last; i++) {
+    int v = coef[g_zigzagToDct[i]];
+    if (v == 0) {
+      run++;
+      continue;
+    }
+    while (run >= 16) {
+      PutBits(b, ac->code[0xF0], ac->size[0xF0]); // 16 zeros
+      run -= 16;
+    }
+    n = BitCount(v);
+    int sym = (run << 4) | n;
+    PutBits(b, ac->code[sym], ac->size[sym]);
+    PutBits(b, v < 0 ? v - 1 : v, n);
+    run = 0;
+  }
+  if (last < 63)
+    PutBits(b, ac->code[0x00], ac->size[0x00]); // end of block
+}
+
+// room for one more mcu
+static int Reserve(RowOut *out, size_t bytes) {
+  if (out->len + bytes <= out->cap)
+    return 1;
+  size_t cap = out->cap * 2 > out->len + bytes ? out->cap * 2
+                                               : out->len + bytes;
+  unsigned char *data = (unsigned char *)realloc(out->data, cap);
+  if (!data)
+    return 0;
+  out->data = data;
+  out->cap = cap;
+  return 1;
+}
+
+// one mcu row, from a fresh restart (dc predictors at 0) to a byte boundary
+static void EncodeMcuRow(const JpegTables *t, const unsigned char *rgba,
+                         int width, int height, int mcuRow, RowOut *out) {
+  float y[256], cb[256], cr[256]; // one mcu, row stride 16
+  float sub[2][64];
+  int coef[64];
+  int dcPrev[3] = {0, 0, 0};
+  int mcusX = (width + t->mcuW - 1) / t->mcuW;
+  int blocks = t->lumaBlocks + 2;
+  BitOut b = {out, 0, 0};
+  out->len = 0;
+
+  for (int mx = 0; mx < mcusX; mx++) {
+    if (!Reserve(out, (size_t)blocks * BLOCK_BOUND)) {
+      out->failed = 1;
+      return;
+    }
+
+    // color convert, repeating the last row / column past the edges
+    for (int py = 0; py < t->mcuH; py++) {
+      int sy = mcuRow * t->mcuH + py;
+      if (sy >= height)
+        sy = height - 1;
+      const unsigned char *row = rgba + (size_t)sy * width * 4;
+      for (int px = 0; px < t->mcuW; px += 4) {
+        int sx = mx * t->mcuW + px;
+        float *dst = y + py * 16 + px;
+        if (sx + 4 <= width) {
+          ConvertPixels(row + (size_t)sx * 4, dst, cb + py * 16 + px,
+                        cr + py * 16 + px);
+        } else {
+          unsigned char edge[16];
+          for (int k = 0; k < 4; k++) {
+            int x = sx + k < width ? sx + k : width - 1;
+            memcpy(edge + k * 4, row + (size_t)x * 4, 4);
+          }
+          ConvertPixels(edge, dst, cb + py * 16 + px, cr + py * 16 + px);
+        }
+      }
+    }
+
+    for (int by = 0; by < t->mcuH; by += 8) {
+      for (int bx = 0; bx < t->mcuW; bx += 8) {
+        ForwardDct(y + by * 16 + bx, 16, t->divisor[0], coef);
+        EncodeBlock(&b, coef, &dcPrev[0], &g_dcHuff[0], &g_acHuff[0]);
+      }
+    }
+
+    const float *chroma[2] = {cb, cr};
+    for (int c = 0; c < 2; c++) {
+      const float *src = chroma[c];
+      int stride = 16;
+      if (t->mcuW == 16) {
+        // average 2x1 (422) or 2x2 (420) down to one 8x8 block
+        __m128 scale = _mm_set1_ps(t->mcuH == 16 ? 0.25f : 0.5f);
+        for (int r = 0; r < 8; r++) {
+          const float *s0 = src + (t->mcuH == 16 ? r * 2 : r) * 16;
+          for (int k = 0; k < 8; k += 4) {
+            __m128 a = _mm_loadu_ps(s0 + k * 2);
+            __m128 bb = _mm_loadu_ps(s0 + k * 2 + 4);
+            if (t->mcuH == 16) {
+              a = _mm_add_ps(a, _mm_loadu_ps(s0 + 16 + k * 2));
+              bb = _mm_add_ps(bb, _mm_loadu_ps(s0 + 16 + k * 2 + 4));
+            }
+            __m128 even = _mm_shuffle_ps(a, bb, _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 odd = _mm_shuffle_ps(a, bb, _MM_SHUFFLE(3, 1, 3, 1));
+            _mm_storeu_ps(sub[c] + r * 8 + k,
+                          _mm_mul_ps(_mm_add_ps(even, odd), scale));
+          }
+        }
+        src = sub[c];
+        stride = 8;
+      }
+      ForwardDct(src, stride, t->divisor[1], coef);
+      EncodeBlock(&b, coef, &dcPrev[1 + c], &g_dcHuff[1], &g_acHuff[1]);
+    }
+  }
+
+  // pad the last byte with ones
+  if (b.count > 0)
+    PutBits(&b, 0x7F, 8 - b.count);
+}
+
+// ---- file ----
+
+static void PutMarker(FILE *f, int marker, int length) {
+  fputc(0xFF, f);
+  fputc(marker, f);
+  if (length > 0) {
+    fputc(length >> 8, f);
+    fputc(length & 0xFF, f);
+  }
+}
+
+static void WriteHeaders(FILE *f, const JpegTables *t, int width, int height,
+                         int restartInterval) {
+  PutMarker(f, 0xD8, 0); // start of image
+
+  static const unsigned char jfif[14] = {'J', 'F', 'I', 'F', 0, 1, 1,
+                                         0,   0,   1,   0,   1, 0, 0};
+  PutMarker(f, 0xE0, 16);
+  fwrite(jfif, 1, sizeof(jfif), f);
+
+  PutMarker(f, 0xDB, 2 + 2 * 65);
+  for (int table = 0; table < 2; table++) {
+    unsigned char zz[64];
+    for (int n = 0; n < 64; n++)
+      zz[g_zigzag[n]] = t->quant[table][n];
+    fputc(table, f);
+    fwrite(zz, 1, 64, f);
+  }
+
+  PutMarker(f, 0xC0, 17); // baseline
+  fputc(8, f);
+  fputc(height >> 8, f);
+  fputc(height & 0xFF, f);
+  fputc(width >> 8, f);
+  fputc(width & 0xFF, f);
+  fputc(3, f);
+  fputc(1, f); // y
+  fputc(((t->mcuW / 8) << 4) | (t->mcuH / 8), f);
+  fputc(0, f);
+  fputc(2, f); // cb
+  fputc(0x11, f);
+  fputc(1, f);
+  fputc(3, f); // cr
+  fputc(0x11, f);
+  fputc(1, f);
+
+  PutMarker(f, 0xC4, 2 + 2 * (17 + 12) + 2 * (17 + 162));
+  fputc(0x00, f);
+  fwrite(g_dcLumCounts, 1, 16, f);
+  fwrite(g_dcValues, 1, 12, f);
+  fputc(0x10, f);
+  fwrite(g_acLumCounts, 1, 16, f);
+  fwrite(g_acLumValues, 1, 162, f);
+  fputc(0x01, f);
+  fwrite(g_dcChromaCounts, 1, 16, f);
+  fwrite(g_dcValues, 1, 12, f);
+  fputc(0x11, f);
+  fwrite(g_acChromaCounts, 1, 16, f);
+  fwrite(g_acChromaValues, 1, 162, f);
+
+  PutMarker(f, 0xDD, 4); // restart interval, in mcus
+  fputc(restartInterval >> 8, f);
+  fputc(restartInterval & 0xFF, f);
+
+  static const unsigned char scan[10] = {3,    1, 0x00, 2, 0x11,
+                                         3, 0x11, 0,    63, 0};
+  PutMarker(f, 0xDA, 12);
+  fwrite(scan, 1, sizeof(scan), f);
+}
+
+int JpegWriter_WriteImage(const char *path, const unsigned char *rgba,
+                          int width, int height, int quality,
+                          JpegSubsample subsample, int threads) {
+  if (!rgba || width <= 0 || height <= 0 || width > JPEG_MAX_DIM ||
+      height > JPEG_MAX_DIM)
+    return 0;
+  InitOnceExecuteOnce(&g_tablesOnce, BuildTables, NULL, NULL);
+
+  if (quality < 1)
+    quality = 1;
+  if (quality > 100)
+    quality = 100;
+  if (threads <= 0)
+    threads = omp_get_max_threads();
+
+  JpegTables t;
+  BuildQuant(g_lumQuant, quality, t.quant[0], t.divisor[0]);
+  BuildQuant(g_chromaQuant, quality, t.quant[1], t.divisor[1]);
+  t.mcuW = subsample == JPEG_SUBSAMPLE_444 ? 8 : 16;
+  t.mcuH = subsample == JPEG_SUBSAMPLE_420 ? 16 : 8;
+  t.lumaBlocks = (t.mcuW / 8) * (t.mcuH / 8);
+
+  int mcusX = (width + t.mcuW - 1) / t.mcuW;
+  int mcuRows = (height + t.mcuH - 1) / t.mcuH;
+
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return 0;
+  setvbuf(f, NULL, _IOFBF, 256 * 1024);
+  WriteHeaders(f, &t, width, height, mcusX);
+
+  // a band of mcu rows at a time, so only a band of coded rows is held
+  int band = threads * 4;
+  RowOut *rows = (RowOut *)calloc(band, sizeof(RowOut));
+  int ok = rows != NULL;
+
+  for (int first = 0; ok && first < mcuRows; first += band) {
+    int count = mcuRows - first < band ? mcuRows - first : band;
+
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+    for (int i = 0; i < count; i++)
+      EncodeMcuRow(&t, rgba, width, height, first + i, &rows[i]);
+
+    for (int i = 0; ok && i < count; i++) {
+      int r = first + i;
+      if (rows[i].failed ||
+          fwrite(rows[i].data, 1, rows[i].len, f) != rows[i].len)
+        ok = 0;
+      else if (r < mcuRows - 1)
+        PutMarker(f, 0xD0 + (r & 7), 0); // RSTn
+    }
+  }
+  PutMarker(f, 0xD9, 0); // end of image
+
+  if (rows) {
+    for (int i = 0; i < band; i++)
+      free(rows[i].data);
+    free(rows);
+  }
+  if (ferror(f))
+    ok = 0;
+  if (fclose(f) != 0)
+    ok = 0;
+  if (!ok)
+    DeleteFileA(path); // no half written files
+  return ok;
+}
+
+const char *JpegWriter_SubsampleName(JpegSubsample subsample) {
+  return (subsample >= 0 && subsample < JPEG_SUBSAMPLE_COUNT)
+             ? g_subsampleNames[subsample]
+             : "420";
+}
+
+int JpegWriter_SubsampleFromName(const char *name) {
+  // "4:2:0" works as well as "420"
+  char digits[8];
+  int n = 0;
+  for (const char *p = name; *p && n < 7; p++) {
+    if (*p != ':')
+      digits[n++] = *p;
+  }
+  digits[n] = '\0';
+  for (int i = 0; i < JPEG_SUBSAMPLE_COUNT; i++) {
+    if (strcmp(digits, g_subsampleNames[i]) == 0)
+      return i;
+  }
+  return -1;
+}
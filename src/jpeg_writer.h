@@ -0,0 +1,27 @@
+// jpeg writer header
+// baseline jpeg with sse2 color conversion + dct. every mcu row is a
+// restart interval, so rows encode on their own threads and are joined
+// with RSTn markers
+
+#ifndef JPEG_WRITER_H
+#define JPEG_WRITER_H
+
+#include <stddef.h>
+
+typedef enum {
+  JPEG_SUBSAMPLE_420, // chroma at half size both ways (smallest)
+  JPEG_SUBSAMPLE_422, // chroma at half width
+  JPEG_SUBSAMPLE_444, // full chroma (sharpest colour edges)
+  JPEG_SUBSAMPLE_COUNT
+} JpegSubsample;
+
+// rgba in, alpha is dropped. quality 1-100. threads <= 0 uses the openmp
+// default for the calling thread. 0 (and no file left behind) on failure
+int JpegWriter_WriteImage(const char *path, const unsigned char *rgba,
+                          int width, int height, int quality,
+                          JpegSubsample subsample, int threads);
+
+const char *JpegWriter_SubsampleName(JpegSubsample subsample); // "420"...
+int JpegWriter_SubsampleFromName(const char *name); // -1 if unknown
+
+#endif
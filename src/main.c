@@ -10,6 +10,7 @@
 //   scroll         zoom at cursor
 //   drag           pan around
 //   s              slideshow
+//   shift+g        thumbnail grid
 //   ctrl+s         save as png/jpg/bmp
 //   ctrl+z         undo
 //   i              info panel
@@ -24,15 +25,26 @@
 //   esc            exit
 
 #include "../lib/stb_image_write.h"
+#include "anim_clock.h"
+#include "batch.h"
 #include "file_browser.h"
+#include "gdi_cache.h"
 #include "image_loader.h"
+#include "image_ops.h"
+#include "jpeg_writer.h"
+#include "pixel_memory.h"
+#include "png_writer.h"
 #include "renderer.h"
 #include "settings.h"
+#include "stress_decode.h"
+#include "thumb_cache.h"
 #include "ui.h"
 #include <commdlg.h>
+#include <math.h>
 #include <shellapi.h>
 #include <shlobj.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <windows.h>
 #include <windowsx.h>
 
@@ -43,6 +55,7 @@
 // Timer IDs
 #define TIMER_SLIDESHOW 1
 #define TIMER_ANIMATION 2
+#define TIMER_WHEEL 3
 
 // Slideshow speed limits (milliseconds)
 #define SLIDESHOW_MIN_INTERVAL 500
@@ -52,6 +65,7 @@
 ImageData g_image = {0};
 Renderer g_renderer = {0};
 FileBrowser g_browser = {0};
+AnimClock g_animClock = {0}; // gif playback
 BOOL g_fullscreen = FALSE;
 static WINDOWPLACEMENT g_prevPlacement = {sizeof(g_prevPlacement)};
 
@@ -62,6 +76,11 @@ static int g_panStartY = 0;
 static int g_offsetStartX = 0;
 static int g_offsetStartY = 0;
 
+// Wheel zoom pacing (local to this file)
+static int g_frameMs = 16;          // one display refresh
+static LONGLONG g_wheelFrameAt = 0; // qpc time of the last wheel repaint
+static BOOL g_wheelTimer = FALSE;   // a repaint is booked for later
+
 // Slideshow state (shared)
 BOOL g_slideshowActive = FALSE;
 int g_slideshowInterval = 3000; // 3 seconds default
@@ -71,12 +90,18 @@ DWORD g_slideshowStartTime = 0;
 BOOL g_showInfo = FALSE;
 BOOL g_darkTheme = TRUE;
 BOOL g_showThumbnails = FALSE;
+BOOL g_showGrid = FALSE; // full window thumbnail grid
 BOOL g_showStatusBar = TRUE;
 BOOL g_showEditPanel = FALSE;
 BOOL g_showZoom = TRUE;      // zoom % overlay
 BOOL g_showHelp = FALSE;     // keyboard help popup
 BOOL g_showSettings = FALSE; // settings panel
 
+// Thumbnail grid state (shared)
+int g_gridScrollY = 0;
+int g_gridScrollDir = 1;
+int g_gridSelection = 0;
+
 // Selection mode for cropping
 BOOL g_selectMode = FALSE;
 RECT g_selection = {0, 0, 0, 0};
@@ -90,6 +115,11 @@ float g_editContrast = 1.0f;   // 0.5 to 2.0
 float g_editSaturation = 1.0f; // 0.0 to 2.0
 int g_editSelection = 0;       // 0=brightness, 1=contrast, 2=saturation
 
+// every edit since the image was loaded, in batch op form (ctrl+e saves it)
+static ImageOpList g_editLog;
+static ImageOpList g_editLogUndo; // the log as it was at the undo copy
+static BOOL g_editLogFull = FALSE;
+
 // UI constants (now in app_state.h)
 #define THUMB_SIZE 80
 #define THUMB_PADDING 5
@@ -119,94 +149,156 @@ void SetAsWallpaper(void);
 void PrintImage(HWND hwnd);
 void SaveImage(HWND hwnd);
 void ApplyEdits(HWND hwnd);
-
-// Batch processing mode (returns 1 if batch mode was used, 0 for normal GUI)
-int RunBatchMode(int argc, char *argv[]) {
-  if (argc < 3)
+void SaveEditLog(HWND hwnd);
+void ToggleGrid(HWND hwnd);
+void OpenGridSelection(HWND hwnd);
+BOOL HandleGridKey(HWND hwnd, WPARAM key);
+
+// pixel_memory.c evictor for the undo pool - ctrl+z just has nothing to go
+// back to afterwards
+static size_t EvictUndo(size_t bytes) {
+  (void)bytes;
+  if (!g_image.undo)
     return 0;
+  size_t before = PixelMemory_Used(PIXMEM_UNDO);
+  ImageLoader_FreePixels(&g_image, g_image.undo);
+  g_image.undo = NULL;
+  return before - PixelMemory_Used(PIXMEM_UNDO);
+}
 
-  // Check for --batch-upscale
-  if (strcmp(argv[1], "--batch-upscale") == 0) {
-    const char *folder = argv[2];
-    int scale = (argc > 3) ? atoi(argv[3]) : 2; // default 2x
-
-    // Attach console for output
-    AttachConsole(ATTACH_PARENT_PROCESS);
-    FILE *con = freopen("CONOUT$", "w", stdout);
-
-    printf("\npix batch upscale\n");
-    printf("folder: %s\n", folder);
-    printf("scale: %dx\n", scale);
-    printf("--------------------------------\n");
-
-    // Create output folder
-    char outFolder[MAX_PATH];
-    snprintf(outFolder, sizeof(outFolder), "%s\\upscaled", folder);
-    CreateDirectoryA(outFolder, NULL);
-
-    // Find all images
-    char searchPath[MAX_PATH];
-    snprintf(searchPath, sizeof(searchPath), "%s\\*.*", folder);
-
-    WIN32_FIND_DATAA findData;
-    HANDLE hFind = FindFirstFileA(searchPath, &findData);
-    int processed = 0;
-
-    if (hFind != INVALID_HANDLE_VALUE) {
-      do {
-        if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
-          // Check if image file
-          const char *ext = strrchr(findData.cFileName, '.');
-          if (ext &&
-              (_stricmp(ext, ".jpg") == 0 || _stricmp(ext, ".jpeg") == 0 ||
-               _stricmp(ext, ".png") == 0 || _stricmp(ext, ".bmp") == 0)) {
-
-            char inputPath[MAX_PATH];
-            snprintf(inputPath, sizeof(inputPath), "%s\\%s", folder,
-                     findData.cFileName);
-
-            printf("processing: %s ... ", findData.cFileName);
-            fflush(stdout);
-
-            // Load image
-            ImageData img = {0};
-            if (ImageLoader_Load(inputPath, &img)) {
-              // Upscale
-              int newW = img.width * scale;
-              int newH = img.height * scale;
-              ImageLoader_ResizeLanczos(&img, newW, newH);
-
-              // Save to output folder
-              char outputPath[MAX_PATH];
-              snprintf(outputPath, sizeof(outputPath), "%s\\%s", outFolder,
-                       findData.cFileName);
-
-              // Use stbi_write for PNG output
-              stbi_write_png(outputPath, img.width, img.height, 4, img.pixels,
-                             img.width * 4);
-
-              ImageLoader_Free(&img);
-              printf("done (%dx%d)\n", newW, newH);
-              processed++;
-            } else {
-              printf("failed to load\n");
-            }
-          }
-        }
-      } while (FindNextFileA(hFind, &findData));
-      FindClose(hFind);
+// and for the mip pyramid - the next zoomed out paint just builds it again
+static size_t EvictMips(size_t bytes) {
+  (void)bytes;
+  return Renderer_FreeMips(&g_renderer);
+}
+
+// repaints part of the image (in image pixels, NULL for all of it) where
+// it is on screen now. a couple of pixels over, for the box filter's edges
+static void InvalidateImage(HWND hwnd, const RECT *part) {
+  RECT all = {0, 0, g_image.width, g_image.height};
+  if (!part)
+    part = &all;
+  float s = g_renderer.scale;
+  RECT r = {g_renderer.offsetX + (int)(part->left * s) - 2,
+            g_renderer.offsetY + (int)(part->top * s) - 2,
+            g_renderer.offsetX + (int)(part->right * s) + 2,
+            g_renderer.offsetY + (int)(part->bottom * s) + 2};
+  InvalidateRect(hwnd, &r, FALSE);
+}
+
+// repaints just one overlay, whether its being shown, hidden or changed
+static void InvalidateOverlay(HWND hwnd, Overlay overlay) {
+  RECT clientRect, rect;
+  GetClientRect(hwnd, &clientRect);
+  OverlayRect(overlay, &clientRect, &rect);
+  InvalidateRect(hwnd, &rect, FALSE);
+}
+
+// the panels that show live numbers: the info panel's frame and fps line,
+// and the settings panel's memory breakdown and gdi counters. those change
+// without anything on them being touched, so whatever moves them calls this
+static void InvalidateReadouts(HWND hwnd) {
+  if (g_showInfo)
+    InvalidateOverlay(hwnd, OVERLAY_INFO);
+  if (g_showSettings)
+    InvalidateOverlay(hwnd, OVERLAY_SETTINGS);
+}
+
+// pans the image by dx, dy. whats already on the window is moved with
+// ScrollWindowEx and only the strips that uncovers get painted - plus the
+// overlays, which stay put while the image slides under them, so theyre
+// repainted where they belong and where the scroll dragged a copy of them
+static void ScrollImage(HWND hwnd, int dx, int dy) {
+  if (!dx && !dy)
+    return;
+  g_renderer.offsetX += dx;
+  g_renderer.offsetY += dy;
+  g_renderer.fitToWindow = FALSE;
+
+  RECT clientRect;
+  GetClientRect(hwnd, &clientRect);
+  if (g_selectMode || abs(dx) >= clientRect.right ||
+      abs(dy) >= clientRect.bottom) {
+    InvalidateRect(hwnd, NULL, FALSE);
+    return;
+  }
+
+  ScrollWindowEx(hwnd, dx, dy, NULL, NULL, NULL, NULL, SW_INVALIDATE);
+  for (int i = 0; i < OVERLAY_COUNT; i++) {
+    RECT rect;
+    if (!OverlayRect((Overlay)i, &clientRect, &rect))
+      continue;
+    InvalidateRect(hwnd, &rect, FALSE);
+    OffsetRect(&rect, dx, dy);
+    InvalidateRect(hwnd, &rect, FALSE);
+  }
+}
+
+// wheel zooms change the view straight away but repaint at most once a
+// display frame - a fast wheel or a touchpad sends far more messages than
+// that, and each one at a new zoom is a full rescale. the title (which
+// shows the zoom) goes with the repaint
+static void RequestWheelFrame(HWND hwnd) {
+  if (g_wheelTimer)
+    return; // the booked frame picks this one up too
+
+  LARGE_INTEGER now, freq;
+  QueryPerformanceCounter(&now);
+  QueryPerformanceFrequency(&freq);
+  LONGLONG sinceMs = (now.QuadPart - g_wheelFrameAt) * 1000 / freq.QuadPart;
+  if (sinceMs < g_frameMs) {
+    g_wheelTimer = TRUE;
+    SetTimer(hwnd, TIMER_WHEEL, g_frameMs - (int)sinceMs, NULL);
+    return;
+  }
+
+  g_wheelFrameAt = now.QuadPart;
+  UpdateWindowTitle(hwnd);
+  InvalidateRect(hwnd, NULL, FALSE);
+}
+
+// shows whichever gif frame the clock says is due. resident gifs jump
+// straight to it, streamed ones step through the ready ring (just pointer
+// swaps) - either way the bitmap is only updated once, and a frame that
+// wasnt ready in time is skipped rather than delaying every one after it
+static void AdvanceAnimation(HWND hwnd) {
+  int wait;
+  int due = AnimClock_Due(&g_animClock, &wait);
+  int from = g_image.currentFrame;
+
+  int moved = 0;
+  if (due != from) {
+    if (ImageLoader_SeekFrame(&g_image, due)) {
+      moved = 1;
+    } else {
+      for (int i = 0; i < g_image.frameCount && g_image.currentFrame != due;
+           i++) {
+        if (!ImageLoader_NextFrame(&g_image))
+          break;
+        moved = 1;
+      }
     }
+    if (g_image.currentFrame != due)
+      wait = USER_TIMER_MINIMUM; // decoder is behind, look again shortly
+  }
 
-    printf("--------------------------------\n");
-    printf("processed %d images\n", processed);
-    printf("output: %s\n\n", outFolder);
+  if (moved) {
+    int stepped = (g_image.currentFrame - from + g_image.frameCount) %
+                  g_image.frameCount;
+    AnimClock_Shown(&g_animClock, stepped - 1);
 
-    if (con)
-      fclose(con);
-    return 1; // batch mode was used
+    // only what the frame changed goes into the dib, it stays put
+    if (!Renderer_UpdateBitmap(&g_renderer, &g_image, &g_image.frameDirty)) {
+      HDC hdc = GetDC(hwnd);
+      Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
+      ReleaseDC(hwnd, hdc);
+    }
+    InvalidateImage(hwnd, &g_image.frameDirty);
+    SetRectEmpty(&g_image.frameDirty);
+    InvalidateReadouts(hwnd);
   }
 
-  return 0; // not batch mode
+  SetTimer(hwnd, TIMER_ANIMATION, wait, NULL);
 }
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
@@ -231,13 +323,22 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     Settings_Load(&g_settings);
     Settings_ApplyThreads(&g_settings);
 
-    if (RunBatchMode(argc, argv)) {
+    if (Batch_Run(argc, argv)) {
       // Batch mode completed, exit
       for (int i = 0; i < argc; i++)
         free(argv[i]);
       free(argv);
       return 0;
     }
+
+    // Debug mode: concurrent decodes checked against a single thread
+    int stress = StressDecode_Run(argc, argv);
+    if (stress) {
+      for (int i = 0; i < argc; i++)
+        free(argv[i]);
+      free(argv);
+      return stress == 1 ? 0 : 1;
+    }
     for (int i = 0; i < argc; i++)
       free(argv[i]);
     free(argv);
@@ -249,6 +350,9 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
   Settings_Load(&g_settings);
   Settings_ApplyThreads(&g_settings);
 
+  // maxMemoryMB caps every pixel buffer the viewer holds (0 = no cap)
+  PixelMemory_SetBudget((size_t)g_settings.maxMemoryMB * 1024 * 1024);
+
   // Initialize components
   Renderer_Init(&g_renderer);
   FileBrowser_Init(&g_browser);
@@ -256,7 +360,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
   // Register window class
   WNDCLASSEXA wc = {0};
   wc.cbSize = sizeof(WNDCLASSEXA);
-  wc.style = CS_HREDRAW | CS_VREDRAW;
+  wc.style = CS_HREDRAW | CS_VREDRAW | CS_DBLCLKS;
   wc.lpfnWndProc = WindowProc;
   wc.hInstance = hInstance;
   wc.hCursor = LoadCursor(NULL, IDC_ARROW);
@@ -287,6 +391,26 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     return 1;
   }
 
+  // Background thumbnail decoding for the grid and strip
+  ThumbCache_Init(hwnd, GRID_THUMB_SIZE);
+  // and high quality zoom rendering
+  Renderer_StartHq(&g_renderer, hwnd);
+  // fonts, brushes and pens for painting, made once
+  GdiCache_Init();
+
+  // wheel zooms repaint at most once per refresh of the screen
+  HDC screenDC = GetDC(NULL);
+  int refresh = GetDeviceCaps(screenDC, VREFRESH);
+  ReleaseDC(NULL, screenDC);
+  if (refresh > 1)
+    g_frameMs = 1000 / refresh;
+
+  // the undo copy goes before the image itself would fail to fit, and
+  // windows running low on ram empties the caches
+  PixelMemory_SetEvictor(PIXMEM_UNDO, EvictUndo);
+  PixelMemory_SetEvictor(PIXMEM_MIPS, EvictMips);
+  PixelMemory_WatchPressure(hwnd);
+
   // Check if file was passed as command line argument
   if (lpCmdLine && lpCmdLine[0] != '\0') {
     // Remove quotes if present
@@ -313,8 +437,14 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
   }
 
   // Cleanup
+  PixelMemory_StopWatching();
+  ThumbCache_Shutdown();
+  AnimClock_Stop(&g_animClock);
   ImageLoader_Free(&g_image);
+  Renderer_StopHq(&g_renderer);
   Renderer_Cleanup(&g_renderer);
+  GdiCache_Free();
+  FileBrowser_Free(&g_browser);
 
   return (int)msg.wParam;
 }
@@ -322,13 +452,21 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 void LoadImageFile(HWND hwnd, const char *filepath) {
   // Stop any existing animation
   KillTimer(hwnd, TIMER_ANIMATION);
+  AnimClock_Stop(&g_animClock);
 
   // Free previous image
   ImageLoader_Free(&g_image);
   Renderer_Cleanup(&g_renderer);
 
-  // Load new image
-  if (ImageLoader_Load(filepath, &g_image)) {
+  // new image, new edit log
+  ImageOps_Clear(&g_editLog);
+  ImageOps_Clear(&g_editLogUndo);
+  g_editLogFull = FALSE;
+
+  // Load new image, in the order the dib wants
+  ImageLoadContext load = {0};
+  load.flags = IMAGE_LOAD_BGRA;
+  if (ImageLoader_Load(filepath, &g_image, &load)) {
     // Load directory for navigation
     FileBrowser_LoadDirectory(&g_browser, filepath);
 
@@ -343,10 +481,13 @@ void LoadImageFile(HWND hwnd, const char *filepath) {
 
     ReleaseDC(hwnd, hdc);
 
-    // Start animation timer for animated GIFs
-    if (g_image.isAnimated) {
-      int delay = ImageLoader_GetFrameDelay(&g_image);
-      SetTimer(hwnd, TIMER_ANIMATION, delay, NULL);
+    // Start the playback clock for animated GIFs, frame 0 is up already
+    if (g_image.isAnimated &&
+        AnimClock_Start(&g_animClock, g_image.frameDelays,
+                        g_image.frameCount)) {
+      int wait;
+      AnimClock_Due(&g_animClock, &wait);
+      SetTimer(hwnd, TIMER_ANIMATION, wait, NULL);
     }
 
     UpdateWindowTitle(hwnd);
@@ -354,7 +495,7 @@ void LoadImageFile(HWND hwnd, const char *filepath) {
   } else {
     char msg[512];
     snprintf(msg, sizeof(msg), "Failed to load image:\n%s\n\nError: %s",
-             filepath, ImageLoader_GetError());
+             filepath, load.error);
     MessageBoxA(hwnd, msg, "Error", MB_ICONERROR);
   }
 }
@@ -449,6 +590,7 @@ void ToggleTheme(void) {
     g_statusBarColor = RGB(235, 235, 238);
     g_accentColor = RGB(0, 100, 180);
   }
+  GdiCache_SetTheme();
 }
 
 void CopyImageToClipboard(HWND hwnd) {
@@ -483,15 +625,16 @@ void CopyImageToClipboard(HWND hwnd) {
   bih->biCompression = BI_RGB;
   bih->biSizeImage = imageSize;
 
-  // Copy pixels (RGBA -> BGR, flip vertically)
+  // Copy pixels (-> BGR, flip vertically)
+  int b = g_image.pixelFormat == PIXEL_BGRA ? 0 : 2;
   BYTE *dst = pData + sizeof(BITMAPINFOHEADER);
   for (int y = 0; y < height; y++) {
     BYTE *srcRow = g_image.pixels + (height - 1 - y) * width * 4;
     BYTE *dstRow = dst + y * rowBytes;
     for (int x = 0; x < width; x++) {
-      dstRow[x * 3 + 0] = srcRow[x * 4 + 2]; // B
-      dstRow[x * 3 + 1] = srcRow[x * 4 + 1]; // G
-      dstRow[x * 3 + 2] = srcRow[x * 4 + 0]; // R
+      dstRow[x * 3 + 0] = srcRow[x * 4 + b];     // B
+      dstRow[x * 3 + 1] = srcRow[x * 4 + 1];     // G
+      dstRow[x * 3 + 2] = srcRow[x * 4 + 2 - b]; // R
     }
   }
 
@@ -631,20 +774,25 @@ void PrintImage(HWND hwnd) {
     bmi.bmiHeader.biBitCount = 32;
     bmi.bmiHeader.biCompression = BI_RGB;
 
-    // Convert RGBA to BGRA for Windows
-    BYTE *pixels = (BYTE *)malloc(g_image.width * g_image.height * 4);
-    for (int i = 0; i < g_image.width * g_image.height; i++) {
-      pixels[i * 4 + 0] = g_image.pixels[i * 4 + 2]; // B
-      pixels[i * 4 + 1] = g_image.pixels[i * 4 + 1]; // G
-      pixels[i * 4 + 2] = g_image.pixels[i * 4 + 0]; // R
-      pixels[i * 4 + 3] = g_image.pixels[i * 4 + 3]; // A
+    // bgra already goes straight to the printer, rgba needs a copy
+    BYTE *pixels = g_image.pixels;
+    if (g_image.pixelFormat != PIXEL_BGRA) {
+      size_t count = (size_t)g_image.width * g_image.height;
+      pixels = (BYTE *)PixelMemory_Alloc(count * 4, PIXMEM_RENDERER);
+      if (!pixels) {
+        AbortDoc(printerDC);
+        DeleteDC(printerDC);
+        return;
+      }
+      ImageLoader_SwizzleRB(pixels, g_image.pixels, count);
     }
 
     SetStretchBltMode(printerDC, HALFTONE);
     StretchDIBits(printerDC, x, y, printWidth, printHeight, 0, 0, g_image.width,
                   g_image.height, pixels, &bmi, DIB_RGB_COLORS, SRCCOPY);
 
-    free(pixels);
+    if (pixels != g_image.pixels)
+      PixelMemory_Free(pixels);
 
     EndPage(printerDC);
     EndDoc(printerDC);
@@ -653,6 +801,60 @@ void PrintImage(HWND hwnd) {
   DeleteDC(printerDC);
 }
 
+// only for edits that went through - the ones that need memory for a new
+// buffer leave the image alone when they dont get it, and --ops-file
+// shouldnt replay what the user never saw
+static void LogEdit(ImageOpType type, int arg, float value) {
+  ImageOp op = {0};
+  op.type = type;
+  op.args[0] = arg;
+  op.value = value;
+  if (!ImageOps_Append(&g_editLog, &op))
+    g_editLogFull = TRUE;
+}
+
+// call right before an edit that saves an undo copy (rotate, flip, crop,
+// reset) so ctrl+z can swap the log back together with the pixels
+static void LogUndoPoint(void) { g_editLogUndo = g_editLog; }
+
+void SaveEditLog(HWND hwnd) {
+  if (!g_image.pixels)
+    return;
+  if (g_editLog.count == 0) {
+    MessageBoxA(hwnd, "No edits to save yet", "Save Edits",
+                MB_ICONINFORMATION);
+    return;
+  }
+
+  char filename[MAX_PATH] = "edits.txt";
+
+  OPENFILENAMEA ofn = {0};
+  ofn.lStructSize = sizeof(ofn);
+  ofn.hwndOwner = hwnd;
+  ofn.lpstrFilter = "Edit Log\0*.txt\0All Files\0*.*\0";
+  ofn.lpstrFile = filename;
+  ofn.nMaxFile = MAX_PATH;
+  ofn.lpstrDefExt = "txt";
+  ofn.Flags = OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST;
+
+  if (!GetSaveFileNameA(&ofn))
+    return;
+
+  if (!ImageOps_WriteFile(&g_editLog, filename)) {
+    MessageBoxA(hwnd, "Failed to save edit log", "Error", MB_ICONERROR);
+    return;
+  }
+
+  char msg[MAX_PATH + 256];
+  snprintf(msg, sizeof(msg),
+           "Saved %d edits%s.\n\nApply them to a folder with:\n"
+           "pix --batch <folder> --ops-file \"%s\"",
+           g_editLog.count,
+           g_editLogFull ? " (log was full, later edits were left out)" : "",
+           filename);
+  MessageBoxA(hwnd, msg, "Save Edits", MB_ICONINFORMATION);
+}
+
 void SaveImage(HWND hwnd) {
   if (!g_image.pixels)
     return;
@@ -676,25 +878,33 @@ void SaveImage(HWND hwnd) {
   int height = g_image.height;
   int success = 0;
 
+  // the writers take rgba - swap in place for the write and back after,
+  // rather than holding a second copy of the image
+  PixelFormat viewFormat = g_image.pixelFormat;
+  ImageLoader_SetPixelFormat(&g_image, PIXEL_RGBA);
+
   // determine format from extension
   const char *ext = strrchr(filename, '.');
 
   if (ext && (_stricmp(ext, ".png") == 0)) {
-    // save as png
-    success =
-        stbi_write_png(filename, width, height, 4, g_image.pixels, width * 4);
+    // save as png (parallel writer, level from settings)
+    success = PngWriter_WriteImage(filename, g_image.pixels, width, height,
+                                   (PngLevel)g_settings.pngLevel, 0);
   } else if (ext &&
              (_stricmp(ext, ".jpg") == 0 || _stricmp(ext, ".jpeg") == 0)) {
-    // save as jpg (quality 90)
-    success = stbi_write_jpg(filename, width, height, 4, g_image.pixels, 90);
+    // save as jpg (quality + chroma from settings)
+    success = JpegWriter_WriteImage(filename, g_image.pixels, width, height,
+                                    g_settings.jpegQuality,
+                                    (JpegSubsample)g_settings.jpegSubsample, 0);
   } else if (ext && (_stricmp(ext, ".bmp") == 0)) {
     // save as bmp
     success = stbi_write_bmp(filename, width, height, 4, g_image.pixels);
   } else {
     // default to png
-    success =
-        stbi_write_png(filename, width, height, 4, g_image.pixels, width * 4);
+    success = PngWriter_WriteImage(filename, g_image.pixels, width, height,
+                                   (PngLevel)g_settings.pngLevel, 0);
   }
+  ImageLoader_SetPixelFormat(&g_image, viewFormat);
 
   if (success) {
     MessageBoxA(hwnd, "Image saved successfully!", "Save", MB_ICONINFORMATION);
@@ -705,6 +915,93 @@ void SaveImage(HWND hwnd) {
 
 // Draw functions are now in ui.c
 
+void ToggleGrid(HWND hwnd) {
+  g_showGrid = !g_showGrid;
+  if (g_showGrid) {
+    // Start on the image being viewed
+    RECT clientRect;
+    GetClientRect(hwnd, &clientRect);
+    g_gridSelection = g_browser.currentIndex < 0 ? 0 : g_browser.currentIndex;
+    GridEnsureVisible(&clientRect, g_gridSelection);
+  }
+  InvalidateRect(hwnd, NULL, TRUE);
+}
+
+void OpenGridSelection(HWND hwnd) {
+  if (g_gridSelection < 0 || g_gridSelection >= g_browser.fileCount)
+    return;
+
+  // copy first - loading rescans the folder and frees the list entries
+  char path[MAX_PATH];
+  strncpy(path, g_browser.files[g_gridSelection], MAX_PATH - 1);
+  path[MAX_PATH - 1] = '\0';
+
+  g_showGrid = FALSE;
+  LoadImageFile(hwnd, path);
+  InvalidateRect(hwnd, NULL, TRUE);
+}
+
+// Keyboard navigation inside the grid, returns TRUE if the key was used
+BOOL HandleGridKey(HWND hwnd, WPARAM key) {
+  RECT clientRect, area;
+  GetClientRect(hwnd, &clientRect);
+  GridGetArea(&clientRect, &area);
+
+  int cols = GridColumns(&clientRect);
+  int pageRows = (area.bottom - area.top) / GRID_CELL_HEIGHT;
+  if (pageRows < 1)
+    pageRows = 1;
+
+  int sel = g_gridSelection;
+  switch (key) {
+  case VK_LEFT:
+    sel--;
+    break;
+  case VK_RIGHT:
+    sel++;
+    break;
+  case VK_UP:
+    sel -= cols;
+    break;
+  case VK_DOWN:
+    sel += cols;
+    break;
+  case VK_PRIOR:
+    sel -= cols * pageRows;
+    break;
+  case VK_NEXT:
+    sel += cols * pageRows;
+    break;
+  case VK_HOME:
+    sel = 0;
+    break;
+  case VK_END:
+    sel = g_browser.fileCount - 1;
+    break;
+  case VK_RETURN:
+    OpenGridSelection(hwnd);
+    return TRUE;
+  case VK_ESCAPE:
+    ToggleGrid(hwnd);
+    return TRUE;
+  default:
+    return FALSE;
+  }
+
+  if (g_browser.fileCount == 0)
+    return TRUE;
+  if (sel < 0)
+    sel = 0;
+  if (sel >= g_browser.fileCount)
+    sel = g_browser.fileCount - 1;
+
+  g_gridScrollDir = (sel >= g_gridSelection) ? 1 : -1;
+  g_gridSelection = sel;
+  GridEnsureVisible(&clientRect, sel);
+  InvalidateRect(hwnd, NULL, FALSE);
+  return TRUE;
+}
+
 void ApplyEdits(HWND hwnd) {
   if (!g_image.pixels)
     return;
@@ -712,12 +1009,15 @@ void ApplyEdits(HWND hwnd) {
   // Apply all edits
   if (g_editBrightness != 0) {
     ImageLoader_AdjustBrightness(&g_image, g_editBrightness);
+    LogEdit(IMAGE_OP_BRIGHTNESS, g_editBrightness, 0);
   }
   if (g_editContrast != 1.0f) {
     ImageLoader_AdjustContrast(&g_image, g_editContrast);
+    LogEdit(IMAGE_OP_CONTRAST, 0, g_editContrast);
   }
   if (g_editSaturation != 1.0f) {
     ImageLoader_AdjustSaturation(&g_image, g_editSaturation);
+    LogEdit(IMAGE_OP_SATURATION, 0, g_editSaturation);
   }
 
   // Reset edit values
@@ -744,41 +1044,29 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     return 1;
 
   case WM_PAINT: {
-    PAINTSTRUCT ps;
-    HDC hdc = BeginPaint(hwnd, &ps);
-
     RECT clientRect;
     GetClientRect(hwnd, &clientRect);
     int width = clientRect.right - clientRect.left;
     int height = clientRect.bottom - clientRect.top;
 
-    // Create double buffer
-    HDC memDC = CreateCompatibleDC(hdc);
-    HBITMAP memBitmap = CreateCompatibleBitmap(hdc, width, height);
-    HBITMAP oldBitmap = SelectObject(memDC, memBitmap);
+    // Draw into the persistent back buffer (gdi_cache.c), clipped to the
+    // part of the window that needs it - everything below is drawn as if
+    // for the whole window, gdi drops whats outside
+    PAINTSTRUCT ps;
+    HDC memDC = GdiCache_BeginPaint(hwnd, &ps, width, height);
 
     // Fill background with theme color
-    HBRUSH bgBrush = CreateSolidBrush(g_bgColor);
-    FillRect(memDC, &clientRect, bgBrush);
-    DeleteObject(bgBrush);
+    FillRect(memDC, &clientRect, GdiCache_Brush(UI_BRUSH_BG));
 
-    // Draw image to buffer
-    if (g_image.pixels && g_renderer.hMemDC) {
+    // Draw image to buffer (the grid replaces it while open)
+    if (g_showGrid) {
+      DrawThumbnailGrid(memDC, &clientRect);
+    } else if (g_image.pixels && g_renderer.hMemDC) {
       int scaledWidth = (int)(g_image.width * g_renderer.scale);
       int scaledHeight = (int)(g_image.height * g_renderer.scale);
 
-      // use nearest-neighbor when zoomed in (sharp pixels)
-      // use halftone when zoomed out (smooth downscaling)
-      if (g_renderer.scale >= 1.0f) {
-        SetStretchBltMode(memDC, COLORONCOLOR);
-      } else {
-        SetStretchBltMode(memDC, HALFTONE);
-        SetBrushOrgEx(memDC, 0, 0, NULL);
-      }
-
-      StretchBlt(memDC, g_renderer.offsetX, g_renderer.offsetY, scaledWidth,
-                 scaledHeight, g_renderer.hMemDC, 0, 0, g_image.width,
-                 g_image.height, SRCCOPY);
+      // only the part of the image inside the window gets scaled
+      Renderer_DrawView(&g_renderer, memDC, &clientRect);
 
       // Draw selection rectangle if in crop mode
       if (g_selectMode) {
@@ -793,7 +1081,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
             (int)((g_selection.bottom - g_selection.top) * g_renderer.scale);
 
         // Dim area outside selection
-        HBRUSH dimBrush = CreateSolidBrush(RGB(0, 0, 0));
+        HBRUSH dimBrush = GdiCache_Brush(UI_BRUSH_DIM);
         RECT topDim = {g_renderer.offsetX, g_renderer.offsetY,
                        g_renderer.offsetX + scaledWidth, selY};
         RECT bottomDim = {g_renderer.offsetX, selY + selH,
@@ -808,16 +1096,13 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
         FillRect(memDC, &bottomDim, dimBrush);
         FillRect(memDC, &leftDim, dimBrush);
         FillRect(memDC, &rightDim, dimBrush);
-        DeleteObject(dimBrush);
 
         // Draw selection border
-        HPEN selPen = CreatePen(PS_DASH, 2, RGB(255, 255, 255));
-        HPEN oldPen = SelectObject(memDC, selPen);
+        HPEN oldPen = SelectObject(memDC, GdiCache_Pen(UI_PEN_SELECTION));
         HBRUSH oldBrush = SelectObject(memDC, GetStockObject(NULL_BRUSH));
         Rectangle(memDC, selX, selY, selX + selW, selY + selH);
         SelectObject(memDC, oldBrush);
         SelectObject(memDC, oldPen);
-        DeleteObject(selPen);
 
         // Draw crop size text
         char cropText[64];
@@ -841,26 +1126,23 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     }
 
     // Draw info panel overlay to buffer
-    DrawInfoPanel(memDC, &clientRect);
+    if (!g_showGrid)
+      DrawInfoPanel(memDC, &clientRect);
 
     // Draw slideshow progress bar at top
     DrawSlideshowProgress(memDC, &clientRect);
 
     // Draw zoom percentage overlay
-    DrawZoomOverlay(memDC, &clientRect);
+    if (!g_showGrid)
+      DrawZoomOverlay(memDC, &clientRect);
 
     // Draw slideshow indicator to buffer
     if (g_slideshowActive) {
       SetBkMode(memDC, TRANSPARENT);
       SetTextColor(memDC, g_accentColor);
-      HFONT font =
-          CreateFontA(14, 0, 0, 0, FW_SEMIBOLD, FALSE, FALSE, FALSE,
-                      DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
-                      CLEARTYPE_QUALITY, DEFAULT_PITCH | FF_SWISS, "Segoe UI");
-      HFONT oldFont = SelectObject(memDC, font);
+      HFONT oldFont = SelectObject(memDC, GdiCache_Font(UI_FONT_LABEL));
       TextOutA(memDC, 15, 10, "SLIDESHOW", 9);
       SelectObject(memDC, oldFont);
-      DeleteObject(font);
     }
 
     // Draw status bar (hide in fullscreen for cleaner look)
@@ -878,19 +1160,42 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     DrawSettingsOverlay(memDC, &clientRect);
 
     // Draw thumbnail strip at bottom
-    DrawThumbnailStrip(hwnd, memDC, &clientRect);
+    if (!g_showGrid)
+      DrawThumbnailStrip(hwnd, memDC, &clientRect);
 
     // Copy buffer to screen in one operation (no flicker!)
-    BitBlt(hdc, 0, 0, width, height, memDC, 0, 0, SRCCOPY);
+    GdiCache_EndPaint(hwnd, &ps);
+    return 0;
+  }
 
-    // Cleanup double buffer
-    SelectObject(memDC, oldBitmap);
-    DeleteObject(memBitmap);
-    DeleteDC(memDC);
+  case WM_MEMORY_PRESSURE:
+    PixelMemory_Relieve();
+    if (g_showGrid) {
+      InvalidateRect(hwnd, NULL, FALSE);
+    } else {
+      if (g_showThumbnails)
+        InvalidateOverlay(hwnd, OVERLAY_STRIP);
+      InvalidateReadouts(hwnd);
+    }
+    return 0;
 
-    EndPaint(hwnd, &ps);
+  case WM_THUMB_READY:
+    // A worker finished a thumbnail - cache it and repaint
+    ThumbCache_Commit(lParam);
+    if (g_showGrid)
+      InvalidateRect(hwnd, NULL, FALSE);
+    else if (g_showThumbnails)
+      InvalidateOverlay(hwnd, OVERLAY_STRIP);
+    return 0;
+
+  case WM_RENDER_READY:
+    // the lanczos pass for the current view is done, paint picks it up
+    // (the finished view cache moved the memory and gdi numbers too)
+    if (!g_showGrid && g_image.pixels) {
+      InvalidateImage(hwnd, NULL);
+      InvalidateReadouts(hwnd);
+    }
     return 0;
-  }
 
   case WM_TIMER: {
     if (wParam == TIMER_SLIDESHOW && g_slideshowActive) {
@@ -900,24 +1205,25 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
         LoadImageFile(hwnd, next);
       }
     } else if (wParam == TIMER_ANIMATION && g_image.isAnimated) {
-      // Advance GIF frame
-      if (ImageLoader_NextFrame(&g_image)) {
-        // Recreate bitmap with new frame
-        HDC hdc = GetDC(hwnd);
-        Renderer_Cleanup(&g_renderer);
-        Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
-        ReleaseDC(hwnd, hdc);
-        InvalidateRect(hwnd, NULL, FALSE);
-
-        // Set timer for next frame
-        int delay = ImageLoader_GetFrameDelay(&g_image);
-        SetTimer(hwnd, TIMER_ANIMATION, delay, NULL);
-      }
+      AdvanceAnimation(hwnd);
+    } else if (wParam == TIMER_WHEEL) {
+      // the wheel frame booked by RequestWheelFrame, due now
+      KillTimer(hwnd, TIMER_WHEEL);
+      g_wheelTimer = FALSE;
+      g_wheelFrameAt = 0;
+      RequestWheelFrame(hwnd);
     }
     return 0;
   }
 
   case WM_SIZE: {
+    // grow the back buffer now rather than in the next paint
+    GdiCache_Resize(hwnd);
+    if (g_showGrid) {
+      RECT clientRect;
+      GetClientRect(hwnd, &clientRect);
+      GridClampScroll(&clientRect);
+    }
     if (g_image.pixels && g_renderer.fitToWindow) {
       RECT clientRect;
       GetClientRect(hwnd, &clientRect);
@@ -928,6 +1234,10 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
   }
 
   case WM_KEYDOWN: {
+    // Grid navigation takes the arrows, paging keys, enter and esc
+    if (g_showGrid && HandleGridKey(hwnd, wParam))
+      return 0;
+
     switch (wParam) {
     case 'O': // Open file
       if (FileBrowser_OpenDialog(&g_browser, hwnd)) {
@@ -937,12 +1247,19 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 
     case 'I': // Toggle info panel
       g_showInfo = !g_showInfo;
-      InvalidateRect(hwnd, NULL, TRUE);
+      InvalidateOverlay(hwnd, OVERLAY_INFO);
       break;
 
-    case 'G': // Toggle thumbnail strip
-      g_showThumbnails = !g_showThumbnails;
-      InvalidateRect(hwnd, NULL, TRUE);
+    case 'G': // Toggle thumbnail strip (Shift+G for the full grid)
+      if (GetKeyState(VK_SHIFT) & 0x8000) {
+        ToggleGrid(hwnd);
+      } else {
+        // the status bar sits on the strip, so it moves too
+        InvalidateOverlay(hwnd, OVERLAY_STATUS);
+        g_showThumbnails = !g_showThumbnails;
+        InvalidateOverlay(hwnd, OVERLAY_STRIP);
+        InvalidateOverlay(hwnd, OVERLAY_STATUS);
+      }
       break;
 
     case VK_LEFT: // Adjust edit value or previous image
@@ -960,7 +1277,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
           if (g_editSaturation < 0.0f)
             g_editSaturation = 0.0f;
         }
-        InvalidateRect(hwnd, NULL, TRUE);
+        InvalidateOverlay(hwnd, OVERLAY_EDIT);
       } else {
         const char *prev = FileBrowser_Previous(&g_browser);
         if (prev)
@@ -983,7 +1300,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
           if (g_editSaturation > 2.0f)
             g_editSaturation = 2.0f;
         }
-        InvalidateRect(hwnd, NULL, TRUE);
+        InvalidateOverlay(hwnd, OVERLAY_EDIT);
       } else {
         const char *next = FileBrowser_Next(&g_browser);
         if (next)
@@ -998,12 +1315,14 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
       break;
     }
 
-    case 'E': // Toggle edit panel (Shift+E for explorer)
-      if (GetKeyState(VK_SHIFT) & 0x8000) {
+    case 'E': // Toggle edit panel (Shift+E for explorer, Ctrl+E saves edits)
+      if (GetKeyState(VK_CONTROL) & 0x8000) {
+        SaveEditLog(hwnd);
+      } else if (GetKeyState(VK_SHIFT) & 0x8000) {
         OpenInExplorer();
       } else {
         g_showEditPanel = !g_showEditPanel;
-        InvalidateRect(hwnd, NULL, TRUE);
+        InvalidateOverlay(hwnd, OVERLAY_EDIT);
       }
       break;
 
@@ -1016,20 +1335,22 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     case VK_UP: // Edit panel navigation
       if (g_showEditPanel) {
         g_editSelection = (g_editSelection + 2) % 3;
-        InvalidateRect(hwnd, NULL, TRUE);
+        InvalidateOverlay(hwnd, OVERLAY_EDIT);
       }
       break;
 
     case VK_DOWN:
       if (g_showEditPanel) {
         g_editSelection = (g_editSelection + 1) % 3;
-        InvalidateRect(hwnd, NULL, TRUE);
+        InvalidateOverlay(hwnd, OVERLAY_EDIT);
       }
       break;
 
     case 'R': { // Rotate right 90°
       if (g_image.pixels) {
-        ImageLoader_RotateRight(&g_image);
+        LogUndoPoint();
+        if (ImageLoader_RotateRight(&g_image))
+          LogEdit(IMAGE_OP_ROTATE, 1, 0);
         // Recreate bitmap
         HDC hdc = GetDC(hwnd);
         Renderer_Cleanup(&g_renderer);
@@ -1046,7 +1367,9 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 
     case 'L': { // Rotate left 90°
       if (g_image.pixels) {
-        ImageLoader_RotateLeft(&g_image);
+        LogUndoPoint();
+        if (ImageLoader_RotateLeft(&g_image))
+          LogEdit(IMAGE_OP_ROTATE, 3, 0);
         HDC hdc = GetDC(hwnd);
         Renderer_Cleanup(&g_renderer);
         Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1062,7 +1385,9 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 
     case 'H': { // Flip horizontal
       if (g_image.pixels) {
+        LogUndoPoint();
         ImageLoader_FlipHorizontal(&g_image);
+        LogEdit(IMAGE_OP_FLIP, 0, 0);
         HDC hdc = GetDC(hwnd);
         Renderer_Cleanup(&g_renderer);
         Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1074,7 +1399,9 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 
     case 'V': { // Flip vertical
       if (g_image.pixels) {
+        LogUndoPoint();
         ImageLoader_FlipVertical(&g_image);
+        LogEdit(IMAGE_OP_FLIP, 1, 0);
         HDC hdc = GetDC(hwnd);
         Renderer_Cleanup(&g_renderer);
         Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1107,8 +1434,13 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
         int cropW = g_selection.right - g_selection.left;
         int cropH = g_selection.bottom - g_selection.top;
         if (cropW > 0 && cropH > 0) {
+          LogUndoPoint();
           ImageLoader_SaveUndo(&g_image);
-          ImageLoader_Crop(&g_image, cropX, cropY, cropW, cropH);
+          if (ImageLoader_Crop(&g_image, cropX, cropY, cropW, cropH)) {
+            ImageOp crop = {IMAGE_OP_CROP, {cropX, cropY, cropW, cropH}, 0};
+            if (!ImageOps_Append(&g_editLog, &crop))
+              g_editLogFull = TRUE;
+          }
           HDC hdc = GetDC(hwnd);
           Renderer_Cleanup(&g_renderer);
           Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1127,6 +1459,11 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
       if (GetKeyState(VK_CONTROL) & 0x8000) {
         // Ctrl+Z = Undo
         if (g_image.pixels && ImageLoader_Undo(&g_image)) {
+          // the log swaps along with the pixels (so ctrl+z again redoes)
+          ImageOpList log = g_editLog;
+          g_editLog = g_editLogUndo;
+          g_editLogUndo = log;
+
           // Recreate bitmap with restored state
           HDC hdc = GetDC(hwnd);
           Renderer_Cleanup(&g_renderer);
@@ -1141,7 +1478,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
       } else {
         // Z alone = toggle zoom overlay
         g_showZoom = !g_showZoom;
-        InvalidateRect(hwnd, NULL, TRUE);
+        InvalidateOverlay(hwnd, OVERLAY_ZOOM);
       }
       break;
     }
@@ -1153,24 +1490,24 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     case VK_OEM_2: // ? key (/ with shift) or / without - toggle help
       if (GetKeyState(VK_SHIFT) & 0x8000) {
         g_showHelp = !g_showHelp;
-        InvalidateRect(hwnd, NULL, TRUE);
+        InvalidateOverlay(hwnd, OVERLAY_HELP);
       }
       break;
 
     case VK_F1: // F1 also toggles help
       g_showHelp = !g_showHelp;
-      InvalidateRect(hwnd, NULL, TRUE);
+      InvalidateOverlay(hwnd, OVERLAY_HELP);
       break;
 
     case VK_F2: // F2 opens settings panel
       g_showSettings = !g_showSettings;
-      InvalidateRect(hwnd, NULL, TRUE);
+      InvalidateOverlay(hwnd, OVERLAY_SETTINGS);
       break;
 
     case 'M': // Cycle max image size (when settings panel is open)
       if (g_showSettings) {
         Settings_CycleMaxSize(&g_settings);
-        InvalidateRect(hwnd, NULL, TRUE);
+        InvalidateOverlay(hwnd, OVERLAY_SETTINGS);
       }
       break;
 
@@ -1179,7 +1516,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
         // When settings panel is open, toggle warnings
         g_settings.showWarnings = !g_settings.showWarnings;
         Settings_Save(&g_settings);
-        InvalidateRect(hwnd, NULL, TRUE);
+        InvalidateOverlay(hwnd, OVERLAY_SETTINGS);
       } else {
         // Otherwise set as wallpaper
         SetAsWallpaper();
@@ -1190,7 +1527,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
       if (g_showSettings) {
         // When settings panel is open, cycle threads
         Settings_CycleThreads(&g_settings);
-        InvalidateRect(hwnd, NULL, TRUE);
+        InvalidateOverlay(hwnd, OVERLAY_SETTINGS);
       } else {
         // Otherwise toggle theme
         ToggleTheme();
@@ -1198,10 +1535,15 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
       }
       break;
 
-    case 'P': // Print image OR Reset (with Shift)
-      if (GetKeyState(VK_SHIFT) & 0x8000) {
+    case 'P': // Print image OR Reset (with Shift) OR cycle png level
+      if (g_showSettings) {
+        Settings_CyclePngLevel(&g_settings);
+        InvalidateOverlay(hwnd, OVERLAY_SETTINGS);
+      } else if (GetKeyState(VK_SHIFT) & 0x8000) {
         // Shift+P = Reset to original (reloads from disk)
+        LogUndoPoint();
         if (g_image.pixels && ImageLoader_Reset(&g_image)) {
+          ImageOps_Clear(&g_editLog);
           HDC hdc = GetDC(hwnd);
           Renderer_Cleanup(&g_renderer);
           Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1229,6 +1571,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     case 'B': // Increase brightness
       if (g_image.pixels) {
         ImageLoader_AdjustBrightness(&g_image, 10);
+        LogEdit(IMAGE_OP_BRIGHTNESS, 10, 0);
         HDC hdc = GetDC(hwnd);
         Renderer_Cleanup(&g_renderer);
         Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1240,6 +1583,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     case 'N': // Decrease brightness (N for "night")
       if (g_image.pixels) {
         ImageLoader_AdjustBrightness(&g_image, -10);
+        LogEdit(IMAGE_OP_BRIGHTNESS, -10, 0);
         HDC hdc = GetDC(hwnd);
         Renderer_Cleanup(&g_renderer);
         Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1251,6 +1595,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     case 'A': // Auto-levels
       if (g_image.pixels && !g_showEditPanel) {
         ImageLoader_AutoLevels(&g_image);
+        LogEdit(IMAGE_OP_LEVELS, 0, 0);
         HDC hdc = GetDC(hwnd);
         Renderer_Cleanup(&g_renderer);
         Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1262,6 +1607,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     case 'X': // Invert colors
       if (g_image.pixels) {
         ImageLoader_Invert(&g_image);
+        LogEdit(IMAGE_OP_INVERT, 0, 0);
         HDC hdc = GetDC(hwnd);
         Renderer_Cleanup(&g_renderer);
         Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1272,7 +1618,8 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 
     case 'U': // Blur
       if (g_image.pixels) {
-        ImageLoader_Blur(&g_image);
+        if (ImageLoader_Blur(&g_image))
+          LogEdit(IMAGE_OP_BLUR, 0, 0);
         HDC hdc = GetDC(hwnd);
         Renderer_Cleanup(&g_renderer);
         Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1283,7 +1630,8 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
 
     case 'Y': // Sharpen
       if (g_image.pixels) {
-        ImageLoader_Sharpen(&g_image);
+        if (ImageLoader_Sharpen(&g_image))
+          LogEdit(IMAGE_OP_SHARPEN, 0, 0);
         HDC hdc = GetDC(hwnd);
         Renderer_Cleanup(&g_renderer);
         Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1292,9 +1640,13 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
       }
       break;
 
-    case 'J': // Sepia/Vintage
-      if (g_image.pixels) {
+    case 'J': // Sepia/Vintage OR cycle jpeg quality
+      if (g_showSettings) {
+        Settings_CycleJpegQuality(&g_settings);
+        InvalidateOverlay(hwnd, OVERLAY_SETTINGS);
+      } else if (g_image.pixels) {
         ImageLoader_Sepia(&g_image);
+        LogEdit(IMAGE_OP_SEPIA, 0, 0);
         HDC hdc = GetDC(hwnd);
         Renderer_Cleanup(&g_renderer);
         Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1313,7 +1665,8 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
           // warn if operation will use lots of memory
           size_t memNeeded = Settings_EstimateMemory(newW, newH);
           if (Settings_WarnIfLarge(hwnd, memNeeded)) {
-            ImageLoader_ResizeLanczos(&g_image, newW, newH);
+            if (ImageLoader_ResizeLanczos(&g_image, newW, newH))
+              LogEdit(IMAGE_OP_SCALE, 0, 2.0f);
             HDC hdc = GetDC(hwnd);
             Renderer_Cleanup(&g_renderer);
             Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1328,9 +1681,13 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
       }
       break;
 
-    case 'K': // Grayscale
-      if (g_image.pixels) {
+    case 'K': // Grayscale OR cycle jpeg chroma subsampling
+      if (g_showSettings) {
+        Settings_CycleJpegSubsample(&g_settings);
+        InvalidateOverlay(hwnd, OVERLAY_SETTINGS);
+      } else if (g_image.pixels) {
         ImageLoader_Grayscale(&g_image);
+        LogEdit(IMAGE_OP_GRAYSCALE, 0, 0);
         HDC hdc = GetDC(hwnd);
         Renderer_Cleanup(&g_renderer);
         Renderer_CreateBitmap(&g_renderer, hdc, &g_image);
@@ -1345,16 +1702,16 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
         InvalidateRect(hwnd, NULL, TRUE);
       } else if (g_showSettings) {
         g_showSettings = FALSE;
-        InvalidateRect(hwnd, NULL, TRUE);
+        InvalidateOverlay(hwnd, OVERLAY_SETTINGS);
       } else if (g_showHelp) {
         g_showHelp = FALSE;
-        InvalidateRect(hwnd, NULL, TRUE);
+        InvalidateOverlay(hwnd, OVERLAY_HELP);
       } else if (g_showEditPanel) {
         g_showEditPanel = FALSE;
         g_editBrightness = 0;
         g_editContrast = 1.0f;
         g_editSaturation = 1.0f;
-        InvalidateRect(hwnd, NULL, TRUE);
+        InvalidateOverlay(hwnd, OVERLAY_EDIT);
       } else if (g_slideshowActive) {
         ToggleSlideshow(hwnd);
         InvalidateRect(hwnd, NULL, TRUE);
@@ -1444,6 +1801,18 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
   }
 
   case WM_MOUSEWHEEL: {
+    // Scroll the grid a third of a row per notch
+    if (g_showGrid) {
+      int delta = GET_WHEEL_DELTA_WPARAM(wParam);
+      RECT clientRect;
+      GetClientRect(hwnd, &clientRect);
+      g_gridScrollDir = (delta > 0) ? -1 : 1;
+      g_gridScrollY -= delta * GRID_CELL_HEIGHT / 360;
+      GridClampScroll(&clientRect);
+      InvalidateRect(hwnd, NULL, FALSE);
+      return 0;
+    }
+
     // Zoom at cursor position
     if (!g_image.pixels)
       return 0;
@@ -1454,9 +1823,12 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     pt.y = GET_Y_LPARAM(lParam);
     ScreenToClient(hwnd, &pt);
 
+    // 15% a notch, and touchpads and free spinning wheels send fractions
+    // of one
     int delta = GET_WHEEL_DELTA_WPARAM(wParam);
+    float notches = fabsf((float)delta / WHEEL_DELTA);
     float oldScale = g_renderer.scale;
-    float newScale = (delta > 0) ? oldScale * 1.15f : oldScale * 0.87f;
+    float newScale = oldScale * powf(delta > 0 ? 1.15f : 0.87f, notches);
 
     // Clamp scale
     if (newScale < 0.05f)
@@ -1471,8 +1843,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     g_renderer.scale = newScale;
     g_renderer.fitToWindow = FALSE;
 
-    UpdateWindowTitle(hwnd);
-    InvalidateRect(hwnd, NULL, TRUE);
+    RequestWheelFrame(hwnd);
     return 0;
   }
 
@@ -1480,7 +1851,16 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     int mouseX = GET_X_LPARAM(lParam);
     int mouseY = GET_Y_LPARAM(lParam);
 
-    if (g_selectMode && g_image.pixels) {
+    if (g_showGrid) {
+      // Grid - click selects
+      RECT clientRect;
+      GetClientRect(hwnd, &clientRect);
+      int hit = GridHitTest(&clientRect, mouseX, mouseY);
+      if (hit >= 0) {
+        g_gridSelection = hit;
+        InvalidateRect(hwnd, NULL, FALSE);
+      }
+    } else if (g_selectMode && g_image.pixels) {
       // Selection mode - start drawing selection
       int imgX = (int)((mouseX - g_renderer.offsetX) / g_renderer.scale);
       int imgY = (int)((mouseY - g_renderer.offsetY) / g_renderer.scale);
@@ -1509,6 +1889,21 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     return 0;
   }
 
+  case WM_LBUTTONDBLCLK: {
+    // Grid - double click opens
+    if (g_showGrid) {
+      RECT clientRect;
+      GetClientRect(hwnd, &clientRect);
+      int hit = GridHitTest(&clientRect, GET_X_LPARAM(lParam),
+                            GET_Y_LPARAM(lParam));
+      if (hit >= 0) {
+        g_gridSelection = hit;
+        OpenGridSelection(hwnd);
+      }
+    }
+    return 0;
+  }
+
   case WM_LBUTTONUP: {
     if (g_selectDragging) {
       // Stop selection
@@ -1564,10 +1959,8 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
       // Normal mode - pan image
       int dx = mouseX - g_panStartX;
       int dy = mouseY - g_panStartY;
-      g_renderer.offsetX = g_offsetStartX + dx;
-      g_renderer.offsetY = g_offsetStartY + dy;
-      g_renderer.fitToWindow = FALSE;
-      InvalidateRect(hwnd, NULL, TRUE);
+      ScrollImage(hwnd, g_offsetStartX + dx - g_renderer.offsetX,
+                  g_offsetStartY + dy - g_renderer.offsetY);
     }
     return 0;
   }
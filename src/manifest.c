@@ -0,0 +1,280 @@
+/*
+ * Manifest - Implementation
+ * pix - batch manifest
+ *
+ * plain text, one tab separated line per file:
+ *   name  size  mtime  hash  params  output
+ * finished files are appended and flushed one by one, so a run that gets
+ * killed halfway still has a record of everything it wrote. later lines
+ * win over earlier ones, and close rewrites the file compacted.
+ *
+ * a shard opens its own file over the main manifest: the main one is read
+ * first so the shard's newer lines win, and its entries are marked so the
+ * compacted shard file holds only what the shard itself did.
+ */
+
+#include "manifest.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MANIFEST_HEADER "; pix batch manifest v1"
+#define MANIFEST_LINE_MAX (MAX_PATH * 2 + MANIFEST_MAX_PARAMS + 96)
+
+// fnv-1a, case insensitive like windows file names
+static unsigned int HashName(const char *name) {
+  unsigned int h = 2166136261u;
+  while (*name) {
+    unsigned char c = (unsigned char)*name++;
+    if (c >= 'A' && c <= 'Z')
+      c += 32;
+    h ^= c;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int FindIndex(Manifest *m, const char *name) {
+  if (!m->buckets)
+    return -1;
+  unsigned int b = HashName(name) & (m->bucketCount - 1);
+  for (int i = m->buckets[b]; i >= 0; i = m->next[i]) {
+    if (_stricmp(m->entries[i].name, name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+static int Rehash(Manifest *m, int bucketCount) {
+  int *buckets = (int *)malloc(sizeof(int) * bucketCount);
+  if (!buckets)
+    return 0;
+  for (int i = 0; i < bucketCount; i++)
+    buckets[i] = -1;
+  for (int i = 0; i < m->count; i++) {
+    unsigned int b = HashName(m->entries[i].name) & (bucketCount - 1);
+    m->next[i] = buckets[b];
+    buckets[b] = i;
+  }
+  free(m->buckets);
+  m->buckets = buckets;
+  m->bucketCount = bucketCount;
+  return 1;
+}
+
+// add or replace in memory only
+static int Put(Manifest *m, const ManifestEntry *entry, char base) {
+  int i = FindIndex(m, entry->name);
+  if (i >= 0) {
+    m->entries[i] = *entry;
+    m->base[i] = base;
+    return 1;
+  }
+
+  if (m->count == m->capacity) {
+    int newCap = m->capacity ? m->capacity * 2 : 256;
+    ManifestEntry *entries = (ManifestEntry *)realloc(
+        m->entries, sizeof(ManifestEntry) * newCap);
+    if (!entries)
+      return 0;
+    m->entries = entries;
+    int *next = (int *)realloc(m->next, sizeof(int) * newCap);
+    if (!next)
+      return 0;
+    m->next = next;
+    char *isBase = (char *)realloc(m->base, newCap);
+    if (!isBase)
+      return 0;
+    m->base = isBase;
+    m->capacity = newCap;
+  }
+
+  i = m->count++;
+  m->entries[i] = *entry;
+  m->next[i] = -1;
+  m->base[i] = base;
+
+  // keep chains short - about one entry per bucket
+  if (m->count > m->bucketCount)
+    return Rehash(m, m->bucketCount ? m->bucketCount * 2 : 512);
+
+  unsigned int b = HashName(entry->name) & (m->bucketCount - 1);
+  m->next[i] = m->buckets[b];
+  m->buckets[b] = i;
+  return 1;
+}
+
+static void WriteEntry(FILE *f, const ManifestEntry *e) {
+  fprintf(f, "%s\t%llu\t%llu\t%016llx\t%s\t%s\n", e->name, e->size, e->mtime,
+          e->hash, e->params, e->output);
+}
+
+// splits a line in place on tabs, returns the field count
+static int SplitFields(char *line, char **fields, int maxFields) {
+  int n = 0;
+  char *p = line;
+  while (n < maxFields) {
+    fields[n++] = p;
+    char *tab = strchr(p, '\t');
+    if (!tab)
+      break;
+    *tab = '\0';
+    p = tab + 1;
+  }
+  return n;
+}
+
+static void CopyField(char *dst, size_t size, const char *src) {
+  strncpy(dst, src, size - 1);
+  dst[size - 1] = '\0';
+}
+
+static int LoadFile(Manifest *m, const char *path, char base) {
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return -1;
+
+  int loaded = 0;
+  char line[MANIFEST_LINE_MAX];
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == ';' || line[0] == '\0')
+      continue;
+
+    // a torn last line from a killed run just doesnt parse
+    char *fields[6];
+    if (SplitFields(line, fields, 6) != 6 || !fields[5][0])
+      continue;
+
+    ManifestEntry e;
+    memset(&e, 0, sizeof(e));
+    CopyField(e.name, sizeof(e.name), fields[0]);
+    e.size = strtoull(fields[1], NULL, 10);
+    e.mtime = strtoull(fields[2], NULL, 10);
+    e.hash = strtoull(fields[3], NULL, 16);
+    CopyField(e.params, sizeof(e.params), fields[4]);
+    CopyField(e.output, sizeof(e.output), fields[5]);
+    if (Put(m, &e, base))
+      loaded++;
+  }
+  fclose(f);
+  return loaded;
+}
+
+int Manifest_Open(Manifest *m, const char *path, const char *basePath) {
+  memset(m, 0, sizeof(Manifest));
+  CopyField(m->path, sizeof(m->path), path);
+  InitializeCriticalSection(&m->lock);
+
+  if (basePath)
+    LoadFile(m, basePath, 1);
+  LoadFile(m, m->path, 0);
+
+  m->log = fopen(m->path, "a");
+  if (!m->log) {
+    Manifest_Close(m); // no log, so this only frees what was loaded
+    return 0;
+  }
+
+  // new file - start with the header
+  fseek(m->log, 0, SEEK_END);
+  if (ftell(m->log) == 0) {
+    fprintf(m->log, "%s\n", MANIFEST_HEADER);
+    fflush(m->log);
+  }
+  return 1;
+}
+
+int Manifest_Import(Manifest *m, const char *path) {
+  EnterCriticalSection(&m->lock);
+  int loaded = LoadFile(m, path, 0);
+  LeaveCriticalSection(&m->lock);
+  return loaded;
+}
+
+int Manifest_Close(Manifest *m) {
+  int saved = 0;
+  if (m->log) {
+    fclose(m->log);
+    m->log = NULL;
+
+    // compact - write a fresh copy and swap it in, so a crash here leaves
+    // the old (still valid) file behind
+    char tmpPath[MAX_PATH];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", m->path);
+    FILE *f = fopen(tmpPath, "w");
+    if (f) {
+      fprintf(f, "%s\n", MANIFEST_HEADER);
+      for (int i = 0; i < m->count; i++) {
+        if (!m->base[i])
+          WriteEntry(f, &m->entries[i]);
+      }
+      saved = (fclose(f) == 0) &&
+              MoveFileExA(tmpPath, m->path, MOVEFILE_REPLACE_EXISTING);
+      if (!saved)
+        DeleteFileA(tmpPath);
+    }
+  }
+
+  free(m->entries);
+  free(m->next);
+  free(m->base);
+  free(m->buckets);
+  DeleteCriticalSection(&m->lock);
+  memset(m, 0, sizeof(Manifest));
+  return saved;
+}
+
+int Manifest_Find(Manifest *m, const char *name, ManifestEntry *out) {
+  EnterCriticalSection(&m->lock);
+  int i = FindIndex(m, name);
+  if (i >= 0)
+    *out = m->entries[i];
+  LeaveCriticalSection(&m->lock);
+  return i >= 0;
+}
+
+void Manifest_Record(Manifest *m, const ManifestEntry *entry) {
+  EnterCriticalSection(&m->lock);
+  Put(m, entry, 0);
+  if (m->log) {
+    WriteEntry(m->log, entry);
+    fflush(m->log);
+  }
+  LeaveCriticalSection(&m->lock);
+}
+
+int Manifest_HashFile(const char *path, unsigned long long *outHash) {
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return 0;
+
+  static const DWORD chunkSize = 256 * 1024;
+  unsigned char *buffer = (unsigned char *)malloc(chunkSize);
+  if (!buffer) {
+    CloseHandle(file);
+    return 0;
+  }
+
+  unsigned long long h = 14695981039346656037ull;
+  DWORD got;
+  int ok = 1;
+  for (;;) {
+    if (!ReadFile(file, buffer, chunkSize, &got, NULL)) {
+      ok = 0;
+      break;
+    }
+    if (got == 0)
+      break;
+    for (DWORD i = 0; i < got; i++) {
+      h ^= buffer[i];
+      h *= 1099511628211ull;
+    }
+  }
+
+  free(buffer);
+  CloseHandle(file);
+  if (ok)
+    *outHash = h;
+  return ok;
+}
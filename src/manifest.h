@@ -0,0 +1,59 @@
+// manifest header
+// remembers what batch mode already produced so reruns only do new work
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stdio.h>
+#include <windows.h>
+
+#define MANIFEST_BASE "pix_manifest" // upscaled\pix_manifest[.shard-i-of-n].txt
+#define MANIFEST_MAX_PARAMS 1024 // a whole op chain (IMAGE_OPS_TEXT_MAX)
+
+// one processed source file
+typedef struct {
+  char name[MAX_PATH];           // source file name (no folder)
+  unsigned long long size;       // source bytes
+  unsigned long long mtime;      // source last write time (FILETIME ticks)
+  unsigned long long hash;       // fnv-1a 64 of the source contents
+  char params[MANIFEST_MAX_PARAMS]; // the operation it went through
+  char output[MAX_PATH];         // output file name (no folder)
+} ManifestEntry;
+
+typedef struct {
+  ManifestEntry *entries;
+  int *next; // hash chains, parallel to entries
+  char *base; // parallel to entries, 1 if it came from the base manifest
+  int count;
+  int capacity;
+  int *buckets;
+  int bucketCount;
+  FILE *log; // append-only, one line per finished file
+  char path[MAX_PATH];
+  CRITICAL_SECTION lock;
+} Manifest;
+
+// loads an existing manifest (if any) and opens it for appending.
+// basePath (or NULL) is loaded first, underneath it - a shard skips what
+// the main manifest already has, but only its own entries are written back.
+// returns 0 if the file cant be opened for appending - m is released then,
+// dont Close it
+int Manifest_Open(Manifest *m, const char *path, const char *basePath);
+// loads another manifest on top (later wins), without writing anything.
+// returns the number of lines read, -1 if the file cant be opened
+int Manifest_Import(Manifest *m, const char *path);
+// rewrites the file with one line per name (leaving out base manifest
+// entries nothing replaced), then releases everything.
+// returns 0 if the compacted file couldnt be written
+int Manifest_Close(Manifest *m);
+
+// thread safe - copies the entry out, returns 0 if the name isnt known
+int Manifest_Find(Manifest *m, const char *name, ManifestEntry *out);
+// thread safe - adds/replaces the entry and appends it to disk right away,
+// so an interrupted run still knows everything that finished
+void Manifest_Record(Manifest *m, const ManifestEntry *entry);
+
+// fnv-1a 64 over the whole file
+int Manifest_HashFile(const char *path, unsigned long long *outHash);
+
+#endif
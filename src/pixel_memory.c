@@ -0,0 +1,246 @@
+/*
+ * Pixel Memory - Implementation
+ * pix - pixel memory
+ *
+ * each block carries a small header with its size and tag, so frees dont
+ * need to be told either and the per-tag counters stay exact. counters are
+ * interlocked, any thread can allocate. the budget is only enforced on the
+ * ui thread (the one that registers the evictors) - that is where the long
+ * lived buffers are made, and the only place a cache can safely be trimmed.
+ *
+ * over budget, pools are drained cheapest first: thumbnails, then
+ * prefetch and the mip pyramid, then undo. a request only drains pools worth no more than
+ * itself, so a thumbnail can push out older thumbnails but never the undo
+ * copy, and loading an image can push out all three.
+ */
+
+#include "pixel_memory.h"
+#include <stdlib.h>
+
+// 16 bytes so the pixels after it keep malloc's sse alignment
+typedef union {
+  struct {
+    size_t size;
+    int tag;
+  } info;
+  char align[16];
+} BlockHeader;
+
+#define VALUE_ESSENTIAL 3     // the image itself - never evicted
+#define VALUE_RELIEVE 1       // os pressure empties pools worth this or less
+#define PRESSURE_COOLDOWN_MS 5000
+
+// how much each tag is worth keeping
+static const int g_tagValue[PIXMEM_TAG_COUNT] = {
+    VALUE_ESSENTIAL, // current
+    2,               // undo
+    VALUE_ESSENTIAL, // gif frames
+    0,               // cache
+    1,               // prefetch
+    VALUE_ESSENTIAL, // renderer
+    1,               // mips
+};
+
+static struct {
+  volatile LONGLONG used[PIXMEM_TAG_COUNT];
+  volatile LONGLONG total;
+  volatile LONGLONG peak;
+  size_t budget;
+  PixelEvictor evict[PIXMEM_TAG_COUNT];
+  DWORD uiThread;
+
+  // low memory watcher
+  HANDLE lowMemory;
+  HANDLE stopWatch;
+  HANDLE watcher;
+  HWND watchHwnd;
+} g_mem;
+
+static const char *g_tagNames[PIXMEM_TAG_COUNT] = {
+    "image", "undo", "gif", "cache", "prefetch", "view", "mips"};
+
+static void Count(int tag, LONGLONG bytes) {
+  InterlockedExchangeAdd64(&g_mem.used[tag], bytes);
+  LONGLONG total = InterlockedExchangeAdd64(&g_mem.total, bytes) + bytes;
+
+  LONGLONG peak = g_mem.peak;
+  while (total > peak) {
+    LONGLONG seen = InterlockedCompareExchange64(&g_mem.peak, total, peak);
+    if (seen == peak)
+      break;
+    peak = seen;
+  }
+}
+
+static int Fits(size_t size) {
+  return (size_t)g_mem.total + size <= g_mem.budget;
+}
+
+// drains pools worth no more than value, cheapest first, until size more
+// would fit. 0 if it still wont
+static int MakeRoom(size_t size, int value) {
+  if (!g_mem.budget || Fits(size))
+    return 1;
+  if (!g_mem.uiThread || GetCurrentThreadId() != g_mem.uiThread)
+    return 1; // worker scratch, see the top
+
+  for (int v = 0; v <= value && !Fits(size); v++) {
+    for (int t = 0; t < PIXMEM_TAG_COUNT && !Fits(size); t++) {
+      if (g_tagValue[t] != v || !g_mem.evict[t])
+        continue;
+      while (!Fits(size)) {
+        size_t over = (size_t)g_mem.total + size - g_mem.budget;
+        if (g_mem.evict[t](over) == 0)
+          break;
+      }
+    }
+  }
+  return Fits(size);
+}
+
+void *PixelMemory_Alloc(size_t size, PixelTag tag) {
+  if (!MakeRoom(size, g_tagValue[tag]))
+    return NULL;
+
+  BlockHeader *h = (BlockHeader *)malloc(sizeof(BlockHeader) + size);
+  if (!h)
+    return NULL;
+  h->info.size = size;
+  h->info.tag = tag;
+  Count(tag, (LONGLONG)size);
+  return h + 1;
+}
+
+void *PixelMemory_Realloc(void *ptr, size_t newSize) {
+  if (!ptr)
+    return PixelMemory_Alloc(newSize, PIXMEM_CURRENT);
+
+  BlockHeader *h = (BlockHeader *)ptr - 1;
+  size_t oldSize = h->info.size;
+  int tag = h->info.tag;
+  if (newSize > oldSize && !MakeRoom(newSize - oldSize, g_tagValue[tag]))
+    return NULL;
+
+  h = (BlockHeader *)realloc(h, sizeof(BlockHeader) + newSize);
+  if (!h)
+    return NULL;
+  h->info.size = newSize;
+  Count(tag, (LONGLONG)newSize - (LONGLONG)oldSize);
+  return h + 1;
+}
+
+void PixelMemory_Free(void *ptr) {
+  if (!ptr)
+    return;
+  BlockHeader *h = (BlockHeader *)ptr - 1;
+  Count(h->info.tag, -(LONGLONG)h->info.size);
+  free(h);
+}
+
+void PixelMemory_Retag(void *ptr, PixelTag tag) {
+  if (!ptr)
+    return;
+  BlockHeader *h = (BlockHeader *)ptr - 1;
+  if (h->info.tag == (int)tag)
+    return;
+  InterlockedExchangeAdd64(&g_mem.used[h->info.tag],
+                           -(LONGLONG)h->info.size);
+  InterlockedExchangeAdd64(&g_mem.used[tag], (LONGLONG)h->info.size);
+  h->info.tag = tag;
+}
+
+void PixelMemory_Track(PixelTag tag, long long bytes) {
+  if (bytes > 0)
+    MakeRoom((size_t)bytes, g_tagValue[tag]);
+  Count(tag, bytes);
+}
+
+void PixelMemory_SetBudget(size_t bytes) { g_mem.budget = bytes; }
+
+void PixelMemory_SetEvictor(PixelTag tag, PixelEvictor evict) {
+  g_mem.evict[tag] = evict;
+  g_mem.uiThread = GetCurrentThreadId();
+}
+
+int PixelMemory_Reserve(size_t bytes, PixelTag tag) {
+  return MakeRoom(bytes, g_tagValue[tag]);
+}
+
+void PixelMemory_Enforce(void) { MakeRoom(0, VALUE_ESSENTIAL); }
+
+// the notification stays signalled for as long as ram is low, so after
+// each post it waits a while instead of spinning on it
+static DWORD WINAPI PressureWatcher(LPVOID param) {
+  (void)param;
+  HANDLE waits[2] = {g_mem.stopWatch, g_mem.lowMemory};
+  while (WaitForMultipleObjects(2, waits, FALSE, INFINITE) ==
+         WAIT_OBJECT_0 + 1) {
+    PostMessageA(g_mem.watchHwnd, WM_MEMORY_PRESSURE, 0, 0);
+    if (WaitForSingleObject(g_mem.stopWatch, PRESSURE_COOLDOWN_MS) !=
+        WAIT_TIMEOUT)
+      break;
+  }
+  return 0;
+}
+
+int PixelMemory_WatchPressure(HWND hwnd) {
+  if (g_mem.watcher)
+    return 1;
+
+  g_mem.lowMemory =
+      CreateMemoryResourceNotification(LowMemoryResourceNotification);
+  g_mem.stopWatch = CreateEventA(NULL, TRUE, FALSE, NULL);
+  g_mem.watchHwnd = hwnd;
+  if (g_mem.lowMemory && g_mem.stopWatch)
+    g_mem.watcher = CreateThread(NULL, 0, PressureWatcher, NULL, 0, NULL);
+
+  if (!g_mem.watcher) {
+    PixelMemory_StopWatching();
+    return 0;
+  }
+  return 1;
+}
+
+void PixelMemory_StopWatching(void) {
+  if (g_mem.watcher) {
+    SetEvent(g_mem.stopWatch);
+    WaitForSingleObject(g_mem.watcher, INFINITE);
+    CloseHandle(g_mem.watcher);
+    g_mem.watcher = NULL;
+  }
+  if (g_mem.lowMemory)
+    CloseHandle(g_mem.lowMemory);
+  if (g_mem.stopWatch)
+    CloseHandle(g_mem.stopWatch);
+  g_mem.lowMemory = NULL;
+  g_mem.stopWatch = NULL;
+}
+
+void PixelMemory_Relieve(void) {
+  for (int t = 0; t < PIXMEM_TAG_COUNT; t++) {
+    if (g_tagValue[t] > VALUE_RELIEVE || !g_mem.evict[t])
+      continue;
+    while (PixelMemory_Used((PixelTag)t) > 0 &&
+           g_mem.evict[t](PixelMemory_Used((PixelTag)t)) > 0)
+      ;
+  }
+}
+
+size_t PixelMemory_Used(PixelTag tag) {
+  LONGLONG used = g_mem.used[tag];
+  return used > 0 ? (size_t)used : 0;
+}
+
+size_t PixelMemory_Total(void) {
+  return g_mem.total > 0 ? (size_t)g_mem.total : 0;
+}
+
+size_t PixelMemory_Peak(void) { return (size_t)g_mem.peak; }
+
+size_t PixelMemory_Budget(void) { return g_mem.budget; }
+
+const char *PixelMemory_TagName(PixelTag tag) {
+  if (tag < 0 || tag >= PIXMEM_TAG_COUNT)
+    return "?";
+  return g_tagNames[tag];
+}
@@ -0,0 +1,64 @@
+// pixel memory header
+// every pixel buffer in pix comes from here, tagged with what it is for, so
+// the settings panel can show where the ram went and maxMemoryMB can be
+// held by evicting whatever is cheapest to lose
+
+#ifndef PIXEL_MEMORY_H
+#define PIXEL_MEMORY_H
+
+#include <stddef.h>
+#include <windows.h>
+
+#define WM_MEMORY_PRESSURE (WM_APP + 2) // posted when windows runs low on ram
+
+typedef enum {
+  PIXMEM_CURRENT,    // the image on screen (and its edit buffers)
+  PIXMEM_UNDO,       // the undo copy
+  PIXMEM_GIF_FRAMES, // decoded animation frames
+  PIXMEM_CACHE,      // thumbnails (and their decode scratch)
+  PIXMEM_PREFETCH,   // neighbours decoded ahead of time
+  PIXMEM_RENDERER,   // dib sections and other display copies
+  PIXMEM_MIPS,       // the renderer's zoomed out pyramid, rebuilt on demand
+  PIXMEM_TAG_COUNT
+} PixelTag;
+
+// frees at least bytes of one pool (its least valuable entries first) and
+// returns what it actually freed, 0 once there is nothing left to give
+typedef size_t (*PixelEvictor)(size_t bytes);
+
+// any thread. NULL if size doesnt fit the budget even after evicting (only
+// on the ui thread - worker scratch is short lived and never refused)
+void *PixelMemory_Alloc(size_t size, PixelTag tag);
+void *PixelMemory_Realloc(void *ptr, size_t newSize); // keeps the tag
+void PixelMemory_Free(void *ptr);
+void PixelMemory_Retag(void *ptr, PixelTag tag);
+
+// memory allocated elsewhere (gdi dib sections), counted under tag.
+// growing it evicts like an alloc would, but never fails
+void PixelMemory_Track(PixelTag tag, long long bytes);
+
+// 0 = no cap
+void PixelMemory_SetBudget(size_t bytes);
+// a pool that can give memory back. pools are drained cheapest tag first
+// (thumbnails, then prefetch and mips, then undo) and only for something worth at
+// least as much. call from the ui thread, evictors run on it
+void PixelMemory_SetEvictor(PixelTag tag, PixelEvictor evict);
+// room for bytes more of tag, evicting cheaper pools. 0 if it wont fit
+int PixelMemory_Reserve(size_t bytes, PixelTag tag);
+// evicts until back under budget (after the budget shrank, say)
+void PixelMemory_Enforce(void);
+
+// low memory notification from windows -> WM_MEMORY_PRESSURE to hwnd, which
+// should call PixelMemory_Relieve. StopWatching before hwnd goes away
+int PixelMemory_WatchPressure(HWND hwnd);
+void PixelMemory_StopWatching(void);
+// empties the cache pools (not undo) whatever the budget says
+void PixelMemory_Relieve(void);
+
+size_t PixelMemory_Used(PixelTag tag);
+size_t PixelMemory_Total(void);
+size_t PixelMemory_Peak(void);
+size_t PixelMemory_Budget(void);
+const char *PixelMemory_TagName(PixelTag tag); // "image", "undo"...
+
+#endif
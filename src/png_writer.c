@@ -0,0 +1,890 @@
+/*
+ * PNG Writer - Implementation
+ * pix - streaming, multithreaded png encoder
+ *
+ * rows come in bands. a band is cut into chunks of about PNG_CHUNK_BYTES
+ * and every chunk is filtered and deflated on its own openmp thread (like
+ * pigz): matches may reach back 32k into the chunk before it, and each
+ * chunk ends on a byte boundary with an empty stored block, so the pieces
+ * simply concatenate into one zlib stream. the per chunk adler-32s are
+ * combined at the end, so nothing has to be checksummed twice.
+ */
+
+#include "png_writer.h"
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFLATE_WINDOW 32768
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define FAR_MATCH 4096    // a 3 byte match further back costs more than 3 literals
+#define BLOCK_TOKENS 16384 // tokens per huffman block
+
+// per level knobs
+typedef struct {
+  int maxChain;       // candidates checked per position
+  int lazy;           // look one byte ahead before taking a match
+  int dynamic;        // build huffman tables per block
+  int adaptiveFilter; // best of the five filters per row
+} LevelInfo;
+
+static const LevelInfo g_levels[PNG_LEVEL_COUNT] = {
+    {4, 0, 0, 0},   // fast
+    {32, 0, 1, 1},  // default
+    {256, 1, 1, 1}, // small
+};
+static const char *g_levelNames[PNG_LEVEL_COUNT] = {"fast", "default",
+                                                     "small"};
+
+static const unsigned short g_lengthBase[] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23,  27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 259};
+static const unsigned char g_lengthExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                              1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                              4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned short g_distBase[] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,    25,   33,
+    49,   65,   97,   129,  193,  257,   385,   513,   769,   1025, 1537,
+    2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577, 32769};
+static const unsigned char g_distExtra[] = {0, 0, 0,  0,  1,  1,  2,  2,
+                                            3, 3, 4,  4,  5,  5,  6,  6,
+                                            7, 7, 8,  8,  9,  9,  10, 10,
+                                            11, 11, 12, 12, 13, 13};
+// order the code length code lengths are sent in
+static const unsigned char g_clenOrder[19] = {16, 17, 18, 0, 8,  7, 9,
+                                              6,  10, 5,  11, 4, 12, 3,
+                                              13, 2,  14, 1,  15};
+
+// built once
+static unsigned int g_crcTable[256];
+static unsigned char g_lengthCode[MAX_MATCH + 1]; // match length -> 0..28
+static unsigned char g_distCode[512];             // see DistCode
+static unsigned char g_fixedLitLen[288];
+static unsigned short g_fixedLitCode[288];
+static unsigned char g_fixedDistLen[30];
+static unsigned short g_fixedDistCode[30];
+static INIT_ONCE g_tablesOnce = INIT_ONCE_STATIC_INIT;
+
+struct PngTask {
+  size_t start; // chunk bytes in w->filtered
+  size_t len;
+  int firstRow; // rows of the band this chunk covers
+  int rows;
+  int *head; // match finder
+  int *prev;
+  unsigned int *tokens; // literal, or (length << 16) | distance
+  unsigned char *out;   // 2 spare bytes up front for the zlib header
+  size_t outCap;
+  size_t outLen;
+  unsigned int adler;
+  int failed;
+};
+
+// huffman codes go out msb first, everything else lsb first
+static unsigned int Reverse(unsigned int code, int n) {
+  unsigned int r = 0;
+  while (n--) {
+    r = (r << 1) | (code & 1);
+    code >>= 1;
+  }
+  return r;
+}
+
+// canonical codes from code lengths, already bit reversed
+static void BuildCodes(const unsigned char *lengths, int n,
+                       unsigned short *codes) {
+  int count[16] = {0};
+  for (int i = 0; i < n; i++)
+    count[lengths[i]]++;
+  count[0] = 0;
+
+  int next[16] = {0};
+  int code = 0;
+  for (int bits = 1; bits < 16; bits++) {
+    code = (code + count[bits - 1]) << 1;
+    next[bits] = code;
+  }
+  for (int i = 0; i < n; i++) {
+    if (lengths[i])
+      codes[i] = (unsigned short)Reverse(next[lengths[i]]++, lengths[i]);
+  }
+}
+
+static BOOL CALLBACK BuildTables(PINIT_ONCE once, PVOID param,
+                                 PVOID *context) {
+  (void)once;
+  (void)param;
+  (void)context;
+  for (unsigned int n = 0; n < 256; n++) {
+    unsigned int c = n;
+    for (int k = 0; k < 8; k++)
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    g_crcTable[n] = c;
+  }
+
+  for (int code = 0; code < 29; code++) {
+    for (int len = g_lengthBase[code];
+         len < g_lengthBase[code + 1] && len <= MAX_MATCH; len++)
+      g_lengthCode[len] = (unsigned char)code;
+  }
+  g_lengthCode[MAX_MATCH] = 28; // 258 has its own code, not 227 + 31
+
+  for (int code = 0; code < 30; code++) {
+    for (int d = g_distBase[code]; d < g_distBase[code + 1]; d++) {
+      if (d <= 256)
+        g_distCode[d - 1] = (unsigned char)code;
+      else
+        g_distCode[256 + ((d - 1) >> 7)] = (unsigned char)code;
+    }
+  }
+
+  for (int i = 0; i < 288; i++)
+    g_fixedLitLen[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+  BuildCodes(g_fixedLitLen, 288, g_fixedLitCode);
+  for (int i = 0; i < 30; i++)
+    g_fixedDistLen[i] = 5;
+  BuildCodes(g_fixedDistLen, 30, g_fixedDistCode);
+  return TRUE;
+}
+
+static int DistCode(int dist) {
+  return dist <= 256 ? g_distCode[dist - 1] : g_distCode[256 + ((dist - 1) >> 7)];
+}
+
+static unsigned int Crc32(unsigned int crc, const unsigned char *data,
+                          size_t len) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++)
+    crc = g_crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+static unsigned int Adler32(unsigned int adler, const unsigned char *data,
+                            size_t len) {
+  unsigned int a = adler & 0xFFFF, b = adler >> 16;
+  while (len > 0) {
+    // 5552 is the most bytes before b can overflow 32 bits
+    size_t n = len < 5552 ? len : 5552;
+    len -= n;
+    while (n--) {
+      a += *data++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+// adler-32 of two pieces joined, from the two checksums and the length of
+// the second (same math as zlib's adler32_combine)
+static unsigned int AdlerCombine(unsigned int adler1, unsigned int adler2,
+                                 size_t len2) {
+  const unsigned int base = 65521;
+  unsigned int rem = (unsigned int)(len2 % base);
+  unsigned int sum1 = adler1 & 0xFFFF;
+  unsigned int sum2 = (rem * sum1) % base;
+  sum1 += (adler2 & 0xFFFF) + base - 1;
+  sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+  if (sum1 >= base)
+    sum1 -= base;
+  if (sum1 >= base)
+    sum1 -= base;
+  if (sum2 >= base * 2)
+    sum2 -= base * 2;
+  if (sum2 >= base)
+    sum2 -= base;
+  return sum1 | (sum2 << 16);
+}
+
+// ---- huffman ----
+
+// code lengths for the given frequencies, none longer than limit. plain
+// huffman, and if that comes out too deep the counts get flattened and
+// it goes again - not optimal, but close and simple
+static void BuildLengths(const unsigned int *freq, int n, int limit,
+                         unsigned char *lengths) {
+  unsigned int f[288];
+  int used = 0;
+  for (int i = 0; i < n; i++) {
+    f[i] = freq[i];
+    used += f[i] > 0;
+  }
+  // always at least two codes, a lone one would be an incomplete code
+  for (int i = 0; i < n && used < 2; i++) {
+    if (!f[i]) {
+      f[i] = 1;
+      used++;
+    }
+  }
+
+  for (;;) {
+    unsigned long long weight[576];
+    int parent[576];
+    int nodes = 0;
+    int leaf[288];
+    for (int i = 0; i < n; i++) {
+      leaf[i] = -1;
+      if (f[i]) {
+        leaf[i] = nodes;
+        weight[nodes] = f[i];
+        parent[nodes] = -1;
+        nodes++;
+      }
+    }
+
+    // join the two lightest free nodes until one is left
+    int roots = nodes;
+    while (roots > 1) {
+      int a = -1, b = -1;
+      for (int k = 0; k < nodes; k++) {
+        if (parent[k] != -1)
+          continue;
+        if (a < 0 || weight[k] < weight[a]) {
+          b = a;
+          a = k;
+        } else if (b < 0 || weight[k] < weight[b]) {
+          b = k;
+        }
+      }
+      weight[nodes] = weight[a] + weight[b];
+      parent[nodes] = -1;
+      parent[a] = nodes;
+      parent[b] = nodes;
+      nodes++;
+      roots--;
+    }
+
+    int deepest = 0;
+    for (int i = 0; i < n; i++) {
+      int depth = 0;
+      if (leaf[i] >= 0) {
+        for (int k = leaf[i]; parent[k] != -1; k = parent[k])
+          depth++;
+      }
+      lengths[i] = (unsigned char)depth;
+      if (depth > deepest)
+        deepest = depth;
+    }
+    if (deepest <= limit)
+      return;
+
+    for (int i = 0; i < n; i++) {
+      if (f[i])
+        f[i] = (f[i] >> 1) | 1;
+    }
+  }
+}
+
+// ---- bits ----
+
+typedef struct {
+  unsigned char *out;
+  size_t pos;
+  unsigned int bits;
+  int count;
+} BitOut;
+
+static void PutBits(BitOut *b, unsigned int value, int n) {
+  b->bits |= value << b->count;
+  b->count += n;
+  while (b->count >= 8) {
+    b->out[b->pos++] = (unsigned char)b->bits;
+    b->bits >>= 8;
+    b->count -= 8;
+  }
+}
+
+static void PutTokens(BitOut *b, const unsigned int *tokens, int count,
+                      const unsigned short *litCode,
+                      const unsigned char *litLen,
+                      const unsigned short *distCode,
+                      const unsigned char *distLen) {
+  for (int t = 0; t < count; t++) {
+    unsigned int tok = tokens[t];
+    int len = tok >> 16;
+    if (len == 0) {
+      PutBits(b, litCode[tok], litLen[tok]);
+      continue;
+    }
+    int lc = g_lengthCode[len];
+    PutBits(b, litCode[257 + lc], litLen[257 + lc]);
+    if (g_lengthExtra[lc])
+      PutBits(b, len - g_lengthBase[lc], g_lengthExtra[lc]);
+
+    int dist = tok & 0xFFFF;
+    int dc = DistCode(dist);
+    PutBits(b, distCode[dc], distLen[dc]);
+    if (g_distExtra[dc])
+      PutBits(b, dist - g_distBase[dc], g_distExtra[dc]);
+  }
+  PutBits(b, litCode[256], litLen[256]); // end of block
+}
+
+// code length sequence, run length coded with 16 / 17 / 18
+static int RunLengths(const unsigned char *lens, int total,
+                      unsigned char *syms, unsigned char *extra) {
+  int n = 0;
+  int i = 0;
+  while (i < total) {
+    int l = lens[i];
+    int run = 1;
+    while (i + run < total && lens[i + run] == l)
+      run++;
+
+    if (l == 0) {
+      while (run >= 11) {
+        int r = run < 138 ? run : 138;
+        syms[n] = 18;
+        extra[n++] = (unsigned char)(r - 11);
+        run -= r;
+        i += r;
+      }
+      if (run >= 3) {
+        syms[n] = 17;
+        extra[n++] = (unsigned char)(run - 3);
+        i += run;
+        run = 0;
+      }
+    } else {
+      syms[n] = (unsigned char)l;
+      extra[n++] = 0;
+      i++;
+      run--;
+      while (run >= 3) {
+        int r = run < 6 ? run : 6;
+        syms[n] = 16;
+        extra[n++] = (unsigned char)(r - 3);
+        run -= r;
+        i += r;
+      }
+    }
+    while (run > 0) {
+      syms[n] = (unsigned char)l;
+      extra[n++] = 0;
+      i++;
+      run--;
+    }
+  }
+  return n;
+}
+
+// one block (not the last) of tokens, dynamic or fixed - whichever is
+// smaller. fixed never costs more than 9 bits a byte, so the output bound
+// holds either way
+static void FlushBlock(BitOut *b, const unsigned int *tokens, int count,
+                       int allowDynamic) {
+  unsigned int litFreq[286] = {0};
+  unsigned int distFreq[30] = {0};
+  unsigned long long extraBits = 0;
+  for (int t = 0; t < count; t++) {
+    unsigned int tok = tokens[t];
+    int len = tok >> 16;
+    if (len == 0) {
+      litFreq[tok]++;
+      continue;
+    }
+    int lc = g_lengthCode[len];
+    int dist = tok & 0xFFFF;
+    int dc = DistCode(dist);
+    litFreq[257 + lc]++;
+    distFreq[dc]++;
+    extraBits += g_lengthExtra[lc] + g_distExtra[dc];
+  }
+  litFreq[256] = 1;
+
+  unsigned long long fixedCost = 3 + extraBits;
+  for (int s = 0; s < 286; s++)
+    fixedCost += (unsigned long long)litFreq[s] * g_fixedLitLen[s];
+  for (int s = 0; s < 30; s++)
+    fixedCost += (unsigned long long)distFreq[s] * 5;
+
+  if (allowDynamic) {
+    unsigned char litLen[286], distLen[30];
+    BuildLengths(litFreq, 286, 15, litLen);
+    BuildLengths(distFreq, 30, 15, distLen);
+
+    int hlit = 286, hdist = 30;
+    while (hlit > 257 && !litLen[hlit - 1])
+      hlit--;
+    while (hdist > 1 && !distLen[hdist - 1])
+      hdist--;
+
+    unsigned char lens[316];
+    memcpy(lens, litLen, hlit);
+    memcpy(lens + hlit, distLen, hdist);
+    unsigned char syms[316], extra[316];
+    int symCount = RunLengths(lens, hlit + hdist, syms, extra);
+
+    unsigned int clenFreq[19] = {0};
+    for (int k = 0; k < symCount; k++)
+      clenFreq[syms[k]]++;
+    unsigned char clenLen[19];
+    BuildLengths(clenFreq, 19, 7, clenLen);
+    int hclen = 19;
+    while (hclen > 4 && !clenLen[g_clenOrder[hclen - 1]])
+      hclen--;
+
+    unsigned long long cost = 3 + 14 + hclen * 3 + extraBits;
+    for (int k = 0; k < symCount; k++)
+      cost += clenLen[syms[k]] +
+              (syms[k] == 16 ? 2 : syms[k] == 17 ? 3 : syms[k] == 18 ? 7 : 0);
+    for (int s = 0; s < 286; s++)
+      cost += (unsigned long long)litFreq[s] * litLen[s];
+    for (int s = 0; s < 30; s++)
+      cost += (unsigned long long)distFreq[s] * distLen[s];
+
+    if (cost < fixedCost) {
+      unsigned short litCode[286], distCode[30], clenCode[19];
+      BuildCodes(litLen, 286, litCode);
+      BuildCodes(distLen, 30, distCode);
+      BuildCodes(clenLen, 19, clenCode);
+
+      PutBits(b, 0, 1); // not the last block
+      PutBits(b, 2, 2); // dynamic huffman
+      PutBits(b, hlit - 257, 5);
+      PutBits(b, hdist - 1, 5);
+      PutBits(b, hclen - 4, 4);
+      for (int k = 0; k < hclen; k++)
+        PutBits(b, clenLen[g_clenOrder[k]], 3);
+      for (int k = 0; k < symCount; k++) {
+        PutBits(b, clenCode[syms[k]], clenLen[syms[k]]);
+        if (syms[k] == 16)
+          PutBits(b, extra[k], 2);
+        else if (syms[k] == 17)
+          PutBits(b, extra[k], 3);
+        else if (syms[k] == 18)
+          PutBits(b, extra[k], 7);
+      }
+      PutTokens(b, tokens, count, litCode, litLen, distCode, distLen);
+      return;
+    }
+  }
+
+  PutBits(b, 0, 1); // not the last block
+  PutBits(b, 1, 2); // fixed huffman
+  PutTokens(b, tokens, count, g_fixedLitCode, g_fixedLitLen, g_fixedDistCode,
+            g_fixedDistLen);
+}
+
+// ---- lz77 ----
+
+static unsigned int Hash3(const unsigned char *p) {
+  unsigned int v = (p[0] << 16) | (p[1] << 8) | p[2];
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// longest earlier match for position i (everything before i is hashed)
+static int FindMatch(const unsigned char *d, int n, int i, const int *head,
+                     const int *prev, int maxChain, int *outDist) {
+  if (i + MIN_MATCH > n)
+    return 0;
+  int maxLen = n - i < MAX_MATCH ? n - i : MAX_MATCH;
+  int best = 0, bestDist = 0;
+  int chain = maxChain;
+  for (int cand = head[Hash3(d + i)];
+       cand >= 0 && i - cand < DEFLATE_WINDOW && chain-- > 0;
+       cand = prev[cand & (DEFLATE_WINDOW - 1)]) {
+    const unsigned char *p = d + cand;
+    if (p[best] != d[i + best])
+      continue;
+    int len = 0;
+    while (len < maxLen && p[len] == d[i + len])
+      len++;
+    if (len > best) {
+      best = len;
+      bestDist = i - cand;
+      if (len == maxLen)
+        break;
+    }
+  }
+  if (best < MIN_MATCH || (best == MIN_MATCH && bestDist > FAR_MATCH))
+    return 0;
+  *outDist = bestDist;
+  return best;
+}
+
+// worst case is every byte a 9 bit literal, plus block overhead
+static size_t DeflateBound(size_t n) {
+  return n + n / 8 + (n / BLOCK_TOKENS + 2) * 8 + 64;
+}
+
+// deflates d[start..n) as non-final blocks, using d[0..start) as history,
+// then pads to a byte with an empty stored block
+static size_t DeflateChunk(PngTask *task, const LevelInfo *level,
+                           const unsigned char *d, int start, int n,
+                           unsigned char *out) {
+  BitOut b = {out, 0, 0, 0};
+  int *head = task->head;
+  int *prev = task->prev;
+  for (int k = 0; k < HASH_SIZE; k++)
+    head[k] = -1;
+
+  int hashed = 0; // positions below this are in the chains
+  int tokens = 0;
+  int i = start;
+  while (i < n) {
+    // history and everything up to here goes into the chains first
+    for (; hashed < i && hashed + MIN_MATCH <= n; hashed++) {
+      unsigned int h = Hash3(d + hashed);
+      prev[hashed & (DEFLATE_WINDOW - 1)] = head[h];
+      head[h] = hashed;
+    }
+
+    int dist = 0;
+    int len = FindMatch(d, n, i, head, prev, level->maxChain, &dist);
+
+    // lazy: a longer match one byte on wins over this one
+    if (len && level->lazy && len < 32 && i + 1 < n) {
+      if (hashed == i && i + MIN_MATCH <= n) {
+        unsigned int h = Hash3(d + i);
+        prev[i & (DEFLATE_WINDOW - 1)] = head[h];
+        head[h] = i;
+        hashed++;
+      }
+      int nextDist;
+      if (FindMatch(d, n, i + 1, head, prev, level->maxChain, &nextDist) >
+          len)
+        len = 0;
+    }
+
+    if (len) {
+      task->tokens[tokens++] = ((unsigned int)len << 16) | (dist & 0xFFFF);
+      i += len;
+    } else {
+      task->tokens[tokens++] = d[i];
+      i++;
+    }
+
+    if (tokens == BLOCK_TOKENS) {
+      FlushBlock(&b, task->tokens, tokens, level->dynamic);
+      tokens = 0;
+    }
+  }
+  if (tokens > 0)
+    FlushBlock(&b, task->tokens, tokens, level->dynamic);
+
+  PutBits(&b, 0, 3); // stored, not last
+  if (b.count > 0)
+    PutBits(&b, 0, 8 - b.count);
+  out[b.pos++] = 0x00; // len 0
+  out[b.pos++] = 0x00;
+  out[b.pos++] = 0xFF; // ~len
+  out[b.pos++] = 0xFF;
+  return b.pos;
+}
+
+// ---- png ----
+
+static void PutBE32(unsigned char *p, unsigned int v) {
+  p[0] = (unsigned char)(v >> 24);
+  p[1] = (unsigned char)(v >> 16);
+  p[2] = (unsigned char)(v >> 8);
+  p[3] = (unsigned char)v;
+}
+
+static void WriteChunk(PngWriter *w, const char *type,
+                       const unsigned char *data, size_t len) {
+  unsigned char header[8];
+  PutBE32(header, (unsigned int)len);
+  memcpy(header + 4, type, 4);
+  unsigned int crc = Crc32(0, header + 4, 4);
+  crc = Crc32(crc, data, len);
+  unsigned char trailer[4];
+  PutBE32(trailer, crc);
+
+  if (fwrite(header, 1, 8, w->file) != 8 ||
+      (len && fwrite(data, 1, len, w->file) != len) ||
+      fwrite(trailer, 1, 4, w->file) != 4)
+    w->failed = 1;
+}
+
+static int Paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if (pa <= pb && pa <= pc)
+    return a;
+  return pb <= pc ? b : c;
+}
+
+static unsigned char FilterByte(int type, const unsigned char *cur,
+                                const unsigned char *up, int i) {
+  int a = i >= 4 ? cur[i - 4] : 0;
+  int b = up[i];
+  int c = i >= 4 ? up[i - 4] : 0;
+  switch (type) {
+  case 1:
+    return (unsigned char)(cur[i] - a);
+  case 2:
+    return (unsigned char)(cur[i] - b);
+  case 3:
+    return (unsigned char)(cur[i] - ((a + b) >> 1));
+  case 4:
+    return (unsigned char)(cur[i] - Paeth(a, b, c));
+  default:
+    return cur[i];
+  }
+}
+
+// adaptive: tries all five filters, keeps the smallest signed sum.
+// otherwise paeth, which is the usual winner on photos anyway
+static void FilterRow(const unsigned char *cur, const unsigned char *up,
+                      int rowBytes, int adaptive, unsigned char *out) {
+  int best = 4;
+  if (adaptive) {
+    long long bestCost = -1;
+    for (int type = 0; type < 5; type++) {
+      long long cost = 0;
+      for (int i = 0; i < rowBytes; i++)
+        cost += abs((signed char)FilterByte(type, cur, up, i));
+      if (bestCost < 0 || cost < bestCost) {
+        bestCost = cost;
+        best = type;
+      }
+    }
+  }
+
+  out[0] = (unsigned char)best;
+  for (int i = 0; i < rowBytes; i++)
+    out[i + 1] = FilterByte(best, cur, up, i);
+}
+
+static int ChunkRows(int width) {
+  int rows = PNG_CHUNK_BYTES / (width * 4 + 1);
+  return rows < 1 ? 1 : rows;
+}
+
+static void FreeTask(PngTask *task) {
+  free(task->head);
+  free(task->prev);
+  free(task->tokens);
+  free(task->out);
+  memset(task, 0, sizeof(PngTask));
+}
+
+// lazily sized, kept for the next band
+static int PrepareTask(PngTask *task, size_t len) {
+  if (!task->head) {
+    task->head = (int *)malloc(sizeof(int) * HASH_SIZE);
+    task->prev = (int *)malloc(sizeof(int) * DEFLATE_WINDOW);
+    task->tokens = (unsigned int *)malloc(sizeof(unsigned int) * BLOCK_TOKENS);
+  }
+  size_t need = DeflateBound(len) + 2;
+  if (task->outCap < need) {
+    unsigned char *out = (unsigned char *)realloc(task->out, need);
+    if (out) {
+      task->out = out;
+      task->outCap = need;
+    }
+  }
+  return task->head && task->prev && task->tokens && task->outCap >= need;
+}
+
+int PngWriter_Open(PngWriter *w, const char *path, int width, int height,
+                   PngLevel level, int threads) {
+  memset(w, 0, sizeof(PngWriter));
+  InitOnceExecuteOnce(&g_tablesOnce, BuildTables, NULL, NULL);
+
+  strncpy(w->path, path, MAX_PATH - 1);
+  w->width = width;
+  w->height = height;
+  w->level = (level >= 0 && level < PNG_LEVEL_COUNT) ? level
+                                                      : PNG_LEVEL_DEFAULT;
+  w->threads = threads > 0 ? threads : omp_get_max_threads();
+  w->adler = 1;
+  w->prevRow = (unsigned char *)calloc((size_t)width, 4); // row -1 is zeros
+  w->file = fopen(path, "wb");
+  if (!w->prevRow || !w->file) {
+    w->failed = 1;
+    PngWriter_Close(w);
+    return 0;
+  }
+  setvbuf(w->file, NULL, _IOFBF, 256 * 1024);
+
+  static const unsigned char signature[8] = {0x89, 'P',  'N',  'G',
+                                             '\r', '\n', 0x1A, '\n'};
+  if (fwrite(signature, 1, 8, w->file) != 8)
+    w->failed = 1;
+
+  unsigned char ihdr[13];
+  PutBE32(ihdr, (unsigned int)width);
+  PutBE32(ihdr + 4, (unsigned int)height);
+  ihdr[8] = 8;  // bits per channel
+  ihdr[9] = 6;  // rgba
+  ihdr[10] = 0; // deflate
+  ihdr[11] = 0; // adaptive filters
+  ihdr[12] = 0; // not interlaced
+  WriteChunk(w, "IHDR", ihdr, sizeof(ihdr));
+  return !w->failed;
+}
+
+int PngWriter_WriteRows(PngWriter *w, const unsigned char *rgba, int rows) {
+  if (w->failed || rows <= 0 || w->rowsWritten + rows > w->height) {
+    w->failed = 1;
+    return 0;
+  }
+
+  const LevelInfo *level = &g_levels[w->level];
+  int rowBytes = w->width * 4;
+  size_t lineBytes = (size_t)rowBytes + 1;
+  int chunkRows = ChunkRows(w->width);
+  int taskCount = (rows + chunkRows - 1) / chunkRows;
+
+  // the history tail of the last band stays at the front
+  size_t need = w->historyLen + (size_t)rows * lineBytes;
+  if (need > w->filteredCap) {
+    unsigned char *buf = (unsigned char *)realloc(w->filtered, need);
+    if (!buf) {
+      w->failed = 1;
+      return 0;
+    }
+    w->filtered = buf;
+    w->filteredCap = need;
+  }
+  if (taskCount > w->taskCap) {
+    PngTask *tasks =
+        (PngTask *)realloc(w->tasks, sizeof(PngTask) * taskCount);
+    if (!tasks) {
+      w->failed = 1;
+      return 0;
+    }
+    memset(tasks + w->taskCap, 0, sizeof(PngTask) * (taskCount - w->taskCap));
+    w->tasks = tasks;
+    w->taskCap = taskCount;
+  }
+
+  for (int t = 0; t < taskCount; t++) {
+    PngTask *task = &w->tasks[t];
+    task->firstRow = t * chunkRows;
+    task->rows = rows - task->firstRow < chunkRows ? rows - task->firstRow
+                                                   : chunkRows;
+    task->start = w->historyLen + (size_t)task->firstRow * lineBytes;
+    task->len = (size_t)task->rows * lineBytes;
+  }
+
+  // filter everything first - a chunk's matches look into the one before
+#pragma omp parallel for schedule(dynamic) num_threads(w->threads)
+  for (int t = 0; t < taskCount; t++) {
+    PngTask *task = &w->tasks[t];
+    for (int r = task->firstRow; r < task->firstRow + task->rows; r++) {
+      const unsigned char *cur = rgba + (size_t)r * rowBytes;
+      const unsigned char *up = r > 0 ? cur - rowBytes : w->prevRow;
+      FilterRow(cur, up, rowBytes, level->adaptiveFilter,
+                w->filtered + w->historyLen + (size_t)r * lineBytes);
+    }
+  }
+
+#pragma omp parallel for schedule(dynamic) num_threads(w->threads)
+  for (int t = 0; t < taskCount; t++) {
+    PngTask *task = &w->tasks[t];
+    task->failed = !PrepareTask(task, task->len);
+    if (task->failed)
+      continue;
+
+    // up to 32k before the chunk is history for the match finder
+    size_t history = task->start < DEFLATE_WINDOW ? task->start
+                                                  : DEFLATE_WINDOW;
+    const unsigned char *base = w->filtered + task->start - history;
+    task->outLen = DeflateChunk(task, level, base, (int)history,
+                                (int)(history + task->len), task->out + 2);
+    task->adler = Adler32(1, w->filtered + task->start, task->len);
+  }
+
+  // stitch in order
+  for (int t = 0; t < taskCount && !w->failed; t++) {
+    PngTask *task = &w->tasks[t];
+    if (task->failed) {
+      w->failed = 1;
+      break;
+    }
+    unsigned char *data = task->out + 2;
+    size_t len = task->outLen;
+    if (w->rowsWritten == 0 && t == 0) {
+      // the zlib header rides along with the very first chunk
+      data = task->out;
+      data[0] = 0x78;
+      data[1] = 0x01;
+      len += 2;
+    }
+    WriteChunk(w, "IDAT", data, len);
+    w->adler = AdlerCombine(w->adler, task->adler, task->len);
+  }
+
+  memcpy(w->prevRow, rgba + (size_t)(rows - 1) * rowBytes, rowBytes);
+  size_t total = w->historyLen + (size_t)rows * lineBytes;
+  size_t keep = total < DEFLATE_WINDOW ? total : DEFLATE_WINDOW;
+  memmove(w->filtered, w->filtered + total - keep, keep);
+  w->historyLen = keep;
+
+  w->rowsWritten += rows;
+  return !w->failed;
+}
+
+int PngWriter_Close(PngWriter *w) {
+  if (w->file && !w->failed && w->rowsWritten == w->height) {
+    // empty final block, then the adler-32 of the whole stream
+    unsigned char tail[6] = {0x03, 0x00};
+    PutBE32(tail + 2, w->adler);
+    WriteChunk(w, "IDAT", tail, sizeof(tail));
+    WriteChunk(w, "IEND", NULL, 0);
+  } else {
+    w->failed = 1;
+  }
+
+  if (w->file && fclose(w->file) != 0)
+    w->failed = 1;
+  if (w->failed && w->file)
+    DeleteFileA(w->path); // no half written files
+
+  int ok = !w->failed;
+  for (int t = 0; t < w->taskCap; t++)
+    FreeTask(&w->tasks[t]);
+  free(w->tasks);
+  free(w->prevRow);
+  free(w->filtered);
+  memset(w, 0, sizeof(PngWriter));
+  return ok;
+}
+
+int PngWriter_WriteImage(const char *path, const unsigned char *rgba,
+                         int width, int height, PngLevel level, int threads) {
+  PngWriter w;
+  if (!PngWriter_Open(&w, path, width, height, level, threads))
+    return 0;
+
+  // two chunks per thread per band keeps every thread busy
+  int band = ChunkRows(width) * w.threads * 2;
+  for (int y = 0; y < height; y += band) {
+    int rows = height - y < band ? height - y : band;
+    if (!PngWriter_WriteRows(&w, rgba + (size_t)y * width * 4, rows))
+      break;
+  }
+  return PngWriter_Close(&w);
+}
+
+size_t PngWriter_WorkingSet(int width, int rows) {
+  size_t lineBytes = (size_t)width * 4 + 1;
+  int chunkRows = ChunkRows(width);
+  size_t tasks = (rows + chunkRows - 1) / chunkRows;
+  size_t perTask = sizeof(int) * (HASH_SIZE + DEFLATE_WINDOW) +
+                   sizeof(unsigned int) * BLOCK_TOKENS +
+                   DeflateBound((size_t)chunkRows * lineBytes);
+  return DEFLATE_WINDOW + (size_t)rows * lineBytes + lineBytes +
+         tasks * perTask;
+}
+
+const char *PngWriter_LevelName(PngLevel level) {
+  return (level >= 0 && level < PNG_LEVEL_COUNT) ? g_levelNames[level]
+                                                 : "default";
+}
+
+int PngWriter_LevelFromName(const char *name) {
+  for (int i = 0; i < PNG_LEVEL_COUNT; i++) {
+    if (_stricmp(name, g_levelNames[i]) == 0)
+      return i;
+  }
+  return -1;
+}
@@ -0,0 +1,60 @@
+// png writer header
+// writes a png a band of rows at a time, so the whole image never has to
+// sit in memory. each band is cut into chunks that filter + deflate on
+// their own threads and get stitched back into one zlib stream
+
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include <stdio.h>
+#include <windows.h>
+
+#define PNG_CHUNK_BYTES (1024 * 1024) // raw bytes per thread task
+
+typedef enum {
+  PNG_LEVEL_FAST,    // one filter, short match search, fixed huffman
+  PNG_LEVEL_DEFAULT, // best of five filters per row, dynamic huffman
+  PNG_LEVEL_SMALL,   // + long match search and lazy matching
+  PNG_LEVEL_COUNT
+} PngLevel;
+
+typedef struct PngTask PngTask; // one chunk's buffers, png_writer.c
+
+typedef struct {
+  FILE *file;
+  char path[MAX_PATH]; // removed again if the write fails
+  int width;
+  int height;
+  int rowsWritten;
+  PngLevel level;
+  int threads;
+  unsigned char *prevRow; // last rgba row written (the filters look up)
+  unsigned char *filtered; // tail of the last band (match history) + band
+  size_t filteredCap;
+  size_t historyLen;
+  PngTask *tasks;
+  int taskCap;
+  unsigned int adler; // adler-32 of everything deflated so far
+  int failed;
+} PngWriter;
+
+// writes the header. rows must then add up to exactly height.
+// threads <= 0 uses the openmp default for the calling thread
+int PngWriter_Open(PngWriter *w, const char *path, int width, int height,
+                   PngLevel level, int threads);
+// filters and deflates rgba rows (chunks in parallel), then appends them
+int PngWriter_WriteRows(PngWriter *w, const unsigned char *rgba, int rows);
+// finishes the stream. returns 0 (and deletes the file) if anything failed
+int PngWriter_Close(PngWriter *w);
+
+// a whole image, fed through in bands - drop in for stbi_write_png
+int PngWriter_WriteImage(const char *path, const unsigned char *rgba,
+                         int width, int height, PngLevel level, int threads);
+
+// bytes the writer holds while taking rows at a time
+size_t PngWriter_WorkingSet(int width, int rows);
+
+const char *PngWriter_LevelName(PngLevel level);
+int PngWriter_LevelFromName(const char *name); // -1 if unknown
+
+#endif
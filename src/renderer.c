@@ -1,10 +1,67 @@
 /*
  * Renderer - Implementation
  * pix - renderer
+ *
+ * the image is never stretched whole. a paint works out which part of it
+ * is on screen, resamples just that (plus a margin) out of the dib into a
+ * second one at the current scale, and blits from there - so the cost
+ * follows the window size, and a pan that stays inside the margin doesnt
+ * resample anything at all.
+ *
+ * zoomed out, the resample reads from the smallest mip level that is still
+ * at least as big as the view, so it only ever averages 1-2 source pixels
+ * per axis instead of every pixel the screen pixel covers.
+ *
+ * that first frame is nearest/box, so it is instant. when the view has sat
+ * still for a moment a worker redoes just the visible part with lanczos-3
+ * and it is copied over the cache when it lands. any change of view bumps
+ * the job's generation, which the worker checks every row, so a stale pass
+ * stops almost at once.
  */
 
 #include "renderer.h"
+#include "gdi_cache.h"
+#include "pixel_memory.h"
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define VIEW_MARGIN 256   // scaled pixels cached past each edge of the view
+#define HQ_SETTLE_MS 120  // how long the view has to sit still for lanczos
+#define HQ_MAX_ZOOM 4.0f  // past this nearest neighbour is the point
+
+// one lanczos pass: rect of the image scaled to scaledW x scaledH, read
+// from a mip level
+typedef struct {
+  const unsigned char *src;
+  int srcW, srcH;
+  int scaledW, scaledH;
+  RECT rect; // scaled image coords
+  float scale;
+} HqJob;
+
+struct HqRender {
+  HWND hwnd;
+  HANDLE thread;
+
+  // guarded by lock
+  CRITICAL_SECTION lock;
+  CONDITION_VARIABLE wake; // a job was queued (or quit)
+  CONDITION_VARIABLE idle; // the worker let go of the source
+  int quit;
+  LONG generation; // bumped to cancel whatever is queued or running
+  int pending;
+  int busy; // reading the source pixels right now
+  DWORD queuedAt;
+  HqJob job;
+
+  // a finished pass, waiting for the ui to pick it up
+  unsigned char *result;
+  RECT resultRect;
+  float resultScale;
+};
+
+static void CancelHq(Renderer *renderer, int wait);
 
 void Renderer_Init(Renderer *renderer) {
   renderer->hBitmap = NULL;
@@ -22,12 +79,30 @@ void Renderer_Init(Renderer *renderer) {
   renderer->cachedScale = 0.0f;
   renderer->cachedWidth = 0;
   renderer->cachedHeight = 0;
+  renderer->scaledBits = NULL;
+  renderer->scaledBytes = 0;
+  SetRectEmpty(&renderer->cacheRect);
+  renderer->bitmapBytes = 0;
+  renderer->mipCount = 0;
+
+  SetRectEmpty(&renderer->hqRect);
+  SetRectEmpty(&renderer->hqQueued);
+  renderer->hqQueuedScale = 0.0f;
+  renderer->live = FALSE;
+  renderer->hq = NULL;
 }
 
 void Renderer_Cleanup(Renderer *renderer) {
+  CancelHq(renderer, 1);
+  Renderer_FreeMips(renderer);
+  renderer->mipCount = 0;
+  renderer->live = FALSE;
   if (renderer->hBitmap) {
     DeleteObject(renderer->hBitmap);
     renderer->hBitmap = NULL;
+    renderer->bits = NULL;
+    PixelMemory_Track(PIXMEM_RENDERER, -(long long)renderer->bitmapBytes);
+    renderer->bitmapBytes = 0;
   }
   if (renderer->hMemDC) {
     DeleteDC(renderer->hMemDC);
@@ -37,6 +112,9 @@ void Renderer_Cleanup(Renderer *renderer) {
   if (renderer->hScaledBitmap) {
     DeleteObject(renderer->hScaledBitmap);
     renderer->hScaledBitmap = NULL;
+    renderer->scaledBits = NULL;
+    PixelMemory_Track(PIXMEM_RENDERER, -(long long)renderer->scaledBytes);
+    renderer->scaledBytes = 0;
   }
   if (renderer->hScaledDC) {
     DeleteDC(renderer->hScaledDC);
@@ -45,6 +123,635 @@ void Renderer_Cleanup(Renderer *renderer) {
   renderer->cachedScale = 0.0f;
   renderer->cachedWidth = 0;
   renderer->cachedHeight = 0;
+  SetRectEmpty(&renderer->cacheRect);
+  SetRectEmpty(&renderer->hqRect);
+}
+
+// the image's size on screen at the current scale
+static void ScaledSize(const Renderer *renderer, int *w, int *h) {
+  *w = (int)(renderer->displayWidth * renderer->scale);
+  *h = (int)(renderer->displayHeight * renderer->scale);
+}
+
+// the next level down, half the size (rounded up so the last odd row and
+// column still count)
+static int Half(int n) { return n > 1 ? (n + 1) / 2 : 1; }
+
+// rebuilds r (level coords) of mip level from the one above it, each pixel
+// the average of the 2x2 under it. rows are independent, so openmp
+static void Reduce(Renderer *renderer, int level, const RECT *r) {
+  const unsigned char *src = renderer->mips[level - 1];
+  int sw = renderer->mipW[level - 1], sh = renderer->mipH[level - 1];
+  unsigned char *dst = renderer->mips[level];
+  int dw = renderer->mipW[level];
+
+#pragma omp parallel for schedule(static)
+  for (int y = r->top; y < r->bottom; y++) {
+    const unsigned char *a = src + (size_t)(y * 2) * sw * 4;
+    const unsigned char *b =
+        y * 2 + 1 < sh ? a + (size_t)sw * 4 : a; // odd last row
+    unsigned char *o = dst + ((size_t)y * dw + r->left) * 4;
+    for (int x = r->left; x < r->right; x++, o += 4) {
+      int x0 = x * 2 * 4;
+      int x1 = x * 2 + 1 < sw ? x0 + 4 : x0;
+      for (int c = 0; c < 4; c++)
+        o[c] = (unsigned char)((a[x0 + c] + a[x1 + c] + b[x0 + c] +
+                                b[x1 + c] + 2) >> 2);
+    }
+  }
+}
+
+// the smallest level that is still at least scaledW x scaledH
+static int WantLevel(const Renderer *renderer, int scaledW, int scaledH) {
+  int level = 0;
+  int w = renderer->displayWidth, h = renderer->displayHeight;
+  while (level + 1 < RENDERER_MAX_MIPS && Half(w) >= scaledW &&
+         Half(h) >= scaledH && (w > 1 || h > 1)) {
+    w = Half(w);
+    h = Half(h);
+    level++;
+  }
+  return level;
+}
+
+// builds the levels down to level that arent there yet. stops early if
+// memory runs out, the resample then just reads from a bigger level
+static void BuildMips(Renderer *renderer, int level) {
+  while (renderer->mipCount && renderer->mipCount <= level) {
+    int i = renderer->mipCount;
+    int w = Half(renderer->mipW[i - 1]), h = Half(renderer->mipH[i - 1]);
+    unsigned char *pixels =
+        (unsigned char *)PixelMemory_Alloc((size_t)w * h * 4, PIXMEM_MIPS);
+    if (!pixels)
+      return;
+    if (renderer->mipCount != i) {
+      // making room evicted the pyramid itself
+      PixelMemory_Free(pixels);
+      return;
+    }
+    renderer->mips[i] = pixels;
+    renderer->mipW[i] = w;
+    renderer->mipH[i] = h;
+    RECT all = {0, 0, w, h};
+    Reduce(renderer, i, &all);
+    renderer->mipCount = i + 1;
+  }
+}
+
+size_t Renderer_FreeMips(Renderer *renderer) {
+  if (renderer->mipCount > 1)
+    CancelHq(renderer, 1);
+  size_t freed = 0;
+  for (int i = 1; i < renderer->mipCount; i++) {
+    freed += (size_t)renderer->mipW[i] * renderer->mipH[i] * 4;
+    PixelMemory_Free(renderer->mips[i]);
+    renderer->mips[i] = NULL;
+  }
+  if (renderer->mipCount > 1)
+    renderer->mipCount = 1;
+  return freed;
+}
+
+// fills dst (scaled image coords, inside cacheRect) of the cache from the
+// bitmap. zoomed in each pixel is the source pixel under its centre;
+// zoomed out it is the average of every pixel it covers in the nearest mip
+// level, like halftone but only over the part asked for
+static void Resample(Renderer *renderer, const RECT *dst) {
+  int scaledW, scaledH;
+  ScaledSize(renderer, &scaledW, &scaledH);
+  int level = WantLevel(renderer, scaledW, scaledH);
+  if (level >= renderer->mipCount)
+    level = renderer->mipCount - 1;
+  int sw = renderer->mipW[level], sh = renderer->mipH[level];
+  double fx = (double)sw / scaledW, fy = (double)sh / scaledH;
+
+  int w = dst->right - dst->left;
+  int stride = renderer->cachedWidth;
+  const unsigned int *src = (const unsigned int *)renderer->mips[level];
+  unsigned int *out =
+      (unsigned int *)renderer->scaledBits +
+      (size_t)(dst->top - renderer->cacheRect.top) * stride +
+      (dst->left - renderer->cacheRect.left);
+
+  // source columns for each output column: [x0, x1)
+  int *x0 = (int *)malloc(sizeof(int) * w * 2);
+  if (!x0)
+    return;
+  int *x1 = x0 + w;
+  for (int x = 0; x < w; x++) {
+    int dx = dst->left + x;
+    if (fx <= 1.0) {
+      x0[x] = (int)((dx + 0.5) * fx);
+      x1[x] = x0[x] + 1;
+    } else {
+      x0[x] = (int)(dx * fx);
+      x1[x] = (int)((dx + 1) * fx);
+      if (x1[x] <= x0[x])
+        x1[x] = x0[x] + 1;
+    }
+    if (x1[x] > sw)
+      x1[x] = sw;
+    if (x0[x] >= x1[x])
+      x0[x] = x1[x] - 1;
+  }
+
+  if (fx <= 1.0 && fy <= 1.0) {
+    // zoomed in, runs of output rows repeat one source row
+    int lastY = -1;
+    for (int y = dst->top; y < dst->bottom; y++, out += stride) {
+      int sy = (int)((y + 0.5) * fy);
+      if (sy >= sh)
+        sy = sh - 1;
+      if (sy == lastY) {
+        memcpy(out, out - stride, (size_t)w * 4);
+        continue;
+      }
+      const unsigned int *row = src + (size_t)sy * sw;
+      for (int x = 0; x < w; x++)
+        out[x] = row[x0[x]];
+      lastY = sy;
+    }
+    free(x0);
+    return;
+  }
+
+  unsigned int *sum = (unsigned int *)malloc(sizeof(unsigned int) * w * 4);
+  if (!sum) {
+    free(x0);
+    return;
+  }
+  for (int y = dst->top; y < dst->bottom; y++, out += stride) {
+    int y0 = (int)(y * fy), y1 = (int)((y + 1) * fy);
+    if (y1 <= y0)
+      y1 = y0 + 1;
+    if (y1 > sh)
+      y1 = sh;
+    if (y0 >= y1)
+      y0 = y1 - 1;
+
+    memset(sum, 0, sizeof(unsigned int) * w * 4);
+    for (int sy = y0; sy < y1; sy++) {
+      const unsigned char *row =
+          (const unsigned char *)(src + (size_t)sy * sw);
+      for (int x = 0; x < w; x++) {
+        unsigned int *s = sum + x * 4;
+        for (int sx = x0[x]; sx < x1[x]; sx++) {
+          const unsigned char *p = row + sx * 4;
+          s[0] += p[0];
+          s[1] += p[1];
+          s[2] += p[2];
+          s[3] += p[3];
+        }
+      }
+    }
+
+    unsigned char *o = (unsigned char *)out;
+    for (int x = 0; x < w; x++) {
+      unsigned int n = (unsigned int)((x1[x] - x0[x]) * (y1 - y0));
+      const unsigned int *s = sum + x * 4;
+      o[x * 4 + 0] = (unsigned char)(s[0] / n);
+      o[x * 4 + 1] = (unsigned char)(s[1] / n);
+      o[x * 4 + 2] = (unsigned char)(s[2] / n);
+      o[x * 4 + 3] = (unsigned char)(s[3] / n);
+    }
+  }
+  free(sum);
+  free(x0);
+}
+
+// makes the cache cover vis (scaled image coords) plus the margin. the dib
+// is kept when it is big enough and not wastefully so
+static BOOL FillCache(Renderer *renderer, HDC hdc, const RECT *vis) {
+  int scaledW, scaledH;
+  ScaledSize(renderer, &scaledW, &scaledH);
+
+  RECT want = *vis;
+  InflateRect(&want, VIEW_MARGIN, VIEW_MARGIN);
+  RECT all = {0, 0, scaledW, scaledH};
+  IntersectRect(&want, &want, &all);
+  int w = want.right - want.left;
+  int h = want.bottom - want.top;
+
+  if (w > renderer->cachedWidth || h > renderer->cachedHeight ||
+      (size_t)renderer->cachedWidth * renderer->cachedHeight >
+          (size_t)w * h * 2) {
+    if (renderer->hScaledBitmap) {
+      DeleteObject(renderer->hScaledBitmap);
+      PixelMemory_Track(PIXMEM_RENDERER, -(long long)renderer->scaledBytes);
+    }
+    renderer->hScaledBitmap = NULL;
+    renderer->scaledBits = NULL;
+    renderer->scaledBytes = 0;
+    renderer->cachedWidth = renderer->cachedHeight = 0;
+    renderer->cachedScale = 0.0f;
+
+    // this runs mid-paint, so these show up in the settings panel's
+    // "while painting" count - once per zoom/resize, not per frame
+    if (!renderer->hScaledDC) {
+      renderer->hScaledDC = CreateCompatibleDC(hdc);
+      if (!renderer->hScaledDC)
+        return FALSE;
+      GdiCache_NoteCreated();
+    }
+
+    BITMAPINFO bmi = {0};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = w;
+    bmi.bmiHeader.biHeight = -h;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    void *bits = NULL;
+    renderer->hScaledBitmap =
+        CreateDIBSection(hdc, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+    if (renderer->hScaledBitmap)
+      GdiCache_NoteCreated();
+    if (!renderer->hScaledBitmap || !bits) {
+      if (renderer->hScaledBitmap)
+        DeleteObject(renderer->hScaledBitmap);
+      renderer->hScaledBitmap = NULL;
+      return FALSE;
+    }
+    SelectObject(renderer->hScaledDC, renderer->hScaledBitmap);
+    renderer->scaledBits = bits;
+    renderer->cachedWidth = w;
+    renderer->cachedHeight = h;
+    renderer->scaledBytes = (size_t)w * h * 4;
+    PixelMemory_Track(PIXMEM_RENDERER, (long long)renderer->scaledBytes);
+  } else {
+    GdiFlush(); // a queued blt may still be reading the old contents
+  }
+
+  BuildMips(renderer, WantLevel(renderer, scaledW, scaledH));
+
+  renderer->cacheRect = want;
+  renderer->cachedScale = renderer->scale;
+  SetRectEmpty(&renderer->hqRect);
+  Resample(renderer, &want);
+  return TRUE;
+}
+
+// lanczos window, sinc(x) * sinc(x/3)
+static double Lanczos3(double x) {
+  if (x == 0.0)
+    return 1.0;
+  if (x <= -3.0 || x >= 3.0)
+    return 0.0;
+  double pix = 3.14159265358979323846 * x;
+  return 3.0 * sin(pix) * sin(pix / 3.0) / (pix * pix);
+}
+
+// weights for output pixels [from, from + count) of a srcLen -> dstLen
+// resize, *taps per pixel starting at source index first[i] (unclamped).
+// shrinking widens the kernel by the ratio so every source pixel counts
+static float *LanczosWeights(int from, int count, int srcLen, int dstLen,
+                             int *first, int *taps) {
+  double ratio = (double)srcLen / dstLen;
+  double stretch = ratio > 1.0 ? ratio : 1.0;
+  double support = 3.0 * stretch;
+  int n = (int)ceil(support) * 2 + 1;
+
+  float *weights = (float *)malloc(sizeof(float) * count * n);
+  if (!weights)
+    return NULL;
+  for (int i = 0; i < count; i++) {
+    double center = (from + i + 0.5) * ratio - 0.5;
+    int lo = (int)floor(center - support) + 1;
+    float *w = weights + (size_t)i * n;
+    double sum = 0;
+    for (int k = 0; k < n; k++) {
+      w[k] = (float)Lanczos3((lo + k - center) / stretch);
+      sum += w[k];
+    }
+    for (int k = 0; k < n; k++)
+      w[k] = sum != 0 ? (float)(w[k] / sum) : 0.0f;
+    first[i] = lo;
+  }
+  *taps = n;
+  return weights;
+}
+
+static int Clamp(int v, int lo, int hi) { return v < lo ? lo : v > hi ? hi : v; }
+
+static int Cancelled(HqRender *hq, LONG generation) {
+  EnterCriticalSection(&hq->lock);
+  int stale = hq->quit || hq->generation != generation;
+  LeaveCriticalSection(&hq->lock);
+  return stale;
+}
+
+// the job's rect into out (rect sized, bgra), separably: each source row
+// is filtered across once into a small ring, output rows mix the ring.
+// 0 if cancelled or out of memory
+static int LanczosRect(HqRender *hq, const HqJob *job, LONG generation,
+                       unsigned char *out) {
+  const RECT *r = &job->rect;
+  int w = r->right - r->left, h = r->bottom - r->top;
+  int sw = job->srcW, sh = job->srcH;
+
+  int *firstX = (int *)malloc(sizeof(int) * (w + h));
+  int *firstY = firstX ? firstX + w : NULL;
+  int tapsX = 0, tapsY = 0;
+  float *wx = firstX ? LanczosWeights(r->left, w, sw, job->scaledW, firstX,
+                                      &tapsX)
+                     : NULL;
+  float *wy = wx ? LanczosWeights(r->top, h, sh, job->scaledH, firstY, &tapsY)
+                 : NULL;
+  // filtered rows, source row s lives in slot s % tapsY
+  float *ring = wy ? (float *)malloc(sizeof(float) * w * 4 * tapsY) : NULL;
+  int *ringRow = ring ? (int *)malloc(sizeof(int) * tapsY) : NULL;
+
+  int ok = ringRow != NULL;
+  for (int i = 0; ok && i < tapsY; i++)
+    ringRow[i] = -1;
+
+  for (int y = 0; ok && y < h; y++) {
+    if (Cancelled(hq, generation)) {
+      ok = 0;
+      break;
+    }
+
+    for (int k = 0; k < tapsY; k++) {
+      int sy = Clamp(firstY[y] + k, 0, sh - 1);
+      float *row = ring + (size_t)(sy % tapsY) * w * 4;
+      if (ringRow[sy % tapsY] == sy)
+        continue;
+      ringRow[sy % tapsY] = sy;
+
+      const unsigned char *src = job->src + (size_t)sy * sw * 4;
+      for (int x = 0; x < w; x++) {
+        const float *kw = wx + (size_t)x * tapsX;
+        float c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+        for (int t = 0; t < tapsX; t++) {
+          const unsigned char *p =
+              src + Clamp(firstX[x] + t, 0, sw - 1) * 4;
+          c0 += p[0] * kw[t];
+          c1 += p[1] * kw[t];
+          c2 += p[2] * kw[t];
+          c3 += p[3] * kw[t];
+        }
+        row[x * 4 + 0] = c0;
+        row[x * 4 + 1] = c1;
+        row[x * 4 + 2] = c2;
+        row[x * 4 + 3] = c3;
+      }
+    }
+
+    unsigned char *o = out + (size_t)y * w * 4;
+    const float *kw = wy + (size_t)y * tapsY;
+    for (int x = 0; x < w * 4; x++) {
+      float v = 0.5f;
+      for (int k = 0; k < tapsY; k++) {
+        int sy = Clamp(firstY[y] + k, 0, sh - 1);
+        v += ring[(size_t)(sy % tapsY) * w * 4 + x] * kw[k];
+      }
+      o[x] = (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+  }
+
+  free(ringRow);
+  free(ring);
+  free(wy);
+  free(wx);
+  free(firstX);
+  return ok;
+}
+
+static DWORD WINAPI HqWorker(LPVOID param) {
+  HqRender *hq = (HqRender *)param;
+
+  EnterCriticalSection(&hq->lock);
+  for (;;) {
+    while (!hq->quit && !hq->pending)
+      SleepConditionVariableCS(&hq->wake, &hq->lock, INFINITE);
+    if (hq->quit)
+      break;
+
+    // only once the view has stopped moving - a drag would otherwise
+    // start (and cancel) a pass on every mouse move
+    DWORD age = GetTickCount() - hq->queuedAt;
+    if (age < HQ_SETTLE_MS) {
+      SleepConditionVariableCS(&hq->wake, &hq->lock, HQ_SETTLE_MS - age);
+      continue;
+    }
+
+    LONG generation = hq->generation;
+    HqJob job = hq->job;
+    hq->pending = 0;
+    hq->busy = 1;
+    LeaveCriticalSection(&hq->lock);
+
+    size_t bytes = (size_t)(job.rect.right - job.rect.left) *
+                   (job.rect.bottom - job.rect.top) * 4;
+    unsigned char *out =
+        (unsigned char *)PixelMemory_Alloc(bytes, PIXMEM_RENDERER);
+    int ok = out && LanczosRect(hq, &job, generation, out);
+
+    EnterCriticalSection(&hq->lock);
+    hq->busy = 0;
+    WakeAllConditionVariable(&hq->idle);
+    if (ok && generation == hq->generation) {
+      PixelMemory_Free(hq->result);
+      hq->result = out;
+      hq->resultRect = job.rect;
+      hq->resultScale = job.scale;
+      out = NULL;
+      PostMessageA(hq->hwnd, WM_RENDER_READY, 0, 0);
+    }
+    PixelMemory_Free(out);
+  }
+  LeaveCriticalSection(&hq->lock);
+  return 0;
+}
+
+void Renderer_StartHq(Renderer *renderer, HWND hwnd) {
+  if (renderer->hq)
+    return;
+
+  HqRender *hq = (HqRender *)calloc(1, sizeof(HqRender));
+  if (!hq)
+    return;
+  hq->hwnd = hwnd;
+  InitializeCriticalSection(&hq->lock);
+  InitializeConditionVariable(&hq->wake);
+  InitializeConditionVariable(&hq->idle);
+
+  hq->thread = CreateThread(NULL, 0, HqWorker, hq, 0, NULL);
+  if (!hq->thread) {
+    DeleteCriticalSection(&hq->lock);
+    free(hq);
+    return;
+  }
+  SetThreadPriority(hq->thread, THREAD_PRIORITY_BELOW_NORMAL);
+  renderer->hq = hq;
+}
+
+void Renderer_StopHq(Renderer *renderer) {
+  HqRender *hq = renderer->hq;
+  if (!hq)
+    return;
+
+  EnterCriticalSection(&hq->lock);
+  hq->quit = 1;
+  WakeAllConditionVariable(&hq->wake);
+  LeaveCriticalSection(&hq->lock);
+  WaitForSingleObject(hq->thread, INFINITE);
+  CloseHandle(hq->thread);
+
+  PixelMemory_Free(hq->result);
+  DeleteCriticalSection(&hq->lock);
+  free(hq);
+  renderer->hq = NULL;
+  renderer->hqQueuedScale = 0.0f;
+}
+
+// drops whatever is queued or running, and with wait also returns only
+// once the worker has stopped reading the source (before it is changed)
+static void CancelHq(Renderer *renderer, int wait) {
+  HqRender *hq = renderer->hq;
+  renderer->hqQueuedScale = 0.0f;
+  if (!hq)
+    return;
+
+  EnterCriticalSection(&hq->lock);
+  hq->generation++;
+  hq->pending = 0;
+  PixelMemory_Free(hq->result);
+  hq->result = NULL;
+  while (wait && hq->busy)
+    SleepConditionVariableCS(&hq->idle, &hq->lock, INFINITE);
+  LeaveCriticalSection(&hq->lock);
+}
+
+// lanczos is worth it zoomed out and at in-between zooms in. at whole
+// zooms nearest is exact, and far in the pixels are what you want to see
+static int WantsHq(float scale) {
+  if (scale < 1.0f)
+    return 1;
+  return scale < HQ_MAX_ZOOM && scale != (float)(int)scale;
+}
+
+// copies a finished pass over the cache, then queues one for vis if the
+// cache doesnt already have it
+static void UpdateHq(Renderer *renderer, const RECT *vis) {
+  HqRender *hq = renderer->hq;
+  if (!hq)
+    return;
+
+  EnterCriticalSection(&hq->lock);
+  unsigned char *result = hq->result;
+  RECT resultRect = hq->resultRect;
+  float resultScale = hq->resultScale;
+  hq->result = NULL;
+  LeaveCriticalSection(&hq->lock);
+
+  RECT inside;
+  if (result && resultScale == renderer->cachedScale &&
+      resultScale == renderer->scale &&
+      IntersectRect(&inside, &resultRect, &renderer->cacheRect) &&
+      EqualRect(&inside, &resultRect)) {
+    int w = resultRect.right - resultRect.left;
+    GdiFlush();
+    for (int y = resultRect.top; y < resultRect.bottom; y++)
+      memcpy((unsigned int *)renderer->scaledBits +
+                 (size_t)(y - renderer->cacheRect.top) * renderer->cachedWidth +
+                 (resultRect.left - renderer->cacheRect.left),
+             result + (size_t)(y - resultRect.top) * w * 4, (size_t)w * 4);
+    renderer->hqRect = resultRect;
+  }
+  // the cache holds it now (or it was for a view thats gone)
+  PixelMemory_Free(result);
+
+  BOOL done = IntersectRect(&inside, vis, &renderer->hqRect) &&
+              EqualRect(&inside, vis);
+  if (done || renderer->live || !WantsHq(renderer->scale)) {
+    if (renderer->hqQueuedScale != 0.0f)
+      CancelHq(renderer, 0);
+    return;
+  }
+  if (renderer->hqQueuedScale == renderer->scale &&
+      EqualRect(&renderer->hqQueued, vis))
+    return; // already on it
+
+  int scaledW, scaledH;
+  ScaledSize(renderer, &scaledW, &scaledH);
+  int level = WantLevel(renderer, scaledW, scaledH);
+  if (level >= renderer->mipCount)
+    level = renderer->mipCount - 1;
+
+  EnterCriticalSection(&hq->lock);
+  hq->generation++;
+  hq->pending = 1;
+  hq->queuedAt = GetTickCount();
+  hq->job.src = renderer->mips[level];
+  hq->job.srcW = renderer->mipW[level];
+  hq->job.srcH = renderer->mipH[level];
+  hq->job.scaledW = scaledW;
+  hq->job.scaledH = scaledH;
+  hq->job.rect = *vis;
+  hq->job.scale = renderer->scale;
+  WakeConditionVariable(&hq->wake);
+  LeaveCriticalSection(&hq->lock);
+
+  renderer->hqQueued = *vis;
+  renderer->hqQueuedScale = renderer->scale;
+}
+
+void Renderer_DrawView(Renderer *renderer, HDC hdc, const RECT *view) {
+  if (!renderer->bits || !renderer->displayWidth || !renderer->displayHeight)
+    return;
+
+  int scaledW, scaledH;
+  ScaledSize(renderer, &scaledW, &scaledH);
+  if (scaledW < 1 || scaledH < 1)
+    return;
+
+  RECT image = {renderer->offsetX, renderer->offsetY,
+                renderer->offsetX + scaledW, renderer->offsetY + scaledH};
+  RECT vis;
+  if (!IntersectRect(&vis, view, &image))
+    return;
+  OffsetRect(&vis, -renderer->offsetX, -renderer->offsetY);
+
+  RECT inside;
+  BOOL cached = renderer->cachedScale == renderer->scale &&
+                IntersectRect(&inside, &vis, &renderer->cacheRect) &&
+                EqualRect(&inside, &vis);
+  if (!cached && !FillCache(renderer, hdc, &vis)) {
+    // no room for the cache, let gdi stretch the visible part directly
+    int sw = renderer->displayWidth, sh = renderer->displayHeight;
+    int sx = (int)((double)vis.left * sw / scaledW);
+    int sy = (int)((double)vis.top * sh / scaledH);
+    int sx1 = (int)((double)vis.right * sw / scaledW + 0.999);
+    int sy1 = (int)((double)vis.bottom * sh / scaledH + 0.999);
+    int dx = renderer->offsetX + (int)((double)sx * scaledW / sw);
+    int dy = renderer->offsetY + (int)((double)sy * scaledH / sh);
+    SetStretchBltMode(hdc, renderer->scale >= 1.0f ? COLORONCOLOR : HALFTONE);
+    SetBrushOrgEx(hdc, 0, 0, NULL);
+    StretchBlt(hdc, dx, dy,
+               renderer->offsetX + (int)((double)sx1 * scaledW / sw) - dx,
+               renderer->offsetY + (int)((double)sy1 * scaledH / sh) - dy,
+               renderer->hMemDC, sx, sy, sx1 - sx, sy1 - sy, SRCCOPY);
+    return;
+  }
+
+  UpdateHq(renderer, &vis);
+
+  BitBlt(hdc, vis.left + renderer->offsetX, vis.top + renderer->offsetY,
+         vis.right - vis.left, vis.bottom - vis.top, renderer->hScaledDC,
+         vis.left - renderer->cacheRect.left,
+         vis.top - renderer->cacheRect.top, SRCCOPY);
+}
+
+// a dib section wants bgra - the viewer loads that already, so normally
+// this is a straight copy
+static void CopyToDib(unsigned char *dst, const ImageData *image,
+                      const unsigned char *src, size_t pixels) {
+  if (image->pixelFormat == PIXEL_BGRA)
+    memcpy(dst, src, pixels * 4);
+  else
+    ImageLoader_SwizzleRB(dst, src, pixels);
 }
 
 void Renderer_CreateBitmap(Renderer *renderer, HDC hdc,
@@ -57,6 +764,8 @@ void Renderer_CreateBitmap(Renderer *renderer, HDC hdc,
 
   // Create compatible DC
   renderer->hMemDC = CreateCompatibleDC(hdc);
+  if (renderer->hMemDC)
+    GdiCache_NoteCreated();
 
   // Create DIB section for the image
   BITMAPINFO bmi = {0};
@@ -71,26 +780,75 @@ void Renderer_CreateBitmap(Renderer *renderer, HDC hdc,
   renderer->hBitmap =
       CreateDIBSection(hdc, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
 
+  if (renderer->hBitmap) {
+    GdiCache_NoteCreated();
+    renderer->bitmapBytes = (size_t)image->width * image->height * 4;
+    PixelMemory_Track(PIXMEM_RENDERER, (long long)renderer->bitmapBytes);
+  }
+
   if (renderer->hBitmap && bits) {
-    // Copy pixels (convert RGBA to BGRA for Windows)
-    unsigned char *src = image->pixels;
-    unsigned char *dst = (unsigned char *)bits;
-    int totalPixels = image->width * image->height;
-
-    for (int i = 0; i < totalPixels; i++) {
-      dst[i * 4 + 0] = src[i * 4 + 2]; // B
-      dst[i * 4 + 1] = src[i * 4 + 1]; // G
-      dst[i * 4 + 2] = src[i * 4 + 0]; // R
-      dst[i * 4 + 3] = src[i * 4 + 3]; // A
-    }
+    CopyToDib((unsigned char *)bits, image, image->pixels,
+              (size_t)image->width * image->height);
 
     SelectObject(renderer->hMemDC, renderer->hBitmap);
+    renderer->bits = bits;
+    renderer->mips[0] = (unsigned char *)bits;
+    renderer->mipW[0] = image->width;
+    renderer->mipH[0] = image->height;
+    renderer->mipCount = 1;
   }
 
   renderer->displayWidth = image->width;
   renderer->displayHeight = image->height;
 }
 
+int Renderer_UpdateBitmap(Renderer *renderer, const ImageData *image,
+                          const RECT *dirty) {
+  if (!renderer->bits || !image || !image->pixels ||
+      renderer->displayWidth != image->width ||
+      renderer->displayHeight != image->height)
+    return 0;
+
+  RECT all = {0, 0, image->width, image->height};
+  RECT r;
+  if (!dirty || !IntersectRect(&r, dirty, &all))
+    return 1; // nothing changed
+
+  // gdi may still be reading the bits for a blt it queued, and the hq
+  // worker might be too
+  GdiFlush();
+  CancelHq(renderer, 1);
+  renderer->live = TRUE;
+
+  int w = r.right - r.left;
+  for (int y = r.top; y < r.bottom; y++) {
+    size_t at = ((size_t)y * image->width + r.left) * 4;
+    CopyToDib((unsigned char *)renderer->bits + at, image, image->pixels + at,
+              w);
+  }
+
+  // then the pyramid under it, each level's rect half the one above
+  RECT m = r;
+  for (int i = 1; i < renderer->mipCount; i++) {
+    SetRect(&m, m.left / 2, m.top / 2, (m.right + 1) / 2, (m.bottom + 1) / 2);
+    Reduce(renderer, i, &m);
+  }
+
+  // and the same part of the scaled cache, if it is still for this scale
+  if (renderer->cachedScale == renderer->scale && renderer->scaledBits) {
+    int scaledW, scaledH;
+    ScaledSize(renderer, &scaledW, &scaledH);
+    RECT s = {(int)((double)r.left * scaledW / image->width) - 1,
+              (int)((double)r.top * scaledH / image->height) - 1,
+              (int)((double)r.right * scaledW / image->width) + 2,
+              (int)((double)r.bottom * scaledH / image->height) + 2};
+    if (IntersectRect(&s, &s, &renderer->cacheRect))
+      Resample(renderer, &s);
+    SetRectEmpty(&renderer->hqRect);
+  }
+  return 1;
+}
+
 void Renderer_FitToWindow(Renderer *renderer, RECT *clientRect,
                           const ImageData *image) {
   if (!image || image->width == 0 || image->height == 0)
@@ -142,6 +900,7 @@ void Renderer_Paint(Renderer *renderer, HDC hdc, RECT *clientRect,
                     const ImageData *image) {
   // Fill background with dark gray
   HBRUSH bgBrush = CreateSolidBrush(RGB(30, 30, 30));
+  GdiCache_NoteCreated();
   FillRect(hdc, clientRect, bgBrush);
   DeleteObject(bgBrush);
 
@@ -156,16 +915,5 @@ void Renderer_Paint(Renderer *renderer, HDC hdc, RECT *clientRect,
     return;
   }
 
-  // Calculate scaled dimensions
-  int scaledWidth = (int)(image->width * renderer->scale);
-  int scaledHeight = (int)(image->height * renderer->scale);
-
-  // Use high-quality stretching
-  SetStretchBltMode(hdc, HALFTONE);
-  SetBrushOrgEx(hdc, 0, 0, NULL);
-
-  // Draw the image
-  StretchBlt(hdc, renderer->offsetX, renderer->offsetY, scaledWidth,
-             scaledHeight, renderer->hMemDC, 0, 0, image->width, image->height,
-             SRCCOPY);
+  Renderer_DrawView(renderer, hdc, clientRect);
 }
@@ -7,10 +7,16 @@
 #include "image_loader.h"
 #include <windows.h>
 
+#define RENDERER_MAX_MIPS 24
+#define WM_RENDER_READY (WM_APP + 3) // posted when an hq pass has finished
+
+typedef struct HqRender HqRender;
+
 // main renderer state
 typedef struct {
   HBITMAP hBitmap;
   HDC hMemDC;
+  void *bits; // hBitmap's pixels (bgra), written in place by UpdateBitmap
   int displayWidth;
   int displayHeight;
   float scale;
@@ -18,23 +24,55 @@ typedef struct {
   int offsetY;
   BOOL fitToWindow;
 
-  // cached scaled bitmap for smooth panning
+  // cached scaled bitmap for smooth panning. holds cacheRect of the image
+  // as drawn at cachedScale (0 = nothing cached), a margin bigger than the
+  // view so short pans are just a blit out of it
   HBITMAP hScaledBitmap;
   HDC hScaledDC;
+  void *scaledBits;
   float cachedScale;
-  int cachedWidth;
+  int cachedWidth; // hScaledBitmap's size, can be bigger than cacheRect
   int cachedHeight;
+  RECT cacheRect; // in scaled image coords, 0,0 = image's top left
+  size_t scaledBytes;
+
+  // lanczos hq zoom - the worker's finished pass is copied into the cache
+  // at hqRect and dropped. a pass is queued whenever the view changes and
+  // cancelled as soon as it changes again
+  RECT hqRect;         // part of the cache the lanczos pass covers
+  RECT hqQueued;       // what the worker was last asked for
+  float hqQueuedScale; // 0 = nothing asked
+  BOOL live;           // frames are updated in place (gif), no hq pass
+  HqRender *hq;        // NULL until Renderer_StartHq
+
+  size_t bitmapBytes; // hBitmap's pixels, counted as PIXMEM_RENDERER
 
-  // lanczos-scaled buffer for hq zoom
-  unsigned char *scaledPixels;
-  int scaledPixelsW;
-  int scaledPixelsH;
+  // mip pyramid for zooming out: level i is the bitmap halved i times, and
+  // level 0 is bits itself. further levels are built the first time a
+  // zoom needs them and dropped under memory pressure (PIXMEM_MIPS)
+  unsigned char *mips[RENDERER_MAX_MIPS];
+  int mipW[RENDERER_MAX_MIPS];
+  int mipH[RENDERER_MAX_MIPS];
+  int mipCount; // levels there are now, 0 with no bitmap
 } Renderer;
 
 // functions
 void Renderer_Init(Renderer *renderer);
 void Renderer_Cleanup(Renderer *renderer);
 void Renderer_CreateBitmap(Renderer *renderer, HDC hdc, const ImageData *image);
+// copies just the dirty rect of image into the existing bitmap. 0 if there
+// isnt one of the right size (then CreateBitmap)
+int Renderer_UpdateBitmap(Renderer *renderer, const ImageData *image,
+                          const RECT *dirty);
+// draws the part of the image that falls inside view (client coords) at
+// the current scale and offset. only the visible region is ever resampled
+void Renderer_DrawView(Renderer *renderer, HDC hdc, const RECT *view);
+// the background lanczos pass. finished passes are announced to hwnd with
+// WM_RENDER_READY, which should just repaint
+void Renderer_StartHq(Renderer *renderer, HWND hwnd);
+void Renderer_StopHq(Renderer *renderer);
+// drops the pyramid (not level 0), returns the bytes freed
+size_t Renderer_FreeMips(Renderer *renderer);
 void Renderer_Paint(Renderer *renderer, HDC hdc, RECT *clientRect,
                     const ImageData *image);
 void Renderer_FitToWindow(Renderer *renderer, RECT *clientRect,
@@ -4,6 +4,8 @@
  */
 
 #include "settings.h"
+#include "jpeg_writer.h"
+#include "png_writer.h"
 #include <omp.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -30,6 +32,9 @@ void Settings_SetDefaults(Settings *s) {
   s->maxMemoryMB = 0;        // 0 = unlimited
   s->prefetchImages = FALSE; // disabled by default
   s->showWarnings = TRUE;    // warn for large ops
+  s->pngLevel = PNG_LEVEL_DEFAULT;
+  s->jpegQuality = 90;
+  s->jpegSubsample = JPEG_SUBSAMPLE_420;
 }
 
 void Settings_Load(Settings *s) {
@@ -83,6 +88,20 @@ void Settings_Load(Settings *s) {
         s->prefetchImages = (atoi(value) != 0);
       } else if (strcmp(k, "showWarnings") == 0) {
         s->showWarnings = (atoi(value) != 0);
+      } else if (strcmp(k, "pngLevel") == 0) {
+        s->pngLevel = atoi(value);
+        if (s->pngLevel < 0 || s->pngLevel >= PNG_LEVEL_COUNT)
+          s->pngLevel = PNG_LEVEL_DEFAULT;
+      } else if (strcmp(k, "jpegQuality") == 0) {
+        s->jpegQuality = atoi(value);
+        if (s->jpegQuality < 1)
+          s->jpegQuality = 1;
+        if (s->jpegQuality > 100)
+          s->jpegQuality = 100;
+      } else if (strcmp(k, "jpegSubsample") == 0) {
+        s->jpegSubsample = atoi(value);
+        if (s->jpegSubsample < 0 || s->jpegSubsample >= JPEG_SUBSAMPLE_COUNT)
+          s->jpegSubsample = JPEG_SUBSAMPLE_420;
       }
     }
   }
@@ -107,6 +126,11 @@ void Settings_Save(Settings *s) {
   fprintf(f, "\n[behavior]\n");
   fprintf(f, "prefetchImages = %d\n", s->prefetchImages);
   fprintf(f, "showWarnings = %d\n", s->showWarnings);
+  fprintf(f, "; 0 = fast, 1 = default, 2 = small\n");
+  fprintf(f, "pngLevel = %d\n", s->pngLevel);
+  fprintf(f, "jpegQuality = %d\n", s->jpegQuality);
+  fprintf(f, "; 0 = 4:2:0, 1 = 4:2:2, 2 = 4:4:4\n");
+  fprintf(f, "jpegSubsample = %d\n", s->jpegSubsample);
 
   fclose(f);
 }
@@ -167,11 +191,78 @@ int Settings_CycleThreads(Settings *s) {
   return s->cpuThreads;
 }
 
+int Settings_CyclePngLevel(Settings *s) {
+  // fast -> default -> small -> fast
+  s->pngLevel = (s->pngLevel + 1) % PNG_LEVEL_COUNT;
+  Settings_Save(s);
+  return s->pngLevel;
+}
+
+int Settings_CycleJpegQuality(Settings *s) {
+  // 75 -> 85 -> 90 -> 95 -> 100 -> 75
+  if (s->jpegQuality < 75)
+    s->jpegQuality = 75;
+  else if (s->jpegQuality < 85)
+    s->jpegQuality = 85;
+  else if (s->jpegQuality < 90)
+    s->jpegQuality = 90;
+  else if (s->jpegQuality < 95)
+    s->jpegQuality = 95;
+  else if (s->jpegQuality < 100)
+    s->jpegQuality = 100;
+  else
+    s->jpegQuality = 75;
+  Settings_Save(s);
+  return s->jpegQuality;
+}
+
+int Settings_CycleJpegSubsample(Settings *s) {
+  // 4:2:0 -> 4:2:2 -> 4:4:4 -> 4:2:0
+  s->jpegSubsample = (s->jpegSubsample + 1) % JPEG_SUBSAMPLE_COUNT;
+  Settings_Save(s);
+  return s->jpegSubsample;
+}
+
 size_t Settings_EstimateMemory(int width, int height) {
   // RGBA pixels + working buffer for operations
   return (size_t)width * height * 4 * 2;
 }
 
+// peak for one load -> resize -> png save job. the stages dont overlap
+// within a job, so its the worst of:
+//   decode: rgba result + decoder scratch (png keeps inflated rows around)
+//   resize: source + destination rgba
+//   encode: destination + filtered rows + zlib output (about 1x each)
+size_t Settings_EstimateJobMemory(int srcWidth, int srcHeight, int dstWidth,
+                                  int dstHeight) {
+  size_t src = (size_t)srcWidth * srcHeight * 4;
+  size_t dst = (size_t)dstWidth * dstHeight * 4;
+
+  size_t peak = src * 2;
+  if (src + dst > peak)
+    peak = src + dst;
+  if (dst * 3 > peak)
+    peak = dst * 3;
+  return peak;
+}
+
+// bytes big operations may use - maxMemoryMB, or half the free ram if
+// that is set to unlimited
+size_t Settings_MemoryBudget(void) {
+  if (g_settings.maxMemoryMB > 0)
+    return (size_t)g_settings.maxMemoryMB * 1024 * 1024;
+
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status))
+    return (size_t)1024 * 1024 * 1024; // 1gb if windows wont say
+
+  unsigned long long half = status.ullAvailPhys / 2;
+  if (half > (size_t)-1)
+    half = (size_t)-1;
+  return (size_t)half;
+}
+
 BOOL Settings_WarnIfLarge(HWND hwnd, size_t memBytes) {
   if (!g_settings.showWarnings)
     return TRUE; // proceed without warning
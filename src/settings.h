@@ -15,6 +15,9 @@ typedef struct {
   int maxMemoryMB;     // 0 = unlimited, or cap in MB
   BOOL prefetchImages; // preload next/prev images in background
   BOOL showWarnings;   // warn before large memory operations
+  int pngLevel;        // png save speed / size (PngLevel, png_writer.h)
+  int jpegQuality;     // 1-100
+  int jpegSubsample;   // chroma subsampling (JpegSubsample, jpeg_writer.h)
 } Settings;
 
 // Global settings instance
@@ -27,9 +30,15 @@ void Settings_Save(Settings *s);
 void Settings_ApplyThreads(Settings *s);
 int Settings_CycleMaxSize(Settings *s);
 int Settings_CycleThreads(Settings *s);
+int Settings_CyclePngLevel(Settings *s);
+int Settings_CycleJpegQuality(Settings *s);
+int Settings_CycleJpegSubsample(Settings *s);
 
 // Memory estimation helper
 size_t Settings_EstimateMemory(int width, int height);
+size_t Settings_EstimateJobMemory(int srcWidth, int srcHeight, int dstWidth,
+                                  int dstHeight);
+size_t Settings_MemoryBudget(void);
 BOOL Settings_WarnIfLarge(HWND hwnd, size_t memBytes);
 
 #endif // SETTINGS_H
@@ -0,0 +1,276 @@
+/*
+ * Stress Decode - Implementation
+ * pix - stress decode
+ *
+ * every file in the folder is loaded once on this thread for reference
+ * (result, error text, size, frame count, a hash of the pixels). then n
+ * threads are released together and each loads the whole folder, starting
+ * at a different file, with its own ImageLoadContext and its own counting
+ * allocator. every load has to match the reference, and every allocator
+ * has to be back to zero blocks and bytes once its images are freed.
+ * meant to be run on a sanitizer build (build.bat asan) - see
+ * how_it_works.txt.
+ */
+
+#include "stress_decode.h"
+#include "image_loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STRESS_MAX_FILES 512
+#define STRESS_MAX_THREADS 64
+#define STRESS_HEADER 16 // bytes in front of each block, holds its size
+
+// one load's outcome, what the threads are checked against
+typedef struct {
+  int ok;
+  char error[256];
+  int width, height, frameCount;
+  unsigned long long hash; // fnv-1a 64 of the first frame's pixels
+} LoadResult;
+
+// counting allocator, one per thread. the gif decoder thread of an
+// animated load allocates too, hence the interlocked counters
+typedef struct {
+  volatile LONGLONG blocks;
+  volatile LONGLONG bytes;
+} CountingHeap;
+
+static struct {
+  char (*paths)[MAX_PATH];
+  LoadResult *expected;
+  int fileCount;
+  int rounds;
+  HANDLE start; // manual reset, lets every thread go at once
+  volatile LONG mismatches;
+  CRITICAL_SECTION printLock;
+} g_stress;
+
+typedef struct {
+  int index;
+  CountingHeap heap;
+  int loads;
+} StressThread;
+
+static void *CountAlloc(void *user, size_t size, PixelTag tag) {
+  (void)tag;
+  CountingHeap *heap = (CountingHeap *)user;
+  unsigned char *block = (unsigned char *)malloc(size + STRESS_HEADER);
+  if (!block)
+    return NULL;
+  *(size_t *)block = size;
+  InterlockedIncrement64(&heap->blocks);
+  InterlockedExchangeAdd64(&heap->bytes, (LONGLONG)size);
+  return block + STRESS_HEADER;
+}
+
+static void *CountResize(void *user, void *ptr, size_t oldSize,
+                         size_t newSize) {
+  (void)oldSize; // the header knows, and is what gets checked
+  CountingHeap *heap = (CountingHeap *)user;
+  unsigned char *block = (unsigned char *)ptr - STRESS_HEADER;
+  size_t had = *(size_t *)block;
+  block = (unsigned char *)realloc(block, newSize + STRESS_HEADER);
+  if (!block)
+    return NULL;
+  *(size_t *)block = newSize;
+  InterlockedExchangeAdd64(&heap->bytes, (LONGLONG)newSize - (LONGLONG)had);
+  return block + STRESS_HEADER;
+}
+
+static void CountRelease(void *user, void *ptr) {
+  CountingHeap *heap = (CountingHeap *)user;
+  unsigned char *block = (unsigned char *)ptr - STRESS_HEADER;
+  InterlockedDecrement64(&heap->blocks);
+  InterlockedExchangeAdd64(&heap->bytes, -(LONGLONG) * (size_t *)block);
+  free(block);
+}
+
+static void Load(const char *path, CountingHeap *heap, LoadResult *out) {
+  ImageLoadContext ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.allocator.alloc = CountAlloc;
+  ctx.allocator.resize = CountResize;
+  ctx.allocator.release = CountRelease;
+  ctx.allocator.user = heap;
+
+  ImageData image;
+  memset(out, 0, sizeof(LoadResult));
+  out->ok = ImageLoader_Load(path, &image, &ctx);
+  strcpy(out->error, ctx.error);
+  if (out->ok) {
+    out->width = image.width;
+    out->height = image.height;
+    out->frameCount = image.frameCount;
+
+    unsigned long long h = 14695981039346656037ull;
+    size_t size = (size_t)image.width * image.height * 4;
+    for (size_t i = 0; image.pixels && i < size; i++) {
+      h ^= image.pixels[i];
+      h *= 1099511628211ull;
+    }
+    out->hash = h;
+  }
+  ImageLoader_Free(&image);
+}
+
+static int SameResult(const LoadResult *a, const LoadResult *b) {
+  return a->ok == b->ok && strcmp(a->error, b->error) == 0 &&
+         a->width == b->width && a->height == b->height &&
+         a->frameCount == b->frameCount && a->hash == b->hash;
+}
+
+static DWORD WINAPI StressWorker(LPVOID param) {
+  StressThread *t = (StressThread *)param;
+  WaitForSingleObject(g_stress.start, INFINITE);
+
+  for (int r = 0; r < g_stress.rounds; r++) {
+    for (int i = 0; i < g_stress.fileCount; i++) {
+      // each thread starts somewhere else, so different files overlap
+      int f = (i + t->index) % g_stress.fileCount;
+      LoadResult got;
+      Load(g_stress.paths[f], &t->heap, &got);
+      t->loads++;
+
+      if (!SameResult(&got, &g_stress.expected[f])) {
+        InterlockedIncrement(&g_stress.mismatches);
+        EnterCriticalSection(&g_stress.printLock);
+        printf("thread %d: %s differs (ok %d/%d, %dx%d, \"%s\")\n", t->index,
+               g_stress.paths[f], got.ok, g_stress.expected[f].ok, got.width,
+               got.height, got.error);
+        LeaveCriticalSection(&g_stress.printLock);
+      }
+    }
+  }
+  return 0;
+}
+
+// every file, images or not - broken files have to fail the same way too
+static int ListFiles(const char *folder) {
+  char searchPath[MAX_PATH];
+  snprintf(searchPath, sizeof(searchPath), "%s\\*", folder);
+
+  WIN32_FIND_DATAA findData;
+  HANDLE hFind = FindFirstFileA(searchPath, &findData);
+  if (hFind == INVALID_HANDLE_VALUE)
+    return 0;
+
+  int count = 0;
+  do {
+    if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+      continue;
+    snprintf(g_stress.paths[count], MAX_PATH, "%s\\%s", folder,
+             findData.cFileName);
+    count++;
+  } while (count < STRESS_MAX_FILES && FindNextFileA(hFind, &findData));
+  FindClose(hFind);
+  return count;
+}
+
+static int RunStress(const char *folder, int threads) {
+  g_stress.paths = malloc(sizeof(*g_stress.paths) * STRESS_MAX_FILES);
+  g_stress.mismatches = 0;
+  g_stress.expected = (LoadResult *)calloc(STRESS_MAX_FILES, sizeof(LoadResult));
+  StressThread *state = (StressThread *)calloc(threads, sizeof(StressThread));
+  HANDLE *handles = (HANDLE *)calloc(threads, sizeof(HANDLE));
+  g_stress.fileCount = 0;
+  if (!g_stress.paths || !g_stress.expected || !state || !handles)
+    printf("out of memory\n");
+  else if ((g_stress.fileCount = ListFiles(folder)) == 0)
+    printf("no files in %s\n", folder);
+  if (g_stress.fileCount == 0) {
+    free(handles);
+    free(state);
+    free(g_stress.expected);
+    free(g_stress.paths);
+    return 0;
+  }
+
+  // the reference, one load at a time
+  CountingHeap heap = {0, 0};
+  int decoded = 0;
+  for (int i = 0; i < g_stress.fileCount; i++) {
+    Load(g_stress.paths[i], &heap, &g_stress.expected[i]);
+    decoded += g_stress.expected[i].ok;
+  }
+  printf("%d files, %d decode, %d threads x %d rounds\n", g_stress.fileCount,
+         decoded, threads, g_stress.rounds);
+  int passed = heap.blocks == 0 && heap.bytes == 0;
+  if (!passed)
+    printf("single thread: %lld blocks, %lld bytes never freed\n",
+           (long long)heap.blocks, (long long)heap.bytes);
+
+  InitializeCriticalSection(&g_stress.printLock);
+  g_stress.start = CreateEventA(NULL, TRUE, FALSE, NULL);
+  int started = 0;
+  for (int i = 0; i < threads; i++) {
+    state[i].index = i;
+    handles[i] = CreateThread(NULL, 0, StressWorker, &state[i], 0, NULL);
+    if (!handles[i])
+      break;
+    started++;
+  }
+  DWORD t0 = GetTickCount();
+  SetEvent(g_stress.start);
+  for (int i = 0; i < started; i++) {
+    WaitForSingleObject(handles[i], INFINITE);
+    CloseHandle(handles[i]);
+  }
+  DWORD elapsed = GetTickCount() - t0;
+
+  int loads = 0;
+  for (int i = 0; i < started; i++) {
+    loads += state[i].loads;
+    if (state[i].heap.blocks != 0 || state[i].heap.bytes != 0) {
+      printf("thread %d: %lld blocks, %lld bytes never freed\n", i,
+             (long long)state[i].heap.blocks, (long long)state[i].heap.bytes);
+      passed = 0;
+    }
+  }
+  if (started < threads) {
+    printf("only %d of %d threads started\n", started, threads);
+    passed = 0;
+  }
+  if (g_stress.mismatches > 0)
+    passed = 0;
+
+  printf("--------------------------------\n");
+  printf("%d loads in %.1f s, %ld mismatched - %s\n", loads,
+         elapsed / 1000.0, (long)g_stress.mismatches,
+         passed ? "ok" : "FAILED");
+
+  CloseHandle(g_stress.start);
+  DeleteCriticalSection(&g_stress.printLock);
+  free(handles);
+  free(state);
+  free(g_stress.expected);
+  free(g_stress.paths);
+  return passed;
+}
+
+int StressDecode_Run(int argc, char *argv[]) {
+  if (argc < 3 || strcmp(argv[1], "--stress-decode") != 0)
+    return 0;
+
+  // Attach console for output
+  AttachConsole(ATTACH_PARENT_PROCESS);
+  FILE *con = freopen("CONOUT$", "w", stdout);
+
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  int threads = argc > 3 ? atoi(argv[3]) : (int)info.dwNumberOfProcessors;
+  if (threads < 1)
+    threads = 1;
+  if (threads > STRESS_MAX_THREADS)
+    threads = STRESS_MAX_THREADS;
+  g_stress.rounds = argc > 4 ? atoi(argv[4]) : 4;
+  if (g_stress.rounds < 1)
+    g_stress.rounds = 1;
+
+  int passed = RunStress(argv[2], threads);
+
+  if (con)
+    fclose(con);
+  return passed ? 1 : 2;
+}
@@ -0,0 +1,12 @@
+// stress decode header
+// debug mode that checks concurrent loads against a single threaded one
+//   pix --stress-decode <folder> [threads] [rounds]
+
+#ifndef STRESS_DECODE_H
+#define STRESS_DECODE_H
+
+// 0 if argv isnt --stress-decode (normal gui), otherwise it ran:
+// 1 if every thread matched, 2 if anything differed or leaked
+int StressDecode_Run(int argc, char *argv[]);
+
+#endif
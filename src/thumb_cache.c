@@ -0,0 +1,357 @@
+/*
+ * Thumbnail Cache - Implementation
+ * pix - thumbnail cache
+ *
+ * the ui asks for the paths it can see (plus a screen of prefetch in the
+ * scroll direction) every paint. workers always pick the most urgent path
+ * that isnt cached yet, so anything scrolled away simply drops off the list.
+ * slots are a fixed pool, so memory stays bounded no matter the folder size.
+ */
+
+#include "thumb_cache.h"
+#include "image_loader.h"
+#include "pixel_memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THUMB_HASH_BUCKETS 2048 // power of two, > THUMB_CACHE_SLOTS
+
+enum { REQ_PENDING, REQ_BUSY, REQ_DONE };
+
+typedef struct {
+  char path[MAX_PATH];
+  int state;
+} ThumbRequest;
+
+typedef struct {
+  char path[MAX_PATH];
+  Thumbnail thumb;
+  DWORD lastUsed;
+  int used;
+  int next; // hash chain
+} ThumbSlot;
+
+// handed from a worker to the ui thread through WM_THUMB_READY
+typedef struct {
+  char path[MAX_PATH];
+  LONG generation;
+  Thumbnail thumb;
+} ThumbResult;
+
+static struct {
+  HWND hwnd;
+  int thumbSize;
+  int initialized;
+
+  // shared with workers - guarded by lock
+  CRITICAL_SECTION lock;
+  CONDITION_VARIABLE wake;
+  int quit;
+  LONG generation;
+  ThumbRequest requests[THUMB_MAX_REQUESTS];
+  int requestCount;
+  char busy[THUMB_MAX_WORKERS][MAX_PATH];
+
+  HANDLE workers[THUMB_MAX_WORKERS];
+  int workerCount;
+
+  // ui thread only
+  ThumbSlot slots[THUMB_CACHE_SLOTS];
+  int buckets[THUMB_HASH_BUCKETS];
+  DWORD useClock;
+} g_cache;
+
+// fnv-1a
+static unsigned int HashPath(const char *path) {
+  unsigned int h = 2166136261u;
+  while (*path) {
+    h ^= (unsigned char)*path++;
+    h *= 16777619u;
+  }
+  return h & (THUMB_HASH_BUCKETS - 1);
+}
+
+static int Lookup(const char *path) {
+  for (int i = g_cache.buckets[HashPath(path)]; i >= 0;
+       i = g_cache.slots[i].next) {
+    if (strcmp(g_cache.slots[i].path, path) == 0)
+      return i;
+  }
+  return -1;
+}
+
+static void Unlink(int slot) {
+  int *link = &g_cache.buckets[HashPath(g_cache.slots[slot].path)];
+  while (*link >= 0) {
+    if (*link == slot) {
+      *link = g_cache.slots[slot].next;
+      return;
+    }
+    link = &g_cache.slots[*link].next;
+  }
+}
+
+// free slot if there is one, otherwise evict the least recently drawn
+static int AcquireSlot(void) {
+  int oldest = 0;
+  for (int i = 0; i < THUMB_CACHE_SLOTS; i++) {
+    if (!g_cache.slots[i].used)
+      return i;
+    if (g_cache.slots[i].lastUsed < g_cache.slots[oldest].lastUsed)
+      oldest = i;
+  }
+
+  Unlink(oldest);
+  PixelMemory_Free(g_cache.slots[oldest].thumb.pixels);
+  g_cache.slots[oldest].thumb.pixels = NULL;
+  g_cache.slots[oldest].used = 0;
+  return oldest;
+}
+
+// pixel_memory.c evictor for the cache pool, runs on the ui thread when
+// the budget is hit. drops least recently drawn thumbnails until bytes
+// are freed
+static size_t EvictThumbs(size_t bytes) {
+  size_t freed = 0;
+  while (freed < bytes) {
+    int oldest = -1;
+    for (int i = 0; i < THUMB_CACHE_SLOTS; i++) {
+      if (g_cache.slots[i].used && g_cache.slots[i].thumb.pixels &&
+          (oldest < 0 ||
+           g_cache.slots[i].lastUsed < g_cache.slots[oldest].lastUsed))
+        oldest = i;
+    }
+    if (oldest < 0)
+      break;
+
+    Thumbnail *t = &g_cache.slots[oldest].thumb;
+    freed += (size_t)t->width * t->height * 4;
+    Unlink(oldest);
+    PixelMemory_Free(t->pixels);
+    t->pixels = NULL;
+    g_cache.slots[oldest].used = 0;
+  }
+  return freed;
+}
+
+// worker helpers - called with lock held
+static int PickRequest(void) {
+  for (int i = 0; i < g_cache.requestCount; i++) {
+    if (g_cache.requests[i].state == REQ_PENDING)
+      return i;
+  }
+  return -1;
+}
+
+static int FindRequest(const char *path) {
+  for (int i = 0; i < g_cache.requestCount; i++) {
+    if (strcmp(g_cache.requests[i].path, path) == 0)
+      return i;
+  }
+  return -1;
+}
+
+static int IsBusy(const char *path) {
+  for (int i = 0; i < g_cache.workerCount; i++) {
+    if (strcmp(g_cache.busy[i], path) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+static DWORD WINAPI ThumbWorker(LPVOID param) {
+  int id = (int)(INT_PTR)param;
+  char path[MAX_PATH];
+
+  for (;;) {
+    EnterCriticalSection(&g_cache.lock);
+    int pick = -1;
+    while (!g_cache.quit && (pick = PickRequest()) < 0)
+      SleepConditionVariableCS(&g_cache.wake, &g_cache.lock, INFINITE);
+    if (g_cache.quit) {
+      LeaveCriticalSection(&g_cache.lock);
+      break;
+    }
+    g_cache.requests[pick].state = REQ_BUSY;
+    strcpy(path, g_cache.requests[pick].path);
+    strcpy(g_cache.busy[id], path);
+    LONG generation = g_cache.generation;
+    LeaveCriticalSection(&g_cache.lock);
+
+    ThumbResult *result = (ThumbResult *)calloc(1, sizeof(ThumbResult));
+    if (result) {
+      strcpy(result->path, path);
+      result->generation = generation;
+      result->thumb.pixels =
+          ImageLoader_LoadThumbnail(path, g_cache.thumbSize,
+                                    &result->thumb.width, &result->thumb.height);
+    }
+
+    // still wanted? if it scrolled away meanwhile, drop it
+    EnterCriticalSection(&g_cache.lock);
+    g_cache.busy[id][0] = '\0';
+    int req = FindRequest(path);
+    if (req >= 0)
+      g_cache.requests[req].state = REQ_DONE;
+    int wanted = (req >= 0 && generation == g_cache.generation);
+    LeaveCriticalSection(&g_cache.lock);
+
+    if (result && (!wanted || !PostMessageA(g_cache.hwnd, WM_THUMB_READY, 0,
+                                            (LPARAM)result))) {
+      PixelMemory_Free(result->thumb.pixels);
+      free(result);
+    }
+  }
+  return 0;
+}
+
+void ThumbCache_Init(HWND hwnd, int thumbSize) {
+  if (g_cache.initialized)
+    return;
+
+  g_cache.hwnd = hwnd;
+  g_cache.thumbSize = thumbSize;
+  g_cache.quit = 0;
+  g_cache.requestCount = 0;
+  for (int i = 0; i < THUMB_HASH_BUCKETS; i++)
+    g_cache.buckets[i] = -1;
+
+  InitializeCriticalSection(&g_cache.lock);
+  InitializeConditionVariable(&g_cache.wake);
+
+  // half the cores, the ui and the main image decode keep the rest
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  int count = (int)si.dwNumberOfProcessors / 2;
+  if (count < 1)
+    count = 1;
+  if (count > THUMB_MAX_WORKERS)
+    count = THUMB_MAX_WORKERS;
+
+  g_cache.workerCount = 0;
+  for (int i = 0; i < count; i++) {
+    g_cache.busy[i][0] = '\0';
+    HANDLE h =
+        CreateThread(NULL, 0, ThumbWorker, (LPVOID)(INT_PTR)i, 0, NULL);
+    if (!h)
+      break;
+    SetThreadPriority(h, THREAD_PRIORITY_BELOW_NORMAL);
+    g_cache.workers[g_cache.workerCount++] = h;
+  }
+
+  PixelMemory_SetEvictor(PIXMEM_CACHE, EvictThumbs);
+  g_cache.initialized = 1;
+}
+
+void ThumbCache_Shutdown(void) {
+  if (!g_cache.initialized)
+    return;
+
+  EnterCriticalSection(&g_cache.lock);
+  g_cache.quit = 1;
+  WakeAllConditionVariable(&g_cache.wake);
+  LeaveCriticalSection(&g_cache.lock);
+
+  if (g_cache.workerCount > 0)
+    WaitForMultipleObjects(g_cache.workerCount, g_cache.workers, TRUE,
+                           INFINITE);
+  for (int i = 0; i < g_cache.workerCount; i++)
+    CloseHandle(g_cache.workers[i]);
+  g_cache.workerCount = 0;
+
+  ThumbCache_Clear();
+  PixelMemory_SetEvictor(PIXMEM_CACHE, NULL);
+  DeleteCriticalSection(&g_cache.lock);
+  g_cache.initialized = 0;
+}
+
+void ThumbCache_Clear(void) {
+  if (!g_cache.initialized)
+    return;
+
+  // bump generation so in-flight results from the old folder are ignored
+  EnterCriticalSection(&g_cache.lock);
+  g_cache.generation++;
+  g_cache.requestCount = 0;
+  LeaveCriticalSection(&g_cache.lock);
+
+  for (int i = 0; i < THUMB_CACHE_SLOTS; i++) {
+    PixelMemory_Free(g_cache.slots[i].thumb.pixels);
+    g_cache.slots[i].thumb.pixels = NULL;
+    g_cache.slots[i].used = 0;
+  }
+  for (int i = 0; i < THUMB_HASH_BUCKETS; i++)
+    g_cache.buckets[i] = -1;
+}
+
+void ThumbCache_Request(const char **paths, int count) {
+  if (!g_cache.initialized)
+    return;
+  if (count > THUMB_MAX_REQUESTS)
+    count = THUMB_MAX_REQUESTS;
+
+  EnterCriticalSection(&g_cache.lock);
+
+  // same window as last paint - nothing to do
+  int same = (count == g_cache.requestCount);
+  for (int i = 0; same && i < count; i++)
+    same = (strcmp(g_cache.requests[i].path, paths[i]) == 0);
+
+  if (!same) {
+    for (int i = 0; i < count; i++) {
+      ThumbRequest *req = &g_cache.requests[i];
+      strncpy(req->path, paths[i], MAX_PATH - 1);
+      req->path[MAX_PATH - 1] = '\0';
+      if (Lookup(req->path) >= 0)
+        req->state = REQ_DONE;
+      else if (IsBusy(req->path))
+        req->state = REQ_BUSY;
+      else
+        req->state = REQ_PENDING;
+    }
+    g_cache.requestCount = count;
+    WakeAllConditionVariable(&g_cache.wake);
+  }
+
+  LeaveCriticalSection(&g_cache.lock);
+}
+
+const Thumbnail *ThumbCache_Get(const char *path) {
+  if (!g_cache.initialized || !path)
+    return NULL;
+
+  int slot = Lookup(path);
+  if (slot < 0)
+    return NULL;
+  g_cache.slots[slot].lastUsed = ++g_cache.useClock;
+  return &g_cache.slots[slot].thumb;
+}
+
+void ThumbCache_Commit(LPARAM result) {
+  ThumbResult *r = (ThumbResult *)result;
+  if (!r)
+    return;
+
+  // stale folder or a duplicate decode - just drop it. same if it only
+  // fits the memory budget by pushing out something worth more than a
+  // thumbnail (older thumbnails are fair game)
+  if (g_cache.initialized && r->generation == g_cache.generation &&
+      Lookup(r->path) < 0 && PixelMemory_Reserve(0, PIXMEM_CACHE)) {
+    int slot = AcquireSlot();
+    ThumbSlot *s = &g_cache.slots[slot];
+    strcpy(s->path, r->path);
+    s->thumb = r->thumb;
+    s->lastUsed = ++g_cache.useClock;
+    s->used = 1;
+
+    unsigned int bucket = HashPath(s->path);
+    s->next = g_cache.buckets[bucket];
+    g_cache.buckets[bucket] = slot;
+
+    r->thumb.pixels = NULL; // slot owns it now
+  }
+
+  PixelMemory_Free(r->thumb.pixels);
+  free(r);
+}
@@ -0,0 +1,33 @@
+// thumbnail cache header
+// decodes folder thumbnails on background threads for the grid and strip
+
+#ifndef THUMB_CACHE_H
+#define THUMB_CACHE_H
+
+#include <windows.h>
+
+#define THUMB_CACHE_SLOTS 768   // max resident thumbnails (bounded memory)
+#define THUMB_MAX_REQUESTS 512  // max paths in the wanted window
+#define THUMB_MAX_WORKERS 4     // decode threads
+#define WM_THUMB_READY (WM_APP + 1) // posted by workers, lParam = result
+
+// a decoded thumbnail, pixels is NULL if the file couldnt be decoded
+typedef struct {
+  int width;
+  int height;
+  unsigned char *pixels; // bgra top-down, ready for SetDIBitsToDevice
+} Thumbnail;
+
+// lifetime - results are posted to hwnd as WM_THUMB_READY
+void ThumbCache_Init(HWND hwnd, int thumbSize);
+void ThumbCache_Shutdown(void);
+void ThumbCache_Clear(void);
+
+// ui thread only
+// replaces the wanted list, paths in priority order (first = most urgent).
+// anything not in the list is cancelled
+void ThumbCache_Request(const char **paths, int count);
+const Thumbnail *ThumbCache_Get(const char *path);
+void ThumbCache_Commit(LPARAM result);
+
+#endif
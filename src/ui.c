@@ -2,45 +2,153 @@
 // extracted from main.c for better organization
 
 #include "ui.h"
+#include "gdi_cache.h"
+#include "pixel_memory.h"
+#include "png_writer.h"
+#include "thumb_cache.h"
 #include <stdio.h>
 #include <string.h>
 
+// draws a cached thumbnail centered in box, shrinking it if it doesnt fit
+static void DrawThumb(HDC hdc, const Thumbnail *thumb, RECT *box) {
+  int boxW = box->right - box->left;
+  int boxH = box->bottom - box->top;
+  int w = thumb->width;
+  int h = thumb->height;
+  if (w > boxW || h > boxH) {
+    if (w * boxH > h * boxW) {
+      h = h * boxW / w;
+      w = boxW;
+    } else {
+      w = w * boxH / h;
+      h = boxH;
+    }
+  }
+  int x = box->left + (boxW - w) / 2;
+  int y = box->top + (boxH - h) / 2;
+
+  BITMAPINFO bmi = {0};
+  bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+  bmi.bmiHeader.biWidth = thumb->width;
+  bmi.bmiHeader.biHeight = -thumb->height; // top-down
+  bmi.bmiHeader.biPlanes = 1;
+  bmi.bmiHeader.biBitCount = 32;
+  bmi.bmiHeader.biCompression = BI_RGB;
+
+  if (w == thumb->width && h == thumb->height) {
+    SetDIBitsToDevice(hdc, x, y, w, h, 0, 0, 0, h, thumb->pixels, &bmi,
+                      DIB_RGB_COLORS);
+  } else {
+    SetStretchBltMode(hdc, HALFTONE);
+    SetBrushOrgEx(hdc, 0, 0, NULL);
+    StretchDIBits(hdc, x, y, w, h, 0, 0, thumb->width, thumb->height,
+                  thumb->pixels, &bmi, DIB_RGB_COLORS, SRCCOPY);
+  }
+}
+
+static const char *helpLines[] = {
+    "keyboard shortcuts",       "",
+    "o          open file",     "left/right prev/next image",
+    "f11 / f    fullscreen",    "0 / 1      fit / actual size",
+    "+/-        zoom",          "scroll     zoom at cursor",
+    "s          slideshow",     "ctrl+z     undo",
+    "r / l      rotate",        "h / v      flip",
+    "q          upscale 2x",    "ctrl+s     save image",
+    "ctrl+e     save edit log", "shift+c    crop mode",
+    "c          crop",          "i          info panel",
+    "t          toggle theme",  "z          toggle zoom %",
+    "shift+g    thumbnail grid", "?          this help",
+    "esc        close / exit"};
+#define HELP_LINE_COUNT (int)(sizeof(helpLines) / sizeof(helpLines[0]))
+
+// where each overlay sits. the rects have to match what the Draw* functions
+// below draw, since only this rect gets repainted when the overlay changes
+// or the image scrolls under it
+BOOL OverlayRect(Overlay overlay, RECT *clientRect, RECT *rect) {
+  int right = clientRect->right;
+  int bottom = clientRect->bottom;
+  BOOL strip = g_showThumbnails && g_browser.fileCount >= 2 && !g_showGrid;
+
+  switch (overlay) {
+  case OVERLAY_INFO: {
+    int panelWidth = 280;
+    int panelHeight = g_image.exif.hasExif ? 280 : 180;
+    if (g_image.isAnimated)
+      panelHeight += 22;
+    int margin = 15;
+    SetRect(rect, right - panelWidth - margin, margin, right - margin,
+            margin + panelHeight);
+    return g_showInfo && g_image.pixels && !g_showGrid;
+  }
+  case OVERLAY_SLIDESHOW:
+    // progress bar along the top and the "SLIDESHOW" label under it
+    SetRect(rect, 0, 0, right, 30);
+    return g_slideshowActive;
+  case OVERLAY_ZOOM:
+    // bounds the box for anything up to "5000%"
+    SetRect(rect, 12, bottom - STATUS_BAR_HEIGHT - 12 - 40, 12 + 80,
+            bottom - STATUS_BAR_HEIGHT - 12);
+    return g_image.pixels && g_showZoom && !g_showGrid;
+  case OVERLAY_STATUS: {
+    int barY = bottom - STATUS_BAR_HEIGHT;
+    if (g_showThumbnails && g_browser.fileCount >= 2)
+      barY -= THUMB_STRIP_HEIGHT;
+    SetRect(rect, 0, barY, right, barY + STATUS_BAR_HEIGHT);
+    return g_showStatusBar && !g_fullscreen;
+  }
+  case OVERLAY_EDIT:
+    SetRect(rect, right - EDIT_PANEL_WIDTH, 50, right, 50 + 280);
+    return g_showEditPanel;
+  case OVERLAY_HELP: {
+    int panelWidth = 280;
+    int panelHeight = HELP_LINE_COUNT * 22 + 30;
+    int panelX = (right - panelWidth) / 2;
+    int panelY = (bottom - panelHeight) / 2;
+    SetRect(rect, panelX, panelY, panelX + panelWidth, panelY + panelHeight);
+    return g_showHelp;
+  }
+  case OVERLAY_SETTINGS: {
+    int panelWidth = 320;
+    int panelHeight = 382;
+    int panelX = (right - panelWidth) / 2;
+    int panelY = (bottom - panelHeight) / 2;
+    SetRect(rect, panelX, panelY, panelX + panelWidth, panelY + panelHeight);
+    return g_showSettings;
+  }
+  case OVERLAY_STRIP:
+    SetRect(rect, 0, bottom - THUMB_STRIP_HEIGHT, right, bottom);
+    return strip;
+  default:
+    SetRectEmpty(rect);
+    return FALSE;
+  }
+}
+
 // draws the info panel with image details and exif data
 void DrawInfoPanel(HDC hdc, RECT *clientRect) {
   if (!g_showInfo || !g_image.pixels)
     return;
 
-  // panel dimensions - taller if we have exif
-  int panelWidth = 280;
-  int panelHeight = g_image.exif.hasExif ? 280 : 180;
-  int margin = 15;
   int padding = 12;
 
-  RECT panelRect = {clientRect->right - panelWidth - margin, margin,
-                    clientRect->right - margin, margin + panelHeight};
+  // panel dimensions - taller if we have exif
+  RECT panelRect;
+  OverlayRect(OVERLAY_INFO, clientRect, &panelRect);
 
   // draw semi-transparent panel background
-  HBRUSH panelBrush = CreateSolidBrush(g_panelBgColor);
-  FillRect(hdc, &panelRect, panelBrush);
-  DeleteObject(panelBrush);
+  FillRect(hdc, &panelRect, GdiCache_Brush(UI_BRUSH_PANEL));
 
   // draw border
-  HPEN borderPen = CreatePen(
-      PS_SOLID, 1, g_darkTheme ? RGB(80, 80, 80) : RGB(180, 180, 180));
-  HPEN oldPen = SelectObject(hdc, borderPen);
+  HPEN oldPen = SelectObject(hdc, GdiCache_Pen(UI_PEN_PANEL));
   Rectangle(hdc, panelRect.left, panelRect.top, panelRect.right,
             panelRect.bottom);
   SelectObject(hdc, oldPen);
-  DeleteObject(borderPen);
 
   // setup text
   SetBkMode(hdc, TRANSPARENT);
   SetTextColor(hdc, g_textColor);
 
-  HFONT font =
-      CreateFontA(15, 0, 0, 0, FW_MEDIUM, FALSE, FALSE, FALSE, DEFAULT_CHARSET,
-                  OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY,
-                  DEFAULT_PITCH | FF_SWISS, "Segoe UI");
+  HFONT font = GdiCache_Font(UI_FONT_INFO);
   HFONT oldFont = SelectObject(hdc, font);
 
   const char *filename = strrchr(g_image.filepath, '\\');
@@ -68,10 +176,7 @@ void DrawInfoPanel(HDC hdc, RECT *clientRect) {
   int lineHeight = 22;
   int labelX = panelRect.left + padding;
 
-  HFONT boldFont =
-      CreateFontA(15, 0, 0, 0, FW_BOLD, FALSE, FALSE, FALSE, DEFAULT_CHARSET,
-                  OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY,
-                  DEFAULT_PITCH | FF_SWISS, "Segoe UI");
+  HFONT boldFont = GdiCache_Font(UI_FONT_INFO_BOLD);
   SelectObject(hdc, boldFont);
   TextOutA(hdc, labelX, y, "Image Information", 17);
   y += lineHeight + 5;
@@ -110,6 +215,18 @@ void DrawInfoPanel(HDC hdc, RECT *clientRect) {
   TextOutA(hdc, labelX, y, buffer, (int)strlen(buffer));
   y += lineHeight;
 
+  if (g_image.isAnimated) {
+    // achieved vs what the gif asks for, and frames dropped to keep time
+    snprintf(buffer, sizeof(buffer), "Frame: %d/%d  %.1f of %.1f fps",
+             g_image.currentFrame + 1, g_image.frameCount,
+             g_animClock.achievedFps, g_animClock.targetFps);
+    if (g_animClock.skipped)
+      snprintf(buffer + strlen(buffer), sizeof(buffer) - strlen(buffer),
+               ", %d skipped", g_animClock.skipped);
+    TextOutA(hdc, labelX, y, buffer, (int)strlen(buffer));
+    y += lineHeight;
+  }
+
   if (g_image.exif.hasExif) {
     y += 5;
     SetTextColor(hdc, g_accentColor);
@@ -160,8 +277,6 @@ void DrawInfoPanel(HDC hdc, RECT *clientRect) {
   }
 
   SelectObject(hdc, oldFont);
-  DeleteObject(font);
-  DeleteObject(boldFont);
 }
 
 // draws navigation thumbnail strip at bottom
@@ -174,16 +289,11 @@ void DrawThumbnailStrip(HWND hwnd, HDC hdc, RECT *clientRect) {
   int stripWidth = clientRect->right - clientRect->left;
 
   RECT stripRect = {0, stripY, stripWidth, clientRect->bottom};
-  HBRUSH stripBrush = CreateSolidBrush(RGB(20, 20, 20));
-  FillRect(hdc, &stripRect, stripBrush);
-  DeleteObject(stripBrush);
+  FillRect(hdc, &stripRect, GdiCache_Brush(UI_BRUSH_STRIP));
 
-  HPEN borderPen = CreatePen(PS_SOLID, 1, RGB(60, 60, 60));
-  HPEN oldPen = SelectObject(hdc, borderPen);
+  HPEN oldPen = SelectObject(hdc, GdiCache_Pen(UI_PEN_STRIP));
   MoveToEx(hdc, 0, stripY, NULL);
   LineTo(hdc, stripWidth, stripY);
-  SelectObject(hdc, oldPen);
-  DeleteObject(borderPen);
 
   int thumbsVisible =
       (stripWidth - THUMB_PADDING) / (THUMB_SIZE + THUMB_PADDING);
@@ -199,36 +309,51 @@ void DrawThumbnailStrip(HWND hwnd, HDC hdc, RECT *clientRect) {
       startIdx = 0;
   }
 
+  // ask the cache for whats on the strip (grid does its own requests)
+  if (!g_showGrid) {
+    const char *wanted[THUMB_MAX_REQUESTS];
+    int n = 0;
+    for (int i = startIdx;
+         i < g_browser.fileCount && i < startIdx + thumbsVisible &&
+         n < THUMB_MAX_REQUESTS;
+         i++)
+      wanted[n++] = g_browser.files[i];
+    ThumbCache_Request(wanted, n);
+  }
+
   int x = THUMB_PADDING;
   for (int i = 0; i < thumbsVisible && (startIdx + i) < g_browser.fileCount;
        i++) {
     int idx = startIdx + i;
     int thumbY = stripY + THUMB_PADDING;
 
-    COLORREF bgColor =
-        (idx == g_browser.currentIndex) ? RGB(70, 130, 180) : RGB(50, 50, 50);
-    HBRUSH thumbBrush = CreateSolidBrush(bgColor);
+    BOOL current = idx == g_browser.currentIndex;
     RECT thumbRect = {x, thumbY, x + THUMB_SIZE, thumbY + THUMB_SIZE};
-    FillRect(hdc, &thumbRect, thumbBrush);
-    DeleteObject(thumbBrush);
+    FillRect(hdc, &thumbRect,
+             GdiCache_Brush(current ? UI_BRUSH_THUMB_CURRENT : UI_BRUSH_THUMB));
 
-    HPEN thumbPen = CreatePen(
-        PS_SOLID, 1,
-        (idx == g_browser.currentIndex) ? RGB(100, 180, 255) : RGB(80, 80, 80));
-    SelectObject(hdc, thumbPen);
+    SelectObject(hdc,
+                 GdiCache_Pen(current ? UI_PEN_THUMB_CURRENT : UI_PEN_THUMB));
     Rectangle(hdc, x, thumbY, x + THUMB_SIZE, thumbY + THUMB_SIZE);
-    DeleteObject(thumbPen);
 
-    SetBkMode(hdc, TRANSPARENT);
-    SetTextColor(hdc, RGB(200, 200, 200));
-    char numStr[16];
-    snprintf(numStr, sizeof(numStr), "%d", idx + 1);
-    RECT numRect = thumbRect;
-    DrawTextA(hdc, numStr, -1, &numRect,
-              DT_CENTER | DT_VCENTER | DT_SINGLELINE);
+    const Thumbnail *thumb = ThumbCache_Get(g_browser.files[idx]);
+    if (thumb && thumb->pixels) {
+      RECT inner = {thumbRect.left + 2, thumbRect.top + 2, thumbRect.right - 2,
+                    thumbRect.bottom - 2};
+      DrawThumb(hdc, thumb, &inner);
+    } else {
+      SetBkMode(hdc, TRANSPARENT);
+      SetTextColor(hdc, RGB(200, 200, 200));
+      char numStr[16];
+      snprintf(numStr, sizeof(numStr), "%d", idx + 1);
+      RECT numRect = thumbRect;
+      DrawTextA(hdc, numStr, -1, &numRect,
+                DT_CENTER | DT_VCENTER | DT_SINGLELINE);
+    }
 
     x += THUMB_SIZE + THUMB_PADDING;
   }
+  SelectObject(hdc, oldPen);
 }
 
 // draws status bar at bottom of window
@@ -236,31 +361,20 @@ void DrawStatusBar(HDC hdc, RECT *clientRect) {
   if (!g_showStatusBar)
     return;
 
-  int barY = clientRect->bottom - STATUS_BAR_HEIGHT;
-  if (g_showThumbnails && g_browser.fileCount >= 2) {
-    barY -= THUMB_STRIP_HEIGHT;
-  }
+  RECT barRect;
+  OverlayRect(OVERLAY_STATUS, clientRect, &barRect);
+  int barY = barRect.top;
+  FillRect(hdc, &barRect, GdiCache_Brush(UI_BRUSH_STATUS));
 
-  RECT barRect = {0, barY, clientRect->right, barY + STATUS_BAR_HEIGHT};
-  HBRUSH barBrush = CreateSolidBrush(g_statusBarColor);
-  FillRect(hdc, &barRect, barBrush);
-  DeleteObject(barBrush);
-
-  HPEN borderPen = CreatePen(PS_SOLID, 1, RGB(45, 45, 48));
-  HPEN oldPen = SelectObject(hdc, borderPen);
+  HPEN oldPen = SelectObject(hdc, GdiCache_Pen(UI_PEN_STATUS));
   MoveToEx(hdc, 0, barY, NULL);
   LineTo(hdc, clientRect->right, barY);
   SelectObject(hdc, oldPen);
-  DeleteObject(borderPen);
 
   if (!g_image.pixels)
     return;
 
-  HFONT font =
-      CreateFontA(13, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE, DEFAULT_CHARSET,
-                  OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY,
-                  DEFAULT_PITCH | FF_SWISS, "Segoe UI");
-  HFONT oldFont = SelectObject(hdc, font);
+  HFONT oldFont = SelectObject(hdc, GdiCache_Font(UI_FONT_SMALL));
   SetBkMode(hdc, TRANSPARENT);
 
   const char *filename = strrchr(g_image.filepath, '\\');
@@ -284,24 +398,19 @@ void DrawStatusBar(HDC hdc, RECT *clientRect) {
            (int)strlen(rightText));
 
   SelectObject(hdc, oldFont);
-  DeleteObject(font);
 }
 
 // draws subtle shadow around image
 void DrawImageShadow(HDC hdc, int x, int y, int w, int h) {
+  HPEN oldPen = SelectObject(hdc, GdiCache_Pen(UI_PEN_SHADOW));
   for (int i = SHADOW_SIZE; i > 0; i--) {
-    HPEN shadowPen = CreatePen(PS_SOLID, 1, RGB(0, 0, 0));
-    HPEN oldPen = SelectObject(hdc, shadowPen);
-
     MoveToEx(hdc, x + i, y + h + i, NULL);
     LineTo(hdc, x + w + i, y + h + i);
 
     MoveToEx(hdc, x + w + i, y + i, NULL);
     LineTo(hdc, x + w + i, y + h + i);
-
-    SelectObject(hdc, oldPen);
-    DeleteObject(shadowPen);
   }
+  SelectObject(hdc, oldPen);
 }
 
 // draws slideshow progress bar at top
@@ -318,20 +427,14 @@ void DrawSlideshowProgress(HDC hdc, RECT *clientRect) {
   int barWidth = (int)(clientRect->right * progress);
 
   RECT trackRect = {0, 0, clientRect->right, barHeight};
-  HBRUSH trackBrush = CreateSolidBrush(RGB(50, 50, 55));
-  FillRect(hdc, &trackRect, trackBrush);
-  DeleteObject(trackBrush);
+  FillRect(hdc, &trackRect, GdiCache_Brush(UI_BRUSH_TRACK));
 
   if (barWidth > 0) {
     RECT progressRect = {0, 0, barWidth, barHeight};
-    HBRUSH progressBrush = CreateSolidBrush(g_accentColor);
-    FillRect(hdc, &progressRect, progressBrush);
-    DeleteObject(progressBrush);
+    FillRect(hdc, &progressRect, GdiCache_Brush(UI_BRUSH_ACCENT));
 
     RECT highlightRect = {0, 0, barWidth, 1};
-    HBRUSH highlightBrush = CreateSolidBrush(RGB(120, 170, 210));
-    FillRect(hdc, &highlightRect, highlightBrush);
-    DeleteObject(highlightBrush);
+    FillRect(hdc, &highlightRect, GdiCache_Brush(UI_BRUSH_HIGHLIGHT));
   }
 }
 
@@ -345,11 +448,7 @@ void DrawZoomOverlay(HDC hdc, RECT *clientRect) {
   char zoomText[32];
   snprintf(zoomText, sizeof(zoomText), "%d%%", zoomPercent);
 
-  HFONT font =
-      CreateFontA(16, 0, 0, 0, FW_MEDIUM, FALSE, FALSE, FALSE, DEFAULT_CHARSET,
-                  OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY,
-                  DEFAULT_PITCH | FF_SWISS, "Segoe UI");
-  HFONT oldFont = SelectObject(hdc, font);
+  HFONT oldFont = SelectObject(hdc, GdiCache_Font(UI_FONT_ZOOM));
 
   SIZE textSize;
   GetTextExtentPoint32A(hdc, zoomText, (int)strlen(zoomText), &textSize);
@@ -362,22 +461,17 @@ void DrawZoomOverlay(HDC hdc, RECT *clientRect) {
 
   RECT bgRect = {x, y, x + textSize.cx + padding * 2,
                  y + textSize.cy + padding * 2};
-  HBRUSH bgBrush = CreateSolidBrush(RGB(30, 30, 35));
-  FillRect(hdc, &bgRect, bgBrush);
-  DeleteObject(bgBrush);
+  FillRect(hdc, &bgRect, GdiCache_Brush(UI_BRUSH_OVERLAY));
 
-  HPEN borderPen = CreatePen(PS_SOLID, 1, RGB(60, 60, 65));
-  HPEN oldPen = SelectObject(hdc, borderPen);
+  HPEN oldPen = SelectObject(hdc, GdiCache_Pen(UI_PEN_OVERLAY));
   Rectangle(hdc, bgRect.left, bgRect.top, bgRect.right, bgRect.bottom);
   SelectObject(hdc, oldPen);
-  DeleteObject(borderPen);
 
   SetBkMode(hdc, TRANSPARENT);
   SetTextColor(hdc, RGB(180, 180, 180));
   TextOutA(hdc, x + padding, y + padding, zoomText, (int)strlen(zoomText));
 
   SelectObject(hdc, oldFont);
-  DeleteObject(font);
 }
 
 // draws keyboard shortcuts help overlay
@@ -385,52 +479,28 @@ void DrawHelpOverlay(HDC hdc, RECT *clientRect) {
   if (!g_showHelp)
     return;
 
-  const char *helpLines[] = {
-      "keyboard shortcuts",       "",
-      "o          open file",     "left/right prev/next image",
-      "f11 / f    fullscreen",    "0 / 1      fit / actual size",
-      "+/-        zoom",          "scroll     zoom at cursor",
-      "s          slideshow",     "ctrl+z     undo",
-      "r / l      rotate",        "h / v      flip",
-      "q          upscale 2x",    "ctrl+s     save image",
-      "shift+c    crop mode",     "c          crop",
-      "i          info panel",    "t          toggle theme",
-      "z          toggle zoom %", "?          this help",
-      "esc        close / exit"};
-  int lineCount = sizeof(helpLines) / sizeof(helpLines[0]);
 
   int lineHeight = 22;
-  int panelWidth = 280;
-  int panelHeight = lineCount * lineHeight + 30;
-  int panelX = (clientRect->right - panelWidth) / 2;
-  int panelY = (clientRect->bottom - panelHeight) / 2;
-
-  RECT panelRect = {panelX, panelY, panelX + panelWidth, panelY + panelHeight};
-  HBRUSH bgBrush = CreateSolidBrush(RGB(25, 25, 30));
-  FillRect(hdc, &panelRect, bgBrush);
-  DeleteObject(bgBrush);
-
-  HPEN borderPen = CreatePen(PS_SOLID, 1, RGB(70, 70, 80));
-  HPEN oldPen = SelectObject(hdc, borderPen);
+
+  RECT panelRect;
+  OverlayRect(OVERLAY_HELP, clientRect, &panelRect);
+  int panelX = panelRect.left;
+  int panelY = panelRect.top;
+  FillRect(hdc, &panelRect, GdiCache_Brush(UI_BRUSH_DIALOG));
+
+  HPEN oldPen = SelectObject(hdc, GdiCache_Pen(UI_PEN_DIALOG));
   Rectangle(hdc, panelRect.left, panelRect.top, panelRect.right,
             panelRect.bottom);
   SelectObject(hdc, oldPen);
-  DeleteObject(borderPen);
-
-  HFONT font =
-      CreateFontA(14, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE, DEFAULT_CHARSET,
-                  OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY,
-                  FIXED_PITCH | FF_MODERN, "Consolas");
-  HFONT boldFont =
-      CreateFontA(16, 0, 0, 0, FW_BOLD, FALSE, FALSE, FALSE, DEFAULT_CHARSET,
-                  OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY,
-                  DEFAULT_PITCH | FF_SWISS, "Segoe UI");
+
+  HFONT font = GdiCache_Font(UI_FONT_MONO);
+  HFONT boldFont = GdiCache_Font(UI_FONT_TITLE);
   HFONT oldFont = SelectObject(hdc, font);
 
   SetBkMode(hdc, TRANSPARENT);
 
   int y = panelY + 15;
-  for (int i = 0; i < lineCount; i++) {
+  for (int i = 0; i < HELP_LINE_COUNT; i++) {
     if (i == 0) {
       SelectObject(hdc, boldFont);
       SetTextColor(hdc, g_accentColor);
@@ -443,8 +513,6 @@ void DrawHelpOverlay(HDC hdc, RECT *clientRect) {
   }
 
   SelectObject(hdc, oldFont);
-  DeleteObject(font);
-  DeleteObject(boldFont);
 }
 
 // draws settings overlay panel
@@ -453,31 +521,20 @@ void DrawSettingsOverlay(HDC hdc, RECT *clientRect) {
     return;
 
   int lineHeight = 24;
-  int panelWidth = 320;
-  int panelHeight = 180;
-  int panelX = (clientRect->right - panelWidth) / 2;
-  int panelY = (clientRect->bottom - panelHeight) / 2;
-
-  RECT panelRect = {panelX, panelY, panelX + panelWidth, panelY + panelHeight};
-  HBRUSH bgBrush = CreateSolidBrush(RGB(25, 25, 30));
-  FillRect(hdc, &panelRect, bgBrush);
-  DeleteObject(bgBrush);
-
-  HPEN borderPen = CreatePen(PS_SOLID, 1, RGB(70, 70, 80));
-  HPEN oldPen = SelectObject(hdc, borderPen);
+
+  RECT panelRect;
+  OverlayRect(OVERLAY_SETTINGS, clientRect, &panelRect);
+  int panelX = panelRect.left;
+  int panelY = panelRect.top;
+  FillRect(hdc, &panelRect, GdiCache_Brush(UI_BRUSH_DIALOG));
+
+  HPEN oldPen = SelectObject(hdc, GdiCache_Pen(UI_PEN_DIALOG));
   Rectangle(hdc, panelRect.left, panelRect.top, panelRect.right,
             panelRect.bottom);
   SelectObject(hdc, oldPen);
-  DeleteObject(borderPen);
-
-  HFONT font =
-      CreateFontA(14, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE, DEFAULT_CHARSET,
-                  OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY,
-                  FIXED_PITCH | FF_MODERN, "Consolas");
-  HFONT boldFont =
-      CreateFontA(16, 0, 0, 0, FW_BOLD, FALSE, FALSE, FALSE, DEFAULT_CHARSET,
-                  OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY,
-                  DEFAULT_PITCH | FF_SWISS, "Segoe UI");
+
+  HFONT font = GdiCache_Font(UI_FONT_MONO);
+  HFONT boldFont = GdiCache_Font(UI_FONT_TITLE);
   HFONT oldFont = SelectObject(hdc, font);
 
   SetBkMode(hdc, TRANSPARENT);
@@ -515,14 +572,63 @@ void DrawSettingsOverlay(HDC hdc, RECT *clientRect) {
   snprintf(line3, sizeof(line3), "[W] Large op warnings: %s",
            g_settings.showWarnings ? "on" : "off");
   TextOutA(hdc, panelX + 20, y, line3, (int)strlen(line3));
+  y += lineHeight;
+
+  char line4[64];
+  snprintf(line4, sizeof(line4), "[P] PNG saves: %s",
+           PngWriter_LevelName((PngLevel)g_settings.pngLevel));
+  TextOutA(hdc, panelX + 20, y, line4, (int)strlen(line4));
+  y += lineHeight;
+
+  char line5[64];
+  snprintf(line5, sizeof(line5), "[J] JPEG quality: %d",
+           g_settings.jpegQuality);
+  TextOutA(hdc, panelX + 20, y, line5, (int)strlen(line5));
+  y += lineHeight;
+
+  static const char *chroma[] = {"4:2:0", "4:2:2", "4:4:4"};
+  char line6[64];
+  snprintf(line6, sizeof(line6), "[K] JPEG chroma: %s",
+           chroma[g_settings.jpegSubsample]);
+  TextOutA(hdc, panelX + 20, y, line6, (int)strlen(line6));
+  y += lineHeight + 10;
+
+  // live pixel memory, by what its for (pixel_memory.c)
+  char mem[64];
+  size_t mb = 1024 * 1024;
+  if (PixelMemory_Budget())
+    snprintf(mem, sizeof(mem), "Memory: %d / %d MB (peak %d)",
+             (int)(PixelMemory_Total() / mb), (int)(PixelMemory_Budget() / mb),
+             (int)(PixelMemory_Peak() / mb));
+  else
+    snprintf(mem, sizeof(mem), "Memory: %d MB, no cap (peak %d)",
+             (int)(PixelMemory_Total() / mb), (int)(PixelMemory_Peak() / mb));
+  TextOutA(hdc, panelX + 20, y, mem, (int)strlen(mem));
+  y += lineHeight;
+
+  SetTextColor(hdc, RGB(110, 110, 120));
+  for (int row = 0; row * 3 < PIXMEM_TAG_COUNT; row++) {
+    char tags[64];
+    int len = 0;
+    for (int t = row * 3; t < row * 3 + 3 && t < PIXMEM_TAG_COUNT; t++)
+      len += snprintf(tags + len, sizeof(tags) - len, "  %s %d",
+                      PixelMemory_TagName((PixelTag)t),
+                      (int)(PixelMemory_Used((PixelTag)t) / mb));
+    TextOutA(hdc, panelX + 20, y, tags, len);
+    y += lineHeight;
+  }
+
+  // gdi_cache.c - mid-paint ones should only be the renderer's view cache
+  char gdi[64];
+  int gdiLen = snprintf(gdi, sizeof(gdi), "  gdi %ld made, %ld while painting",
+                        GdiCache_Created(), GdiCache_CreatedInPaint());
+  TextOutA(hdc, panelX + 20, y, gdi, gdiLen);
   y += lineHeight + 10;
 
   SetTextColor(hdc, RGB(90, 90, 100));
   TextOutA(hdc, panelX + 20, y, "press key to change, ESC to close", 34);
 
   SelectObject(hdc, oldFont);
-  DeleteObject(font);
-  DeleteObject(boldFont);
 }
 
 // draws edit panel with brightness/contrast/saturation sliders
@@ -530,30 +636,20 @@ void DrawEditPanel(HDC hdc, RECT *clientRect) {
   if (!g_showEditPanel)
     return;
 
-  int panelX = clientRect->right - EDIT_PANEL_WIDTH;
-  int panelY = 50;
-  int panelH = 280;
-
-  RECT panelRect = {panelX, panelY, clientRect->right, panelY + panelH};
-  HBRUSH panelBrush = CreateSolidBrush(RGB(35, 35, 38));
-  FillRect(hdc, &panelRect, panelBrush);
-  DeleteObject(panelBrush);
+  RECT panelRect;
+  OverlayRect(OVERLAY_EDIT, clientRect, &panelRect);
+  int panelX = panelRect.left;
+  int panelY = panelRect.top;
+  FillRect(hdc, &panelRect, GdiCache_Brush(UI_BRUSH_EDIT));
 
-  HPEN borderPen = CreatePen(PS_SOLID, 1, RGB(60, 60, 65));
-  HPEN oldPen = SelectObject(hdc, borderPen);
-  Rectangle(hdc, panelX, panelY, clientRect->right, panelY + panelH);
+  HPEN oldPen = SelectObject(hdc, GdiCache_Pen(UI_PEN_OVERLAY));
+  Rectangle(hdc, panelRect.left, panelRect.top, panelRect.right,
+            panelRect.bottom);
   SelectObject(hdc, oldPen);
-  DeleteObject(borderPen);
-
-  HFONT font =
-      CreateFontA(14, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE, DEFAULT_CHARSET,
-                  OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY,
-                  DEFAULT_PITCH | FF_SWISS, "Segoe UI");
-  HFONT boldFont =
-      CreateFontA(15, 0, 0, 0, FW_BOLD, FALSE, FALSE, FALSE, DEFAULT_CHARSET,
-                  OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY,
-                  DEFAULT_PITCH | FF_SWISS, "Segoe UI");
-  HFONT oldFont = SelectObject(hdc, boldFont);
+
+  HBRUSH trackBrush = GdiCache_Brush(UI_BRUSH_SLIDER);
+  HBRUSH fillBrush = GdiCache_Brush(UI_BRUSH_ACCENT);
+  HFONT oldFont = SelectObject(hdc, GdiCache_Font(UI_FONT_INFO_BOLD));
   SetBkMode(hdc, TRANSPARENT);
 
   int x = panelX + 15;
@@ -566,7 +662,7 @@ void DrawEditPanel(HDC hdc, RECT *clientRect) {
   TextOutA(hdc, x, y, "Edit Image", 10);
   y += lineH + 5;
 
-  SelectObject(hdc, font);
+  SelectObject(hdc, GdiCache_Font(UI_FONT_EDIT));
 
   // brightness
   SetTextColor(hdc, g_editSelection == 0 ? g_accentColor : g_textColor);
@@ -576,15 +672,11 @@ void DrawEditPanel(HDC hdc, RECT *clientRect) {
   y += 20;
 
   RECT trackRect = {x, y, x + sliderW, y + sliderH};
-  HBRUSH trackBrush = CreateSolidBrush(RGB(60, 60, 65));
   FillRect(hdc, &trackRect, trackBrush);
-  DeleteObject(trackBrush);
 
   int bFill = (g_editBrightness + 100) * sliderW / 200;
   RECT fillRect = {x, y, x + bFill, y + sliderH};
-  HBRUSH fillBrush = CreateSolidBrush(g_accentColor);
   FillRect(hdc, &fillRect, fillBrush);
-  DeleteObject(fillBrush);
   y += lineH;
 
   // contrast
@@ -596,18 +688,14 @@ void DrawEditPanel(HDC hdc, RECT *clientRect) {
 
   trackRect.top = y;
   trackRect.bottom = y + sliderH;
-  trackBrush = CreateSolidBrush(RGB(60, 60, 65));
   FillRect(hdc, &trackRect, trackBrush);
-  DeleteObject(trackBrush);
 
   int cFill = (int)((g_editContrast - 0.5f) * sliderW / 1.5f);
   fillRect.left = x;
   fillRect.right = x + cFill;
   fillRect.top = y;
   fillRect.bottom = y + sliderH;
-  fillBrush = CreateSolidBrush(g_accentColor);
   FillRect(hdc, &fillRect, fillBrush);
-  DeleteObject(fillBrush);
   y += lineH;
 
   // saturation
@@ -619,18 +707,14 @@ void DrawEditPanel(HDC hdc, RECT *clientRect) {
 
   trackRect.top = y;
   trackRect.bottom = y + sliderH;
-  trackBrush = CreateSolidBrush(RGB(60, 60, 65));
   FillRect(hdc, &trackRect, trackBrush);
-  DeleteObject(trackBrush);
 
   int sFill = (int)(g_editSaturation * sliderW / 2.0f);
   fillRect.left = x;
   fillRect.right = x + sFill;
   fillRect.top = y;
   fillRect.bottom = y + sliderH;
-  fillBrush = CreateSolidBrush(g_accentColor);
   FillRect(hdc, &fillRect, fillBrush);
-  DeleteObject(fillBrush);
   y += lineH + 10;
 
   SetTextColor(hdc, RGB(140, 140, 145));
@@ -641,6 +725,182 @@ void DrawEditPanel(HDC hdc, RECT *clientRect) {
   TextOutA(hdc, x, y, "Enter: Apply | Esc: Cancel", 26);
 
   SelectObject(hdc, oldFont);
-  DeleteObject(font);
-  DeleteObject(boldFont);
+}
+
+// grid area is the client rect minus the status bar
+void GridGetArea(RECT *clientRect, RECT *area) {
+  *area = *clientRect;
+  if (g_showStatusBar && !g_fullscreen)
+    area->bottom -= STATUS_BAR_HEIGHT;
+  if (area->bottom < area->top)
+    area->bottom = area->top;
+}
+
+int GridColumns(RECT *clientRect) {
+  RECT area;
+  GridGetArea(clientRect, &area);
+  int cols = (area.right - area.left) / GRID_CELL_WIDTH;
+  return cols < 1 ? 1 : cols;
+}
+
+// left edge of the first column, the grid is centered horizontally
+static int GridLeft(RECT *area, int cols) {
+  return area->left + (area->right - area->left - cols * GRID_CELL_WIDTH) / 2;
+}
+
+int GridHitTest(RECT *clientRect, int x, int y) {
+  RECT area;
+  GridGetArea(clientRect, &area);
+  if (y < area.top || y >= area.bottom)
+    return -1;
+
+  int cols = GridColumns(clientRect);
+  int left = GridLeft(&area, cols);
+  if (x < left || x >= left + cols * GRID_CELL_WIDTH)
+    return -1;
+
+  int col = (x - left) / GRID_CELL_WIDTH;
+  int row = (y - area.top + g_gridScrollY) / GRID_CELL_HEIGHT;
+  int idx = row * cols + col;
+  return idx < g_browser.fileCount ? idx : -1;
+}
+
+void GridClampScroll(RECT *clientRect) {
+  RECT area;
+  GridGetArea(clientRect, &area);
+  int cols = GridColumns(clientRect);
+  int rows = (g_browser.fileCount + cols - 1) / cols;
+  int maxScroll = rows * GRID_CELL_HEIGHT - (area.bottom - area.top);
+  if (maxScroll < 0)
+    maxScroll = 0;
+  if (g_gridScrollY > maxScroll)
+    g_gridScrollY = maxScroll;
+  if (g_gridScrollY < 0)
+    g_gridScrollY = 0;
+}
+
+void GridEnsureVisible(RECT *clientRect, int index) {
+  if (index < 0)
+    return;
+
+  RECT area;
+  GridGetArea(clientRect, &area);
+  int areaH = area.bottom - area.top;
+  int top = (index / GridColumns(clientRect)) * GRID_CELL_HEIGHT;
+
+  if (top < g_gridScrollY)
+    g_gridScrollY = top;
+  else if (top + GRID_CELL_HEIGHT > g_gridScrollY + areaH)
+    g_gridScrollY = top + GRID_CELL_HEIGHT - areaH;
+  GridClampScroll(clientRect);
+}
+
+// appends file indices from..to (exclusive, either direction) to the
+// thumbnail request list
+static int AddGridRange(const char **wanted, int n, int from, int to) {
+  int step = (to >= from) ? 1 : -1;
+  for (int i = from; i != to && n < THUMB_MAX_REQUESTS; i += step) {
+    if (i < 0 || i >= g_browser.fileCount)
+      break;
+    wanted[n++] = g_browser.files[i];
+  }
+  return n;
+}
+
+// draws the full window thumbnail grid
+// only the rows on screen are touched, so cost doesnt depend on folder size
+void DrawThumbnailGrid(HDC hdc, RECT *clientRect) {
+  if (!g_showGrid)
+    return;
+
+  RECT area;
+  GridGetArea(clientRect, &area);
+  FillRect(hdc, &area, GdiCache_Brush(UI_BRUSH_BG));
+
+  SetBkMode(hdc, TRANSPARENT);
+
+  if (g_browser.fileCount == 0) {
+    SetTextColor(hdc, g_textColor);
+    const char *msg = "No images here - press O to open a folder";
+    DrawTextA(hdc, msg, -1, &area, DT_CENTER | DT_VCENTER | DT_SINGLELINE);
+    return;
+  }
+
+  GridClampScroll(clientRect);
+
+  int cols = GridColumns(clientRect);
+  int areaH = area.bottom - area.top;
+  int left = GridLeft(&area, cols);
+
+  int firstRow = g_gridScrollY / GRID_CELL_HEIGHT;
+  int rowsVisible = areaH / GRID_CELL_HEIGHT + 2;
+  int first = firstRow * cols;
+  int end = (firstRow + rowsVisible) * cols;
+  if (end > g_browser.fileCount)
+    end = g_browser.fileCount;
+
+  // request order: whats on screen, then a screen ahead in the scroll
+  // direction, then a row behind. everything else gets cancelled
+  const char *wanted[THUMB_MAX_REQUESTS];
+  int screen = rowsVisible * cols;
+  int n = AddGridRange(wanted, 0, first, end);
+  if (g_gridScrollDir >= 0) {
+    n = AddGridRange(wanted, n, end, end + screen);
+    n = AddGridRange(wanted, n, first - 1, first - 1 - cols);
+  } else {
+    n = AddGridRange(wanted, n, first - 1, first - 1 - screen);
+    n = AddGridRange(wanted, n, end, end + cols);
+  }
+  ThumbCache_Request(wanted, n);
+
+  HFONT oldFont = SelectObject(hdc, GdiCache_Font(UI_FONT_SMALL));
+  HBRUSH cellBrush = GdiCache_Brush(UI_BRUSH_PANEL);
+  HBRUSH selBrush = GdiCache_Brush(UI_BRUSH_ACCENT);
+
+  for (int i = first; i < end; i++) {
+    int x = left + (i % cols) * GRID_CELL_WIDTH;
+    int y = area.top + (i / cols) * GRID_CELL_HEIGHT - g_gridScrollY;
+
+    RECT cellRect = {x + 4, y + 4, x + GRID_CELL_WIDTH - 4,
+                     y + GRID_CELL_HEIGHT - 4};
+    FillRect(hdc, &cellRect, i == g_gridSelection ? selBrush : cellBrush);
+
+    int boxX = x + (GRID_CELL_WIDTH - GRID_THUMB_SIZE) / 2;
+    RECT box = {boxX, y + 10, boxX + GRID_THUMB_SIZE,
+                y + 10 + GRID_THUMB_SIZE};
+
+    const Thumbnail *thumb = ThumbCache_Get(g_browser.files[i]);
+    if (thumb && thumb->pixels) {
+      DrawThumb(hdc, thumb, &box);
+    } else {
+      // still decoding, or not decodable
+      SetTextColor(hdc, RGB(110, 110, 115));
+      DrawTextA(hdc, thumb ? "?" : "...", -1, &box,
+                DT_CENTER | DT_VCENTER | DT_SINGLELINE);
+    }
+
+    const char *name = strrchr(g_browser.files[i], '\\');
+    name = name ? name + 1 : g_browser.files[i];
+    RECT textRect = {cellRect.left + 4, box.bottom + 4, cellRect.right - 4,
+                     cellRect.bottom};
+    SetTextColor(hdc, (i == g_browser.currentIndex && i != g_gridSelection)
+                          ? g_accentColor
+                          : g_textColor);
+    DrawTextA(hdc, name, -1, &textRect,
+              DT_CENTER | DT_SINGLELINE | DT_END_ELLIPSIS | DT_NOPREFIX);
+  }
+
+  SelectObject(hdc, oldFont);
+
+  // scroll position indicator on the right edge
+  int contentH = ((g_browser.fileCount + cols - 1) / cols) * GRID_CELL_HEIGHT;
+  if (contentH > areaH && areaH > 0) {
+    int barH = (int)((long long)areaH * areaH / contentH);
+    if (barH < 20)
+      barH = 20;
+    int barY = area.top + (int)((long long)(areaH - barH) * g_gridScrollY /
+                                (contentH - areaH));
+    RECT barRect = {area.right - 5, barY, area.right - 1, barY + barH};
+    FillRect(hdc, &barRect, GdiCache_Brush(UI_BRUSH_SCROLLBAR));
+  }
 }
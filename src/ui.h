@@ -8,6 +8,23 @@
 #include "settings.h"
 #include <windows.h>
 
+// overlays drawn over the image, fixed to the window
+typedef enum {
+  OVERLAY_INFO,
+  OVERLAY_SLIDESHOW, // progress bar and label
+  OVERLAY_ZOOM,
+  OVERLAY_STATUS,
+  OVERLAY_EDIT,
+  OVERLAY_HELP,
+  OVERLAY_SETTINGS,
+  OVERLAY_STRIP,
+  OVERLAY_COUNT
+} Overlay;
+
+// where an overlay sits, so just it gets repainted. the rect is filled in
+// whether or not its showing, the return says if it is
+BOOL OverlayRect(Overlay overlay, RECT *clientRect, RECT *rect);
+
 // draw functions
 void DrawInfoPanel(HDC hdc, RECT *clientRect);
 void DrawThumbnailStrip(HWND hwnd, HDC hdc, RECT *clientRect);
@@ -18,5 +35,13 @@ void DrawZoomOverlay(HDC hdc, RECT *clientRect);
 void DrawHelpOverlay(HDC hdc, RECT *clientRect);
 void DrawSettingsOverlay(HDC hdc, RECT *clientRect);
 void DrawEditPanel(HDC hdc, RECT *clientRect);
+void DrawThumbnailGrid(HDC hdc, RECT *clientRect);
+
+// grid layout helpers (shared by painting and input)
+void GridGetArea(RECT *clientRect, RECT *area);
+int GridColumns(RECT *clientRect);
+int GridHitTest(RECT *clientRect, int x, int y);
+void GridClampScroll(RECT *clientRect);
+void GridEnsureVisible(RECT *clientRect, int index);
 
 #endif